@@ -65,6 +65,7 @@ pub async fn authenticate_microsoft_user_from_token(
 		access_token: AccessToken(access_token),
 		xbox_uid: mc_token.username.clone(),
 		refresh_token,
+		expires_in: mc_token.expires_in,
 	};
 
 	Ok(out)
@@ -202,6 +203,8 @@ pub struct MicrosoftAuthResult {
 	pub xbox_uid: String,
 	/// The refresh token
 	pub refresh_token: Option<RefreshToken>,
+	/// How many seconds until the access token expires
+	pub expires_in: u32,
 }
 
 /// An access token for a user that will be hidden in debug messages
@@ -1,18 +1,18 @@
 use std::sync::Arc;
 
-use anyhow::Context;
+use anyhow::{bail, Context};
 use clap::Subcommand;
 use color_print::{cprint, cprintln};
 use inquire::Select;
 use itertools::Itertools;
 use mcvm::config::Config;
-use mcvm::instance::update::InstanceUpdateContext;
+use mcvm::core::net::download;
+use mcvm::instance::update::{update_instances, InstanceUpdateContext};
 use mcvm::io::lock::Lockfile;
 use mcvm::shared::id::InstanceID;
 
 use mcvm::instance::launch::LaunchSettings;
 use mcvm::shared::Side;
-use reqwest::Client;
 
 use super::CmdData;
 use crate::output::{icons_enabled, HYPHEN_POINT, INSTANCE, LOADER, PACKAGE, VERSION};
@@ -48,6 +48,9 @@ pub enum InstanceSubcommand {
 		/// Whether to force update files that have already been downloaded
 		#[arg(short, long)]
 		force: bool,
+		/// Whether to verify the contents of installed files that have changed
+		#[arg(short, long)]
+		verify: bool,
 		/// Whether to update all instances
 		#[arg(short, long)]
 		all: bool,
@@ -78,11 +81,12 @@ pub async fn run(command: InstanceSubcommand, data: &mut CmdData) -> anyhow::Res
 		InstanceSubcommand::Info { instance } => info(data, &instance).await,
 		InstanceSubcommand::Update {
 			force,
+			verify,
 			all,
 			skip_packages,
 			groups,
 			instances,
-		} => update(data, instances, groups, all, force, skip_packages).await,
+		} => update(data, instances, groups, all, force, verify, skip_packages).await,
 		InstanceSubcommand::Dir { instance } => dir(data, instance).await,
 	}
 }
@@ -206,10 +210,10 @@ pub async fn launch(
 
 	// Perform first update if needed
 	let mut lock = Lockfile::open(&data.paths).context("Failed to open lockfile")?;
-	if !lock.has_instance_done_first_update(&instance_id) {
+	if !lock.has_instance_done_first_update(&instance_id)? {
 		cprintln!("<s>Performing first update of instance profile...");
 
-		let client = Client::new();
+		let client = download::new_client()?;
 		let mut ctx = InstanceUpdateContext {
 			packages: &mut config.packages,
 			users: &config.users,
@@ -222,15 +226,16 @@ pub async fn launch(
 		};
 
 		instance
-			.update(true, false, &mut ctx)
+			.update(true, false, false, &mut ctx)
 			.await
 			.context("Failed to perform first update for instance")?;
 
 		// Since the update was successful, we can mark the instance as ready
-		lock.update_instance_has_done_first_update(&instance_id);
-		lock.finish(&data.paths)
-			.context("Failed to finish using lockfile")?;
+		lock.update_instance_has_done_first_update(&instance_id)?;
+		lock.finish().context("Failed to finish using lockfile")?;
 	}
+	// Let other processes update the instance while it is running
+	lock.release_instance(&instance_id)?;
 
 	if let Some(user) = user {
 		config
@@ -284,6 +289,7 @@ async fn update(
 	groups: Vec<String>,
 	all: bool,
 	force: bool,
+	verify: bool,
 	skip_packages: bool,
 ) -> anyhow::Result<()> {
 	data.ensure_config(true).await?;
@@ -304,29 +310,41 @@ async fn update(
 		ids.extend(group.clone());
 	}
 
-	let client = Client::new();
+	// Instances can be in multiple groups or listed more than once
+	let ids: Vec<InstanceID> = ids.into_iter().unique().collect();
+	for id in &ids {
+		if !config.instances.contains_key(id) {
+			bail!("Unknown instance '{id}'");
+		}
+	}
+
+	let client = download::new_client()?;
 	let mut lock = Lockfile::open(&data.paths).context("Failed to open lockfile")?;
-	for id in ids {
-		let instance = config
-			.instances
-			.get_mut(&id)
-			.with_context(|| format!("Unknown instance '{id}'"))?;
 
-		let mut ctx = InstanceUpdateContext {
-			packages: &mut config.packages,
-			users: &config.users,
-			plugins: &config.plugins,
-			prefs: &config.prefs,
-			paths: &data.paths,
-			lock: &mut lock,
-			client: &client,
-			output: &mut data.output,
-		};
+	// All of the instances are updated together so that they can share downloads
+	let mut instances: Vec<_> = config
+		.instances
+		.iter_mut()
+		.filter(|(id, _)| ids.contains(id))
+		.map(|(_, instance)| instance)
+		.collect();
+	let mut ctx = InstanceUpdateContext {
+		packages: &mut config.packages,
+		users: &config.users,
+		plugins: &config.plugins,
+		prefs: &config.prefs,
+		paths: &data.paths,
+		lock: &mut lock,
+		client: &client,
+		output: &mut data.output,
+	};
+	update_instances(&mut instances, !skip_packages, force, verify, &mut ctx)
+		.await
+		.context("Failed to update instances")?;
 
-		instance
-			.update(!skip_packages, force, &mut ctx)
-			.await
-			.context("Failed to update instance")?;
+	for id in &ids {
+		lock.release_instance(id)
+			.context("Failed to finish using lockfile")?;
 	}
 
 	Ok(())
@@ -0,0 +1,62 @@
+use super::CmdData;
+
+use std::path::PathBuf;
+
+use anyhow::Context;
+use clap::Subcommand;
+use color_print::cprintln;
+use mcvm::core::net::{download, mirror};
+
+#[derive(Debug, Subcommand)]
+pub enum MirrorSubcommand {
+	#[command(
+		about = "Run a mirror server for other machines to download files from",
+		long_about = "Run a mirror server that other machines can add to the mirrors in their
+preferences. Files that the server doesn't have yet are downloaded and stored the
+first time that they are requested, but only from the hosts that Minecraft files,
+Java, and addons usually come from, along with any that are allowed with --allow-host.
+The server only listens on this machine by default. It has no authentication, so
+only listen on other addresses, like 0.0.0.0:25590, on a network that you trust."
+	)]
+	Serve {
+		/// The address to listen on
+		#[arg(short, long, default_value = "127.0.0.1:25590")]
+		address: String,
+		/// The directory to store files in. Defaults to a directory in the mcvm data
+		#[arg(short, long)]
+		dir: Option<PathBuf>,
+		/// Another domain to allow downloading files from, along with its subdomains
+		#[arg(long = "allow-host")]
+		allowed_hosts: Vec<String>,
+	},
+}
+
+pub async fn run(subcommand: MirrorSubcommand, data: &mut CmdData) -> anyhow::Result<()> {
+	match subcommand {
+		MirrorSubcommand::Serve {
+			address,
+			dir,
+			allowed_hosts,
+		} => serve(data, address, dir, allowed_hosts).await,
+	}
+}
+
+async fn serve(
+	data: &mut CmdData,
+	address: String,
+	dir: Option<PathBuf>,
+	mut allowed_hosts: Vec<String>,
+) -> anyhow::Result<()> {
+	let dir = dir.unwrap_or_else(|| data.paths.data.join("mirror"));
+	let client = download::new_client()?;
+	allowed_hosts.extend(mirror::DEFAULT_ALLOWED_HOSTS.iter().map(|x| x.to_string()));
+
+	cprintln!(
+		"<g>Serving files from <b>{}</b> on <b>{}</b>",
+		dir.display(),
+		address
+	);
+	mirror::serve(address, dir, allowed_hosts, client)
+		.await
+		.context("Mirror server failed")
+}
@@ -1,10 +1,14 @@
 mod config;
 mod files;
 mod instance;
+mod mirror;
 mod package;
 mod plugin;
+mod prefetch;
 mod user;
 
+use std::path::PathBuf;
+
 use anyhow::{bail, Context};
 use clap::{Parser, Subcommand};
 use color_print::{cformat, cprintln};
@@ -12,18 +16,22 @@ use color_print::{cformat, cprintln};
 use mcvm::config::plugin::PluginManager;
 use mcvm::config::{Config, ConfigDeser};
 use mcvm::io::paths::Paths;
+use mcvm::pkg::repo;
 use mcvm::plugin::hooks::{self, AddTranslations};
 use mcvm::shared::later::Later;
 use mcvm::shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm::shared::timing;
 
 use self::config::ConfigSubcommand;
 use self::files::FilesSubcommand;
 use self::instance::InstanceSubcommand;
+use self::mirror::MirrorSubcommand;
 use self::package::PackageSubcommand;
 use self::plugin::PluginSubcommand;
 use self::user::UserSubcommand;
 
 use super::output::TerminalOutput;
+use super::timings;
 
 #[derive(Debug, Subcommand)]
 pub enum Command {
@@ -68,6 +76,30 @@ pub enum Command {
 		#[command(subcommand)]
 		command: FilesSubcommand,
 	},
+	#[command(about = "Share downloaded files with other machines")]
+	Mirror {
+		#[command(subcommand)]
+		command: MirrorSubcommand,
+	},
+	#[command(
+		about = "Download files for instances ahead of their next update",
+		long_about = "Download the game files, Java, and addons that instances will need the
+next time that they are updated, without changing the instances themselves. With an
+interval, this keeps running and checks for new files every time it passes."
+	)]
+	Prefetch {
+		/// The instances to prefetch files for. Defaults to all instances
+		instances: Vec<String>,
+		/// Don't prefetch addons for packages
+		#[arg(short, long)]
+		skip_packages: bool,
+		/// Keep running and prefetch again after this many minutes
+		#[arg(short, long)]
+		interval: Option<u64>,
+		/// The most files to download at the same time
+		#[arg(short, long, default_value_t = 4)]
+		transfers: usize,
+	},
 	#[clap(external_subcommand)]
 	External(Vec<String>),
 }
@@ -80,6 +112,12 @@ pub struct Cli {
 	debug: bool,
 	#[arg(short = 'D', long)]
 	trace: bool,
+	/// Print how long each part of the command took once it finishes
+	#[arg(long)]
+	timings: bool,
+	/// Write the timings of the command to a file in the Chrome trace format
+	#[arg(long)]
+	timings_file: Option<PathBuf>,
 }
 
 /// Run the command line interface
@@ -99,6 +137,9 @@ pub async fn run_cli() -> anyhow::Result<()> {
 		}
 	}
 	let cli = cli?;
+	if cli.timings || cli.timings_file.is_some() {
+		timing::enable();
+	}
 
 	// Prepare the command data
 	let mut data = CmdData::new().await?;
@@ -117,9 +158,19 @@ pub async fn run_cli() -> anyhow::Result<()> {
 		Command::Instance { command } => instance::run(command, &mut data).await,
 		Command::Plugin { command } => plugin::run(command, &mut data).await,
 		Command::Config { command } => config::run(command, &mut data).await,
+		Command::Mirror { command } => mirror::run(command, &mut data).await,
+		Command::Prefetch {
+			instances,
+			skip_packages,
+			interval,
+			transfers,
+		} => prefetch::run(&mut data, instances, skip_packages, interval, transfers).await,
 		Command::External(args) => call_plugin_subcommand(args, &mut data).await,
 	};
 
+	// Let cached package indexes finish refreshing so that the next run can use them
+	repo::wait_for_index_refreshes().await;
+
 	if let Err(e) = &res {
 		// Don't use the existing process or section
 		data.output.end_process();
@@ -130,6 +181,16 @@ pub async fn run_cli() -> anyhow::Result<()> {
 		);
 	}
 
+	if cli.timings || cli.timings_file.is_some() {
+		let report = timing::report();
+		if cli.timings {
+			timings::print_summary(&report);
+		}
+		if let Some(path) = &cli.timings_file {
+			timings::write_trace(&report, path)?;
+		}
+	}
+
 	res
 }
 
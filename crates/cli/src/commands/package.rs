@@ -64,6 +64,14 @@ This package does not need to be installed, it just has to be in the index."
 	},
 	#[command(about = "Browse packages from the remote repositories")]
 	Browse {},
+	#[command(about = "Search for packages whose IDs start with some text")]
+	Search {
+		/// Whether to remove formatting and warnings from the output
+		#[arg(short, long)]
+		raw: bool,
+		/// The start of the package IDs to search for
+		query: String,
+	},
 }
 
 #[derive(Debug, Subcommand)]
@@ -90,6 +98,7 @@ pub async fn run(subcommand: PackageSubcommand, data: &mut CmdData) -> anyhow::R
 		PackageSubcommand::Info { package } => info(data, &package).await,
 		PackageSubcommand::Repository { command } => repo(command, data).await,
 		PackageSubcommand::Browse {} => browse(data).await,
+		PackageSubcommand::Search { raw, query } => search(data, &query, raw).await,
 	}
 }
 
@@ -502,3 +511,28 @@ async fn browse(data: &mut CmdData) -> anyhow::Result<()> {
 
 	Ok(())
 }
+
+async fn search(data: &mut CmdData, query: &str, raw: bool) -> anyhow::Result<()> {
+	data.ensure_config(!raw).await?;
+	let config = data.config.get_mut();
+
+	let client = Client::new();
+	let packages = config
+		.packages
+		.search_available_packages(query, &data.paths, &client, &mut data.output)
+		.await
+		.context("Failed to search packages")?;
+
+	if !raw {
+		cprintln!("<s>Packages starting with <b>{}</b>:", query);
+	}
+	for package in packages {
+		if raw {
+			println!("{}", package.id);
+		} else {
+			cprintln!("{}<b!>{}</>", HYPHEN_POINT, package.id);
+		}
+	}
+
+	Ok(())
+}
@@ -0,0 +1,102 @@
+use super::CmdData;
+
+use std::time::Duration;
+
+use anyhow::{bail, Context};
+use color_print::cprintln;
+use mcvm::core::net::download;
+use mcvm::core::net::scheduler::DownloadScheduler;
+use mcvm::instance::update::prefetch::prefetch_instances;
+use mcvm::instance::update::InstanceUpdateContext;
+use mcvm::io::lock::Lockfile;
+use mcvm::shared::id::InstanceID;
+use mcvm::shared::output::{MCVMOutput, MessageContents, MessageLevel};
+
+pub async fn run(
+	data: &mut CmdData,
+	instances: Vec<String>,
+	skip_packages: bool,
+	interval: Option<u64>,
+	transfers: usize,
+) -> anyhow::Result<()> {
+	// Keep enough bandwidth free for anything else that is downloading at the same time
+	DownloadScheduler::global().set_total_limit(transfers);
+
+	let Some(interval) = interval else {
+		return prefetch(data, &instances, skip_packages, true).await;
+	};
+
+	let interval = Duration::from_secs(interval.max(1) * 60);
+	let mut first = true;
+	loop {
+		// Pick up any changes to the config since the last time
+		data.config.clear();
+		if let Err(e) = prefetch(data, &instances, skip_packages, first).await {
+			data.output.end_process();
+			data.output.end_section();
+			data.output.display(
+				MessageContents::Error(format!("{e:?}")),
+				MessageLevel::Important,
+			);
+		}
+		first = false;
+
+		cprintln!(
+			"<k!>Prefetching again in {} minutes",
+			interval.as_secs() / 60
+		);
+		tokio::time::sleep(interval).await;
+	}
+}
+
+async fn prefetch(
+	data: &mut CmdData,
+	instances: &[String],
+	skip_packages: bool,
+	show_warnings: bool,
+) -> anyhow::Result<()> {
+	data.ensure_config(show_warnings).await?;
+	let config = data.config.get_mut();
+
+	let ids: Vec<InstanceID> = if instances.is_empty() {
+		config.instances.keys().cloned().collect()
+	} else {
+		instances
+			.iter()
+			.map(|x| InstanceID::from(x.as_str()))
+			.collect()
+	};
+	for id in &ids {
+		if !config.instances.contains_key(id) {
+			bail!("Unknown instance '{id}'");
+		}
+	}
+
+	let client = download::new_client()?;
+	// Prefetching doesn't change the lockfile, but the update context needs it
+	let mut lock = Lockfile::open(&data.paths).context("Failed to open lockfile")?;
+
+	let mut instances: Vec<_> = config
+		.instances
+		.iter_mut()
+		.filter(|(id, _)| ids.contains(id))
+		.map(|(_, instance)| instance)
+		.collect();
+	let mut ctx = InstanceUpdateContext {
+		packages: &mut config.packages,
+		users: &config.users,
+		plugins: &config.plugins,
+		prefs: &config.prefs,
+		paths: &data.paths,
+		lock: &mut lock,
+		client: &client,
+		output: &mut data.output,
+	};
+	prefetch_instances(&mut instances, !skip_packages, &mut ctx)
+		.await
+		.context("Failed to prefetch files")?;
+
+	cprintln!("<g>Prefetched files for {} instances", ids.len());
+
+	Ok(())
+}
@@ -1,6 +1,7 @@
 mod commands;
 mod output;
 mod secrets;
+mod timings;
 
 use std::process::ExitCode;
 
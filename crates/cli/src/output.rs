@@ -1,4 +1,8 @@
-use std::io::Write;
+use std::io::{BufWriter, Write};
+use std::sync::mpsc::{self, RecvTimeoutError};
+use std::sync::{Arc, Mutex, MutexGuard};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
 use std::{fs::File, path::PathBuf};
 
 use anyhow::Context;
@@ -27,59 +31,94 @@ pub const VERSION: &str = "\u{1F4C5}";
 /// A loader icon
 pub const LOADER: &str = "\u{1F4E5}";
 
+/// The shortest time between redraws of a progress bar. Progress updates that come in faster
+/// than this are merged so that only the latest one is drawn
+const PROGRESS_FRAME_TIME: Duration = Duration::from_millis(50);
+
 /// Terminal MCVMOutput
 pub struct TerminalOutput {
-	printer: ReplPrinter,
+	screen: Arc<Mutex<Screen>>,
 	level: MessageLevel,
 	in_process: bool,
 	indent_level: u8,
-	log_file: File,
-	latest_log_file: File,
+	log: LogWriter,
 	translation_map: Option<TranslationMap>,
+	progress: ProgressThread,
 }
 
 impl MCVMOutput for TerminalOutput {
 	fn display_text(&mut self, text: String, level: MessageLevel) {
 		let _ = self.log_message(&text, level);
+		self.flush_progress();
 		self.display_text_impl(text, level);
 	}
 
 	fn display_message(&mut self, message: Message) {
-		let _ = self.log_message(
-			&Self::format_message_log(message.contents.clone()),
-			message.level,
-		);
+		// Only the end of some progress is logged, since there can be an update for every
+		// file that is downloaded and the log doesn't need all of them
+		if !is_progress_message(&message.contents) || is_progress_finished(&message.contents) {
+			let _ = self.log_message(
+				&Self::format_message_log(message.contents.clone()),
+				message.level,
+			);
+		}
+
+		// Progress in a process replaces itself, so updates that would be covered up
+		// before anyone sees them don't need to be drawn
+		if self.in_process && is_progress_message(&message.contents) {
+			if !message.level.at_least(&self.level) {
+				return;
+			}
+			let finished = is_progress_finished(&message.contents);
+			let text = self.format_message(message.contents);
+			let mut screen = self.screen();
+			if screen.recently_drew_progress() && !finished {
+				screen.pending_progress = Some(text);
+				return;
+			}
+			screen.pending_progress = None;
+			screen.last_progress_draw = Some(Instant::now());
+			screen.printer.print(&text);
+			return;
+		}
+
+		self.flush_progress();
 		self.display_text_impl(self.format_message(message.contents), message.level);
 	}
 
 	fn start_process(&mut self) {
+		self.flush_progress();
 		if self.in_process {
-			self.printer.newline();
+			self.screen().printer.newline();
 		} else {
 			self.in_process = true;
 		}
 	}
 
 	fn end_process(&mut self) {
+		self.flush_progress();
 		if self.in_process {
-			self.printer.newline();
+			self.screen().printer.newline();
 		}
 		self.in_process = false;
 	}
 
 	fn start_section(&mut self) {
+		self.flush_progress();
 		self.indent_level += 1;
-		self.printer.indent(self.indent_level.into());
+		self.screen().printer.indent(self.indent_level.into());
 	}
 
 	fn end_section(&mut self) {
+		self.flush_progress();
 		if self.indent_level != 0 {
 			self.indent_level -= 1;
-			self.printer.indent(self.indent_level.into());
+			self.screen().printer.indent(self.indent_level.into());
 		}
 	}
 
 	fn prompt_yes_no(&mut self, default: bool, message: MessageContents) -> anyhow::Result<bool> {
+		self.flush_progress();
 		let ans = Confirm::new(&self.format_message(message))
 			.with_default(default)
 			.prompt()
@@ -89,6 +128,7 @@ impl MCVMOutput for TerminalOutput {
 	}
 
 	fn prompt_password(&mut self, message: MessageContents) -> anyhow::Result<String> {
+		self.flush_progress();
 		let ans = Password::new(&self.format_message(message))
 			.without_confirmation()
 			.prompt()
@@ -98,6 +138,7 @@ impl MCVMOutput for TerminalOutput {
 	}
 
 	fn prompt_new_password(&mut self, message: MessageContents) -> anyhow::Result<String> {
+		self.flush_progress();
 		let ans = Password::new(&self.format_message(message))
 			.prompt()
 			.context("Inquire prompt failed")?;
@@ -127,28 +168,45 @@ impl TerminalOutput {
 		let file = File::create(path).context("Failed to open log file")?;
 		let latest_file = File::create(get_latest_log_file_path(paths))
 			.context("Failed to open latest.txt log file")?;
-		Ok(Self {
+		let screen = Arc::new(Mutex::new(Screen {
 			printer: ReplPrinter::new(true),
+			pending_progress: None,
+			last_progress_draw: None,
+		}));
+		Ok(Self {
+			screen: screen.clone(),
 			level: MessageLevel::Important,
 			in_process: false,
 			indent_level: 0,
-			log_file: file,
-			latest_log_file: latest_file,
+			log: LogWriter::new(vec![file, latest_file])?,
 			translation_map: None,
+			progress: ProgressThread::new(screen)?,
 		})
 	}
 
+	/// Lock the screen to print to it
+	fn screen(&self) -> MutexGuard<'_, Screen> {
+		// A panic while printing doesn't leave the screen in a state that can't be printed to
+		self.screen.lock().unwrap_or_else(|x| x.into_inner())
+	}
+
+	/// Draw the progress message that was held back, if there is one
+	fn flush_progress(&mut self) {
+		self.screen().flush_progress();
+	}
+
 	/// Display text
 	fn display_text_impl(&mut self, text: String, level: MessageLevel) {
 		if !level.at_least(&self.level) {
 			return;
 		}
 
+		let mut screen = self.screen();
 		if self.in_process {
-			self.printer.print(&text);
+			screen.printer.print(&text);
 		} else {
-			self.printer.print(&text);
-			self.printer.newline();
+			screen.printer.print(&text);
+			screen.printer.newline();
 		}
 	}
 
@@ -259,10 +317,7 @@ impl TerminalOutput {
 			MessageLevel::Debug => "D",
 			MessageLevel::Trace => "T",
 		};
-		writeln!(self.log_file, "[{level_indicator}] {text}")?;
-		writeln!(self.latest_log_file, "[{level_indicator}] {text}")?;
-
-		Ok(())
+		self.log.write(format!("[{level_indicator}] {text}\n"))
 	}
 
 	/// Set the log level of the output
@@ -276,6 +331,155 @@ impl TerminalOutput {
 	}
 }
 
+impl Drop for TerminalOutput {
+	fn drop(&mut self) {
+		self.progress.stop();
+		self.flush_progress();
+	}
+}
+
+/// The printer for the terminal, along with the progress message that is being held back
+/// from it. This is shared with the progress thread
+struct Screen {
+	printer: ReplPrinter,
+	/// The latest progress text, if it hasn't been drawn yet
+	pending_progress: Option<String>,
+	/// When a progress message was last drawn
+	last_progress_draw: Option<Instant>,
+}
+
+impl Screen {
+	/// Check whether progress was drawn too recently to draw it again
+	fn recently_drew_progress(&self) -> bool {
+		self.last_progress_draw
+			.is_some_and(|x| x.elapsed() < PROGRESS_FRAME_TIME)
+	}
+
+	/// Draw the progress text that was held back, if there is one
+	fn flush_progress(&mut self) {
+		if let Some(text) = self.pending_progress.take() {
+			self.last_progress_draw = Some(Instant::now());
+			self.printer.print(&text);
+		}
+	}
+}
+
+/// Draws progress that was held back once its frame is over from its own thread, so that
+/// the latest progress is still shown when no more output comes in for a while
+struct ProgressThread {
+	sender: Option<mpsc::Sender<()>>,
+	thread: Option<JoinHandle<()>>,
+}
+
+impl ProgressThread {
+	fn new(screen: Arc<Mutex<Screen>>) -> anyhow::Result<Self> {
+		let (sender, receiver) = mpsc::channel::<()>();
+		let thread = std::thread::Builder::new()
+			.name("progress".into())
+			.spawn(move || {
+				while let Err(RecvTimeoutError::Timeout) =
+					receiver.recv_timeout(PROGRESS_FRAME_TIME)
+				{
+					let mut screen = screen.lock().unwrap_or_else(|x| x.into_inner());
+					if !screen.recently_drew_progress() {
+						screen.flush_progress();
+					}
+				}
+			})
+			.context("Failed to start progress thread")?;
+
+		Ok(Self {
+			sender: Some(sender),
+			thread: Some(thread),
+		})
+	}
+
+	/// Stop the thread and wait for it to finish
+	fn stop(&mut self) {
+		// Hanging up makes the thread stop the next time it wakes up
+		self.sender.take();
+		if let Some(thread) = self.thread.take() {
+			let _ = thread.join();
+		}
+	}
+}
+
+/// Writes lines to the log files from its own thread, so that logging doesn't wait on the disk.
+/// Lines that come in while it is writing are written together before the files are flushed
+struct LogWriter {
+	sender: Option<mpsc::Sender<String>>,
+	thread: Option<JoinHandle<()>>,
+}
+
+impl LogWriter {
+	fn new(files: Vec<File>) -> anyhow::Result<Self> {
+		let (sender, receiver) = mpsc::channel::<String>();
+		let thread = std::thread::Builder::new()
+			.name("log".into())
+			.spawn(move || {
+				let mut files: Vec<_> = files.into_iter().map(BufWriter::new).collect();
+				while let Ok(line) = receiver.recv() {
+					let lines = std::iter::once(line).chain(receiver.try_iter());
+					for line in lines {
+						for file in &mut files {
+							let _ = file.write_all(line.as_bytes());
+						}
+					}
+					for file in &mut files {
+						let _ = file.flush();
+					}
+				}
+			})
+			.context("Failed to start log thread")?;
+
+		Ok(Self {
+			sender: Some(sender),
+			thread: Some(thread),
+		})
+	}
+
+	/// Queue a line to be written
+	fn write(&self, line: String) -> anyhow::Result<()> {
+		if let Some(sender) = &self.sender {
+			sender
+				.send(line)
+				.map_err(|_| anyhow::anyhow!("Log thread has stopped"))?;
+		}
+
+		Ok(())
+	}
+}
+
+impl Drop for LogWriter {
+	fn drop(&mut self) {
+		// Hanging up makes the thread write everything that is left and then stop
+		self.sender.take();
+		if let Some(thread) = self.thread.take() {
+			let _ = thread.join();
+		}
+	}
+}
+
+/// Check whether a message is a progress bar, which replaces the last one when drawn in a process
+fn is_progress_message(contents: &MessageContents) -> bool {
+	match contents {
+		MessageContents::Progress { .. } => true,
+		MessageContents::Associated(item, ..) => {
+			matches!(item.as_ref(), MessageContents::Progress { .. })
+		}
+		_ => false,
+	}
+}
+
+/// Check whether a progress message shows that the progress is finished
+fn is_progress_finished(contents: &MessageContents) -> bool {
+	match contents {
+		MessageContents::Progress { current, total } => current >= total,
+		MessageContents::Associated(item, ..) => is_progress_finished(item),
+		_ => false,
+	}
+}
+
 /// Format a PkgRequest with colors
 fn disp_pkg_request_with_colors(req: PkgRequest) -> String {
 	match req.source {
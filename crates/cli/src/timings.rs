@@ -0,0 +1,171 @@
+use std::fs::File;
+use std::io::BufWriter;
+use std::path::Path;
+
+use anyhow::Context;
+use color_print::cprintln;
+use mcvm::shared::timing::{HostSummary, SpanCategory, TimingReport};
+use serde_json::json;
+
+/// Print a summary table of the recorded timings
+pub fn print_summary(report: &TimingReport) {
+	cprintln!(
+		"<s>Timings</s> <k!>({} total, {} requests, {} downloaded)</k!>",
+		format_duration(report.elapsed_us),
+		report.total_requests,
+		format_bytes(report.total_bytes)
+	);
+
+	if !report.summaries.is_empty() {
+		cprintln!(
+			"<k!>{:<8} {:<40} {:>6} {:>10} {:>10}</k!>",
+			"Kind",
+			"Name",
+			"Count",
+			"Total",
+			"Max"
+		);
+	}
+	for summary in &report.summaries {
+		// Downloads are summarized by host below, which is more useful than a span per host
+		if let SpanCategory::Download = summary.category {
+			continue;
+		}
+		let kind = match summary.category {
+			SpanCategory::Phase => "phase",
+			SpanCategory::Hook => "hook",
+			SpanCategory::Download => "download",
+		};
+		println!(
+			"{kind:<8} {:<40} {:>6} {:>10} {:>10}",
+			summary.name,
+			summary.count,
+			format_duration(summary.total_us),
+			format_duration(summary.max_us)
+		);
+	}
+
+	if !report.hosts.is_empty() {
+		cprintln!(
+			"<k!>{:<40} {:>8} {:>10} {:>10} {:>10} {:>10}</k!>",
+			"Host",
+			"Requests",
+			"Bytes",
+			"Avg",
+			"p50",
+			"p95"
+		);
+	}
+	for host in &report.hosts {
+		let average = host.total_latency_us / host.requests.max(1);
+		println!(
+			"{:<40} {:>8} {:>10} {:>10} {:>10} {:>10}",
+			host.host,
+			host.requests,
+			format_bytes(host.bytes),
+			format_duration(average),
+			format_percentile(host, &report.latency_buckets_ms, 0.5),
+			format_percentile(host, &report.latency_buckets_ms, 0.95)
+		);
+	}
+}
+
+/// Write the recorded timings to a file in the Chrome trace event format, which can be
+/// opened in chrome://tracing or Perfetto. The summaries are included as extra data
+pub fn write_trace(report: &TimingReport, path: &Path) -> anyhow::Result<()> {
+	let mut events = Vec::with_capacity(report.spans.len());
+	for (i, span) in report.spans.iter().enumerate() {
+		match span.category {
+			// Downloads overlap with each other, so they are async events that each get their own row
+			SpanCategory::Download => {
+				let common = json!({
+					"name": span.name,
+					"cat": "download",
+					"id": i,
+					"pid": 1,
+					"tid": 3,
+				});
+				let mut begin = common.clone();
+				begin["ph"] = json!("b");
+				begin["ts"] = json!(span.start_us);
+				let mut end = common;
+				end["ph"] = json!("e");
+				end["ts"] = json!(span.start_us + span.duration_us);
+				events.push(begin);
+				events.push(end);
+			}
+			SpanCategory::Phase | SpanCategory::Hook => {
+				let (cat, tid) = if let SpanCategory::Phase = span.category {
+					("phase", 1)
+				} else {
+					("hook", 2)
+				};
+				events.push(json!({
+					"name": span.name,
+					"cat": cat,
+					"ph": "X",
+					"ts": span.start_us,
+					"dur": span.duration_us,
+					"pid": 1,
+					"tid": tid,
+				}));
+			}
+		}
+	}
+
+	let trace = json!({
+		"traceEvents": events,
+		"displayTimeUnit": "ms",
+		"otherData": {
+			"elapsed_us": report.elapsed_us,
+			"total_requests": report.total_requests,
+			"total_bytes": report.total_bytes,
+			"summaries": report.summaries,
+			"hosts": report.hosts,
+			"latency_buckets_ms": report.latency_buckets_ms,
+		},
+	});
+
+	let file = File::create(path).context("Failed to create timings file")?;
+	serde_json::to_writer(BufWriter::new(file), &trace).context("Failed to write timings file")
+}
+
+/// Get the latency bucket that a percentile of the requests to a host fall into
+fn format_percentile(host: &HostSummary, buckets: &[u64], percentile: f64) -> String {
+	let target = (host.requests as f64 * percentile).ceil() as u64;
+	let mut count = 0;
+	for (i, bucket_count) in host.latency_histogram.iter().enumerate() {
+		count += bucket_count;
+		if count >= target.max(1) {
+			return match buckets.get(i) {
+				Some(bound) => format!("<{bound}ms"),
+				None => format!(">{}ms", buckets.last().copied().unwrap_or_default()),
+			};
+		}
+	}
+
+	"-".into()
+}
+
+fn format_duration(us: u64) -> String {
+	if us >= 1_000_000 {
+		format!("{:.2}s", us as f64 / 1_000_000.0)
+	} else {
+		format!("{:.1}ms", us as f64 / 1000.0)
+	}
+}
+
+fn format_bytes(bytes: u64) -> String {
+	const UNITS: [&str; 4] = ["B", "KiB", "MiB", "GiB"];
+	let mut value = bytes as f64;
+	let mut unit = 0;
+	while value >= 1024.0 && unit < UNITS.len() - 1 {
+		value /= 1024.0;
+		unit += 1;
+	}
+	if unit == 0 {
+		format!("{bytes}B")
+	} else {
+		format!("{value:.1}{}", UNITS[unit])
+	}
+}
@@ -0,0 +1,274 @@
+use std::path::{Path, PathBuf};
+
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use mcvm_core::config::BrandingProperties;
+use mcvm_core::io::java::classpath::Classpath;
+use mcvm_core::io::store_manifest::StoreManifest;
+use mcvm_core::io::update::UpdateManager;
+use mcvm_core::launch::{replace_arg_placeholders, ArgPlaceholderParams, LaunchConfiguration};
+use mcvm_core::net::game_files::assets::{get_missing_assets, AssetIndex};
+use mcvm_core::net::game_files::client_meta::ClientMeta;
+use mcvm_core::util::versions::VersionName;
+use mcvm_core::{ClientWindowConfig, InstanceKind, Paths};
+use serde_json::{json, Value};
+use sha1::{Digest, Sha1};
+
+/// The number of objects in the synthetic asset index. This is about how many are in
+/// the index for 1.20
+const ASSET_COUNT: usize = 3900;
+/// The number of libraries in the synthetic version JSON. This is a lot more than vanilla
+/// has, to be closer to what modloaders end up with
+const LIBRARY_COUNT: usize = 400;
+
+/// The game arguments of the client meta for 1.20, which are the arguments with the most
+/// placeholders
+const GAME_ARGS: [&str; 22] = [
+	"--username",
+	"${auth_player_name}",
+	"--version",
+	"${version_name}",
+	"--gameDir",
+	"${game_directory}",
+	"--assetsDir",
+	"${assets_root}",
+	"--assetIndex",
+	"${assets_index_name}",
+	"--uuid",
+	"${auth_uuid}",
+	"--accessToken",
+	"${auth_access_token}",
+	"--clientId",
+	"${clientid}",
+	"--xuid",
+	"${auth_xuid}",
+	"--userType",
+	"${user_type}",
+	"--versionType",
+	"${version_type}",
+];
+
+fn sha1_hex(data: &str) -> String {
+	hex::encode(Sha1::digest(data.as_bytes()))
+}
+
+/// Create an asset index with the same shape and name distribution as a real one,
+/// without needing to download it
+fn create_asset_index() -> String {
+	let mut objects = serde_json::Map::new();
+	for i in 0..ASSET_COUNT {
+		let name = match i % 10 {
+			0..=5 => format!("minecraft/sounds/ambient/cave/cave{i}.ogg"),
+			6 | 7 => format!("minecraft/lang/lang_{i}.json"),
+			8 => format!("minecraft/textures/block/block_{i}.png"),
+			_ => format!("realms/textures/gui/icon_{i}.png"),
+		};
+		objects.insert(
+			name.clone(),
+			json!({
+				"hash": sha1_hex(&name),
+				"size": (i * 7919) % 500_000 + 100,
+			}),
+		);
+	}
+
+	json!({ "objects": objects }).to_string()
+}
+
+/// Create a large version JSON in the format of the new client meta
+fn create_client_meta() -> String {
+	let os_rule = |name: &str| json!([{ "action": "allow", "os": { "name": name } }]);
+	let libraries: Vec<Value> = (0..LIBRARY_COUNT)
+		.map(|i| {
+			let path = format!("org/example/lib{i}/1.{i}.0/lib{i}-1.{i}.0.jar");
+			let mut library = json!({
+				"name": format!("org.example:lib{i}:1.{i}.0"),
+				"downloads": {
+					"artifact": {
+						"path": path,
+						"url": format!("https://libraries.minecraft.net/{path}"),
+						"sha1": sha1_hex(&path),
+					}
+				}
+			});
+			if i % 3 == 0 {
+				library["rules"] = os_rule(["linux", "windows", "osx"][i % 9 / 3]);
+			}
+			library
+		})
+		.collect();
+
+	let mut game: Vec<Value> = GAME_ARGS.iter().map(|x| json!(x)).collect();
+	game.push(json!({
+		"rules": [{ "action": "allow", "features": { "has_custom_resolution": true } }],
+		"value": ["--width", "${resolution_width}", "--height", "${resolution_height}"],
+	}));
+	game.push(json!({
+		"rules": [{ "action": "allow", "features": { "is_quick_play_multiplayer": true } }],
+		"value": ["--quickPlayMultiplayer", "${quickPlayMultiplayer}"],
+	}));
+	let jvm = json!([
+		{ "rules": os_rule("osx"), "value": ["-XstartOnFirstThread"] },
+		{ "rules": os_rule("windows"), "value": "-XX:HeapDumpPath=MojangTricksIntelDriversForPerformance_javaw.exe_minecraft.exe.heapdump" },
+		"-Djava.library.path=${natives_directory}",
+		"-Dminecraft.launcher.brand=${launcher_name}",
+		"-Dminecraft.launcher.version=${launcher_version}",
+		"-cp",
+		"${classpath}",
+	]);
+
+	json!({
+		"arguments": { "game": game, "jvm": jvm },
+		"assetIndex": {
+			"url": "https://piston-meta.mojang.com/v1/packages/index/5.json",
+			"sha1": sha1_hex("index"),
+		},
+		"assets": "5",
+		"downloads": {
+			"client": { "url": "https://piston-data.mojang.com/v1/objects/client.jar" },
+			"server": { "url": "https://piston-data.mojang.com/v1/objects/server.jar" },
+		},
+		"javaVersion": { "majorVersion": 17 },
+		"libraries": libraries,
+		"mainClass": "net.minecraft.client.main.Main",
+		"logging": {
+			"client": {
+				"argument": "-Dlog4j.configurationFile=${path}",
+				"file": { "url": "https://piston-data.mojang.com/v1/objects/client-1.12.xml" },
+			}
+		},
+	})
+	.to_string()
+}
+
+/// Create an empty directory for a benchmark to use as the assets store
+fn create_store_dir(name: &str) -> PathBuf {
+	let dir = std::env::temp_dir().join(format!("mcvm_bench_{name}"));
+	let _ = std::fs::remove_dir_all(&dir);
+	std::fs::create_dir_all(&dir).expect("Failed to create store directory");
+	dir
+}
+
+/// Create a store manifest where every asset in the index is already recorded
+fn create_full_manifest(dir: &Path, index: &str) -> StoreManifest {
+	let mut manifest =
+		StoreManifest::open(&dir.join("manifest.json")).expect("Failed to open manifest");
+	// Every entry points at the same file, since only its metadata is recorded
+	let file = dir.join("object");
+	std::fs::write(&file, "").expect("Failed to write object");
+	let mut bytes = index.as_bytes().to_vec();
+	let index = AssetIndex::parse(&mut bytes).expect("Failed to parse index");
+	for (name, asset) in index.objects {
+		let mut buf = [0; 40];
+		let key = asset.hash.to_hex(&mut buf);
+		let hash = (!name.ends_with(".json")).then_some(key);
+		manifest
+			.record_file(key, &file, hash)
+			.expect("Failed to record asset");
+	}
+
+	manifest
+}
+
+fn bench_assets(c: &mut Criterion) {
+	let index = create_asset_index();
+	let manager = UpdateManager::new(false, false);
+
+	let mut group = c.benchmark_group("assets");
+	group.throughput(Throughput::Bytes(index.len() as u64));
+	group.bench_function("parse_index", |b| {
+		b.iter_batched(
+			|| index.as_bytes().to_vec(),
+			|mut bytes| {
+				black_box(AssetIndex::parse(black_box(&mut bytes)).unwrap());
+			},
+			BatchSize::SmallInput,
+		)
+	});
+	group.finish();
+
+	let mut bytes = index.as_bytes().to_vec();
+	let parsed = AssetIndex::parse(&mut bytes).expect("Failed to parse index");
+	let mut group = c.benchmark_group("assets_diff");
+	group.throughput(Throughput::Elements(ASSET_COUNT as u64));
+
+	let dir = create_store_dir("assets_empty");
+	let objects_dir = dir.join("objects");
+	let mut manifest =
+		StoreManifest::open(&dir.join("manifest.json")).expect("Failed to open manifest");
+	group.bench_function("empty_store", |b| {
+		b.iter(|| {
+			let missing =
+				get_missing_assets(&parsed, &objects_dir, None, &mut manifest, &manager).unwrap();
+			assert_eq!(missing.len(), ASSET_COUNT);
+			black_box(missing)
+		})
+	});
+
+	let dir = create_store_dir("assets_full");
+	let objects_dir = dir.join("objects");
+	let mut manifest = create_full_manifest(&dir, &index);
+	group.bench_function("full_store", |b| {
+		b.iter(|| {
+			let missing =
+				get_missing_assets(&parsed, &objects_dir, None, &mut manifest, &manager).unwrap();
+			assert!(missing.is_empty());
+			black_box(missing)
+		})
+	});
+	group.finish();
+}
+
+fn bench_client_meta(c: &mut Criterion) {
+	let meta = create_client_meta();
+
+	let mut group = c.benchmark_group("client_meta");
+	group.throughput(Throughput::Bytes(meta.len() as u64));
+	group.bench_function("parse_large_version", |b| {
+		b.iter(|| black_box(serde_json::from_str::<ClientMeta>(black_box(&meta)).unwrap()))
+	});
+	group.finish();
+}
+
+fn bench_arg_placeholders(c: &mut Criterion) {
+	let version: VersionName = "1.20.4".into();
+	let side = InstanceKind::Client {
+		window: ClientWindowConfig { resolution: None },
+	};
+	let mut classpath = Classpath::new();
+	for i in 0..LIBRARY_COUNT {
+		classpath.add(&format!(
+			"/libraries/org/example/lib{i}/1.{i}.0/lib{i}-1.{i}.0.jar"
+		));
+	}
+	let launch_config = LaunchConfiguration::new();
+	let paths = Paths::new_no_create().expect("Failed to create paths");
+	let branding = BrandingProperties::default();
+	let params = ArgPlaceholderParams {
+		version: &version,
+		side: &side,
+		launch_dir: Path::new("/instances/client"),
+		classpath: &classpath,
+		launch_config: &launch_config,
+		paths: &paths,
+		branding: &branding,
+	};
+
+	let mut group = c.benchmark_group("launch_args");
+	group.throughput(Throughput::Elements(GAME_ARGS.len() as u64));
+	group.bench_function("replace_placeholders", |b| {
+		b.iter(|| {
+			for arg in GAME_ARGS {
+				black_box(replace_arg_placeholders(black_box(arg), &params));
+			}
+		})
+	});
+	group.finish();
+}
+
+criterion_group!(
+	benches,
+	bench_assets,
+	bench_client_meta,
+	bench_arg_placeholders
+);
+criterion_main!(benches);
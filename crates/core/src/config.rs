@@ -20,6 +20,8 @@ pub struct Configuration {
 	pub(crate) force_reinstall: bool,
 	/// Whether to allow offline installs
 	pub(crate) allow_offline: bool,
+	/// Whether to verify the contents of installed files that have changed
+	pub(crate) verify_files: bool,
 	/// Whether to censor user credentials in output messages and logs
 	pub(crate) censor_secrets: bool,
 	/// Whether to use file copies instead of hardlinks. Useful if you
@@ -42,6 +44,7 @@ impl Configuration {
 			ms_client_id: get_ms_client_id(),
 			force_reinstall: false,
 			allow_offline: false,
+			verify_files: false,
 			censor_secrets: true,
 			disable_hardlinks: false,
 			branding: BrandingProperties::default(),
@@ -86,6 +89,12 @@ impl ConfigBuilder {
 
 	builder_method!(allow_offline, bool, "Set whether to allow offline installs");
 
+	builder_method!(
+		verify_files,
+		bool,
+		"Set whether to verify the contents of installed files that have changed"
+	);
+
 	builder_method!(
 		censor_secrets,
 		bool,
@@ -11,7 +11,8 @@ use crate::io::java::classpath::Classpath;
 use crate::io::java::install::{JavaInstallParameters, JavaInstallation};
 use crate::io::persistent::PersistentData;
 use crate::io::update::UpdateManager;
-use crate::launch::{LaunchConfiguration, LaunchParameters};
+use crate::launch::{LaunchConfiguration, LaunchParameters, LaunchPlan};
+use crate::net::download::DownloadPriority;
 use crate::net::game_files::client_meta::ClientMeta;
 use crate::net::game_files::version_manifest::VersionManifestAndList;
 use crate::net::game_files::{game_jar, libraries};
@@ -54,6 +55,8 @@ impl<'params> Instance<'params> {
 			update_manager: params.update_manager,
 			persistent: params.persistent,
 			req_client: params.req_client,
+			priority: DownloadPriority::High,
+			keep_installed: false,
 		};
 		let java =
 			JavaInstallation::install(config.launch.java.clone(), *java_vers, java_params, o)
@@ -201,6 +204,22 @@ impl<'params> Instance<'params> {
 		&mut self,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<InstanceHandle> {
+		let plan = self.get_launch_plan(o)?;
+		let handle = plan
+			.launch(
+				self.params.users,
+				self.params.paths,
+				self.params.req_client,
+				o,
+			)
+			.await
+			.context("Failed to run launch routine")?;
+		Ok(handle)
+	}
+
+	/// Resolve everything that is needed to launch the instance into a plan, which can be
+	/// saved and launched later without loading the instance again
+	pub fn get_launch_plan(&self, o: &mut impl MCVMOutput) -> anyhow::Result<LaunchPlan> {
 		let params = LaunchParameters {
 			version: self.params.version,
 			version_manifest: self.params.version_manifest,
@@ -211,16 +230,12 @@ impl<'params> Instance<'params> {
 			main_class: &self.main_class,
 			launch_config: &self.config.launch,
 			paths: self.params.paths,
-			req_client: self.params.req_client,
 			client_meta: self.params.client_meta,
-			users: self.params.users,
+			users: &*self.params.users,
 			censor_secrets: self.params.censor_secrets,
 			branding: self.params.branding,
 		};
-		let handle = crate::launch::launch(params, o)
-			.await
-			.context("Failed to run launch routine")?;
-		Ok(handle)
+		crate::launch::create_plan(params, o).context("Failed to create launch plan")
 	}
 
 	/// Get the JAR path of the instance
@@ -52,6 +52,101 @@ pub async fn update_hardlink_async(path: &Path, link: &Path) -> std::io::Result<
 	Ok(())
 }
 
+/// Creates a new link to a file if it does not exist. A copy-on-write clone is preferred on
+/// filesystems that support them (like btrfs, XFS, and APFS), since it shares storage just like
+/// a hardlink while keeping changes to one of the files from showing up in the other.
+/// Otherwise, a hardlink is created
+pub fn update_link(path: &Path, link: &Path) -> std::io::Result<()> {
+	if !link.exists() && reflink(path, link).is_err() {
+		fs::hard_link(path, link)?;
+	}
+
+	Ok(())
+}
+
+/// Copy a file, overwriting the destination. The copy is a copy-on-write clone
+/// when the filesystem supports it, so that it is instant and doesn't use any more storage
+pub fn copy_file(src: &Path, dest: &Path) -> std::io::Result<()> {
+	if dest.exists() {
+		fs::remove_file(dest)?;
+	}
+	if reflink(src, dest).is_err() {
+		fs::copy(src, dest)?;
+	}
+
+	Ok(())
+}
+
+/// Create a copy-on-write clone of a file at a path that does not exist yet.
+/// Fails if the filesystem or platform does not support clones
+#[cfg(target_os = "linux")]
+pub fn reflink(path: &Path, link: &Path) -> std::io::Result<()> {
+	use std::os::fd::AsRawFd;
+
+	/// The FICLONE ioctl from linux/fs.h
+	const FICLONE: u64 = 0x40049409;
+
+	let src = File::open(path)?;
+	let dest = File::options().write(true).create_new(true).open(link)?;
+	// SAFETY: Both file descriptors are valid for the duration of the call
+	let result = unsafe { libc::ioctl(dest.as_raw_fd(), FICLONE as _, src.as_raw_fd()) };
+	if result == 0 {
+		return Ok(());
+	}
+
+	let error = std::io::Error::last_os_error();
+	drop(dest);
+	let _ = fs::remove_file(link);
+	Err(error)
+}
+
+/// Create a copy-on-write clone of a file at a path that does not exist yet.
+/// Fails if the filesystem or platform does not support clones
+#[cfg(target_os = "macos")]
+pub fn reflink(path: &Path, link: &Path) -> std::io::Result<()> {
+	use std::ffi::CString;
+	use std::os::unix::ffi::OsStrExt;
+
+	let src = CString::new(path.as_os_str().as_bytes())?;
+	let dest = CString::new(link.as_os_str().as_bytes())?;
+	// SAFETY: Both paths are valid null-terminated strings
+	let result = unsafe { libc::clonefile(src.as_ptr(), dest.as_ptr(), 0) };
+	if result == 0 {
+		Ok(())
+	} else {
+		Err(std::io::Error::last_os_error())
+	}
+}
+
+/// Create a copy-on-write clone of a file at a path that does not exist yet.
+/// Fails if the filesystem or platform does not support clones
+#[cfg(not(any(target_os = "linux", target_os = "macos")))]
+pub fn reflink(_path: &Path, _link: &Path) -> std::io::Result<()> {
+	Err(std::io::ErrorKind::Unsupported.into())
+}
+
+/// Take an exclusive advisory lock on a file, waiting until any other process
+/// that holds it lets go. The lock is released once the file is closed
+#[cfg(target_family = "unix")]
+pub fn lock_file_exclusive(file: &File) -> std::io::Result<()> {
+	use std::os::fd::AsRawFd;
+
+	// SAFETY: The file descriptor is valid for the duration of the call
+	let result = unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_EX) };
+	if result == 0 {
+		Ok(())
+	} else {
+		Err(std::io::Error::last_os_error())
+	}
+}
+
+/// Take an exclusive advisory lock on a file, waiting until any other process
+/// that holds it lets go. This does nothing on platforms other than Unix
+#[cfg(not(target_family = "unix"))]
+pub fn lock_file_exclusive(_file: &File) -> std::io::Result<()> {
+	Ok(())
+}
+
 /// Cross platform - create a directory soft link
 #[cfg(target_os = "windows")]
 pub fn dir_symlink(path: &Path, target: &Path) -> std::io::Result<()> {
@@ -78,10 +173,7 @@ pub fn copy_dir_contents(src: &Path, dest: &Path) -> anyhow::Result<()> {
 		let rel = src_path.strip_prefix(src)?;
 		let dest_path = dest.join(rel);
 
-		let mut src_file = std::io::BufReader::new(std::fs::File::open(src_path)?);
-		let mut dest_file = std::io::BufWriter::new(std::fs::File::create(dest_path)?);
-
-		std::io::copy(&mut src_file, &mut dest_file)?;
+		copy_file(&src_path, &dest_path)?;
 	}
 
 	Ok(())
@@ -99,10 +191,7 @@ pub async fn copy_dir_contents_async(src: &Path, dest: &Path) -> anyhow::Result<
 		let rel = src_path.strip_prefix(src)?;
 		let dest_path = dest.join(rel);
 
-		let mut src_file = std::io::BufReader::new(std::fs::File::open(src_path)?);
-		let mut dest_file = std::io::BufWriter::new(std::fs::File::create(dest_path)?);
-
-		std::io::copy(&mut src_file, &mut dest_file)?;
+		copy_file(&src_path, &dest_path)?;
 	}
 
 	Ok(())
@@ -0,0 +1,282 @@
+use std::fs::File;
+use std::io::{BufReader, Read};
+use std::path::{Component, Path};
+
+use anyhow::{anyhow, ensure, Context};
+use bytes::Bytes;
+use reqwest::IntoUrl;
+use tar::Archive;
+use tokio::sync::mpsc;
+use zip::ZipArchive;
+
+use crate::io::files;
+use crate::net::download::{self, DownloadPriority};
+
+/// How many downloaded chunks can be waiting for the extractor before the download waits for it
+const CHANNEL_CAPACITY: usize = 64;
+
+/// Downloads a Java archive and extracts it into the output directory, returning the name
+/// of the directory inside the archive. Tar archives are extracted while they are
+/// downloaded, so they never touch the disk. Zip archives need to be read in any order,
+/// so they are downloaded first and then have their entries extracted in parallel.
+///
+/// The archive is extracted into a staging directory first and only moved into place
+/// once it is complete, so an interrupted install never looks like a finished one
+pub(super) async fn download_and_extract(
+	url: impl IntoUrl,
+	out_dir: &Path,
+	priority: DownloadPriority,
+	client: &reqwest::Client,
+) -> anyhow::Result<String> {
+	let staging_dir = out_dir.join(format!(".extract{}", std::process::id()));
+	if staging_dir.exists() {
+		std::fs::remove_dir_all(&staging_dir).context("Failed to remove staging directory")?;
+	}
+	files::create_dir(&staging_dir)?;
+
+	let result = if cfg!(windows) {
+		let arc_path = out_dir.join(format!(".download{}.zip", std::process::id()));
+		download::file_with_priority(url, &arc_path, client, priority)
+			.await
+			.context("Failed to download Java archive")?;
+
+		let extract_dir = staging_dir.clone();
+		let extract_path = arc_path.clone();
+		let result = tokio::task::spawn_blocking(move || extract_zip(&extract_path, &extract_dir))
+			.await
+			.context("Extraction task failed")?;
+		let _ = std::fs::remove_file(arc_path);
+
+		result
+	} else {
+		stream_tar_gz(url, &staging_dir, priority, client).await
+	};
+
+	let result = result.and_then(|dir_name| {
+		ensure!(!dir_name.is_empty(), "Missing archive internal directory");
+		let dest = out_dir.join(&dir_name);
+		if dest.exists() {
+			std::fs::remove_dir_all(&dest).context("Failed to remove old Java installation")?;
+		}
+		std::fs::rename(staging_dir.join(&dir_name), &dest)
+			.context("Failed to move extracted Java installation into place")?;
+		Ok(dir_name)
+	});
+	let _ = std::fs::remove_dir_all(&staging_dir);
+
+	result
+}
+
+/// Extract a tar.gz archive from the response body as it is downloaded
+async fn stream_tar_gz(
+	url: impl IntoUrl,
+	out_dir: &Path,
+	priority: DownloadPriority,
+	client: &reqwest::Client,
+) -> anyhow::Result<String> {
+	let (mut resp, permit) = download::download_scheduled(url, client, priority)
+		.await
+		.context("Failed to download Java archive")?;
+
+	let (sender, receiver) = mpsc::channel(CHANNEL_CAPACITY);
+	let out_dir = out_dir.to_owned();
+	let extraction =
+		tokio::task::spawn_blocking(move || extract_tar_gz(ChannelReader::new(receiver), &out_dir));
+
+	let mut total = 0;
+	let mut download_result = Ok(());
+	loop {
+		match resp.chunk().await {
+			Ok(Some(chunk)) => {
+				total += chunk.len();
+				// The extractor only hangs up early if it failed, in which case its error is used
+				if sender.send(chunk).await.is_err() {
+					break;
+				}
+			}
+			Ok(None) => break,
+			Err(e) => {
+				download_result = Err(anyhow!(e).context("Failed to download chunk"));
+				break;
+			}
+		}
+	}
+	// Tell the extractor that there is nothing more to read
+	drop(sender);
+
+	let extract_result = extraction.await.context("Extraction task failed")?;
+	download_result?;
+	let dir_name = extract_result?;
+	permit.report_success(total);
+
+	Ok(dir_name)
+}
+
+/// Extracts a tar.gz archive and returns the name of the directory inside it
+fn extract_tar_gz(reader: impl Read, out_dir: &Path) -> anyhow::Result<String> {
+	let decoder = libflate::gzip::Decoder::new(reader).context("Failed to decode tar.gz")?;
+	let mut arc = Archive::new(decoder);
+
+	let mut dir_name = None;
+	for entry in arc.entries().context("Failed to get Tar entries")? {
+		let mut entry = entry.context("Failed to get entry")?;
+		if dir_name.is_none() {
+			let path = entry.path().context("Failed to get entry path name")?;
+			dir_name = Some(get_top_level_dir(&path));
+		}
+		entry
+			.unpack_in(out_dir)
+			.context("Failed to unarchive tar entry")?;
+	}
+
+	dir_name.context("Missing archive internal directory")
+}
+
+/// Extracts a zip archive using all of the available threads and returns the name of
+/// the directory inside it. Every thread opens the archive on its own so that entries
+/// can be decompressed independently
+fn extract_zip(arc_path: &Path, out_dir: &Path) -> anyhow::Result<String> {
+	let open = || -> anyhow::Result<ZipArchive<BufReader<File>>> {
+		let file = File::open(arc_path).context("Failed to read archive file")?;
+		ZipArchive::new(BufReader::new(file)).context("Failed to open zip archive")
+	};
+
+	let mut archive = open()?;
+	let dir_name = archive
+		.file_names()
+		.next()
+		.map(|x| get_top_level_dir(Path::new(x)))
+		.context("Missing archive internal directory")?;
+
+	// Create the directories first so that the threads don't have to worry about them
+	let mut file_indices = Vec::new();
+	for i in 0..archive.len() {
+		let entry = archive
+			.by_index_raw(i)
+			.context("Failed to read zip entry")?;
+		let Some(path) = entry.enclosed_name() else {
+			continue;
+		};
+		let path = out_dir.join(path);
+		if entry.is_dir() {
+			files::create_dir(&path)?;
+		} else {
+			files::create_leading_dirs(&path)?;
+			file_indices.push((i, path));
+		}
+	}
+
+	let thread_count = std::thread::available_parallelism()
+		.map(|x| x.get())
+		.unwrap_or(1)
+		.min(file_indices.len().max(1));
+	std::thread::scope(|scope| {
+		let threads: Vec<_> = (0..thread_count)
+			.map(|thread| {
+				let file_indices = &file_indices;
+				scope.spawn(move || {
+					let mut archive = open()?;
+					for (i, path) in file_indices.iter().skip(thread).step_by(thread_count) {
+						extract_zip_entry(&mut archive, *i, path)?;
+					}
+					Ok::<_, anyhow::Error>(())
+				})
+			})
+			.collect();
+
+		for thread in threads {
+			thread
+				.join()
+				.map_err(|_| anyhow!("Extraction thread panicked"))??;
+		}
+
+		Ok::<_, anyhow::Error>(())
+	})?;
+
+	Ok(dir_name)
+}
+
+/// Extract a single file from a zip archive
+fn extract_zip_entry(
+	archive: &mut ZipArchive<BufReader<File>>,
+	index: usize,
+	path: &Path,
+) -> anyhow::Result<()> {
+	let mut entry = archive
+		.by_index(index)
+		.context("Failed to read zip entry")?;
+	let mut file = File::create(path)
+		.with_context(|| format!("Failed to create extracted file {}", path.display()))?;
+	std::io::copy(&mut entry, &mut file)
+		.with_context(|| format!("Failed to extract file {}", path.display()))?;
+
+	Ok(())
+}
+
+/// Get the name of the first component of a path in an archive
+fn get_top_level_dir(path: &Path) -> String {
+	path.components()
+		.find(|x| matches!(x, Component::Normal(..)))
+		.map(|x| x.as_os_str().to_string_lossy().to_string())
+		.unwrap_or_default()
+}
+
+/// Reads the chunks of a download that are sent from an async task
+struct ChannelReader {
+	receiver: mpsc::Receiver<Bytes>,
+	current: Bytes,
+}
+
+impl ChannelReader {
+	fn new(receiver: mpsc::Receiver<Bytes>) -> Self {
+		Self {
+			receiver,
+			current: Bytes::new(),
+		}
+	}
+}
+
+impl Read for ChannelReader {
+	fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+		while self.current.is_empty() {
+			match self.receiver.blocking_recv() {
+				Some(chunk) => self.current = chunk,
+				// The sender is gone, so the download is over
+				None => return Ok(0),
+			}
+		}
+
+		let len = buf.len().min(self.current.len());
+		buf[..len].copy_from_slice(&self.current.split_to(len));
+		Ok(len)
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_channel_reader() {
+		let (sender, receiver) = mpsc::channel(4);
+		sender.try_send(Bytes::from_static(b"hello ")).unwrap();
+		sender.try_send(Bytes::new()).unwrap();
+		sender.try_send(Bytes::from_static(b"world")).unwrap();
+		drop(sender);
+
+		let mut out = String::new();
+		ChannelReader::new(receiver)
+			.read_to_string(&mut out)
+			.unwrap();
+		assert_eq!(out, "hello world");
+	}
+
+	#[test]
+	fn test_top_level_dir() {
+		assert_eq!(
+			get_top_level_dir(Path::new("jdk-21.0.2+13-jre/bin/java")),
+			"jdk-21.0.2+13-jre"
+		);
+		assert_eq!(get_top_level_dir(Path::new("./jdk/")), "jdk");
+	}
+}
@@ -1,24 +1,22 @@
+/// Streaming download and extraction of Java archives
+mod archive;
 /// System Java installation
 mod system;
 
-use std::fs::File;
-use std::io::{BufReader, Read, Seek};
-
 #[cfg(target_family = "unix")]
 use std::os::unix::fs::PermissionsExt;
 use std::path::{Path, PathBuf};
 
 use anyhow::{bail, Context};
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::timing::{self, SpanCategory};
 use mcvm_shared::translate;
-use tar::Archive;
-use zip::ZipArchive;
 
 use crate::io::files::{self, paths::Paths};
 use crate::io::persistent::{PersistentData, PersistentDataJavaInstallation};
 use crate::io::update::UpdateManager;
-use crate::net::{self, download};
-use mcvm_shared::util::preferred_archive_extension;
+use crate::net;
+use crate::net::download::DownloadPriority;
 
 use super::JavaMajorVersion;
 
@@ -78,6 +76,7 @@ impl JavaInstallation {
 		mut params: JavaInstallParameters<'_>,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<Self> {
+		let _span = timing::span(SpanCategory::Phase, "install_java");
 		o.start_process();
 		o.display(
 			MessageContents::StartProcess(translate!(o, StartCheckingForJavaUpdates)),
@@ -122,11 +121,7 @@ impl JavaInstallation {
 
 	/// Get the path to the JVM.
 	pub fn get_jvm_path(&self) -> PathBuf {
-		#[cfg(target_family = "windows")]
-		let path = "bin/java.exe";
-		#[cfg(not(target_family = "windows"))]
-		let path = "bin/java";
-		self.path.join(path)
+		get_jvm_path(&self.path)
 	}
 
 	/// Verifies that this installation is set up correctly
@@ -158,6 +153,12 @@ pub(crate) struct JavaInstallParameters<'a> {
 	pub update_manager: &'a mut UpdateManager,
 	pub persistent: &'a mut PersistentData,
 	pub req_client: &'a reqwest::Client,
+	/// The priority to download Java archives with
+	pub priority: DownloadPriority,
+	/// Whether to use an installation that is recorded in the persistent data instead of
+	/// checking for a newer one. Updating can replace the old installation, so this is
+	/// used when it may be in use by a running game
+	pub keep_installed: bool,
 }
 
 async fn install_auto(
@@ -189,22 +190,16 @@ async fn install_adoptium(
 	params: &mut JavaInstallParameters<'_>,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<PathBuf> {
-	if params.update_manager.allow_offline {
-		if let Some(directory) = params
-			.persistent
-			.get_java_path(PersistentDataJavaInstallation::Adoptium, major_version)
-		{
-			Ok(directory)
-		} else {
-			update_adoptium(major_version, params, o)
-				.await
-				.context("Failed to update Adoptium Java")
-		}
-	} else {
-		update_adoptium(major_version, params, o)
-			.await
-			.context("Failed to update Adoptium Java")
+	if let Some(directory) = get_recorded_installation(
+		PersistentDataJavaInstallation::Adoptium,
+		major_version,
+		params,
+	) {
+		return Ok(directory);
 	}
+	update_adoptium(major_version, params, o)
+		.await
+		.context("Failed to update Adoptium Java")
 }
 
 async fn install_zulu(
@@ -212,22 +207,14 @@ async fn install_zulu(
 	params: &mut JavaInstallParameters<'_>,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<PathBuf> {
-	if params.update_manager.allow_offline {
-		if let Some(directory) = params
-			.persistent
-			.get_java_path(PersistentDataJavaInstallation::Zulu, major_version)
-		{
-			Ok(directory)
-		} else {
-			update_zulu(major_version, params, o)
-				.await
-				.context("Failed to update Zulu Java")
-		}
-	} else {
-		update_zulu(major_version, params, o)
-			.await
-			.context("Failed to update Zulu Java")
+	if let Some(directory) =
+		get_recorded_installation(PersistentDataJavaInstallation::Zulu, major_version, params)
+	{
+		return Ok(directory);
 	}
+	update_zulu(major_version, params, o)
+		.await
+		.context("Failed to update Zulu Java")
 }
 
 async fn install_graalvm(
@@ -235,21 +222,33 @@ async fn install_graalvm(
 	params: &mut JavaInstallParameters<'_>,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<PathBuf> {
+	if let Some(directory) = get_recorded_installation(
+		PersistentDataJavaInstallation::GraalVM,
+		major_version,
+		params,
+	) {
+		return Ok(directory);
+	}
+	update_graalvm(major_version, params, o)
+		.await
+		.context("Failed to update GraalVM Java")
+}
+
+/// Get the recorded path of an installation if it should be used without checking for updates
+fn get_recorded_installation(
+	installation: PersistentDataJavaInstallation,
+	major_version: &str,
+	params: &JavaInstallParameters<'_>,
+) -> Option<PathBuf> {
 	if params.update_manager.allow_offline {
-		if let Some(directory) = params
+		params.persistent.get_java_path(installation, major_version)
+	} else if params.keep_installed {
+		params
 			.persistent
-			.get_java_path(PersistentDataJavaInstallation::GraalVM, major_version)
-		{
-			Ok(directory)
-		} else {
-			update_graalvm(major_version, params, o)
-				.await
-				.context("Failed to update GraalVM Java")
-		}
+			.get_java_path(installation, major_version)
+			.filter(|x| is_installed(x))
 	} else {
-		update_graalvm(major_version, params, o)
-			.await
-			.context("Failed to update GraalVM Java")
+		None
 	}
 }
 
@@ -270,7 +269,7 @@ async fn update_adoptium(
 	extracted_bin_name.push_str("-jre");
 	let extracted_bin_dir = out_dir.join(&extracted_bin_name);
 
-	if !params
+	let changed = params
 		.persistent
 		.update_java_installation(
 			PersistentDataJavaInstallation::Adoptium,
@@ -278,42 +277,32 @@ async fn update_adoptium(
 			&release_name,
 			&extracted_bin_dir,
 		)
-		.context("Failed to update Java in lockfile")?
-	{
+		.context("Failed to update Java in lockfile")?;
+	if !changed && is_installed(&extracted_bin_dir) {
 		return Ok(extracted_bin_dir);
 	}
 
 	params.persistent.dump(params.paths).await?;
 
-	let arc_extension = preferred_archive_extension();
-	let arc_name = format!("adoptium{major_version}{arc_extension}");
-	let arc_path = out_dir.join(arc_name);
-
-	let bin_url = version.binary.package.link;
-
-	o.display(
-		MessageContents::StartProcess(translate!(
-			o,
-			DownloadingAdoptium,
-			"version" = &release_name
-		)),
-		MessageLevel::Important,
-	);
-	download::file(bin_url, &arc_path, params.req_client)
+	// Installations are stored by their full version, so this one may already be there
+	if !is_installed(&extracted_bin_dir) {
+		o.display(
+			MessageContents::StartProcess(translate!(
+				o,
+				DownloadingAdoptium,
+				"version" = &release_name
+			)),
+			MessageLevel::Important,
+		);
+		archive::download_and_extract(
+			&version.binary.package.link,
+			&out_dir,
+			params.priority,
+			params.req_client,
+		)
 		.await
-		.context("Failed to download JRE binaries")?;
-
-	// Extraction
-	o.display(
-		MessageContents::StartProcess(translate!(o, StartExtractingJava)),
-		MessageLevel::Important,
-	);
-	extract_archive_file(&arc_path, &out_dir).context("Failed to extract")?;
-	o.display(
-		MessageContents::StartProcess(translate!(o, StartRemovingJavaArchive)),
-		MessageLevel::Important,
-	);
-	std::fs::remove_file(arc_path).context("Failed to remove archive")?;
+		.context("Failed to download and extract JRE binaries")?;
+	}
 
 	o.display(
 		MessageContents::Success(translate!(o, FinishJavaInstallation)),
@@ -338,7 +327,7 @@ async fn update_zulu(
 
 	let extracted_dir = out_dir.join(net::java::zulu::extract_dir_name(&package.name));
 
-	if !params
+	let changed = params
 		.persistent
 		.update_java_installation(
 			PersistentDataJavaInstallation::Zulu,
@@ -346,34 +335,32 @@ async fn update_zulu(
 			&package.name,
 			&extracted_dir,
 		)
-		.context("Failed to update Java in lockfile")?
-	{
+		.context("Failed to update Java in lockfile")?;
+	if !changed && is_installed(&extracted_dir) {
 		return Ok(extracted_dir);
 	}
 
 	params.persistent.dump(params.paths).await?;
 
-	let arc_path = out_dir.join(&package.name);
-
-	o.display(
-		MessageContents::StartProcess(translate!(o, DownloadingZulu, "version" = &package.name)),
-		MessageLevel::Important,
-	);
-	download::file(&package.download_url, &arc_path, params.req_client)
+	// Installations are stored by their full version, so this one may already be there
+	if !is_installed(&extracted_dir) {
+		o.display(
+			MessageContents::StartProcess(translate!(
+				o,
+				DownloadingZulu,
+				"version" = &package.name
+			)),
+			MessageLevel::Important,
+		);
+		archive::download_and_extract(
+			&package.download_url,
+			&out_dir,
+			params.priority,
+			params.req_client,
+		)
 		.await
-		.context("Failed to download JRE binaries")?;
-
-	// Extraction
-	o.display(
-		MessageContents::StartProcess(translate!(o, StartExtractingJava)),
-		MessageLevel::Important,
-	);
-	extract_archive_file(&arc_path, &out_dir).context("Failed to extract")?;
-	o.display(
-		MessageContents::StartProcess(translate!(o, StartRemovingJavaArchive)),
-		MessageLevel::Important,
-	);
-	std::fs::remove_file(arc_path).context("Failed to remove archive")?;
+		.context("Failed to download and extract JRE binaries")?;
+	}
 
 	o.display(
 		MessageContents::Success(translate!(o, FinishJavaInstallation)),
@@ -392,21 +379,16 @@ async fn update_graalvm(
 	let out_dir = params.paths.java.join("graalvm");
 	files::create_dir(&out_dir)?;
 
+	// The version is only known from the archive, so we have to extract it to find out
 	o.display(
 		MessageContents::StartProcess(translate!(o, DownloadingGraalVM)),
 		MessageLevel::Important,
 	);
-	let archive = net::java::graalvm::get_latest(major_version, params.req_client)
-		.await
-		.context("Failed to download the latest GraalVM version")?;
-
-	// We have to extract now since we need the extracted dir
-	o.display(
-		MessageContents::StartProcess(translate!(o, StartExtractingJava)),
-		MessageLevel::Important,
-	);
-	let dir_name = extract_archive(std::io::Cursor::new(archive), &out_dir)
-		.context("Failed to extract GraalVM archive")?;
+	let url = net::java::graalvm::download_url(major_version);
+	let dir_name =
+		archive::download_and_extract(&url, &out_dir, params.priority, params.req_client)
+			.await
+			.context("Failed to download and extract the latest GraalVM version")?;
 
 	let extracted_dir = out_dir.join(&dir_name);
 
@@ -435,55 +417,16 @@ async fn update_graalvm(
 	Ok(extracted_dir)
 }
 
-/// Extracts the archive file
-fn extract_archive_file(arc_path: &Path, out_dir: &Path) -> anyhow::Result<()> {
-	let file = File::open(arc_path).context("Failed to read archive file")?;
-	let file = BufReader::new(file);
-
-	extract_archive(file, out_dir)?;
-
-	Ok(())
+/// Get the path to the JVM in a Java installation directory
+fn get_jvm_path(dir: &Path) -> PathBuf {
+	#[cfg(target_family = "windows")]
+	let path = "bin/java.exe";
+	#[cfg(not(target_family = "windows"))]
+	let path = "bin/java";
+	dir.join(path)
 }
 
-/// Extracts the JRE archive (either a tar or a zip) and also returns the internal extraction directory name
-fn extract_archive<R: Read + Seek>(reader: R, out_dir: &Path) -> anyhow::Result<String> {
-	let dir_name = if cfg!(windows) {
-		let mut archive = ZipArchive::new(reader).context("Failed to open zip archive")?;
-
-		let dir_name = archive
-			.file_names()
-			.next()
-			.context("Missing archive internal directory")?
-			.to_string();
-
-		archive
-			.extract(out_dir)
-			.context("Failed to extract zip file")?;
-
-		dir_name
-	} else {
-		let mut decoder =
-			libflate::gzip::Decoder::new(reader).context("Failed to decode tar.gz")?;
-		// Get the archive twice because of archive shenanigans
-		let mut arc = Archive::new(&mut decoder);
-
-		// Wow
-		let dir_name = arc
-			.entries()
-			.context("Failed to get Tar entries")?
-			.next()
-			.context("Missing archive internal directory")?
-			.context("Failed to get entry")?
-			.path()
-			.context("Failed to get entry path name")?
-			.to_string_lossy()
-			.to_string();
-
-		let mut arc = Archive::new(&mut decoder);
-		arc.unpack(out_dir).context("Failed to unarchive tar")?;
-
-		dir_name
-	};
-
-	Ok(dir_name)
+/// Check whether a Java installation directory has been fully installed
+fn is_installed(dir: &Path) -> bool {
+	get_jvm_path(dir).is_file()
 }
@@ -14,6 +14,8 @@ pub mod java;
 pub mod minecraft;
 /// Use of a file for persistent data
 pub mod persistent;
+/// Manifests of files in content stores
+pub mod store_manifest;
 /// Management of file updates
 pub mod update;
 
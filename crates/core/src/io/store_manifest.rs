@@ -0,0 +1,286 @@
+use std::collections::HashMap;
+use std::fs::{File, Metadata};
+use std::io::BufReader;
+use std::path::{Path, PathBuf};
+use std::time::{SystemTime, UNIX_EPOCH};
+
+use anyhow::Context;
+use serde::{Deserialize, Serialize};
+use sha1::{Digest, Sha1};
+
+use super::{json_from_file, json_to_file};
+
+/// A persistent record of the files in a store, like the assets or libraries directories.
+/// It is used to avoid checking the filesystem for files that are already known to be
+/// installed, and to only rehash files that have changed when verifying
+#[derive(Debug)]
+pub struct StoreManifest {
+	path: PathBuf,
+	contents: StoreManifestContents,
+	dirty: bool,
+}
+
+#[derive(Serialize, Deserialize, Default, Debug)]
+#[serde(default)]
+struct StoreManifestContents {
+	/// Hashes of the indexes that the store has been completely updated from
+	indexes: HashMap<String, String>,
+	/// Recorded files in the store
+	entries: HashMap<String, StoreManifestEntry>,
+	/// Hashes of the archives that files were last extracted from, like native libraries
+	extracted: HashMap<String, String>,
+}
+
+/// Recorded information about a single file in a store
+#[derive(Serialize, Deserialize, Debug, Clone)]
+pub struct StoreManifestEntry {
+	/// The SHA-1 hash of the file, if it is known
+	#[serde(default)]
+	pub hash: Option<String>,
+	/// The size of the file in bytes
+	pub size: u64,
+	/// The modification time of the file, in nanoseconds since the Unix epoch
+	pub mtime: u64,
+	/// When the file was last verified, in seconds since the Unix epoch
+	pub verified_at: u64,
+}
+
+impl StoreManifestEntry {
+	/// Create a new entry from file metadata
+	fn from_metadata(hash: Option<&str>, meta: &Metadata) -> Self {
+		Self {
+			hash: hash.map(str::to_string),
+			size: meta.len(),
+			mtime: get_mtime(meta),
+			verified_at: now_secs(),
+		}
+	}
+
+	/// Check whether file metadata is the same as what was recorded in this entry
+	fn matches_metadata(&self, meta: &Metadata) -> bool {
+		self.size == meta.len() && self.mtime == get_mtime(meta)
+	}
+}
+
+impl StoreManifest {
+	/// Open a store manifest, starting a new one if it does not exist
+	pub fn open(path: &Path) -> anyhow::Result<Self> {
+		let contents = if path.exists() {
+			// A corrupted manifest just means that we have to check the files again
+			json_from_file(path).unwrap_or_default()
+		} else {
+			StoreManifestContents::default()
+		};
+
+		Ok(Self {
+			path: path.to_owned(),
+			contents,
+			dirty: false,
+		})
+	}
+
+	/// Check whether the store was already completely updated from an index with the given hash
+	pub fn is_index_current(&self, index: &str, hash: &str) -> bool {
+		self.contents.indexes.get(index).is_some_and(|x| x == hash)
+	}
+
+	/// Record that the store has been completely updated from an index
+	pub fn set_index(&mut self, index: &str, hash: &str) {
+		if !self.is_index_current(index, hash) {
+			self.contents
+				.indexes
+				.insert(index.to_string(), hash.to_string());
+			self.dirty = true;
+		}
+	}
+
+	/// Get the hash of the archive that files were last extracted from
+	pub fn get_extracted(&self, key: &str) -> Option<&str> {
+		self.contents.extracted.get(key).map(String::as_str)
+	}
+
+	/// Record that files were extracted from an archive with the given hash
+	pub fn set_extracted(&mut self, key: &str, hash: &str) {
+		if self.get_extracted(key) != Some(hash) {
+			self.contents
+				.extracted
+				.insert(key.to_string(), hash.to_string());
+			self.dirty = true;
+		}
+	}
+
+	/// Get a recorded entry
+	pub fn get_entry(&self, key: &str) -> Option<&StoreManifestEntry> {
+		self.contents.entries.get(key)
+	}
+
+	/// Check whether a file is recorded with the expected hash, without touching the filesystem.
+	/// The expected hash should be None if the contents of the file are not comparable to it
+	pub fn is_recorded(&self, key: &str, expected_hash: Option<&str>) -> bool {
+		self.contents.entries.get(key).is_some_and(|entry| {
+			expected_hash.map_or(true, |expected| entry.hash.as_deref() == Some(expected))
+		})
+	}
+
+	/// Check whether a file in the store is present and valid, updating the manifest if needed.
+	/// Without verification, files that are already in the manifest with the same hash are
+	/// trusted without touching the filesystem. Files that exist but aren't recorded are
+	/// trusted too, but they are only recorded once they have been hashed, so that the
+	/// next verification still checks them. With verification, files are statted and only
+	/// rehashed if their size or modification time changed since they were last recorded.
+	/// The expected hash should be None if the contents of the file are not comparable to it.
+	pub fn check_file(
+		&mut self,
+		key: &str,
+		path: &Path,
+		expected_hash: Option<&str>,
+		verify: bool,
+	) -> anyhow::Result<bool> {
+		let entry = self.contents.entries.get(key);
+		let hash_matches = |entry: &StoreManifestEntry| match expected_hash {
+			Some(expected) => entry.hash.as_deref() == Some(expected),
+			None => true,
+		};
+
+		if !verify {
+			if self.is_recorded(key, expected_hash) {
+				return Ok(true);
+			}
+			let Ok(meta) = path.metadata() else {
+				return Ok(false);
+			};
+			// There is nothing to hash when the contents can't be compared
+			if expected_hash.is_none() {
+				self.insert(key, StoreManifestEntry::from_metadata(None, &meta));
+			}
+			return Ok(true);
+		}
+
+		let Ok(meta) = path.metadata() else {
+			self.remove(key);
+			return Ok(false);
+		};
+		if entry.is_some_and(|x| hash_matches(x) && x.matches_metadata(&meta)) {
+			return Ok(true);
+		}
+
+		if let Some(expected) = expected_hash {
+			let actual = hash_file(path).context("Failed to hash file")?;
+			if actual != expected {
+				self.remove(key);
+				return Ok(false);
+			}
+		}
+		self.insert(key, StoreManifestEntry::from_metadata(expected_hash, &meta));
+
+		Ok(true)
+	}
+
+	/// Record a file that was just added to the store
+	pub fn record_file(
+		&mut self,
+		key: &str,
+		path: &Path,
+		hash: Option<&str>,
+	) -> anyhow::Result<()> {
+		let meta = path
+			.metadata()
+			.context("Failed to get metadata of stored file")?;
+		self.insert(key, StoreManifestEntry::from_metadata(hash, &meta));
+
+		Ok(())
+	}
+
+	/// Remove a recorded file
+	pub fn remove(&mut self, key: &str) {
+		if self.contents.entries.remove(key).is_some() {
+			self.dirty = true;
+		}
+	}
+
+	fn insert(&mut self, key: &str, entry: StoreManifestEntry) {
+		self.contents.entries.insert(key.to_string(), entry);
+		self.dirty = true;
+	}
+
+	/// Write the manifest to the disk if it has changed
+	pub fn write(&mut self) -> anyhow::Result<()> {
+		if !self.dirty {
+			return Ok(());
+		}
+		json_to_file(&self.path, &self.contents).context("Failed to write store manifest")?;
+		self.dirty = false;
+
+		Ok(())
+	}
+}
+
+/// Get the hex SHA-1 hash of a file
+pub fn hash_file(path: &Path) -> anyhow::Result<String> {
+	let mut file = BufReader::new(File::open(path).context("Failed to open file")?);
+	let mut hasher = Sha1::new();
+	std::io::copy(&mut file, &mut hasher).context("Failed to read file")?;
+	Ok(hex::encode(hasher.finalize()))
+}
+
+fn get_mtime(meta: &Metadata) -> u64 {
+	meta.modified()
+		.ok()
+		.and_then(|x| x.duration_since(UNIX_EPOCH).ok())
+		.map(|x| x.as_nanos() as u64)
+		.unwrap_or_default()
+}
+
+fn now_secs() -> u64 {
+	SystemTime::now()
+		.duration_since(UNIX_EPOCH)
+		.map(|x| x.as_secs())
+		.unwrap_or_default()
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_store_manifest_check() {
+		let dir = std::env::temp_dir().join("mcvm_test_store_manifest");
+		std::fs::create_dir_all(&dir).unwrap();
+		let file_path = dir.join("file");
+		std::fs::write(&file_path, "Hello").unwrap();
+		let hash = "f7ff9e8b7bb2e09b70935a5d785e0cc5d9d0abf0";
+
+		let mut manifest = StoreManifest::open(&dir.join("manifest.json")).unwrap();
+		assert!(manifest
+			.check_file("file", &file_path, Some(hash), true)
+			.unwrap());
+		assert!(manifest.get_entry("file").is_some());
+		assert!(manifest.is_recorded("file", Some(hash)));
+		assert!(manifest.is_recorded("file", None));
+		assert!(!manifest.is_recorded("file", Some("0000")));
+		assert!(!manifest
+			.check_file("file", &file_path, Some("0000"), true)
+			.unwrap());
+		assert!(manifest.get_entry("file").is_none());
+		assert!(!manifest
+			.check_file("missing", &dir.join("missing"), None, false)
+			.unwrap());
+
+		// Existing files aren't recorded until they are hashed
+		assert!(manifest
+			.check_file("unhashed", &file_path, Some(hash), false)
+			.unwrap());
+		assert!(manifest.get_entry("unhashed").is_none());
+		assert!(!manifest
+			.check_file("unhashed", &file_path, Some("0000"), true)
+			.unwrap());
+
+		manifest.set_index("index", "abc");
+		assert!(manifest.is_index_current("index", "abc"));
+		assert!(!manifest.is_index_current("index", "def"));
+		assert_eq!(manifest.get_extracted("index"), None);
+
+		manifest.set_extracted("native", "abc");
+		assert_eq!(manifest.get_extracted("native"), Some("abc"));
+	}
+}
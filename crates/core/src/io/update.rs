@@ -1,5 +1,8 @@
 use std::collections::HashSet;
 use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+use mcvm_net::cache::META_TTL;
 
 /// Manager for when we are updating profile files.
 /// It will keep track of files we have already downloaded, manage task requirements, etc
@@ -9,6 +12,8 @@ pub struct UpdateManager {
 	pub(crate) force: bool,
 	/// Whether we will prioritize local files instead of remote ones
 	pub(crate) allow_offline: bool,
+	/// Whether to verify the contents of stored files that have changed
+	pub(crate) verify: bool,
 	/// File paths that are added when they have been updated by other functions
 	files: HashSet<PathBuf>,
 }
@@ -19,10 +24,17 @@ impl UpdateManager {
 		Self {
 			force,
 			allow_offline,
+			verify: false,
 			files: HashSet::new(),
 		}
 	}
 
+	/// Set whether to verify the contents of stored files that have changed
+	/// since they were last recorded
+	pub fn set_verify(&mut self, verify: bool) {
+		self.verify = verify;
+	}
+
 	/// Add a single tracked file to the manager
 	pub fn add_file(&mut self, file: PathBuf) {
 		self.files.insert(file);
@@ -58,6 +70,21 @@ impl UpdateManager {
 	pub fn force_reinstall(&self) -> bool {
 		self.force
 	}
+
+	/// Gets how long cached metadata can be used without checking whether it has changed.
+	/// Forced updates always check
+	pub fn meta_ttl(&self) -> Duration {
+		if self.force {
+			Duration::ZERO
+		} else {
+			META_TTL
+		}
+	}
+
+	/// Gets whether the manager verifies the contents of stored files
+	pub fn verify_files(&self) -> bool {
+		self.verify
+	}
 }
 
 /// Struct returned by updating functions, with data like changed files
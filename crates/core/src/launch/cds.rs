@@ -0,0 +1,136 @@
+use std::path::{Path, PathBuf};
+use std::time::UNIX_EPOCH;
+
+use anyhow::Context;
+use sha1::{Digest, Sha1};
+
+use crate::io::files::{self, paths::Paths};
+use crate::io::java::JavaMajorVersion;
+
+/// The first version of Java that can create archives when the JVM exits
+const MIN_JAVA_VERSION: u16 = 13;
+
+/// Check whether class data sharing archives can be created and used with a version of Java
+pub(crate) fn is_supported(java_version: &JavaMajorVersion) -> bool {
+	java_version.0 >= MIN_JAVA_VERSION
+}
+
+/// Get the directory where the archives for the launches in a directory are stored
+pub(crate) fn get_archive_dir(paths: &Paths, launch_dir: &Path) -> PathBuf {
+	let dir_hash = hex::encode(Sha1::digest(launch_dir.to_string_lossy().as_bytes()));
+	paths.internal.join("cds").join(dir_hash)
+}
+
+/// Get the JVM arguments that either use the existing archive for a launch, or create it
+/// when the JVM exits. Archives are named after a fingerprint of the JVM, the classpath,
+/// and the mods, so an archive that no longer matches is just never used again. Those are
+/// removed whenever a new archive has to be created
+pub(crate) fn get_args(
+	archive_dir: &Path,
+	jvm_path: &Path,
+	required_files: &[PathBuf],
+	launch_dir: &Path,
+) -> anyhow::Result<CdsArgs> {
+	let fingerprint = get_fingerprint(jvm_path, required_files, launch_dir);
+	let archive_path = archive_dir.join(format!("{fingerprint}.jsa"));
+	if archive_path.exists() {
+		return Ok(CdsArgs::Use(format!(
+			"-XX:SharedArchiveFile={}",
+			archive_path.to_string_lossy()
+		)));
+	}
+
+	if archive_dir.exists() {
+		let entries = archive_dir
+			.read_dir()
+			.context("Failed to read archive directory")?;
+		for entry in entries.flatten() {
+			let _ = std::fs::remove_file(entry.path());
+		}
+	}
+	files::create_dir(archive_dir)?;
+
+	Ok(CdsArgs::Create(format!(
+		"-XX:ArchiveClassesAtExit={}",
+		archive_path.to_string_lossy()
+	)))
+}
+
+/// JVM argument for class data sharing
+pub(crate) enum CdsArgs {
+	/// Use an existing archive
+	Use(String),
+	/// Create the archive when the game exits
+	Create(String),
+}
+
+/// Get the fingerprint of everything that the classes in an archive come from
+fn get_fingerprint(jvm_path: &Path, required_files: &[PathBuf], launch_dir: &Path) -> String {
+	let mut hasher = Sha1::new();
+
+	// The path to the JVM stays the same when the JDK is updated in place, but the modules file doesn't
+	hash_file(&mut hasher, jvm_path);
+	if let Some(java_home) = jvm_path.parent().and_then(Path::parent) {
+		hash_file(&mut hasher, &java_home.join("release"));
+		hash_file(&mut hasher, &java_home.join("lib").join("modules"));
+	}
+
+	// The required files are the classpath along with some directories, which change all the time
+	for path in required_files.iter().filter(|x| !x.is_dir()) {
+		hash_file(&mut hasher, path);
+	}
+
+	// Mods aren't on the classpath, but the modloader still loads their classes into the archive
+	if let Ok(entries) = launch_dir.join("mods").read_dir() {
+		let mut mods: Vec<_> = entries.flatten().map(|x| x.path()).collect();
+		mods.sort();
+		for path in mods {
+			hash_file(&mut hasher, &path);
+		}
+	}
+
+	hex::encode(hasher.finalize())
+}
+
+/// Hash the path, size, and modification time of a file, which is enough to tell
+/// if it changed without reading the whole thing
+fn hash_file(hasher: &mut Sha1, path: &Path) {
+	hasher.update(path.to_string_lossy().as_bytes());
+	if let Ok(meta) = path.metadata() {
+		hasher.update(meta.len().to_le_bytes());
+		if let Ok(modified) = meta.modified() {
+			let modified = modified.duration_since(UNIX_EPOCH).unwrap_or_default();
+			hasher.update(modified.as_nanos().to_le_bytes());
+		}
+	}
+	// Keep the fields of different files from running together
+	hasher.update([0]);
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_fingerprint() {
+		let dir = std::env::temp_dir().join(format!("mcvm_cds_test_{}", std::process::id()));
+		let mods_dir = dir.join("mods");
+		std::fs::create_dir_all(&mods_dir).unwrap();
+		let jar = dir.join("client.jar");
+		std::fs::write(&jar, "jar").unwrap();
+
+		let required_files = vec![jar.clone(), dir.clone()];
+		let jvm_path = Path::new("/nonexistent/bin/java");
+		let first = get_fingerprint(jvm_path, &required_files, &dir);
+		assert_eq!(first, get_fingerprint(jvm_path, &required_files, &dir));
+
+		std::fs::write(mods_dir.join("mod.jar"), "mod").unwrap();
+		let with_mod = get_fingerprint(jvm_path, &required_files, &dir);
+		assert_ne!(first, with_mod);
+
+		std::fs::write(&jar, "new jar").unwrap();
+		assert_ne!(with_mod, get_fingerprint(jvm_path, &required_files, &dir));
+
+		let _ = std::fs::remove_dir_all(dir);
+	}
+}
@@ -2,13 +2,18 @@ use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
 use mcvm_shared::util::{ARCH_STRING, OS_STRING};
 use mcvm_shared::versions::VersionPattern;
 
+use std::path::Path;
+
+use crate::config::BrandingProperties;
 use crate::instance::{InstanceKind, WindowResolution};
-use crate::launch::{LaunchParameters, QuickPlayType};
+use crate::launch::{LaunchConfiguration, LaunchParameters, QuickPlayType};
 
 use crate::io::files::paths::Paths;
+use crate::io::java::classpath::Classpath;
 use crate::net::game_files::assets::get_virtual_dir_path;
 use crate::net::game_files::client_meta::args::ArgumentItem;
-use crate::user::UserKind;
+use crate::user::{UserKind, UserManager};
+use crate::util::versions::VersionName;
 
 /// Process an argument for the client from the client meta
 pub(crate) fn process_arg(arg: &ArgumentItem, params: &LaunchParameters) -> Vec<String> {
@@ -105,7 +110,7 @@ pub(crate) fn process_arg(arg: &ArgumentItem, params: &LaunchParameters) -> Vec<
 
 /// Process a simple string argument
 pub(crate) fn process_simple_arg(arg: &str, params: &LaunchParameters) -> Option<String> {
-	replace_arg_placeholders(arg, params)
+	replace_arg_placeholders(arg, &params.get_placeholder_params())
 }
 
 /// Get the string for a placeholder token in an argument
@@ -115,8 +120,43 @@ macro_rules! placeholder {
 	};
 }
 
-/// Replace placeholders in a string argument from the client meta
-pub(crate) fn replace_arg_placeholders(arg: &str, params: &LaunchParameters) -> Option<String> {
+/// The parts of the launch parameters that the placeholders in client arguments are
+/// filled in from
+pub struct ArgPlaceholderParams<'a> {
+	/// The version of the game
+	pub version: &'a VersionName,
+	/// The kind of the instance. This must be a client
+	pub side: &'a InstanceKind,
+	/// The directory that the game is launched in
+	pub launch_dir: &'a Path,
+	/// The classpath of the game
+	pub classpath: &'a Classpath,
+	/// The launch configuration of the instance
+	pub launch_config: &'a LaunchConfiguration,
+	/// The shared paths
+	pub paths: &'a Paths,
+	/// The branding of the launcher
+	pub branding: &'a BrandingProperties,
+}
+
+impl<'a> LaunchParameters<'a> {
+	/// Get the parameters for filling in argument placeholders
+	pub(crate) fn get_placeholder_params(&self) -> ArgPlaceholderParams<'a> {
+		ArgPlaceholderParams {
+			version: self.version,
+			side: self.side,
+			launch_dir: self.launch_dir,
+			classpath: self.classpath,
+			launch_config: self.launch_config,
+			paths: self.paths,
+			branding: self.branding,
+		}
+	}
+}
+
+/// Replace placeholders in a string argument from the client meta,
+/// except for the ones for the user
+pub fn replace_arg_placeholders(arg: &str, params: &ArgPlaceholderParams) -> Option<String> {
 	// Branding properties
 	let mut out = arg.replace(
 		placeholder!("launcher_name"),
@@ -193,8 +233,14 @@ pub(crate) fn replace_arg_placeholders(arg: &str, params: &LaunchParameters) ->
 		},
 	);
 
-	// User
-	match params.users.get_chosen_user() {
+	Some(out)
+}
+
+/// Replace the placeholders for the chosen user in an argument that has already had
+/// the rest of its placeholders replaced
+pub(crate) fn fill_user_placeholders(arg: &str, users: &UserManager) -> String {
+	let mut out = arg.to_string();
+	match users.get_chosen_user() {
 		Some(user) => {
 			// User type
 			let user_type = match user.get_kind() {
@@ -225,22 +271,22 @@ pub(crate) fn replace_arg_placeholders(arg: &str, params: &LaunchParameters) ->
 				|| out.contains(placeholder!("auth_uuid"))
 				|| out.contains(placeholder!("auth_xuid"))
 			{
-				return Some(String::new());
+				return String::new();
 			}
 		}
 		None => {
 			if out.contains(placeholder!("auth_player_name")) {
-				return Some("UnknownUser".into());
+				return "UnknownUser".into();
 			}
 			if out.contains(placeholder!("auth_access_token"))
 				|| out.contains(placeholder!("auth_uuid"))
 			{
-				return Some(String::new());
+				return String::new();
 			}
 		}
 	}
 
-	Some(out)
+	out
 }
 
 /// Create the additional game arguments for Quick Play
@@ -1,37 +1,27 @@
 /// Client arguments
 mod args;
 
-use anyhow::{anyhow, bail, Context};
+use anyhow::{anyhow, Context};
 
 use std::collections::HashMap;
 
+use mcvm_shared::skip_none;
 #[cfg(target_os = "linux")]
 use mcvm_shared::versions::VersionPattern;
-use mcvm_shared::{output::MCVMOutput, skip_none};
 
 pub use args::create_quick_play_args;
+pub(crate) use args::fill_user_placeholders;
+pub use args::{replace_arg_placeholders, ArgPlaceholderParams};
 
 use crate::net::game_files::client_meta::args::Arguments;
 
 use super::{process::LaunchProcessProperties, LaunchParameters};
 
-/// Create launch properties for the client
-pub(crate) async fn get_launch_props(
-	params: &mut LaunchParameters<'_>,
-	o: &mut impl MCVMOutput,
+/// Create launch properties for the client. Placeholders for the user are left in
+/// the arguments so that they can be filled in once the user is authenticated
+pub(crate) fn get_launch_props(
+	params: &LaunchParameters<'_>,
 ) -> anyhow::Result<LaunchProcessProperties> {
-	// Ensure a user is picked
-	if !params.users.is_user_chosen() {
-		bail!("No user chosen");
-	}
-
-	// Ensure the user is authenticated
-	params
-		.users
-		.authenticate(params.paths, params.req_client, o)
-		.await
-		.context("Failed to authenticate user")?;
-
 	// Build up arguments
 	let mut jvm_args = Vec::new();
 	let mut game_args = Vec::new();
@@ -72,8 +62,12 @@ pub(crate) async fn get_launch_props(
 			jvm_args.push("-cp".into());
 			jvm_args.push(params.classpath.get_str());
 
+			let placeholder_params = params.get_placeholder_params();
 			for arg in args.split(' ') {
-				game_args.push(skip_none!(args::replace_arg_placeholders(arg, params)));
+				game_args.push(skip_none!(args::replace_arg_placeholders(
+					arg,
+					&placeholder_params
+				)));
 			}
 		}
 	}
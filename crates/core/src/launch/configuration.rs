@@ -1,5 +1,7 @@
 use std::collections::HashMap;
 
+use serde::{Deserialize, Serialize};
+
 use crate::io::java::args::MemoryNum;
 use crate::io::java::install::JavaInstallationKind;
 
@@ -24,6 +26,9 @@ pub struct LaunchConfiguration {
 	pub quick_play: QuickPlayType,
 	/// Whether or not to use the Log4J configuration
 	pub use_log4j_config: bool,
+	/// Whether to create and use class data sharing archives to make the JVM start faster.
+	/// This only works on Java 13 and newer
+	pub use_cds: bool,
 }
 
 impl LaunchConfiguration {
@@ -39,6 +44,7 @@ impl LaunchConfiguration {
 			wrappers: Vec::new(),
 			quick_play: QuickPlayType::None,
 			use_log4j_config: false,
+			use_cds: false,
 		}
 	}
 
@@ -125,6 +131,12 @@ impl LaunchConfigBuilder {
 		self.config.use_log4j_config = use_log4j_config;
 		self
 	}
+
+	/// Set whether to use class data sharing archives
+	pub fn use_cds(mut self, use_cds: bool) -> Self {
+		self.config.use_cds = use_cds;
+		self
+	}
 }
 
 impl Default for LaunchConfigBuilder {
@@ -136,7 +148,7 @@ impl Default for LaunchConfigBuilder {
 /// A wrapper command that can be used to
 /// enclose the normal launch command in another
 /// program.
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct WrapperCommand {
 	/// The command to run
 	pub cmd: String,
@@ -1,7 +1,11 @@
+/// Class data sharing archives for faster JVM startup
+mod cds;
 /// Client-specific launch functionality
 mod client;
 /// Configuration for launch settings
 mod configuration;
+/// Saved, fully resolved launches
+mod plan;
 /// Actual launching of the game process
 mod process;
 /// Server-specific launch functionality
@@ -10,11 +14,11 @@ mod server;
 use std::path::Path;
 
 use anyhow::Context;
-use mcvm_shared::output::MCVMOutput;
+use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::translate;
 use mcvm_shared::Side;
 
 use self::client::create_quick_play_args;
-use self::process::{launch_game_process, LaunchGameProcessParameters};
 use crate::config::BrandingProperties;
 use crate::instance::InstanceKind;
 use crate::io::files::paths::Paths;
@@ -26,47 +30,71 @@ use crate::net::game_files::version_manifest::VersionManifestAndList;
 use crate::user::UserManager;
 use crate::util::versions::VersionName;
 
+pub use self::client::{replace_arg_placeholders, ArgPlaceholderParams};
 pub use self::configuration::{
 	LaunchConfigBuilder, LaunchConfiguration, QuickPlayType, WrapperCommand,
 };
 
+pub use self::plan::LaunchPlan;
 pub use self::process::launch_process;
 pub use self::process::{LaunchProcessParameters, LaunchProcessProperties};
 
-pub(crate) async fn launch(
-	mut params: LaunchParameters<'_>,
+/// Resolve everything needed to launch the game into a plan
+pub(crate) fn create_plan(
+	params: LaunchParameters<'_>,
 	o: &mut impl MCVMOutput,
-) -> anyhow::Result<InstanceHandle> {
-	let command = params.java.get_jvm_path();
+) -> anyhow::Result<LaunchPlan> {
+	let side = params.side.get_side();
 	// Get side-specific launch properties
-	let props = match params.side.get_side() {
-		Side::Client => self::client::get_launch_props(&mut params, o).await,
+	let props = match side {
+		Side::Client => self::client::get_launch_props(&params),
 		Side::Server => self::server::get_launch_props(&params),
 	}
 	.context("Failed to generate side-specific launch properties")?;
 
-	let user_access_token = params
-		.users
-		.get_chosen_user()
-		.and_then(|x| x.get_access_token());
-
-	let proc_params = LaunchGameProcessParameters {
-		command: command.as_os_str(),
-		cwd: params.launch_dir,
-		main_class: Some(params.main_class),
-		props,
-		launch_config: params.launch_config,
-		version: params.version,
-		version_list: &params.version_manifest.list,
-		side: params.side,
-		user_access_token,
-		censor_secrets: params.censor_secrets,
+	let base_game_args = params.launch_config.generate_game_args(
+		params.version,
+		&params.version_manifest.list,
+		side,
+		o,
+	);
+
+	let mut env = params.launch_config.env.clone();
+	env.extend(props.additional_env_vars);
+
+	let mut required_files = params.classpath.get_paths();
+	required_files.push(params.launch_dir.to_owned());
+
+	let cds_archive_dir = if params.launch_config.use_cds {
+		if cds::is_supported(params.java.get_major_version()) {
+			Some(cds::get_archive_dir(params.paths, params.launch_dir))
+		} else {
+			o.display(
+				MessageContents::Warning(translate!(o, CdsUnsupported)),
+				MessageLevel::Important,
+			);
+			None
+		}
+	} else {
+		None
 	};
 
-	let child = launch_game_process(proc_params, o).context("Failed to launch game process")?;
-
-	let handle = InstanceHandle::new(child);
-	Ok(handle)
+	Ok(LaunchPlan {
+		side,
+		command: params.java.get_jvm_path(),
+		cwd: params.launch_dir.to_owned(),
+		wrappers: params.launch_config.wrappers.clone(),
+		env,
+		base_jvm_args: params.launch_config.generate_jvm_args(),
+		jvm_args: props.jvm_args,
+		main_class: Some(params.main_class.to_string()),
+		base_game_args,
+		game_args: props.game_args,
+		demo_user: self::plan::is_demo_user(params.users),
+		censor_secrets: params.censor_secrets,
+		required_files,
+		cds_archive_dir,
+	})
 }
 
 /// Container struct for parameters for launching an instance
@@ -80,9 +108,8 @@ pub(crate) struct LaunchParameters<'a> {
 	pub main_class: &'a str,
 	pub launch_config: &'a LaunchConfiguration,
 	pub paths: &'a Paths,
-	pub req_client: &'a reqwest::Client,
 	pub client_meta: &'a ClientMeta,
-	pub users: &'a mut UserManager,
+	pub users: &'a UserManager,
 	pub censor_secrets: bool,
 	pub branding: &'a BrandingProperties,
 }
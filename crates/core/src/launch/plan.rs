@@ -0,0 +1,154 @@
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::process::Command;
+
+use anyhow::{bail, Context};
+use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::translate;
+use mcvm_shared::Side;
+use serde::{Deserialize, Serialize};
+
+use crate::io::files::paths::Paths;
+use crate::user::{UserKind, UserManager};
+use crate::WrapperCommand;
+
+use super::cds::{self, CdsArgs};
+use super::client::fill_user_placeholders;
+use super::process::{create_wrapped_command, output_launch_command};
+use super::InstanceHandle;
+
+/// A fully resolved launch of an instance. It has everything needed to start the game
+/// process, so it can be saved and used to launch the instance again without resolving
+/// the game files, Java installation, and arguments again. Arguments from the game still
+/// contain the placeholders for the user, which are filled in every time the plan is launched
+#[derive(Serialize, Deserialize, Debug, Clone)]
+pub struct LaunchPlan {
+	/// The side of the instance
+	pub side: Side,
+	/// The base command to run, usually the path to the JVM
+	pub command: PathBuf,
+	/// The working directory of the process
+	pub cwd: PathBuf,
+	/// Wrappers around the command
+	pub wrappers: Vec<WrapperCommand>,
+	/// Environment variables for the process
+	pub env: HashMap<String, String>,
+	/// JVM arguments from the launch configuration
+	pub base_jvm_args: Vec<String>,
+	/// JVM arguments from the game
+	pub jvm_args: Vec<String>,
+	/// The Java main class to run
+	pub main_class: Option<String>,
+	/// Game arguments from the launch configuration
+	pub base_game_args: Vec<String>,
+	/// Game arguments from the game
+	pub game_args: Vec<String>,
+	/// Whether the plan was created for a demo user. Some arguments are only used for demo users
+	pub demo_user: bool,
+	/// Whether to censor user credentials when outputting the launch command
+	pub censor_secrets: bool,
+	/// Files that have to exist for the plan to still be usable, like the classpath
+	pub required_files: Vec<PathBuf>,
+	/// The directory to store class data sharing archives for the launch in, if they are used
+	#[serde(default)]
+	pub cds_archive_dir: Option<PathBuf>,
+}
+
+impl LaunchPlan {
+	/// Check whether this plan can still be used to launch with the given users.
+	/// The plan should be created again if it can't
+	pub fn is_usable(&self, users: &UserManager) -> bool {
+		is_demo_user(users) == self.demo_user
+			&& self.command.exists()
+			&& self.required_files.iter().all(|x| x.exists())
+	}
+
+	/// Launch the game process from this plan, authenticating the chosen user if needed
+	pub async fn launch(
+		&self,
+		users: &mut UserManager,
+		paths: &Paths,
+		req_client: &reqwest::Client,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<InstanceHandle> {
+		let (jvm_args, game_args) = if let Side::Client = self.side {
+			if !users.is_user_chosen() {
+				bail!("No user chosen");
+			}
+
+			users
+				.authenticate(paths, req_client, o)
+				.await
+				.context("Failed to authenticate user")?;
+
+			let fill = |args: &[String]| -> Vec<String> {
+				args.iter()
+					.map(|x| fill_user_placeholders(x, users))
+					.collect()
+			};
+			(fill(&self.jvm_args), fill(&self.game_args))
+		} else {
+			(self.jvm_args.clone(), self.game_args.clone())
+		};
+
+		let mut cmd = create_wrapped_command(self.command.as_os_str(), &self.wrappers);
+		cmd.current_dir(&self.cwd);
+		cmd.envs(&self.env);
+		cmd.args(&self.base_jvm_args);
+		if let Some(archive_dir) = &self.cds_archive_dir {
+			self.add_cds_args(&mut cmd, archive_dir, o);
+		}
+		cmd.args(jvm_args);
+		if let Some(main_class) = &self.main_class {
+			cmd.arg(main_class);
+		}
+		cmd.args(&self.base_game_args);
+		cmd.args(game_args);
+
+		o.display(
+			MessageContents::Success(translate!(o, Launch)),
+			MessageLevel::Important,
+		);
+
+		let access_token = users.get_chosen_user().and_then(|x| x.get_access_token());
+		output_launch_command(&cmd, access_token, self.censor_secrets, o)?;
+
+		let child = cmd.spawn().context("Failed to spawn child process")?;
+
+		Ok(InstanceHandle::new(child))
+	}
+}
+
+impl LaunchPlan {
+	/// Add the arguments to use or create the class data sharing archive. Launching
+	/// without an archive still works, so failing to set it up is only a warning
+	fn add_cds_args(&self, cmd: &mut Command, archive_dir: &Path, o: &mut impl MCVMOutput) {
+		match cds::get_args(archive_dir, &self.command, &self.required_files, &self.cwd) {
+			Ok(CdsArgs::Use(arg)) => {
+				cmd.arg(arg);
+			}
+			Ok(CdsArgs::Create(arg)) => {
+				o.display(
+					MessageContents::Simple(translate!(o, CreatingCdsArchive)),
+					MessageLevel::Debug,
+				);
+				cmd.arg(arg);
+			}
+			Err(e) => o.display(
+				MessageContents::Warning(translate!(
+					o,
+					CdsSetupFailed,
+					"error" = &format!("{e:?}")
+				)),
+				MessageLevel::Important,
+			),
+		}
+	}
+}
+
+/// Check whether the chosen user is a demo user
+pub(crate) fn is_demo_user(users: &UserManager) -> bool {
+	users
+		.get_chosen_user()
+		.is_some_and(|x| matches!(x.kind, UserKind::Demo))
+}
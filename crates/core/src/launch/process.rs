@@ -6,57 +6,11 @@ use std::process::{Child, Command};
 use anyhow::Context;
 use mcvm_auth::mc::AccessToken;
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
-use mcvm_shared::translate;
 
-use crate::instance::InstanceKind;
-use crate::util::versions::VersionName;
 use crate::WrapperCommand;
 
 use super::LaunchConfiguration;
 
-/// Launch the game process
-pub(crate) fn launch_game_process(
-	mut params: LaunchGameProcessParameters<'_>,
-	o: &mut impl MCVMOutput,
-) -> anyhow::Result<std::process::Child> {
-	// Modify the parameters based on game-specific properties
-
-	// Prepend generated game args to the beginning
-	let previous_game_args = params.props.game_args.clone();
-	params.props.game_args = params.launch_config.generate_game_args(
-		params.version,
-		params.version_list,
-		params.side.get_side(),
-		o,
-	);
-	params.props.game_args.extend(previous_game_args);
-
-	// Create the parameters for the process
-	let proc_params = LaunchProcessParameters {
-		command: params.command,
-		cwd: params.cwd,
-		main_class: params.main_class,
-		props: params.props,
-		launch_config: params.launch_config,
-	};
-
-	o.display(
-		MessageContents::Success(translate!(o, Launch)),
-		MessageLevel::Important,
-	);
-
-	// Get the command and output it
-	let mut cmd = get_process_launch_command(proc_params)
-		.context("Failed to create process launch command")?;
-
-	output_launch_command(&cmd, params.user_access_token, params.censor_secrets, o)?;
-
-	// Spawn
-	let child = cmd.spawn().context("Failed to spawn child process")?;
-
-	Ok(child)
-}
-
 /// Launch a generic process with the core's config system
 pub fn launch_process(params: LaunchProcessParameters<'_>) -> anyhow::Result<Child> {
 	let mut cmd =
@@ -88,7 +42,7 @@ pub fn get_process_launch_command(params: LaunchProcessParameters<'_>) -> anyhow
 
 /// Display the launch command in our own way,
 /// censoring any credentials if needed
-fn output_launch_command(
+pub(crate) fn output_launch_command(
 	command: &Command,
 	access_token: Option<&AccessToken>,
 	censor_secrets: bool,
@@ -156,7 +110,7 @@ fn output_launch_command(
 }
 
 /// Creates a command wrapped in multiple other wrappers
-fn create_wrapped_command(command: &OsStr, wrappers: &[WrapperCommand]) -> Command {
+pub(crate) fn create_wrapped_command(command: &OsStr, wrappers: &[WrapperCommand]) -> Command {
 	let mut cmd = Command::new(command);
 	for wrapper in wrappers {
 		cmd = wrap_single(cmd, wrapper);
@@ -173,23 +127,6 @@ fn wrap_single(command: Command, wrapper: &WrapperCommand) -> Command {
 	new_cmd
 }
 
-/// Container struct for parameters for launching the game process
-pub(crate) struct LaunchGameProcessParameters<'a> {
-	/// The base command to run, usually the path to the JVM
-	pub command: &'a OsStr,
-	/// The current working directory, usually the instance dir
-	pub cwd: &'a Path,
-	/// The Java main class to run
-	pub main_class: Option<&'a str>,
-	pub props: LaunchProcessProperties,
-	pub launch_config: &'a LaunchConfiguration,
-	pub version: &'a VersionName,
-	pub version_list: &'a [String],
-	pub side: &'a InstanceKind,
-	pub user_access_token: Option<&'a AccessToken>,
-	pub censor_secrets: bool,
-}
-
 /// Container struct for parameters for launching a generic Java process
 pub struct LaunchProcessParameters<'a> {
 	/// The base command to run, usually the path to the JVM
@@ -33,7 +33,10 @@ use io::java::JavaMajorVersion;
 use io::{persistent::PersistentData, update::UpdateManager};
 use mcvm_shared::output::{self, MCVMOutput};
 use mcvm_shared::versions::VersionInfo;
-use net::game_files::version_manifest::{make_version_list, VersionEntry, VersionManifestAndList};
+use net::download::DownloadPriority;
+use net::game_files::version_manifest::{
+	self, make_version_list, VersionEntry, VersionManifestAndList,
+};
 use user::UserManager;
 use util::versions::MinecraftVersion;
 use version::{
@@ -72,11 +75,13 @@ impl MCVMCore {
 	pub fn with_config_and_paths(config: Configuration, paths: Paths) -> anyhow::Result<Self> {
 		let persistent =
 			PersistentData::open(&paths).context("Failed to open persistent data file")?;
+		let mut update_manager = UpdateManager::new(config.force_reinstall, config.allow_offline);
+		update_manager.set_verify(config.verify_files);
 		let out = Self {
 			paths,
-			req_client: reqwest::Client::new(),
+			req_client: net::download::new_client()?,
 			persistent,
-			update_manager: UpdateManager::new(config.force_reinstall, config.allow_offline),
+			update_manager,
 			versions: VersionRegistry::new(),
 			users: UserManager::new(config.ms_client_id.clone()),
 			config,
@@ -132,10 +137,29 @@ impl MCVMCore {
 			paths: &self.paths,
 			update_manager: &self.update_manager,
 			req_client: &self.req_client,
+			priority: DownloadPriority::High,
+			keep_installed: false,
 		};
 		self.versions.load_version_manifest(params, o).await
 	}
 
+	/// Start checking the version manifest for changes in the background, so that it is ready
+	/// by the time it is needed. Errors are ignored, since they will come up again once
+	/// the manifest is actually loaded. Nothing is started for forced updates, since they
+	/// download the manifest again when it is loaded anyways
+	pub fn prefetch_version_manifest(&self) -> Option<tokio::task::JoinHandle<()>> {
+		if self.update_manager.force_reinstall() {
+			return None;
+		}
+		let paths = self.paths.clone();
+		let client = self.req_client.clone();
+		let allow_offline = self.update_manager.allow_offline;
+		let ttl = self.update_manager.meta_ttl();
+		Some(tokio::spawn(async move {
+			let _ = version_manifest::refresh(&paths, allow_offline, ttl, &client).await;
+		}))
+	}
+
 	/// Load or install a version of the game
 	pub async fn get_version(
 		&mut self,
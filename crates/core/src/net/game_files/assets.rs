@@ -1,35 +1,47 @@
 use std::collections::HashMap;
 use std::path::{Path, PathBuf};
-use std::sync::Arc;
 
 use anyhow::Context;
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::timing::{self, SpanCategory};
 use mcvm_shared::translate;
 use mcvm_shared::versions::VersionPattern;
 use reqwest::Client;
-use serde::{Deserialize, Serialize};
-use tokio::{sync::Semaphore, task::JoinSet};
+use serde::de::Visitor;
+use serde::{Deserialize, Deserializer};
+use tokio::task::JoinSet;
 
 use crate::io::files::{self, paths::Paths};
+use crate::io::json_to_file;
+use crate::io::store_manifest::StoreManifest;
 use crate::io::update::{UpdateManager, UpdateMethodResult};
-use crate::io::{json_from_file, json_to_file};
-use crate::net::download::{self, get_transfer_limit};
+use crate::net::download::{self, DownloadPriority, ExpectedHashes};
 use crate::util::versions::VersionName;
 
 use super::client_meta::ClientMeta;
 
-/// Structure for the assets index
-#[derive(Deserialize, Serialize)]
-pub struct AssetIndex {
+/// Structure for the assets index. The asset names are borrowed from the buffer
+/// that the index was parsed from
+#[derive(Deserialize)]
+pub struct AssetIndex<'a> {
 	/// The map of asset resource locations to index entries
-	pub objects: HashMap<String, IndexEntry>,
+	#[serde(borrow)]
+	pub objects: HashMap<&'a str, IndexEntry>,
+}
+
+impl<'a> AssetIndex<'a> {
+	/// Parse an asset index without copying the asset names out of the buffer.
+	/// The contents of the buffer are changed while parsing
+	pub fn parse(bytes: &'a mut [u8]) -> anyhow::Result<Self> {
+		simd_json::from_slice(bytes).context("Failed to parse asset index")
+	}
 }
 
 /// A single asset in the index
-#[derive(Deserialize, Serialize)]
+#[derive(Deserialize)]
 pub struct IndexEntry {
 	/// The hash of the index file
-	pub hash: String,
+	pub hash: Sha1Hash,
 	/// The size of the asset in bytes
 	pub size: usize,
 }
@@ -38,7 +50,43 @@ impl IndexEntry {
 	/// Get the hash path for this asset, which is used for the relative location on the filesystem
 	/// and the remote server where they are downloaded
 	pub fn get_hash_path(&self) -> String {
-		format!("{}/{}", &self.hash[..2], self.hash)
+		let mut buf = [0; 40];
+		let hash = self.hash.to_hex(&mut buf);
+		format!("{}/{hash}", &hash[..2])
+	}
+}
+
+/// A SHA-1 hash that is stored as bytes instead of as a hex string
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct Sha1Hash(pub [u8; 20]);
+
+impl Sha1Hash {
+	/// Write the hex string of this hash into a buffer and get it, without allocating
+	pub fn to_hex<'b>(&self, buf: &'b mut [u8; 40]) -> &'b str {
+		hex::encode_to_slice(self.0, buf).expect("Buffer should have the right length");
+		std::str::from_utf8(buf).expect("Hex should always be valid UTF-8")
+	}
+}
+
+impl<'de> Deserialize<'de> for Sha1Hash {
+	fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+		struct HashVisitor;
+
+		impl<'de> Visitor<'de> for HashVisitor {
+			type Value = Sha1Hash;
+
+			fn expecting(&self, formatter: &mut std::fmt::Formatter) -> std::fmt::Result {
+				formatter.write_str("a hex SHA-1 hash")
+			}
+
+			fn visit_str<E: serde::de::Error>(self, value: &str) -> Result<Self::Value, E> {
+				let mut out = [0; 20];
+				hex::decode_to_slice(value, &mut out).map_err(E::custom)?;
+				Ok(Sha1Hash(out))
+			}
+		}
+
+		deserializer.deserialize_str(HashVisitor)
 	}
 }
 
@@ -52,19 +100,47 @@ pub async fn get(
 	client: &Client,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<UpdateMethodResult> {
+	let _span = timing::span(SpanCategory::Phase, "assets");
 	let mut out = UpdateMethodResult::new();
 	let version_string = version.to_string();
 	let indexes_dir = paths.assets.join("indexes");
 	files::create_dir(&indexes_dir)?;
 
-	let index_path = indexes_dir.join(version_string + ".json");
+	let index_path = indexes_dir.join(format!("{version_string}.json"));
 	let index_url = &client_meta.asset_index.url;
 
 	let (objects_dir, virtual_dir) = create_dirs(paths, version, version_list)
 		.await
 		.context("Failed to create directories for assets")?;
 
-	let index = match download_index(index_url, &index_path, manager, client, false).await {
+	let mut manifest = StoreManifest::open(&get_manifest_path(paths))
+		.context("Failed to open assets store manifest")?;
+
+	// If we have already installed every object from this exact index, there is nothing to check
+	let index_hash = client_meta.asset_index.sha1.as_deref();
+	if let Some(index_hash) = index_hash {
+		if !manager.force
+			&& !manager.verify
+			&& index_path.exists()
+			&& manifest.is_index_current(&version_string, index_hash)
+		{
+			return Ok(out);
+		}
+	}
+
+	// A second buffer is used if the index has to be downloaded again, since the first one
+	// is still borrowed by the failed attempt
+	let (mut index_bytes, download_error) =
+		match download_index(index_url, &index_path, manager, client, false).await {
+			Ok(bytes) => (bytes, None),
+			Err(e) => (Vec::new(), Some(e)),
+		};
+	let mut redownloaded_bytes;
+	let index_result = match download_error {
+		Some(e) => Err(e.context("Failed to download asset index")),
+		None => AssetIndex::parse(&mut index_bytes).context("Failed to parse asset index"),
+	};
+	let index = match index_result {
 		Ok(val) => val,
 		Err(err) => {
 			o.display(
@@ -72,57 +148,33 @@ pub async fn get(
 				MessageLevel::Important,
 			);
 			o.display(
-				MessageContents::Error(format!("{}", err)),
+				MessageContents::Error(format!("{err:?}")),
 				MessageLevel::Important,
 			);
 			o.display(
 				MessageContents::StartProcess(translate!(o, Redownloading)),
 				MessageLevel::Important,
 			);
-			download_index(index_url, &index_path, manager, client, true)
+			redownloaded_bytes = download_index(index_url, &index_path, manager, client, true)
 				.await
-				.context("Failed to obtain asset index")?
+				.context("Failed to obtain asset index")?;
+			AssetIndex::parse(&mut redownloaded_bytes)?
 		}
 	};
 
-	struct AssetData {
-		name: String,
-		url: String,
-		path: PathBuf,
-		virtual_path: Option<PathBuf>,
-		size: usize,
-	}
-
-	let mut assets_to_download = Vec::new();
-	for (name, asset) in index.objects {
-		let hash_path = asset.get_hash_path();
-		let url = format!("https://resources.download.minecraft.net/{hash_path}");
-
-		let path = objects_dir.join(&hash_path);
-		let virtual_path = virtual_dir.as_ref().map(|x| x.join(&hash_path));
-		if !manager.should_update_file(&path) {
-			if let Some(virtual_path) = &virtual_path {
-				if !manager.should_update_file(virtual_path) {
-					continue;
-				}
-			} else {
-				continue;
-			}
-		}
-
-		out.files_updated.insert(path.clone());
-		files::create_leading_dirs(&path)?;
-		if let Some(virtual_path) = &virtual_path {
+	let mut assets_to_download = get_missing_assets(
+		&index,
+		&objects_dir,
+		virtual_dir.as_deref(),
+		&mut manifest,
+		manager,
+	)?;
+	for asset in &assets_to_download {
+		out.files_updated.insert(asset.path.clone());
+		files::create_leading_dirs(&asset.path)?;
+		if let Some(virtual_path) = &asset.virtual_path {
 			files::create_leading_dirs(virtual_path)?;
 		}
-		let data = AssetData {
-			name,
-			url,
-			path,
-			virtual_path,
-			size: asset.size,
-		};
-		assets_to_download.push(data);
 	}
 	// Sort downloads by biggest first
 	assets_to_download.sort_by_key(|x| std::cmp::Reverse(x.size));
@@ -142,35 +194,38 @@ pub async fn get(
 	}
 
 	let mut join = JoinSet::new();
-	// Used to limit the number of open file descriptors
-	let sem = Arc::new(Semaphore::new(get_transfer_limit()));
 	for asset in assets_to_download {
 		let client = client.clone();
-		let sem = sem.clone();
 		let fut = async move {
-			let _permit = sem.acquire().await;
-			let response = download::bytes(asset.url, &client)
-				.await
-				.context("Failed to download asset")?;
-
+			// Sounds make up most of the assets but are the least important to have right away
+			let priority = if asset.name.starts_with("minecraft/sounds/") {
+				DownloadPriority::Low
+			} else {
+				DownloadPriority::Normal
+			};
 			// Write JSON as minified to save storage space
 			if asset.name.ends_with(".json") {
+				let response = download::bytes_with_priority(&asset.url, &client, priority)
+					.await
+					.context("Failed to download asset")?;
 				let json: serde_json::Value = serde_json::from_slice(&response)
 					.context("Failed to deserialize JSON of asset")?;
 				json_to_file(&asset.path, &json)
 					.context("Failed to write minified JSON asset to file")?;
 			} else {
-				tokio::fs::write(&asset.path, response)
+				let hashes = ExpectedHashes::sha1(Some(asset.hash.clone()));
+				download::file_verified(&asset.url, &asset.path, &client, priority, &hashes)
 					.await
-					.context("Failed to write asset to file")?;
+					.context("Failed to download asset")?;
 			}
 
-			if let Some(virtual_path) = asset.virtual_path {
-				files::update_hardlink_async(&asset.path, &virtual_path)
+			if let Some(virtual_path) = &asset.virtual_path {
+				files::update_hardlink_async(&asset.path, virtual_path)
 					.await
 					.context("Failed to hardlink virtual asset")?;
 			}
-			Ok::<String, anyhow::Error>(asset.name)
+
+			Ok::<AssetDownload, anyhow::Error>(asset)
 		};
 		join.spawn(fut);
 	}
@@ -189,7 +244,14 @@ pub async fn get(
 	}
 	let mut num_done = 0;
 	while let Some(asset) = join.join_next().await {
-		let name = asset??;
+		let asset = asset??;
+		manifest
+			.record_file(
+				&asset.hash,
+				&asset.path,
+				get_comparable_hash(&asset.name, &asset.hash),
+			)
+			.context("Failed to record downloaded asset")?;
 		num_done += 1;
 		o.display(
 			MessageContents::Associated(
@@ -200,13 +262,20 @@ pub async fn get(
 				Box::new(MessageContents::Simple(translate!(
 					o,
 					DownloadedAsset,
-					"asset" = &name
+					"asset" = &asset.name
 				))),
 			),
 			MessageLevel::Important,
 		);
 	}
 
+	if let Some(index_hash) = index_hash {
+		manifest.set_index(&version_string, index_hash);
+	}
+	manifest
+		.write()
+		.context("Failed to write assets store manifest")?;
+
 	o.display(
 		MessageContents::Success(translate!(o, FinishDownloadingAssets)),
 		MessageLevel::Important,
@@ -216,22 +285,104 @@ pub async fn get(
 	Ok(out)
 }
 
-/// Downloads the asset index which contains all of the assets that need to be downloaded
+/// An asset that has to be downloaded
+pub struct AssetDownload {
+	/// The resource location of the asset
+	pub name: String,
+	/// The SHA-1 hash of the asset
+	pub hash: String,
+	/// The URL to download the asset from
+	pub url: String,
+	/// The path to the asset in the objects directory
+	pub path: PathBuf,
+	/// The path to the asset in the virtual directory, for old versions that use it
+	pub virtual_path: Option<PathBuf>,
+	/// The size of the asset in bytes
+	pub size: usize,
+}
+
+/// Compare an asset index against the assets store and get the assets that are missing or
+/// invalid. This does not create any directories. Nothing is allocated for assets that
+/// are already recorded in the store manifest
+pub fn get_missing_assets(
+	index: &AssetIndex,
+	objects_dir: &Path,
+	virtual_dir: Option<&Path>,
+	manifest: &mut StoreManifest,
+	manager: &UpdateManager,
+) -> anyhow::Result<Vec<AssetDownload>> {
+	// Without a virtual directory, recorded objects don't need their paths to be checked at all
+	let trust_manifest = !manager.force && !manager.verify && virtual_dir.is_none();
+
+	let mut out = Vec::new();
+	for (name, asset) in &index.objects {
+		let mut hash_buf = [0; 40];
+		let hash = asset.hash.to_hex(&mut hash_buf);
+		let comparable_hash = get_comparable_hash(name, hash);
+		if trust_manifest && manifest.is_recorded(hash, comparable_hash) {
+			continue;
+		}
+
+		let hash_path = asset.get_hash_path();
+		let path = objects_dir.join(&hash_path);
+		let virtual_path = virtual_dir.map(|x| x.join(&hash_path));
+
+		let object_valid = if manager.force {
+			!manager.should_update_file(&path)
+		} else {
+			manifest
+				.check_file(hash, &path, comparable_hash, manager.verify)
+				.with_context(|| format!("Failed to check asset {name}"))?
+		};
+		let virtual_valid = virtual_path
+			.as_ref()
+			.map(|x| !manager.should_update_file(x))
+			.unwrap_or(true);
+		if object_valid && virtual_valid {
+			continue;
+		}
+
+		out.push(AssetDownload {
+			url: format!("https://resources.download.minecraft.net/{hash_path}"),
+			name: name.to_string(),
+			hash: hash.to_string(),
+			path,
+			virtual_path,
+			size: asset.size,
+		});
+	}
+
+	Ok(out)
+}
+
+/// Get the hash that the stored file for an asset can be compared against.
+/// JSON assets are minified when they are stored, so their hashes will not match.
+fn get_comparable_hash<'a>(name: &str, hash: &'a str) -> Option<&'a str> {
+	if name.ends_with(".json") {
+		None
+	} else {
+		Some(hash)
+	}
+}
+
+/// Downloads the asset index which contains all of the assets that need to be downloaded,
+/// returning its contents so that they can be parsed in place
 async fn download_index(
 	url: &str,
 	path: &Path,
 	manager: &UpdateManager,
 	client: &Client,
 	force: bool,
-) -> anyhow::Result<AssetIndex> {
+) -> anyhow::Result<Vec<u8>> {
 	let index = if manager.allow_offline && !force && path.exists() {
-		json_from_file(path).context("Failed to read asset index contents from file")?
+		std::fs::read(path).context("Failed to read asset index contents from file")?
 	} else {
-		let index = download::json(url, client)
+		let index = download::bytes(url, client)
 			.await
-			.context("Failed to download asset index")?;
+			.context("Failed to download asset index")?
+			.to_vec();
 
-		json_to_file(path, &index).context("Failed to serialize asset index to a file")?;
+		std::fs::write(path, &index).context("Failed to write asset index to a file")?;
 
 		index
 	};
@@ -257,7 +408,37 @@ async fn create_dirs(
 	Ok((objects_dir, virtual_dir))
 }
 
+/// Get the path to the manifest for the assets store
+pub fn get_manifest_path(paths: &Paths) -> PathBuf {
+	paths.assets.join("manifest.json")
+}
+
 /// Get the virtual assets directory path
 pub fn get_virtual_dir_path(paths: &Paths) -> PathBuf {
 	paths.assets.join("virtual").join("legacy")
 }
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_parse_index() {
+		let mut bytes = br#"{"objects": {
+			"minecraft/lang/en_us.json": {"hash": "f7ff9e8b7bb2e09b70935a5d785e0cc5d9d0abf0", "size": 5},
+			"minecraft/sounds/\u0061mbient.ogg": {"hash": "0a4d55a8d778e5022fab701977c5d840bbc486d0", "size": 12}
+		}}"#
+		.to_vec();
+		let index = AssetIndex::parse(&mut bytes).unwrap();
+		assert_eq!(index.objects.len(), 2);
+
+		let entry = &index.objects["minecraft/lang/en_us.json"];
+		assert_eq!(entry.size, 5);
+		assert_eq!(
+			entry.get_hash_path(),
+			"f7/f7ff9e8b7bb2e09b70935a5d785e0cc5d9d0abf0"
+		);
+		// Escaped names are unescaped in place
+		assert!(index.objects.contains_key("minecraft/sounds/ambient.ogg"));
+	}
+}
@@ -12,7 +12,7 @@ use crate::io::files::{self, paths::Paths};
 use crate::io::java::JavaMajorVersion;
 use crate::io::json_from_file;
 use crate::io::update::UpdateManager;
-use crate::net::download::ProgressiveDownload;
+use crate::net::cache::{self, CacheLookup};
 
 use super::version_manifest::VersionManifest;
 
@@ -49,6 +49,9 @@ pub struct ClientMeta {
 pub struct AssetIndexInfo {
 	/// The URL to the assets index for this version
 	pub url: String,
+	/// The SHA-1 hash of the assets index
+	#[serde(default)]
+	pub sha1: Option<String>,
 }
 
 /// Download information for different files
@@ -65,6 +68,9 @@ pub struct Downloads {
 pub struct DownloadInfo {
 	/// The URL to the file
 	pub url: String,
+	/// The SHA-1 hash of the file
+	#[serde(default)]
+	pub sha1: Option<String>,
 }
 
 /// Information about Java for this version
@@ -180,6 +186,9 @@ pub mod libraries {
 		pub path: String,
 		/// URL to download the artifact from
 		pub url: String,
+		/// The SHA-1 hash of the artifact
+		#[serde(default)]
+		pub sha1: Option<String>,
 	}
 
 	/// Extraction rules for a library
@@ -339,59 +348,63 @@ pub async fn get(
 	files::create_dir(&version_dir).context("Failed to create versions directory")?;
 	let path = version_dir.join(client_meta_name);
 
-	let meta = if manager.allow_offline && path.exists() {
-		json_from_file(path).context("Failed to read client meta contents from file")?
-	} else {
-		let mut download = ProgressiveDownload::bytes(&entry.url, client).await?;
-
-		while !download.is_finished() {
-			download.poll_download().await?;
-			o.display(
-				MessageContents::Associated(
-					Box::new(download.get_progress()),
-					Box::new(MessageContents::Simple(translate!(
-						o,
-						DownloadingClientMeta
-					))),
-				),
-				MessageLevel::Important,
-			);
+	if manager.allow_offline && path.exists() {
+		return json_from_file(path).context("Failed to read client meta contents from file");
+	}
+
+	let lookup = cache::lookup(&entry.url, &path, manager.meta_ttl(), client).await?;
+	let (mut download, info) = match lookup {
+		CacheLookup::Cached => {
+			return json_from_file(path).context("Failed to read client meta contents from file")
 		}
-		let mut bytes = download.finish();
-
-		// Unzip if we need to
-		if entry.is_zipped {
-			let mut zip =
-				ZipArchive::new(Cursor::new(&bytes)).context("Failed to open zip archive")?;
-			if !zip.is_empty() {
-				let mut out = None;
-				for i in 0..zip.len() {
-					let mut file = zip.by_index(i).expect("Index should exist");
-					if file.is_file() {
-						let mut buf = Vec::with_capacity(
-							file.size().try_into().expect("Stop using 32 pointer width"),
-						);
-						file.read_to_end(&mut buf)
-							.context("Failed to read zip file")?;
-						out = Some(buf);
-					}
-				}
-				if let Some(out) = out {
-					bytes = out;
-				} else {
-					bail!("No files found for use in zip file");
+		CacheLookup::Modified(download, info) => (download, info),
+	};
+
+	while !download.is_finished() {
+		download.poll_download().await?;
+		o.display(
+			MessageContents::Associated(
+				Box::new(download.get_progress()),
+				Box::new(MessageContents::Simple(translate!(
+					o,
+					DownloadingClientMeta
+				))),
+			),
+			MessageLevel::Important,
+		);
+	}
+	let mut bytes = download.finish();
+
+	// Unzip if we need to
+	if entry.is_zipped {
+		let mut zip = ZipArchive::new(Cursor::new(&bytes)).context("Failed to open zip archive")?;
+		if !zip.is_empty() {
+			let mut out = None;
+			for i in 0..zip.len() {
+				let mut file = zip.by_index(i).expect("Index should exist");
+				if file.is_file() {
+					let mut buf = Vec::with_capacity(
+						file.size().try_into().expect("Stop using 32 pointer width"),
+					);
+					file.read_to_end(&mut buf)
+						.context("Failed to read zip file")?;
+					out = Some(buf);
 				}
+			}
+			if let Some(out) = out {
+				bytes = out;
 			} else {
-				bail!("Zipped client meta has no files inside")
+				bail!("No files found for use in zip file");
 			}
+		} else {
+			bail!("Zipped client meta has no files inside")
 		}
+	}
 
-		std::fs::write(path, &bytes).context("Failed to write client meta to a file")?;
-
-		// Parsing must come second since simd json overwrites the slice
-
-		simd_json::from_slice(&mut bytes).context("Failed to parse client meta")?
-	};
+	// Parse before storing so that an invalid response is never kept. Simd json overwrites
+	// the slice, so it gets a copy
+	let meta = simd_json::from_slice(&mut bytes.clone()).context("Failed to parse client meta")?;
+	cache::store(&path, &bytes, &info).context("Failed to write client meta to a file")?;
 
 	Ok(meta)
 }
@@ -1,23 +1,25 @@
 use std::collections::HashMap;
 use std::fs::File;
-use std::path::Path;
-use std::sync::Arc;
+use std::io::Read;
+use std::path::{Path, PathBuf};
 
 use anyhow::{anyhow, Context};
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::timing::{self, SpanCategory};
 use mcvm_shared::translate;
 use reqwest::Client;
-use tokio::{sync::Semaphore, task::JoinSet};
+use tokio::task::JoinSet;
 use zip::ZipArchive;
 
 use crate::io::files::{self, paths::Paths};
 use crate::io::java::classpath::Classpath;
+use crate::io::store_manifest::{self, StoreManifest};
 use crate::io::update::{UpdateManager, UpdateMethodResult};
-use crate::net::download::{self, get_transfer_limit};
+use crate::net::download::{self, DownloadPriority, ExpectedHashes};
 use mcvm_shared::skip_none;
 use mcvm_shared::util;
 
-use super::client_meta::libraries::ExtractionRules;
+use super::client_meta::libraries::{Artifact, ExtractionRules};
 use super::client_meta::{libraries::Library, ClientMeta};
 
 /// Downloads base client libraries.
@@ -30,6 +32,7 @@ pub async fn get(
 	client: &Client,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<UpdateMethodResult> {
+	let _span = timing::span(SpanCategory::Phase, "libraries");
 	let mut out = UpdateMethodResult::new();
 	let libraries_path = paths.internal.join("libraries");
 	files::create_dir(&libraries_path)?;
@@ -41,6 +44,9 @@ pub async fn get(
 	files::create_dir(&natives_path)?;
 	let natives_jars_path = paths.internal.join("natives");
 
+	let mut manifest = StoreManifest::open(&get_manifest_path(paths))
+		.context("Failed to open libraries store manifest")?;
+
 	let mut natives = Vec::new();
 
 	let libraries = get_list(client_meta);
@@ -59,19 +65,26 @@ pub async fn get(
 
 			let path = natives_jars_path.join(classifier.path.clone());
 
-			natives.push((path.clone(), &lib.name, &lib.extract));
-			if !manager.should_update_file(&path) {
+			natives.push((
+				path.clone(),
+				lib.name.clone(),
+				lib.extract.clone(),
+				classifier.clone(),
+			));
+			let key = format!("natives/{}", classifier.path);
+			if is_library_valid(&key, &path, classifier, &mut manifest, manager)? {
 				continue;
 			}
-			libs_to_download.push((lib.name.clone(), classifier.clone(), path));
+			libs_to_download.push((lib.name.clone(), key, classifier.clone(), path));
 			continue;
 		}
 		if let Some(artifact) = &lib.downloads.artifact {
 			let path = libraries_path.join(artifact.path.clone());
-			if !manager.should_update_file(&path) {
+			let key = format!("libraries/{}", artifact.path);
+			if is_library_valid(&key, &path, artifact, &mut manifest, manager)? {
 				continue;
 			}
-			libs_to_download.push((lib.name.clone(), artifact.clone(), path));
+			libs_to_download.push((lib.name.clone(), key, artifact.clone(), path));
 			continue;
 		}
 	}
@@ -91,25 +104,24 @@ pub async fn get(
 	}
 
 	let mut join = JoinSet::new();
-	// Used to limit the number of open file descriptors
-	let sem = Arc::new(Semaphore::new(get_transfer_limit()));
-	for (name, library, path) in libs_to_download {
+	for (name, key, library, path) in libs_to_download {
 		let client = client.clone();
-		let sem = sem.clone();
 		let path_clone = path.clone();
 		let fut = async move {
 			files::create_leading_dirs_async(&path_clone).await?;
 
-			let _permit = sem.acquire().await;
-
-			let response = download::bytes(library.url, &client)
-				.await
-				.context("Failed to download library")?;
-			tokio::fs::write(&path_clone, response)
-				.await
-				.context("Failed to write library file")?;
-
-			Ok::<String, anyhow::Error>(name)
+			let hashes = ExpectedHashes::sha1(library.sha1.clone());
+			download::file_verified(
+				&library.url,
+				&path_clone,
+				&client,
+				DownloadPriority::High,
+				&hashes,
+			)
+			.await
+			.context("Failed to download library")?;
+
+			Ok::<_, anyhow::Error>((name, key, library, path_clone))
 		};
 		join.spawn(fut);
 		out.files_updated.insert(path.clone());
@@ -129,7 +141,10 @@ pub async fn get(
 	}
 	let mut num_done = 0;
 	while let Some(lib) = join.join_next().await {
-		let name = lib??;
+		let (name, key, library, path) = lib??;
+		manifest
+			.record_file(&key, &path, library.sha1.as_deref())
+			.context("Failed to record downloaded library")?;
 		num_done += 1;
 		o.display(
 			MessageContents::Associated(
@@ -147,16 +162,80 @@ pub async fn get(
 		);
 	}
 
-	for (path, name, extract) in natives {
-		o.display(
-			MessageContents::StartProcess(translate!(o, StartExtractingNative, "lib" = name)),
-			MessageLevel::Debug,
-		);
-		let natives_result = extract_native(&path, &natives_path, extract, manager, o)
-			.with_context(|| format!("Failed to extract native library {name}"))?;
-		out.merge(natives_result);
+	// Natives only have to be extracted again when their jar has changed since the last
+	// time they were extracted for this version. The extracted files could have been removed
+	// along with the directory though, so we can't trust the manifest when it is empty
+	let natives_dir_empty = natives_path
+		.read_dir()
+		.context("Failed to read natives directory")?
+		.next()
+		.is_none();
+	let reextract = manager.force || manager.verify || natives_dir_empty;
+	let mut reads = JoinSet::new();
+	for (i, (path, name, extract, classifier)) in natives.into_iter().enumerate() {
+		let key = format!("{version}/{}", classifier.path);
+		let extracted_hash = if reextract {
+			None
+		} else {
+			manifest.get_extracted(&key).map(str::to_string)
+		};
+		reads.spawn_blocking(move || {
+			let result = read_native(&path, classifier.sha1, extracted_hash, &extract)
+				.with_context(|| format!("Failed to extract native library {name}"));
+			(i, key, name, result)
+		});
+	}
+	let mut reads_done = Vec::new();
+	while let Some(result) = reads.join_next().await {
+		reads_done.push(result.context("Failed to run extraction task")?);
+	}
+	// Different jars can contain files with the same name, so the files are written in the
+	// order of the libraries to always end up with the same ones
+	reads_done.sort_by_key(|(i, ..)| *i);
+
+	let mut natives_to_write = Vec::new();
+	for (_, key, name, result) in reads_done {
+		let (hash, files) = result?;
+		if let Some(files) = files {
+			o.display(
+				MessageContents::StartProcess(translate!(o, StartExtractingNative, "lib" = &name)),
+				MessageLevel::Debug,
+			);
+			natives_to_write.push((key, hash, files));
+		}
+	}
+	if !natives_to_write.is_empty() {
+		let natives_dir = natives_path.clone();
+		let natives_written = tokio::task::spawn_blocking(move || {
+			for (.., files) in &natives_to_write {
+				write_native_files(&natives_dir, files)?;
+			}
+			Ok::<_, anyhow::Error>(natives_to_write)
+		})
+		.await
+		.context("Failed to run extraction task")??;
+
+		for (key, hash, files) in natives_written {
+			for (rel_path, _) in files {
+				let path = natives_path.join(rel_path);
+				o.display(
+					MessageContents::Simple(translate!(
+						o,
+						ExtractedNativeFile,
+						"file" = &path.to_string_lossy()
+					)),
+					MessageLevel::Debug,
+				);
+				out.files_updated.insert(path);
+			}
+			manifest.set_extracted(&key, &hash);
+		}
 	}
 
+	manifest
+		.write()
+		.context("Failed to write libraries store manifest")?;
+
 	o.display(
 		MessageContents::Success(translate!(o, FinishDownloadingLibraries)),
 		MessageLevel::Important,
@@ -166,6 +245,27 @@ pub async fn get(
 	Ok(out)
 }
 
+/// Checks whether an installed library is present and valid using the store manifest
+fn is_library_valid(
+	key: &str,
+	path: &Path,
+	artifact: &Artifact,
+	manifest: &mut StoreManifest,
+	manager: &UpdateManager,
+) -> anyhow::Result<bool> {
+	if manager.force {
+		return Ok(!manager.should_update_file(path));
+	}
+	manifest
+		.check_file(key, path, artifact.sha1.as_deref(), manager.verify)
+		.with_context(|| format!("Failed to check library at {}", path.display()))
+}
+
+/// Get the path to the manifest for the libraries store
+pub fn get_manifest_path(paths: &Paths) -> PathBuf {
+	paths.internal.join("libraries_manifest.json")
+}
+
 /// Gets the classpath from Minecraft libraries
 pub fn get_classpath(client_meta: &ClientMeta, paths: &Paths) -> anyhow::Result<Classpath> {
 	let natives_jars_path = paths.internal.join("natives");
@@ -226,15 +326,27 @@ fn is_allowed(lib: &Library) -> bool {
 	true
 }
 
-/// Extract the files of a native library into the natives directory.
-fn extract_native(
+/// The files of a native library, as paths relative to the natives directory and their contents
+type NativeFiles = Vec<(PathBuf, Vec<u8>)>;
+
+/// Read the files of a native library that need to be extracted. The jar is hashed if its
+/// hash isn't known, and no files are read if the hash is the same as the one that was
+/// last extracted. Returns the hash of the jar and the files
+fn read_native(
 	path: &Path,
-	natives_dir: &Path,
+	hash: Option<String>,
+	extracted_hash: Option<String>,
 	extraction_rules: &ExtractionRules,
-	manager: &UpdateManager,
-	o: &mut impl MCVMOutput,
-) -> anyhow::Result<UpdateMethodResult> {
-	let mut out = UpdateMethodResult::new();
+) -> anyhow::Result<(String, Option<NativeFiles>)> {
+	let hash = match hash {
+		Some(hash) => hash,
+		None => store_manifest::hash_file(path).context("Failed to hash native library")?,
+	};
+	if extracted_hash.as_ref() == Some(&hash) {
+		return Ok((hash, None));
+	}
+
+	let mut out = Vec::new();
 	let file = File::open(path).context("Failed to open native file")?;
 	let mut zip = ZipArchive::new(file).context("Failed to unarchive native")?;
 	for i in 0..zip.len() {
@@ -250,30 +362,28 @@ fn extract_native(
 		if let Some(extension) = rel_path.extension() {
 			match extension.to_str() {
 				Some("so" | "dylib" | "dll") => {
-					let out_path = natives_dir.join(rel_path);
-					if !manager.should_update_file(&out_path) {
-						continue;
-					}
-					let mut out_file =
-						File::create(&out_path).context("Failed to open output file for native")?;
-					std::io::copy(&mut file, &mut out_file)
-						.context("Failed to copy compressed file")?;
-					o.display(
-						MessageContents::Simple(translate!(
-							o,
-							ExtractedNativeFile,
-							"file" = &out_path.to_string_lossy()
-						)),
-						MessageLevel::Debug,
-					);
-					out.files_updated.insert(out_path);
+					let mut contents = Vec::with_capacity(file.size() as usize);
+					file.read_to_end(&mut contents)
+						.context("Failed to read compressed file")?;
+					out.push((rel_path, contents));
 				}
 				_ => continue,
 			}
 		}
 	}
 
-	Ok(out)
+	Ok((hash, Some(out)))
+}
+
+/// Write the files of a native library into the natives directory, replacing any files
+/// that are already there
+fn write_native_files(natives_dir: &Path, files: &NativeFiles) -> anyhow::Result<()> {
+	for (rel_path, contents) in files {
+		let out_path = natives_dir.join(rel_path);
+		std::fs::write(&out_path, contents).context("Failed to write extracted native file")?;
+	}
+
+	Ok(())
 }
 
 /// Gets the list of allowed libraries from the client meta
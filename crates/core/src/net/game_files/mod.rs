@@ -21,7 +21,8 @@ use super::download;
 pub mod game_jar {
 	use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel, OutputProcess};
 
-	use self::download::ProgressiveDownload;
+	use self::download::{DownloadPriority, ExpectedHashes, ProgressiveDownload};
+	use crate::net::mirror;
 
 	use super::{client_meta::ClientMeta, *};
 
@@ -53,16 +54,23 @@ pub mod game_jar {
 			Side::Server => &client_meta.downloads.server,
 		};
 
-		let mut download = ProgressiveDownload::file(&download.url, path, client).await?;
-		while !download.is_finished() {
-			download.poll_download().await?;
-			process.0.display(
-				MessageContents::Associated(
-					Box::new(download.get_progress()),
-					Box::new(MessageContents::Simple(download_message.clone())),
-				),
-				MessageLevel::Important,
-			);
+		// Mirrors can only be used for whole files with hashes, so there is no progress to show
+		if download.sha1.is_some() && mirror::is_enabled() {
+			let hashes = ExpectedHashes::sha1(download.sha1.clone());
+			download::file_verified(&download.url, path, client, DownloadPriority::High, &hashes)
+				.await?;
+		} else {
+			let mut download = ProgressiveDownload::file(&download.url, path, client).await?;
+			while !download.is_finished() {
+				download.poll_download().await?;
+				process.0.display(
+					MessageContents::Associated(
+						Box::new(download.get_progress()),
+						Box::new(MessageContents::Simple(download_message.clone())),
+					),
+					MessageLevel::Important,
+				);
+			}
 		}
 
 		let side_str = cap_first_letter(&side_str);
@@ -1,3 +1,6 @@
+use std::path::PathBuf;
+use std::time::Duration;
+
 use anyhow::Context;
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
 use mcvm_shared::translate;
@@ -5,9 +8,9 @@ use reqwest::Client;
 use serde::{Deserialize, Serialize};
 
 use crate::io::files::{self, paths::Paths};
+use crate::io::json_from_file;
 use crate::io::update::UpdateManager;
-use crate::io::{json_from_file, json_to_file};
-use crate::net::download::ProgressiveDownload;
+use crate::net::cache::{self, CacheLookup};
 use crate::util::versions::VersionName;
 
 /// JSON format for the version manifest that contains all available Minecraft versions
@@ -116,6 +119,9 @@ pub async fn get_with_output(
 	Ok(manifest)
 }
 
+/// The URL to the version manifest
+const MANIFEST_URL: &str = "https://piston-meta.mojang.com/mc/game/version_manifest_v2.json";
+
 /// Obtain the version manifest contents
 async fn get_contents(
 	paths: &Paths,
@@ -124,18 +130,21 @@ async fn get_contents(
 	force: bool,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<VersionManifest> {
-	let mut path = paths.internal.join("versions");
-	files::create_dir(&path)?;
-	path.push("manifest.json");
+	let path = get_path(paths)?;
 	if manager.allow_offline && !force && path.exists() {
 		return json_from_file(path).context("Failed to read manifest contents from file");
 	}
+	if force {
+		cache::invalidate(&path);
+	}
 
-	let mut download = ProgressiveDownload::bytes(
-		"https://piston-meta.mojang.com/mc/game/version_manifest_v2.json",
-		client,
-	)
-	.await?;
+	let lookup = cache::lookup(MANIFEST_URL, &path, manager.meta_ttl(), client).await?;
+	let (mut download, info) = match lookup {
+		CacheLookup::Cached => {
+			return json_from_file(path).context("Failed to read manifest contents from file")
+		}
+		CacheLookup::Modified(download, info) => (download, info),
+	};
 
 	while !download.is_finished() {
 		download.poll_download().await?;
@@ -150,13 +159,43 @@ async fn get_contents(
 			MessageLevel::Important,
 		);
 	}
-	let manifest = download.finish_json()?;
-
-	json_to_file(path, &manifest).context("Failed to write manifest to a file")?;
+	let bytes = download.finish();
+	// Parse before storing so that an invalid response is never kept. Simd json overwrites
+	// the slice, so it gets a copy
+	let manifest =
+		simd_json::from_slice(&mut bytes.clone()).context("Failed to parse version manifest")?;
+	cache::store(&path, &bytes, &info).context("Failed to write manifest to a file")?;
 
 	Ok(manifest)
 }
 
+/// Check the stored version manifest for changes and download it if it changed, without
+/// parsing it. This can run in the background while other work happens, so that getting
+/// the manifest afterwards only has to read it from disk
+pub async fn refresh(
+	paths: &Paths,
+	allow_offline: bool,
+	ttl: Duration,
+	client: &Client,
+) -> anyhow::Result<()> {
+	let path = get_path(paths)?;
+	if allow_offline && path.exists() {
+		return Ok(());
+	}
+	cache::bytes(MANIFEST_URL, &path, ttl, client)
+		.await
+		.context("Failed to refresh version manifest")?;
+
+	Ok(())
+}
+
+/// Get the path to the stored version manifest, creating its directory
+fn get_path(paths: &Paths) -> anyhow::Result<PathBuf> {
+	let path = paths.internal.join("versions");
+	files::create_dir(&path)?;
+	Ok(path.join("manifest.json"))
+}
+
 /// Make an ordered list of versions from the manifest to use for matching
 pub fn make_version_list(version_manifest: &VersionManifest) -> Vec<String> {
 	let mut out = Vec::new();
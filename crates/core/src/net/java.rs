@@ -131,6 +131,8 @@ pub mod zulu {
 
 /// Downloading GraalVM
 pub mod graalvm {
+	use std::path::Path;
+
 	use bytes::Bytes;
 	use mcvm_shared::util::preferred_archive_extension;
 
@@ -142,8 +144,18 @@ pub mod graalvm {
 		download::bytes(url, client).await
 	}
 
-	/// Gets the download URL
-	fn download_url(major_version: &str) -> String {
+	/// Downloads the latest GraalVM archive to a file without keeping it in memory
+	pub async fn download_latest(
+		major_version: &str,
+		path: &Path,
+		client: &Client,
+	) -> anyhow::Result<()> {
+		let url = download_url(major_version);
+		download::file(url, path, client).await
+	}
+
+	/// Gets the download URL of the latest GraalVM archive
+	pub fn download_url(major_version: &str) -> String {
 		format!(
 			"https://download.oracle.com/graalvm/{major_version}/latest/graalvm-jdk-{major_version}_{}-{}_bin{}",
 			OS_STRING,
@@ -3,7 +3,7 @@ use reqwest::Client;
 use serde::{Deserialize, Serialize};
 
 /// Struct for a Minecraft Profile from the Minecraft Services API
-#[derive(Deserialize, Serialize, Debug)]
+#[derive(Deserialize, Serialize, Debug, Clone)]
 pub struct MinecraftUserProfile {
 	/// The username of this user
 	pub name: String,
@@ -17,7 +17,7 @@ pub struct MinecraftUserProfile {
 }
 
 /// A skin for a Minecraft user
-#[derive(Deserialize, Serialize, Debug)]
+#[derive(Deserialize, Serialize, Debug, Clone)]
 pub struct Skin {
 	/// Common cosmetic data for the skin
 	#[serde(flatten)]
@@ -37,7 +37,7 @@ pub enum SkinVariant {
 }
 
 /// A cape for a Minecraft user
-#[derive(Deserialize, Serialize, Debug)]
+#[derive(Deserialize, Serialize, Debug, Clone)]
 pub struct Cape {
 	/// Common cosmetic data for the cape
 	#[serde(flatten)]
@@ -47,7 +47,7 @@ pub struct Cape {
 }
 
 /// Common structure used for a user cosmetic (skins and capes)
-#[derive(Deserialize, Serialize, Debug)]
+#[derive(Deserialize, Serialize, Debug, Clone)]
 pub struct Cosmetic {
 	/// The ID of this cosmetic
 	pub id: String,
@@ -6,4 +6,7 @@ pub mod java;
 pub mod minecraft;
 
 // Re-export
+pub use mcvm_net::cache;
 pub use mcvm_net::download;
+pub use mcvm_net::mirror;
+pub use mcvm_net::scheduler;
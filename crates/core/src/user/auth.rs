@@ -1,6 +1,11 @@
+use std::collections::HashMap;
+use std::path::Path;
+use std::sync::{Arc, Mutex, OnceLock};
+use std::time::{Duration, Instant};
+
 use anyhow::{bail, Context};
 use mcvm_auth::RsaPrivateKey;
-use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel, NoOp};
 use mcvm_shared::translate;
 
 use crate::net::minecraft::MinecraftUserProfile;
@@ -146,19 +151,75 @@ impl User {
 	}
 }
 
+/// How long before its access token expires that a session is refreshed instead of being used
+const SESSION_REFRESH_MARGIN: Duration = Duration::from_secs(10 * 60);
+
 /// Data for a Microsoft user
+#[derive(Clone)]
 pub struct MicrosoftUserData {
 	access_token: AccessToken,
 	profile: MinecraftUserProfile,
 	xbox_uid: Option<String>,
 	keypair: Option<Keypair>,
+	/// When the access token expires
+	expires: Instant,
 }
 
-/// Updates authentication for a Microsoft user using either the database or updating from the API
+impl MicrosoftUserData {
+	/// Check whether the access token is still good to use for a while
+	fn is_fresh(&self) -> bool {
+		Instant::now() + SESSION_REFRESH_MARGIN < self.expires
+	}
+}
+
+/// A session that has been authenticated in this process, behind a lock that is held
+/// for as long as the user is being authenticated
+type SessionSlot = Arc<tokio::sync::Mutex<Option<MicrosoftUserData>>>;
+
+/// Get the session slot for a user. Every authentication of the user in this process goes
+/// through the same slot, so that they can share a single refresh and don't have to
+/// open the database again
+fn get_session_slot(user_id: &str) -> SessionSlot {
+	static SESSIONS: OnceLock<Mutex<HashMap<String, SessionSlot>>> = OnceLock::new();
+	let mut sessions = SESSIONS
+		.get_or_init(Default::default)
+		.lock()
+		.unwrap_or_else(|x| x.into_inner());
+	sessions.entry(user_id.to_string()).or_default().clone()
+}
+
+/// Updates authentication for a Microsoft user using either the session from earlier in the
+/// process, the database, or authenticating again with the API
 async fn update_microsoft_user_auth(
 	user_id: &str,
 	params: AuthParameters<'_>,
 	o: &mut impl MCVMOutput,
+) -> anyhow::Result<MicrosoftUserData> {
+	// If a prefetch is refreshing the user right now, this waits for it to finish
+	let slot = get_session_slot(user_id);
+	let mut session = slot.lock().await;
+
+	if !params.force {
+		if let Some(session) = session.as_ref().filter(|x| x.is_fresh()) {
+			o.display(
+				MessageContents::Simple(translate!(o, UsingExistingSession)),
+				MessageLevel::Debug,
+			);
+			return Ok(session.clone());
+		}
+	}
+
+	let user_data = refresh_microsoft_user_auth(user_id, params, o).await?;
+	*session = Some(user_data.clone());
+
+	Ok(user_data)
+}
+
+/// Updates authentication for a Microsoft user using either the database or updating from the API
+async fn refresh_microsoft_user_auth(
+	user_id: &str,
+	params: AuthParameters<'_>,
+	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<MicrosoftUserData> {
 	let mut db =
 		AuthDatabase::open(&params.paths.auth).context("Failed to open authentication database")?;
@@ -173,33 +234,15 @@ async fn update_microsoft_user_auth(
 	let user_data = if let Some((db_user, sensitive)) =
 		get_full_user(&db, user_id, o).context("Failed to get full user from database")?
 	{
-		let refresh_token = RefreshToken::new(
-			sensitive
-				.refresh_token
-				.expect("Refresh token should be present in a full valid user"),
-		);
-		// Get the access token using the refresh token
-		let oauth_client =
-			auth::create_client(params.client_id).context("Failed to create OAuth client")?;
-		let token = auth::refresh_microsoft_token(&oauth_client, &refresh_token)
-			.await
-			.context("Failed to get refreshed token")?;
-
-		let token = authenticate_microsoft_user_from_token(token, params.req_client, o)
-			.await
-			.context("Failed to authenticate with refreshed token")?;
-
-		MicrosoftUserData {
-			access_token: AccessToken(token.access_token.0.clone()),
-			profile: MinecraftUserProfile {
-				name: db_user.username.clone(),
-				uuid: db_user.uuid.clone(),
-				skins: Vec::new(),
-				capes: Vec::new(),
-			},
-			xbox_uid: sensitive.xbox_uid.clone(),
-			keypair: sensitive.keypair.clone(),
-		}
+		refresh_microsoft_user(
+			db_user.username.clone(),
+			db_user.uuid.clone(),
+			sensitive,
+			params.client_id,
+			params.req_client,
+			o,
+		)
+		.await?
 	} else {
 		// Authenticate with the server again
 		reauth_microsoft_user(user_id, &mut db, params.client_id, params.req_client, o).await?
@@ -208,6 +251,101 @@ async fn update_microsoft_user_auth(
 	Ok(user_data)
 }
 
+/// Start refreshing a Microsoft user in the background so that the session is ready by the
+/// time the user is authenticated, like when the game is launched. Nothing is done if the user
+/// already has a fresh session, or if refreshing them would need a passkey prompt or a new login.
+/// Errors are ignored, since the user will just be authenticated normally later
+pub(crate) fn prefetch_microsoft_user_auth(
+	user_id: &str,
+	paths: &Paths,
+	client_id: ClientId,
+	client: &reqwest::Client,
+) {
+	let Ok(runtime) = tokio::runtime::Handle::try_current() else {
+		return;
+	};
+	// Someone is already authenticating the user
+	let Ok(mut session) = get_session_slot(user_id).try_lock_owned() else {
+		return;
+	};
+	if session.as_ref().is_some_and(|x| x.is_fresh()) {
+		return;
+	}
+
+	let auth_dir = paths.auth.clone();
+	let user_id = user_id.to_string();
+	let client = client.clone();
+	runtime.spawn(async move {
+		// Reading the database is blocking file IO, so it is kept off of the async workers
+		let user = tokio::task::spawn_blocking(move || get_prefetch_user(&auth_dir, &user_id));
+		let Ok(Some((name, uuid, sensitive))) = user.await else {
+			return;
+		};
+		let result =
+			refresh_microsoft_user(name, uuid, sensitive, client_id, &client, &mut NoOp).await;
+		if let Ok(user_data) = result {
+			*session = Some(user_data);
+		}
+	});
+}
+
+/// Get the name, UUID, and sensitive info of a user from the database for a prefetch, if
+/// they can be refreshed without a passkey prompt or a new login
+fn get_prefetch_user(
+	auth_dir: &Path,
+	user_id: &str,
+) -> Option<(String, String, SensitiveUserInfo)> {
+	let db = AuthDatabase::open(auth_dir).ok()?;
+	let db_user = db.get_valid_user(user_id)?;
+	if !db_user.is_logged_in() || db_user.has_passkey() {
+		return None;
+	}
+	let sensitive = db_user.get_sensitive_info_no_passkey().ok()?;
+	if sensitive.refresh_token.is_none() {
+		return None;
+	}
+
+	Some((db_user.username.clone(), db_user.uuid.clone(), sensitive))
+}
+
+/// Gets new tokens for a user in the database using their refresh token
+async fn refresh_microsoft_user(
+	name: String,
+	uuid: String,
+	sensitive: SensitiveUserInfo,
+	client_id: ClientId,
+	client: &reqwest::Client,
+	o: &mut impl MCVMOutput,
+) -> anyhow::Result<MicrosoftUserData> {
+	let refresh_token = RefreshToken::new(
+		sensitive
+			.refresh_token
+			.expect("Refresh token should be present in a full valid user"),
+	);
+	// Get the access token using the refresh token
+	let oauth_client = auth::create_client(client_id).context("Failed to create OAuth client")?;
+	let token = auth::refresh_microsoft_token(&oauth_client, &refresh_token)
+		.await
+		.context("Failed to get refreshed token")?;
+
+	let token = authenticate_microsoft_user_from_token(token, client, o)
+		.await
+		.context("Failed to authenticate with refreshed token")?;
+
+	Ok(MicrosoftUserData {
+		access_token: token.access_token,
+		profile: MinecraftUserProfile {
+			name,
+			uuid,
+			skins: Vec::new(),
+			capes: Vec::new(),
+		},
+		xbox_uid: sensitive.xbox_uid,
+		keypair: sensitive.keypair,
+		expires: Instant::now() + Duration::from_secs(token.expires_in as u64),
+	})
+}
+
 async fn reauth_microsoft_user(
 	user_id: &str,
 	db: &mut AuthDatabase,
@@ -289,6 +427,7 @@ async fn reauth_microsoft_user(
 		xbox_uid: Some(auth_result.xbox_uid),
 		profile,
 		keypair: Some(certificate.key_pair),
+		expires: Instant::now() + Duration::from_secs(auth_result.expires_in as u64),
 	})
 }
 
@@ -284,6 +284,22 @@ impl UserManager {
 		Ok(())
 	}
 
+	/// Start authenticating the currently chosen user in the background, so that `authenticate`
+	/// doesn't have to wait for it later. This is best done before other slow work, like updating
+	/// an instance, and only helps Microsoft users that can be refreshed without any prompts.
+	/// This must be called from within a Tokio runtime
+	pub fn prefetch_auth(&self, paths: &Paths, client: &Client) {
+		if self.offline {
+			return;
+		}
+		let Some(user) = self.get_chosen_user() else {
+			return;
+		};
+		if user.is_microsoft() && !user.is_authenticated() {
+			auth::prefetch_microsoft_user_auth(&user.id, paths, self.ms_client_id.clone(), client);
+		}
+	}
+
 	/// Unchooses the current user, if one is chosen
 	pub fn unchoose_user(&mut self) {
 		self.state = AuthState::Offline;
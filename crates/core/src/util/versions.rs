@@ -43,7 +43,7 @@ impl MinecraftVersionDeser {
 }
 
 /// User-supplied Minecraft version pattern
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, PartialEq)]
 pub enum MinecraftVersion {
 	/// A generic version
 	Version(VersionName),
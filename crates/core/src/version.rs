@@ -6,15 +6,18 @@ use mcvm_shared::later::Later;
 use mcvm_shared::output::MCVMOutput;
 use mcvm_shared::output::{MessageContents, MessageLevel};
 use mcvm_shared::versions::VersionInfo;
+use mcvm_shared::Side;
 
 use crate::config::BrandingProperties;
 use crate::instance::{Instance, InstanceConfiguration, InstanceParameters};
 use crate::io::files::paths::Paths;
+use crate::io::java::install::{JavaInstallParameters, JavaInstallation, JavaInstallationKind};
 use crate::io::persistent::PersistentData;
 use crate::io::update::UpdateManager;
+use crate::net::download::DownloadPriority;
 use crate::net::game_files::client_meta::{self, ClientMeta};
 use crate::net::game_files::version_manifest::{self, VersionEntry, VersionManifestAndList};
-use crate::net::game_files::{assets, libraries};
+use crate::net::game_files::{assets, game_jar, libraries};
 use crate::user::UserManager;
 use crate::util::versions::VersionName;
 
@@ -90,6 +93,56 @@ impl<'inner, 'params> InstalledVersion<'inner, 'params> {
 		};
 		self.inner.client_assets_and_libs.load(params, o).await
 	}
+
+	/// Download the files that instances of this version will need into the shared
+	/// directories, without creating an instance. Instances that are created
+	/// afterwards will find everything already there. The game JAR can be skipped
+	/// for instances that will override it
+	pub async fn prefetch_files(
+		&mut self,
+		side: Side,
+		download_jar: bool,
+		java: JavaInstallationKind,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<()> {
+		let java_vers = &self.inner.client_meta.java_info.major_version;
+		let java_params = JavaInstallParameters {
+			paths: self.params.paths,
+			update_manager: self.params.update_manager,
+			persistent: self.params.persistent,
+			req_client: self.params.req_client,
+			// Games may be running with the current installation, and the update will
+			// take care of any newer one
+			priority: DownloadPriority::Low,
+			keep_installed: true,
+		};
+		JavaInstallation::install(java, *java_vers, java_params, o)
+			.await
+			.context("Failed to install or update Java")?;
+		self.params.persistent.dump(self.params.paths).await?;
+
+		if download_jar {
+			game_jar::get(
+				side,
+				&self.inner.client_meta,
+				&self.inner.version,
+				self.params.paths,
+				self.params.update_manager,
+				self.params.req_client,
+				o,
+			)
+			.await
+			.context("Failed to get the game JAR file")?;
+		}
+
+		if let Side::Client = side {
+			self.ensure_client_assets_and_libs(o)
+				.await
+				.context("Failed to get client assets and libraries")?;
+		}
+
+		Ok(())
+	}
 }
 
 pub(crate) struct InstalledVersionInner {
@@ -1,12 +1,12 @@
 use std::fmt::Display;
 
 use anyhow::{anyhow, Context};
+use mcvm_core::io::files;
 use mcvm_core::io::java::classpath::Classpath;
 use mcvm_core::io::java::maven::MavenLibraryParts;
 use mcvm_core::io::json_from_file;
 use mcvm_core::io::update::UpdateManager;
-use mcvm_core::io::{files, json_to_file};
-use mcvm_core::net::download;
+use mcvm_core::net::{cache, download};
 use mcvm_core::{MCVMCore, Paths};
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel, OutputProcess};
 use mcvm_shared::versions::VersionInfo;
@@ -191,15 +191,9 @@ pub async fn get_meta(
 	let meta = if manager.allow_offline() && path.exists() {
 		json_from_file(path).with_context(|| format!("Failed to parse {mode} meta from file"))?
 	} else {
-		let bytes = download::bytes(&meta_url, client)
+		cache::json::<Vec<FabricQuiltMeta>>(&meta_url, &path, manager.meta_ttl(), client)
 			.await
-			.with_context(|| format!("Failed to download {mode} metadata file"))?;
-		let out = serde_json::from_slice::<Vec<FabricQuiltMeta>>(&bytes)
-			.context("Failed to parse downloaded metadata")?;
-
-		json_to_file(path, &out).context("Failed to serialize meta to a file")?;
-
-		out
+			.with_context(|| format!("Failed to get {mode} metadata file"))?
 	};
 
 	let meta = meta
@@ -1,9 +1,13 @@
+use std::time::Duration;
 use std::{fmt::Display, path::PathBuf};
 
 use anyhow::{anyhow, bail, Context};
+use mcvm_core::io::files;
+use mcvm_core::net::cache;
 use mcvm_core::{net::download, MCVMCore};
 use mcvm_shared::{output::MCVMOutput, versions::VersionInfo, Side};
 use reqwest::Client;
+use serde::de::DeserializeOwned;
 use serde::Deserialize;
 
 use mcvm_core::io::files::paths::Paths;
@@ -61,13 +65,24 @@ pub async fn install_from_core(
 		bail!("Velocity is a proxy and cannot be used in the install_from_core function");
 	}
 
-	let build_num = get_newest_build(mode, &version_info.version, core.get_client())
-		.await
-		.context(format!("Failed to get newest {mode} build"))?;
-	let jar_file_name =
-		get_jar_file_name(mode, &version_info.version, build_num, core.get_client())
-			.await
-			.context(format!("Failed to get the API name of the {mode} JAR file"))?;
+	let build_num = get_newest_build(
+		mode,
+		&version_info.version,
+		core.get_update_manager().meta_ttl(),
+		core.get_paths(),
+		core.get_client(),
+	)
+	.await
+	.context(format!("Failed to get newest {mode} build"))?;
+	let jar_file_name = get_jar_file_name(
+		mode,
+		&version_info.version,
+		build_num,
+		core.get_paths(),
+		core.get_client(),
+	)
+	.await
+	.context(format!("Failed to get the API name of the {mode} JAR file"))?;
 	download_server_jar(
 		mode,
 		&version_info.version,
@@ -85,15 +100,20 @@ pub async fn install_from_core(
 	))
 }
 
-/// Install Velocity, returning the path to the JAR file and the main class
-pub async fn install_velocity(paths: &Paths, client: &Client) -> anyhow::Result<(PathBuf, String)> {
-	let version = get_newest_version(Mode::Velocity, client)
+/// Install Velocity, returning the path to the JAR file and the main class.
+/// Cached responses from the API are used if they were checked less than the TTL ago
+pub async fn install_velocity(
+	ttl: Duration,
+	paths: &Paths,
+	client: &Client,
+) -> anyhow::Result<(PathBuf, String)> {
+	let version = get_newest_version(Mode::Velocity, ttl, paths, client)
 		.await
 		.context("Failed to get newest Velocity version")?;
-	let build_num = get_newest_build(Mode::Velocity, &version, client)
+	let build_num = get_newest_build(Mode::Velocity, &version, ttl, paths, client)
 		.await
 		.context("Failed to get newest Velocity build version")?;
-	let file_name = get_jar_file_name(Mode::Velocity, &version, build_num, client)
+	let file_name = get_jar_file_name(Mode::Velocity, &version, build_num, paths, client)
 		.await
 		.context("Failed to get Velocity build file name")?;
 
@@ -114,10 +134,16 @@ pub async fn install_velocity(paths: &Paths, client: &Client) -> anyhow::Result<
 	))
 }
 
-/// Get the newest version of a PaperMC project
-pub async fn get_newest_version(mode: Mode, client: &Client) -> anyhow::Result<String> {
+/// Get the newest version of a PaperMC project. A cached response is used if it was
+/// checked less than the TTL ago
+pub async fn get_newest_version(
+	mode: Mode,
+	ttl: Duration,
+	paths: &Paths,
+	client: &Client,
+) -> anyhow::Result<String> {
 	let url = format!("https://api.papermc.io/v2/projects/{}", mode.to_str(),);
-	let resp: ProjectInfoResponse = download::json(url, client).await?;
+	let resp: ProjectInfoResponse = get_api_json(&url, ttl, paths, client).await?;
 
 	let version = resp
 		.versions
@@ -132,13 +158,20 @@ struct ProjectInfoResponse {
 	versions: Vec<String>,
 }
 
-/// Get the newest build number of a PaperMC project version
-pub async fn get_newest_build(mode: Mode, version: &str, client: &Client) -> anyhow::Result<u16> {
+/// Get the newest build number of a PaperMC project version. A cached response is used if
+/// it was checked less than the TTL ago
+pub async fn get_newest_build(
+	mode: Mode,
+	version: &str,
+	ttl: Duration,
+	paths: &Paths,
+	client: &Client,
+) -> anyhow::Result<u16> {
 	let url = format!(
 		"https://api.papermc.io/v2/projects/{}/versions/{version}",
 		mode.to_str(),
 	);
-	let resp: VersionInfoResponse = download::json(url, client).await?;
+	let resp: VersionInfoResponse = get_api_json(&url, ttl, paths, client).await?;
 
 	let build = resp
 		.builds
@@ -161,6 +194,7 @@ pub async fn get_jar_file_name(
 	mode: Mode,
 	version: &str,
 	build_num: u16,
+	paths: &Paths,
 	client: &Client,
 ) -> anyhow::Result<String> {
 	let num_str = build_num.to_string();
@@ -168,7 +202,8 @@ pub async fn get_jar_file_name(
 		"https://api.papermc.io/v2/projects/{}/versions/{version}/builds/{num_str}",
 		mode.to_str(),
 	);
-	let resp: BuildInfoResponse = download::json(url, client).await?;
+	// Builds never change once they are published
+	let resp: BuildInfoResponse = get_api_json(&url, cache::IMMUTABLE_TTL, paths, client).await?;
 
 	Ok(resp.downloads.application.name)
 }
@@ -188,6 +223,21 @@ struct BuildInfoApplication {
 	name: String,
 }
 
+/// Get a response from the PaperMC API, using the cached copy if it was checked recently
+async fn get_api_json<T: DeserializeOwned>(
+	url: &str,
+	ttl: Duration,
+	paths: &Paths,
+	client: &Client,
+) -> anyhow::Result<T> {
+	let dir = paths.internal.join("paper_api");
+	files::create_dir(&dir).context("Failed to create PaperMC API cache directory")?;
+	let path = cache::get_cache_path(&dir, url);
+	cache::json(url, &path, ttl, client)
+		.await
+		.context("Failed to get PaperMC API response")
+}
+
 /// Download the server jar
 pub async fn download_server_jar(
 	mode: Mode,
@@ -0,0 +1,261 @@
+use std::io::Cursor;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use anyhow::{bail, Context};
+use reqwest::header::{
+	HeaderMap, HeaderValue, ETAG, IF_MODIFIED_SINCE, IF_NONE_MATCH, LAST_MODIFIED,
+};
+use reqwest::{IntoUrl, StatusCode};
+use serde::de::DeserializeOwned;
+use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
+
+use crate::download::{self, Client, DownloadPriority, ProgressiveDownload};
+
+/// How long metadata that changes every now and then, like the version manifest,
+/// is used before asking the server whether it has changed
+pub const META_TTL: Duration = Duration::from_secs(10 * 60);
+/// TTL for metadata that never changes once it is published, like the info for a single build
+pub const IMMUTABLE_TTL: Duration = Duration::MAX;
+
+/// The validators of a cached response and when it was last known to be up to date.
+/// This is stored next to the cached file
+#[derive(Serialize, Deserialize, Debug, Clone, Default)]
+pub struct CacheInfo {
+	/// The URL that the response is for. A cached file is not used for a different URL
+	url: String,
+	/// The ETag header of the response
+	#[serde(default)]
+	#[serde(skip_serializing_if = "Option::is_none")]
+	etag: Option<String>,
+	/// The Last-Modified header of the response
+	#[serde(default)]
+	#[serde(skip_serializing_if = "Option::is_none")]
+	last_modified: Option<String>,
+	/// When the cached copy was last checked, in seconds since the Unix epoch
+	checked: u64,
+}
+
+impl CacheInfo {
+	/// Load the info for a cached file
+	fn load(path: &Path) -> Option<Self> {
+		let contents = std::fs::read(get_info_path(path)).ok()?;
+		serde_json::from_slice(&contents).ok()
+	}
+
+	/// Store this info for a cached file. This should be done after the file itself is written
+	fn write(&self, path: &Path) -> anyhow::Result<()> {
+		let contents = serde_json::to_vec(self).context("Failed to serialize cache info")?;
+		std::fs::write(get_info_path(path), contents).context("Failed to write cache info")
+	}
+
+	/// Create the info for a new response
+	fn from_headers(url: &str, headers: &HeaderMap) -> Self {
+		let get = |name| {
+			headers
+				.get(name)
+				.and_then(|x: &HeaderValue| x.to_str().ok())
+				.map(str::to_string)
+		};
+		Self {
+			url: url.to_string(),
+			etag: get(ETAG),
+			last_modified: get(LAST_MODIFIED),
+			checked: now(),
+		}
+	}
+
+	/// Check whether the cached copy can be used without asking the server
+	fn is_fresh(&self, ttl: Duration) -> bool {
+		now().saturating_sub(self.checked) < ttl.as_secs()
+	}
+}
+
+/// The result of looking up a URL in the cache
+pub enum CacheLookup {
+	/// The cached file is up to date and can be used as it is
+	Cached,
+	/// The resource has changed and is being downloaded. The new contents should be
+	/// written to the cache with [store] once they are finished
+	Modified(ProgressiveDownload<Cursor<Vec<u8>>>, CacheInfo),
+}
+
+/// Look up a URL that is cached at a path. The cached file is used as it is if it was
+/// checked less than the TTL ago. Otherwise, a conditional request is sent with the
+/// validators of the cached response, so that the body is only downloaded if it changed
+pub async fn lookup(
+	url: impl IntoUrl,
+	path: &Path,
+	ttl: Duration,
+	client: &Client,
+) -> anyhow::Result<CacheLookup> {
+	let url = url.into_url().context("Invalid URL")?;
+	let cached = if path.exists() {
+		CacheInfo::load(path).filter(|x| x.url == url.as_str())
+	} else {
+		None
+	};
+	if cached.as_ref().is_some_and(|x| x.is_fresh(ttl)) {
+		return Ok(CacheLookup::Cached);
+	}
+
+	let mut request = download::create_request(url.clone(), client)?;
+	if let Some(info) = &cached {
+		let headers = request.headers_mut();
+		if let Some(etag) = info.etag.as_deref().and_then(|x| x.parse().ok()) {
+			headers.insert(IF_NONE_MATCH, etag);
+		}
+		if let Some(date) = info.last_modified.as_deref().and_then(|x| x.parse().ok()) {
+			headers.insert(IF_MODIFIED_SINCE, date);
+		}
+	}
+
+	let (response, permit) =
+		download::execute_scheduled(&request, client, DownloadPriority::High).await?;
+	if response.status() == StatusCode::NOT_MODIFIED {
+		let Some(mut info) = cached else {
+			bail!("Server reported that a resource we don't have is not modified");
+		};
+		permit.report_success(0);
+		info.checked = now();
+		// Failing to write the info only means we will ask again next time
+		let _ = info.write(path);
+		return Ok(CacheLookup::Cached);
+	}
+
+	let info = CacheInfo::from_headers(url.as_str(), response.headers());
+	let cursor = Cursor::new(Vec::with_capacity(
+		response.content_length().unwrap_or_default() as usize,
+	));
+	let download = ProgressiveDownload::from_scheduled_response(response, permit, cursor);
+
+	Ok(CacheLookup::Modified(download, info))
+}
+
+/// Get the contents of a URL that is cached at a path, only downloading them if they changed.
+/// The path must be in an existing directory
+pub async fn bytes(
+	url: impl IntoUrl,
+	path: &Path,
+	ttl: Duration,
+	client: &Client,
+) -> anyhow::Result<Vec<u8>> {
+	match lookup(url, path, ttl, client).await? {
+		CacheLookup::Cached => std::fs::read(path).context("Failed to read cached file"),
+		CacheLookup::Modified(mut download, info) => {
+			while !download.is_finished() {
+				download.poll_download().await?;
+			}
+			let bytes = download.finish();
+			store(path, &bytes, &info)?;
+
+			Ok(bytes)
+		}
+	}
+}
+
+/// Get the contents of a URL that is cached at a path as JSON, only downloading them if they
+/// changed. New contents are only stored once they have been parsed, so that an invalid
+/// response is never kept as a fresh copy. The path must be in an existing directory
+pub async fn json<T: DeserializeOwned>(
+	url: impl IntoUrl,
+	path: &Path,
+	ttl: Duration,
+	client: &Client,
+) -> anyhow::Result<T> {
+	match lookup(url, path, ttl, client).await? {
+		CacheLookup::Cached => {
+			let bytes = std::fs::read(path).context("Failed to read cached file")?;
+			let result = serde_json::from_slice(&bytes).context("Failed to parse cached file");
+			// Make sure that a broken file is downloaded again next time
+			if result.is_err() {
+				invalidate(path);
+			}
+			result
+		}
+		CacheLookup::Modified(mut download, info) => {
+			while !download.is_finished() {
+				download.poll_download().await?;
+			}
+			let bytes = download.finish();
+			let out = serde_json::from_slice(&bytes).context("Failed to parse response")?;
+			store(path, &bytes, &info)?;
+
+			Ok(out)
+		}
+	}
+}
+
+/// Write the new contents of a cached file along with their info. The old info is removed
+/// before anything else, and the contents are written to a temporary file that is moved
+/// into place, so that the validators of the old response never describe a file that was
+/// changed or only partly written
+pub fn store(path: &Path, contents: &[u8], info: &CacheInfo) -> anyhow::Result<()> {
+	invalidate(path);
+
+	let mut file_name = path.file_name().unwrap_or_default().to_owned();
+	let count = TMP_COUNTER.fetch_add(1, Ordering::Relaxed);
+	file_name.push(format!(".{}-{count}.tmp", std::process::id()));
+	let tmp_path = path.with_file_name(file_name);
+	std::fs::write(&tmp_path, contents).context("Failed to write cached file")?;
+	if let Err(e) = std::fs::rename(&tmp_path, path) {
+		let _ = std::fs::remove_file(&tmp_path);
+		return Err(e).context("Failed to move cached file into place");
+	}
+
+	info.write(path)
+}
+
+/// Keeps the temporary files of stores that happen at the same time apart
+static TMP_COUNTER: AtomicU64 = AtomicU64::new(0);
+
+/// Remove the info of a cached file so that it is downloaded again the next time it is looked up
+pub fn invalidate(path: &Path) {
+	let _ = std::fs::remove_file(get_info_path(path));
+}
+
+/// Get the path to cache a URL at in a directory, for URLs that don't have a natural place to go
+pub fn get_cache_path(dir: &Path, url: &str) -> PathBuf {
+	dir.join(format!(
+		"{}.json",
+		hex::encode(Sha256::digest(url.as_bytes()))
+	))
+}
+
+/// Get the path to the info for a cached file
+fn get_info_path(path: &Path) -> PathBuf {
+	let mut file_name = path.file_name().unwrap_or_default().to_owned();
+	file_name.push(".cache");
+	path.with_file_name(file_name)
+}
+
+fn now() -> u64 {
+	SystemTime::now()
+		.duration_since(UNIX_EPOCH)
+		.map(|x| x.as_secs())
+		.unwrap_or_default()
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_cache_info() {
+		let mut headers = HeaderMap::new();
+		headers.insert(ETAG, HeaderValue::from_static("\"abc\""));
+		let info = CacheInfo::from_headers("https://example.com/", &headers);
+		assert_eq!(info.etag.as_deref(), Some("\"abc\""));
+		assert_eq!(info.last_modified, None);
+		assert!(info.is_fresh(META_TTL));
+		assert!(info.is_fresh(IMMUTABLE_TTL));
+		assert!(!info.is_fresh(Duration::ZERO));
+
+		assert_eq!(
+			get_info_path(Path::new("versions/manifest.json")),
+			Path::new("versions/manifest.json.cache")
+		);
+	}
+}
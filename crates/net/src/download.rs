@@ -1,12 +1,23 @@
 use std::fs::File;
-use std::io::{BufWriter, Cursor, Write};
-use std::path::Path;
+use std::io::{BufReader, BufWriter, Cursor, Read, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
 
-use anyhow::{ensure, Context};
+use anyhow::{anyhow, ensure, Context};
 use mcvm_shared::output::MessageContents;
-use reqwest::{IntoUrl, Url};
+use mcvm_shared::timing;
+use reqwest::header::{HeaderValue, CONTENT_RANGE, RANGE, RETRY_AFTER};
+use reqwest::{IntoUrl, Request, StatusCode, Url};
 use serde::de::DeserializeOwned;
+use sha1::Sha1;
+use sha2::{Digest, Sha256, Sha512};
+use tokio::io::AsyncWriteExt;
 
+use crate::mirror;
+use crate::scheduler::{DownloadPermit, DownloadScheduler};
+
+/// Re-export of the download priority for users of this download module
+pub use crate::scheduler::DownloadPriority;
 /// Re-export of reqwest::Client for users of this download module
 pub use reqwest::Client;
 
@@ -17,22 +28,50 @@ const FD_SENSIBLE_LIMIT: usize = 128;
 #[cfg(not(target_os = "windows"))]
 const FD_SENSIBLE_LIMIT: usize = 128;
 
+/// How many times a request will be sent when the server keeps rate limiting us
+const MAX_RATE_LIMIT_ATTEMPTS: usize = 3;
+/// How long idle connections are kept open for reuse
+const POOL_IDLE_TIMEOUT: Duration = Duration::from_secs(90);
+/// Interval for TCP and HTTP/2 keep-alive pings
+const KEEP_ALIVE_INTERVAL: Duration = Duration::from_secs(30);
+/// How long we wait to connect to a server before giving up
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(30);
+
 /// Get the sensible limit for asynchronous transfers
 pub fn get_transfer_limit() -> usize {
 	if let Ok(env) = std::env::var("MCVM_TRANSFER_LIMIT") {
-		env.parse().unwrap_or_default()
+		env.parse().unwrap_or(FD_SENSIBLE_LIMIT)
 	} else {
 		FD_SENSIBLE_LIMIT
 	}
 }
 
+/// Create a client that is tuned for many concurrent transfers, like the game files
+/// downloaded during updates. Connections are kept alive and reused between requests,
+/// and HTTP/2 is negotiated with servers that support it so that transfers to the same
+/// host are multiplexed over a single connection instead of each paying for a new one
+pub fn new_client() -> anyhow::Result<Client> {
+	Client::builder()
+		.pool_max_idle_per_host(get_transfer_limit())
+		.pool_idle_timeout(POOL_IDLE_TIMEOUT)
+		.tcp_keepalive(KEEP_ALIVE_INTERVAL)
+		.tcp_nodelay(true)
+		.connect_timeout(CONNECT_TIMEOUT)
+		.http2_adaptive_window(true)
+		.http2_keep_alive_interval(KEEP_ALIVE_INTERVAL)
+		.http2_keep_alive_while_idle(true)
+		.build()
+		.context("Failed to create HTTP client")
+}
+
 /// The User-Agent header for requests
 fn user_agent() -> String {
 	let version = env!("CARGO_PKG_VERSION");
 	format!("mcvm_core_{version}")
 }
 
-/// Downloads data from a remote location
+/// Downloads data from a remote location without waiting for the download scheduler.
+/// Prefer the other functions in this module for transfers that may happen concurrently
 pub async fn download(url: impl IntoUrl, client: &Client) -> anyhow::Result<reqwest::Response> {
 	let resp = client
 		.get(url)
@@ -46,26 +85,103 @@ pub async fn download(url: impl IntoUrl, client: &Client) -> anyhow::Result<reqw
 	Ok(resp)
 }
 
+/// Downloads data from a remote location after waiting for a turn from the global download
+/// scheduler. The returned permit must be held until the response body has been read.
+/// Requests that are rate limited by the server will be retried after backing off.
+pub async fn download_scheduled(
+	url: impl IntoUrl,
+	client: &Client,
+	priority: DownloadPriority,
+) -> anyhow::Result<(reqwest::Response, DownloadPermit)> {
+	let request = create_request(url, client)?;
+	execute_scheduled(&request, client, priority).await
+}
+
+/// Create a GET request with our headers
+pub(crate) fn create_request(url: impl IntoUrl, client: &Client) -> anyhow::Result<Request> {
+	client
+		.get(url)
+		.header("User-Agent", user_agent())
+		.build()
+		.context("Failed to create request")
+}
+
+/// Send a request after waiting for a turn from the global download scheduler
+pub(crate) async fn execute_scheduled(
+	request: &Request,
+	client: &Client,
+	priority: DownloadPriority,
+) -> anyhow::Result<(reqwest::Response, DownloadPermit)> {
+	let host = request.url().host_str().unwrap_or_default().to_string();
+
+	let scheduler = DownloadScheduler::global();
+	let mut attempts = 0;
+	loop {
+		attempts += 1;
+		let permit = scheduler.acquire(&host, priority).await;
+		let attempt = request.try_clone().context("Failed to copy request")?;
+		let start = Instant::now();
+		let resp = client
+			.execute(attempt)
+			.await
+			.context("Failed to send request")?;
+		timing::record_request(&host, start.elapsed());
+
+		let status = resp.status();
+		if status == StatusCode::TOO_MANY_REQUESTS || status == StatusCode::SERVICE_UNAVAILABLE {
+			permit.report_rate_limited(get_retry_after(&resp));
+			if attempts < MAX_RATE_LIMIT_ATTEMPTS {
+				continue;
+			}
+		}
+
+		let resp = resp
+			.error_for_status()
+			.context("Server reported an error")?;
+		return Ok((resp, permit));
+	}
+}
+
+/// Get the amount of time a server wants us to wait from a response
+fn get_retry_after(resp: &reqwest::Response) -> Option<Duration> {
+	let header = resp.headers().get(RETRY_AFTER)?.to_str().ok()?;
+	let secs = header.trim().parse().ok()?;
+	Some(Duration::from_secs(secs))
+}
+
 /// Downloads and returns text
 pub async fn text(url: impl IntoUrl, client: &Client) -> anyhow::Result<String> {
-	let text = download(url, client)
+	let (resp, permit) = download_scheduled(url, client, DownloadPriority::Normal)
 		.await
-		.context("Failed to download")?
+		.context("Failed to download")?;
+	let text = resp
 		.text()
 		.await
 		.context("Failed to convert download to text")?;
+	permit.report_success(text.len());
 
 	Ok(text)
 }
 
 /// Downloads and returns bytes
 pub async fn bytes(url: impl IntoUrl, client: &Client) -> anyhow::Result<bytes::Bytes> {
-	let bytes = download(url, client)
+	bytes_with_priority(url, client, DownloadPriority::Normal).await
+}
+
+/// Downloads and returns bytes, with a priority for the download scheduler
+pub async fn bytes_with_priority(
+	url: impl IntoUrl,
+	client: &Client,
+	priority: DownloadPriority,
+) -> anyhow::Result<bytes::Bytes> {
+	let (resp, permit) = download_scheduled(url, client, priority)
 		.await
-		.context("Failed to download")?
+		.context("Failed to download")?;
+	let bytes = resp
 		.bytes()
 		.await
 		.context("Failed to convert download to raw bytes")?;
+	permit.report_success(bytes.len());
 
 	Ok(bytes)
 }
@@ -76,27 +192,344 @@ pub async fn file(
 	path: impl AsRef<Path>,
 	client: &Client,
 ) -> anyhow::Result<()> {
-	let bytes = bytes(url, client)
-		.await
-		.context("Failed to download data")?;
-	std::fs::write(path.as_ref(), bytes).with_context(|| {
+	file_with_priority(url, path, client, DownloadPriority::Normal).await
+}
+
+/// Downloads and puts the contents in a file, with a priority for the download scheduler
+pub async fn file_with_priority(
+	url: impl IntoUrl,
+	path: impl AsRef<Path>,
+	client: &Client,
+	priority: DownloadPriority,
+) -> anyhow::Result<()> {
+	file_verified(url, path, client, priority, &ExpectedHashes::default()).await
+}
+
+/// Hashes that a downloaded file is expected to have. Only the hashes that are
+/// present will be computed and checked
+#[derive(Debug, Clone, Default)]
+pub struct ExpectedHashes {
+	/// Hex SHA-1 hash
+	pub sha1: Option<String>,
+	/// Hex SHA-256 hash
+	pub sha256: Option<String>,
+	/// Hex SHA-512 hash
+	pub sha512: Option<String>,
+}
+
+impl ExpectedHashes {
+	/// Create expected hashes with only a SHA-1 hash
+	pub fn sha1(hash: Option<String>) -> Self {
+		Self {
+			sha1: hash,
+			..Default::default()
+		}
+	}
+
+	/// Check whether any hashes are expected
+	pub fn is_some(&self) -> bool {
+		self.sha1.is_some() || self.sha256.is_some() || self.sha512.is_some()
+	}
+}
+
+/// Downloads a file by streaming it to a temporary file while it is hashed, so that the
+/// whole file never has to be kept in memory or read again. The temporary file is only
+/// moved to the destination path if all of the expected hashes match.
+///
+/// When there are expected hashes, an interrupted download leaves its temporary file
+/// behind, and the next attempt will only request the rest of the file from the server.
+/// The hashes make sure that a stale or corrupted partial file can't go unnoticed.
+///
+/// Files with expected hashes are looked up on the configured mirrors first, and are
+/// only downloaded from the URL if none of the mirrors can provide them.
+pub async fn file_verified(
+	url: impl IntoUrl,
+	path: impl AsRef<Path>,
+	client: &Client,
+	priority: DownloadPriority,
+	hashes: &ExpectedHashes,
+) -> anyhow::Result<()> {
+	let url = url.into_url().context("Invalid URL")?;
+	let path = path.as_ref();
+	for (mirror, mirror_url) in mirror::get_mirror_urls(&url, hashes) {
+		// The hashes are checked the same way as with the origin, so a bad mirror
+		// can't give us the wrong file
+		match file_verified_direct(mirror_url, path, client, priority, hashes).await {
+			Ok(()) => {
+				mirror::report_success(mirror);
+				return Ok(());
+			}
+			Err(e) => mirror::report_failure(mirror, &e),
+		}
+	}
+
+	file_verified_direct(url, path, client, priority, hashes).await
+}
+
+/// Same as `file_verified`, but always downloads from the URL without trying any mirrors
+pub async fn file_verified_direct(
+	url: impl IntoUrl,
+	path: impl AsRef<Path>,
+	client: &Client,
+	priority: DownloadPriority,
+	hashes: &ExpectedHashes,
+) -> anyhow::Result<()> {
+	let path = path.as_ref();
+	let temp_path = get_temp_path(path);
+	let request = create_request(url, client)?;
+
+	let resumable = hashes.is_some();
+	let offset = if resumable {
+		get_file_len(&temp_path).await
+	} else {
+		0
+	};
+
+	let mut result = stream_to_file(&request, &temp_path, offset, client, priority, hashes).await;
+	// The partial file may have been stale, or the server may not like our range,
+	// so start over from the beginning. Other errors, like the connection dropping
+	// again, keep the partial file so that the next attempt can still resume it
+	if offset > 0 && matches!(result, Err(StreamError::Restart(..))) {
+		let _ = tokio::fs::remove_file(&temp_path).await;
+		result = stream_to_file(&request, &temp_path, 0, client, priority, hashes).await;
+	}
+	if let Err(e) = result {
+		if !resumable || get_file_len(&temp_path).await == 0 {
+			let _ = tokio::fs::remove_file(&temp_path).await;
+		}
+		return Err(e.into_inner());
+	}
+
+	tokio::fs::rename(&temp_path, path).await.with_context(|| {
 		format!(
-			"Failed to write downloaded contents to path {}",
-			path.as_ref().display()
+			"Failed to move downloaded contents to path {}",
+			path.display()
 		)
 	})?;
 
 	Ok(())
 }
 
+/// Get the length of a file, or zero if it doesn't exist
+async fn get_file_len(path: &Path) -> u64 {
+	tokio::fs::metadata(path)
+		.await
+		.map(|x| x.len())
+		.unwrap_or(0)
+}
+
+/// A failed attempt at streaming a download into a file
+enum StreamError {
+	/// The partial file can't be continued, because its contents are wrong or because
+	/// the server won't send the rest of it, so the download has to start over
+	Restart(anyhow::Error),
+	/// Any other error, like a network error. The partial file is still fine to resume
+	Other(anyhow::Error),
+}
+
+impl StreamError {
+	fn into_inner(self) -> anyhow::Error {
+		match self {
+			Self::Restart(e) | Self::Other(e) => e,
+		}
+	}
+}
+
+impl From<anyhow::Error> for StreamError {
+	fn from(value: anyhow::Error) -> Self {
+		Self::Other(value)
+	}
+}
+
+/// Streams a download into a file and checks its hashes. If the offset is not zero,
+/// only the rest of the file after that many bytes is requested and appended to the
+/// existing contents. Files with mismatched hashes are removed. The file is written
+/// asynchronously so that lots of concurrent downloads don't hold up the runtime threads
+async fn stream_to_file(
+	request: &Request,
+	path: &Path,
+	offset: u64,
+	client: &Client,
+	priority: DownloadPriority,
+	hashes: &ExpectedHashes,
+) -> Result<(), StreamError> {
+	let mut request = request.try_clone().context("Failed to copy request")?;
+	if offset > 0 {
+		let range = HeaderValue::from_str(&format!("bytes={offset}-"))
+			.context("Failed to create range header")?;
+		request.headers_mut().insert(RANGE, range);
+	}
+	let (mut resp, permit) = match execute_scheduled(&request, client, priority).await {
+		Ok(result) => result,
+		Err(e) => {
+			let e = e.context("Failed to download data");
+			return Err(if is_range_not_satisfiable(&e) {
+				StreamError::Restart(e)
+			} else {
+				StreamError::Other(e)
+			});
+		}
+	};
+
+	let mut hasher = StreamHasher::new(hashes);
+	// Servers that ignore the range will just send the whole file again
+	let resuming = offset > 0 && resp.status() == StatusCode::PARTIAL_CONTENT;
+	let file = if resuming {
+		if get_range_start(&resp) != Some(offset) {
+			return Err(StreamError::Restart(anyhow!(
+				"Server responded with a different range than was requested"
+			)));
+		}
+		hasher = hash_existing(path.to_owned(), hasher)
+			.await
+			.context("Failed to hash partial download")
+			.map_err(StreamError::Restart)?;
+		tokio::fs::OpenOptions::new().append(true).open(path).await
+	} else {
+		tokio::fs::File::create(path).await
+	};
+	let mut file = tokio::io::BufWriter::new(
+		file.with_context(|| format!("Failed to open file {} for download", path.display()))?,
+	);
+
+	let mut total = 0;
+	while let Some(chunk) = resp.chunk().await.context("Failed to download chunk")? {
+		hasher.update(&chunk);
+		file.write_all(&chunk)
+			.await
+			.context("Failed to write downloaded bytes")?;
+		total += chunk.len();
+	}
+	file.flush()
+		.await
+		.context("Failed to flush downloaded file")?;
+	permit.report_success(total);
+
+	let result = hasher.check(hashes);
+	if result.is_err() {
+		drop(file);
+		let _ = tokio::fs::remove_file(path).await;
+	}
+	result.map_err(StreamError::Restart)
+}
+
+/// Check whether a request failed because the server can't send the range we asked for
+fn is_range_not_satisfiable(error: &anyhow::Error) -> bool {
+	error.chain().any(|x| {
+		x.downcast_ref::<reqwest::Error>()
+			.is_some_and(|x| x.status() == Some(StatusCode::RANGE_NOT_SATISFIABLE))
+	})
+}
+
+/// Feed the existing contents of a partially downloaded file into a hasher. The file
+/// can be large, so it is read on a blocking thread
+async fn hash_existing(path: PathBuf, mut hasher: StreamHasher) -> anyhow::Result<StreamHasher> {
+	tokio::task::spawn_blocking(move || {
+		let mut file = BufReader::new(File::open(path)?);
+		let mut buf = [0u8; 64 * 1024];
+		loop {
+			let len = file.read(&mut buf)?;
+			if len == 0 {
+				break;
+			}
+			hasher.update(&buf[..len]);
+		}
+		Ok::<_, std::io::Error>(hasher)
+	})
+	.await
+	.context("Hashing task failed")?
+	.context("Failed to read partial download")
+}
+
+/// Get the first byte of the range that a partial response contains
+fn get_range_start(resp: &reqwest::Response) -> Option<u64> {
+	parse_range_start(resp.headers().get(CONTENT_RANGE)?.to_str().ok()?)
+}
+
+/// Parse the first byte from a Content-Range header value like `bytes 100-199/200`
+fn parse_range_start(header: &str) -> Option<u64> {
+	let range = header.trim().strip_prefix("bytes ")?;
+	let (start, _) = range.split_once('-')?;
+	start.trim().parse().ok()
+}
+
+/// Get the temporary path that a file is downloaded to before it is complete
+pub fn get_temp_path(path: &Path) -> PathBuf {
+	let mut file_name = path.file_name().unwrap_or_default().to_owned();
+	file_name.push(".part");
+	path.with_file_name(file_name)
+}
+
+/// Incrementally computes the hashes of a stream of data
+struct StreamHasher {
+	sha1: Option<Sha1>,
+	sha256: Option<Sha256>,
+	sha512: Option<Sha512>,
+}
+
+impl StreamHasher {
+	fn new(hashes: &ExpectedHashes) -> Self {
+		Self {
+			sha1: hashes.sha1.as_ref().map(|_| Sha1::new()),
+			sha256: hashes.sha256.as_ref().map(|_| Sha256::new()),
+			sha512: hashes.sha512.as_ref().map(|_| Sha512::new()),
+		}
+	}
+
+	fn update(&mut self, data: &[u8]) {
+		if let Some(hasher) = &mut self.sha1 {
+			hasher.update(data);
+		}
+		if let Some(hasher) = &mut self.sha256 {
+			hasher.update(data);
+		}
+		if let Some(hasher) = &mut self.sha512 {
+			hasher.update(data);
+		}
+	}
+
+	fn check(self, hashes: &ExpectedHashes) -> anyhow::Result<()> {
+		fn check_one(
+			name: &str,
+			actual: Option<Vec<u8>>,
+			expected: &Option<String>,
+		) -> anyhow::Result<()> {
+			if let (Some(actual), Some(expected)) = (actual, expected) {
+				let actual = hex::encode(actual);
+				ensure!(
+					actual.eq_ignore_ascii_case(expected),
+					"{name} checksum of downloaded file did not match (expected {expected}, got {actual})"
+				);
+			}
+			Ok(())
+		}
+
+		check_one(
+			"SHA-1",
+			self.sha1.map(|x| x.finalize().to_vec()),
+			&hashes.sha1,
+		)?;
+		check_one(
+			"SHA-256",
+			self.sha256.map(|x| x.finalize().to_vec()),
+			&hashes.sha256,
+		)?;
+		check_one(
+			"SHA-512",
+			self.sha512.map(|x| x.finalize().to_vec()),
+			&hashes.sha512,
+		)?;
+
+		Ok(())
+	}
+}
+
 /// Downloads and deserializes the contents into JSON
 pub async fn json<T: DeserializeOwned>(url: impl IntoUrl, client: &Client) -> anyhow::Result<T> {
-	download(url, client)
-		.await
-		.context("Failed to download JSON data")?
-		.json()
+	let bytes = bytes(url, client)
 		.await
-		.context("Failed to parse JSON")
+		.context("Failed to download JSON data")?;
+	serde_json::from_slice(&bytes).context("Failed to parse JSON")
 }
 
 /// A persistent single download that can be used to track progress
@@ -106,6 +539,7 @@ pub struct ProgressiveDownload<W: Write> {
 	content_length: u64,
 	bytes_downloaded: usize,
 	finished: bool,
+	permit: Option<DownloadPermit>,
 }
 
 impl<W: Write> ProgressiveDownload<W> {
@@ -117,9 +551,21 @@ impl<W: Write> ProgressiveDownload<W> {
 			writer,
 			bytes_downloaded: 0,
 			finished: false,
+			permit: None,
 		}
 	}
 
+	/// Create a new ProgressiveDownload from a response that was given a turn by the scheduler
+	pub(crate) fn from_scheduled_response(
+		response: reqwest::Response,
+		permit: DownloadPermit,
+		writer: W,
+	) -> Self {
+		let mut out = Self::from_response(response, writer);
+		out.permit = Some(permit);
+		out
+	}
+
 	/// Get the number of bytes that have been downloaded
 	pub fn get_downloaded(&self) -> usize {
 		self.bytes_downloaded
@@ -156,6 +602,10 @@ impl<W: Write> ProgressiveDownload<W> {
 				self.get_downloaded() == self.get_total_length(),
 				"Bytes downloaded did not equal the amount expected"
 			);
+			// Give the turn back to the scheduler now that the transfer is done
+			if let Some(permit) = self.permit.take() {
+				permit.report_success(self.bytes_downloaded);
+			}
 		}
 
 		Ok(())
@@ -168,32 +618,34 @@ impl<W: Write> ProgressiveDownload<W> {
 }
 
 impl ProgressiveDownload<BufWriter<File>> {
-	/// Create a new ProgressiveDownload that downloads a file
+	/// Create a new ProgressiveDownload that downloads a file. These downloads are
+	/// given high priority by the scheduler since they usually block other work
 	pub async fn file(
 		url: impl IntoUrl,
 		path: impl AsRef<Path>,
 		client: &Client,
 	) -> anyhow::Result<Self> {
 		let file = BufWriter::new(File::create(path).context("Failed to open file")?);
-		let response = download(url, client)
+		let (response, permit) = download_scheduled(url, client, DownloadPriority::High)
 			.await
 			.context("Failed to get response")?;
 
-		Ok(Self::from_response(response, file))
+		Ok(Self::from_scheduled_response(response, permit, file))
 	}
 }
 
 impl ProgressiveDownload<Cursor<Vec<u8>>> {
-	/// Create a new ProgressiveDownload that downloads bytes
+	/// Create a new ProgressiveDownload that downloads bytes. These downloads are
+	/// given high priority by the scheduler since they usually block other work
 	pub async fn bytes(url: impl IntoUrl, client: &Client) -> anyhow::Result<Self> {
-		let response = download(url, client)
+		let (response, permit) = download_scheduled(url, client, DownloadPriority::High)
 			.await
 			.context("Failed to get response")?;
 		let cursor = Cursor::new(Vec::with_capacity(
 			response.content_length().unwrap_or_default() as usize,
 		));
 
-		Ok(Self::from_response(response, cursor))
+		Ok(Self::from_scheduled_response(response, permit, cursor))
 	}
 
 	/// Consume the download and get the resulting bytes
@@ -215,3 +667,37 @@ pub fn validate_url(url: &str) -> anyhow::Result<()> {
 
 	Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_stream_hasher() {
+		let hashes = ExpectedHashes::sha1(Some("f7ff9e8b7bb2e09b70935a5d785e0cc5d9d0abf0".into()));
+		let mut hasher = StreamHasher::new(&hashes);
+		hasher.update(b"Hel");
+		hasher.update(b"lo");
+		assert!(hasher.check(&hashes).is_ok());
+
+		let mut hasher = StreamHasher::new(&hashes);
+		hasher.update(b"Goodbye");
+		assert!(hasher.check(&hashes).is_err());
+	}
+
+	#[test]
+	fn test_temp_path() {
+		assert_eq!(
+			get_temp_path(Path::new("foo/bar.jar")),
+			PathBuf::from("foo/bar.jar.part")
+		);
+	}
+
+	#[test]
+	fn test_range_start_parsing() {
+		assert_eq!(parse_range_start("bytes 100-199/200"), Some(100));
+		assert_eq!(parse_range_start("bytes 0-0/*"), Some(0));
+		assert_eq!(parse_range_start("bytes */200"), None);
+		assert_eq!(parse_range_start("items 1-2/3"), None);
+	}
+}
@@ -1,9 +1,15 @@
 //! Note: The asynchronous functions in this library expect the use of the Tokio runtime and may panic
 //! if it is not used
 
+/// Caching of metadata responses with conditional requests
+pub mod cache;
 /// Download utilities
 pub mod download;
+/// Downloading files from content-addressed mirrors and running a mirror server
+pub mod mirror;
 /// Interacting with the Modrinth API
 pub mod modrinth;
+/// Scheduling of concurrent downloads
+pub mod scheduler;
 /// Interacting with the Smithed API
 pub mod smithed;
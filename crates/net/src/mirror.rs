@@ -0,0 +1,525 @@
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, OnceLock};
+
+use anyhow::{ensure, Context};
+use reqwest::{StatusCode, Url};
+use tokio::io::{
+	AsyncBufRead, AsyncBufReadExt, AsyncReadExt, AsyncWrite, AsyncWriteExt, BufReader,
+};
+use tokio::net::{TcpListener, TcpStream, ToSocketAddrs};
+
+use crate::download::{self, Client, DownloadPriority, ExpectedHashes};
+
+/// How many requests to a mirror can fail before it is no longer used for the rest of the process
+const MAX_MIRROR_FAILURES: usize = 3;
+/// The longest that the request line or a header sent to the mirror server can be
+const MAX_LINE_LENGTH: u64 = 8 * 1024;
+
+/// The domains that a mirror server downloads missing files from by default. These are the
+/// places that game files, libraries, Java, and addons come from. Subdomains are allowed too
+pub const DEFAULT_ALLOWED_HOSTS: &[&str] = &[
+	"mojang.com",
+	"minecraft.net",
+	"modrinth.com",
+	"fabricmc.net",
+	"quiltmc.org",
+	"minecraftforge.net",
+	"neoforged.net",
+	"papermc.io",
+	"spongepowered.org",
+	"forgecdn.net",
+	"adoptium.net",
+	"azul.com",
+	"oracle.com",
+	"github.com",
+	"githubusercontent.com",
+];
+
+/// The configured mirrors. These are tried in order before the origin of a file
+static MIRRORS: OnceLock<Vec<Mirror>> = OnceLock::new();
+
+/// A mirror that files can be downloaded from by their hash
+struct Mirror {
+	/// The base URL of the mirror, which always ends with a slash
+	base: Url,
+	/// How many requests to the mirror have failed in a row
+	failures: AtomicUsize,
+}
+
+impl Mirror {
+	fn new(mut base: Url) -> Self {
+		// Without the trailing slash, joining would replace the last segment of the path
+		if !base.path().ends_with('/') {
+			let path = format!("{}/", base.path());
+			base.set_path(&path);
+		}
+		Self {
+			base,
+			failures: AtomicUsize::new(0),
+		}
+	}
+
+	fn is_disabled(&self) -> bool {
+		self.failures.load(Ordering::Relaxed) >= MAX_MIRROR_FAILURES
+	}
+}
+
+/// Set the mirrors that files with known hashes are downloaded from before their origin.
+/// This has to be done before anything is downloaded, and only the first call does anything.
+/// If it is never called, the comma-separated URLs in `MCVM_MIRRORS` are used instead.
+/// Returns false if the mirrors were already set
+pub fn set_mirrors(urls: Vec<Url>) -> bool {
+	MIRRORS
+		.set(urls.into_iter().map(Mirror::new).collect())
+		.is_ok()
+}
+
+/// Check whether any mirrors are configured
+pub fn is_enabled() -> bool {
+	!mirrors().is_empty()
+}
+
+fn mirrors() -> &'static [Mirror] {
+	MIRRORS.get_or_init(|| {
+		let Ok(env) = std::env::var("MCVM_MIRRORS") else {
+			return Vec::new();
+		};
+		env.split(',')
+			.filter_map(|x| Url::parse(x.trim()).ok())
+			.map(Mirror::new)
+			.collect()
+	})
+}
+
+/// Get the URLs that a file can be downloaded from on each of the usable mirrors, along with
+/// the index of the mirror. Files without a hash can't be looked up on a mirror
+pub(crate) fn get_mirror_urls(origin: &Url, hashes: &ExpectedHashes) -> Vec<(usize, Url)> {
+	let Some(key) = ContentKey::from_hashes(hashes) else {
+		return Vec::new();
+	};
+
+	mirrors()
+		.iter()
+		.enumerate()
+		.filter(|(_, mirror)| !mirror.is_disabled())
+		.filter_map(|(i, mirror)| Some((i, key.get_url(&mirror.base, origin)?)))
+		.collect()
+}
+
+/// Report that a download from a mirror succeeded
+pub(crate) fn report_success(mirror: usize) {
+	if let Some(mirror) = mirrors().get(mirror) {
+		mirror.failures.store(0, Ordering::Relaxed);
+	}
+}
+
+/// Report that a download from a mirror failed. Only failures of the mirror itself count
+/// against it. A file that the mirror doesn't have, or couldn't get from the origin, is
+/// not a sign that the mirror is broken
+pub(crate) fn report_failure(mirror: usize, error: &anyhow::Error) {
+	if !is_mirror_fault(error) {
+		return;
+	}
+	if let Some(mirror) = mirrors().get(mirror) {
+		mirror.failures.fetch_add(1, Ordering::Relaxed);
+	}
+}
+
+/// Check whether a failed download was caused by the mirror, either because it couldn't be
+/// reached or because it had an internal error. Bad Gateway and Gateway Timeout mean that the
+/// origin of the file failed instead
+fn is_mirror_fault(error: &anyhow::Error) -> bool {
+	error
+		.chain()
+		.filter_map(|x| x.downcast_ref::<reqwest::Error>())
+		.any(|x| match x.status() {
+			Some(status) => {
+				status.is_server_error()
+					&& status != StatusCode::BAD_GATEWAY
+					&& status != StatusCode::GATEWAY_TIMEOUT
+			}
+			None => x.is_connect() || x.is_timeout() || x.is_request() || x.is_body(),
+		})
+}
+
+/// The hash that a file is stored under in a mirror
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+struct ContentKey {
+	/// The name of the hash algorithm
+	algorithm: &'static str,
+	/// The lowercase hex hash
+	hash: String,
+}
+
+impl ContentKey {
+	/// Create a key using the strongest of a set of hashes
+	fn from_hashes(hashes: &ExpectedHashes) -> Option<Self> {
+		let (algorithm, hash) = if let Some(hash) = &hashes.sha512 {
+			("sha512", hash)
+		} else if let Some(hash) = &hashes.sha256 {
+			("sha256", hash)
+		} else {
+			("sha1", hashes.sha1.as_ref()?)
+		};
+
+		Self::parse(algorithm, hash)
+	}
+
+	/// Parse a key from the name of an algorithm and a hex hash, making sure that the
+	/// hash is actually the right length and can be used as a file name
+	fn parse(algorithm: &str, hash: &str) -> Option<Self> {
+		let (algorithm, len) = match algorithm {
+			"sha1" => ("sha1", 40),
+			"sha256" => ("sha256", 64),
+			"sha512" => ("sha512", 128),
+			_ => return None,
+		};
+		if hash.len() != len || !hash.bytes().all(|x| x.is_ascii_hexdigit()) {
+			return None;
+		}
+
+		Some(Self {
+			algorithm,
+			hash: hash.to_ascii_lowercase(),
+		})
+	}
+
+	/// Get the URL of the file on a mirror. The origin is included so that the mirror can
+	/// download the file itself if it doesn't have it yet
+	fn get_url(&self, base: &Url, origin: &Url) -> Option<Url> {
+		let mut url = base
+			.join(&format!("cas/{}/{}", self.algorithm, self.hash))
+			.ok()?;
+		url.query_pairs_mut().append_pair("url", origin.as_str());
+		Some(url)
+	}
+
+	/// Get the hashes that a file with this key must have
+	fn get_hashes(&self) -> ExpectedHashes {
+		let hash = Some(self.hash.clone());
+		match self.algorithm {
+			"sha512" => ExpectedHashes {
+				sha512: hash,
+				..Default::default()
+			},
+			"sha256" => ExpectedHashes {
+				sha256: hash,
+				..Default::default()
+			},
+			_ => ExpectedHashes::sha1(hash),
+		}
+	}
+
+	/// Get the path that the file with this key is stored at in a store directory. Files are
+	/// split up by the start of their hash so that no single directory gets too big
+	fn get_store_path(&self, dir: &Path) -> PathBuf {
+		dir.join(self.algorithm)
+			.join(&self.hash[..2])
+			.join(&self.hash)
+	}
+}
+
+/// Run a mirror server that other machines can use as one of their mirrors. Files are kept in
+/// a content-addressed store in the directory. When a file that isn't in the store is requested,
+/// it is downloaded from the origin URL in the request, and only stored if it has the right hash.
+///
+/// Files are only downloaded from origins on the allowed hosts, or their subdomains, so that the
+/// server can't be used to make requests to anything else. The server has no authentication, so
+/// it should still only be reachable from a network that you trust
+pub async fn serve(
+	addr: impl ToSocketAddrs,
+	dir: PathBuf,
+	allowed_hosts: Vec<String>,
+	client: Client,
+) -> anyhow::Result<()> {
+	std::fs::create_dir_all(&dir).context("Failed to create mirror store directory")?;
+	let listener = TcpListener::bind(addr)
+		.await
+		.context("Failed to bind mirror server")?;
+	let server = Arc::new(MirrorServer {
+		dir,
+		allowed_hosts: allowed_hosts
+			.into_iter()
+			.map(|x| x.trim_matches('.').to_ascii_lowercase())
+			.collect(),
+		client,
+		filling: Mutex::new(HashMap::new()),
+	});
+
+	loop {
+		let (stream, _) = listener
+			.accept()
+			.await
+			.context("Failed to accept connection")?;
+		let server = server.clone();
+		tokio::spawn(async move {
+			// A client that goes away or sends garbage only affects its own connection
+			let _ = server.handle_connection(stream).await;
+		});
+	}
+}
+
+/// State of a running mirror server
+struct MirrorServer {
+	dir: PathBuf,
+	/// The lowercase domains that files can be downloaded from
+	allowed_hosts: Vec<String>,
+	client: Client,
+	/// Locks for the files that are being downloaded into the store, so that
+	/// many clients asking for the same new file only download it once
+	filling: Mutex<HashMap<ContentKey, Arc<tokio::sync::Mutex<()>>>>,
+}
+
+/// A response from the mirror server
+enum Reply {
+	/// Send a file from the store
+	File(PathBuf),
+	/// Send a status with no file
+	Status(u16, &'static str),
+}
+
+impl MirrorServer {
+	/// Handle the HTTP/1.1 requests on a connection until it is closed
+	async fn handle_connection(&self, stream: TcpStream) -> anyhow::Result<()> {
+		let (read, mut write) = stream.into_split();
+		let mut read = BufReader::new(read);
+		let mut line = String::new();
+		loop {
+			if read_line(&mut read, &mut line).await? == 0 {
+				return Ok(());
+			}
+			let mut parts = line.split_whitespace();
+			let method = parts.next().unwrap_or_default().to_string();
+			let target = parts.next().unwrap_or_default().to_string();
+			let mut keep_alive = parts.next() != Some("HTTP/1.0");
+
+			// Nothing in the headers matters to us besides whether to close the connection
+			loop {
+				if read_line(&mut read, &mut line).await? == 0 {
+					return Ok(());
+				}
+				let header = line.trim_end();
+				if header.is_empty() {
+					break;
+				}
+				if let Some((name, value)) = header.split_once(':') {
+					if name.eq_ignore_ascii_case("connection") {
+						keep_alive = !value.trim().eq_ignore_ascii_case("close");
+					}
+				}
+			}
+
+			let reply = match method.as_str() {
+				"GET" | "HEAD" => self.get(&target).await,
+				_ => Reply::Status(405, "Method Not Allowed"),
+			};
+			write_reply(&mut write, reply, method == "HEAD", keep_alive).await?;
+			if !keep_alive {
+				return Ok(());
+			}
+		}
+	}
+
+	/// Get the reply to a request for a path like `/cas/sha1/<hash>?url=<origin>`
+	async fn get(&self, target: &str) -> Reply {
+		if !target.starts_with('/') {
+			return Reply::Status(400, "Bad Request");
+		}
+		let Ok(url) = Url::parse(&format!("http://mirror{target}")) else {
+			return Reply::Status(400, "Bad Request");
+		};
+		let segments: Vec<_> = url.path_segments().into_iter().flatten().collect();
+		let key = match segments[..] {
+			["cas", algorithm, hash] => ContentKey::parse(algorithm, hash),
+			_ => None,
+		};
+		let Some(key) = key else {
+			return Reply::Status(404, "Not Found");
+		};
+
+		let path = key.get_store_path(&self.dir);
+		if path.exists() {
+			return Reply::File(path);
+		}
+
+		let origin = url
+			.query_pairs()
+			.find(|(name, _)| name == "url")
+			.and_then(|(_, value)| Url::parse(&value).ok())
+			.filter(|x| x.scheme() == "https" || x.scheme() == "http");
+		let Some(origin) = origin else {
+			return Reply::Status(404, "Not Found");
+		};
+		if !is_host_allowed(&origin, &self.allowed_hosts) {
+			return Reply::Status(403, "Forbidden");
+		}
+		match self.fill(&key, origin, &path).await {
+			Ok(()) => Reply::File(path),
+			Err(_) => Reply::Status(502, "Bad Gateway"),
+		}
+	}
+
+	/// Download a file into the store from its origin
+	async fn fill(&self, key: &ContentKey, origin: Url, path: &Path) -> anyhow::Result<()> {
+		let lock = {
+			let mut filling = self.filling.lock().unwrap_or_else(|x| x.into_inner());
+			filling.entry(key.clone()).or_default().clone()
+		};
+
+		let result = async {
+			let _guard = lock.lock().await;
+			// Someone else may have filled it while we were waiting
+			if path.exists() {
+				return Ok(());
+			}
+			if let Some(parent) = path.parent() {
+				std::fs::create_dir_all(parent).context("Failed to create store directory")?;
+			}
+			// Going through other mirrors here could send requests in a circle
+			download::file_verified_direct(
+				origin,
+				path,
+				&self.client,
+				DownloadPriority::Normal,
+				&key.get_hashes(),
+			)
+			.await
+		}
+		.await;
+
+		// Only the last one waiting for the lock removes it, so that nobody ends up with a different lock
+		let mut filling = self.filling.lock().unwrap_or_else(|x| x.into_inner());
+		if Arc::strong_count(&lock) <= 2 {
+			filling.remove(key);
+		}
+
+		result
+	}
+}
+
+/// Check whether the host of a URL is one of the allowed domains or a subdomain of one
+fn is_host_allowed(url: &Url, allowed_hosts: &[String]) -> bool {
+	// IP addresses are never allowed
+	let Some(host) = url.domain() else {
+		return false;
+	};
+	let host = host.trim_end_matches('.').to_ascii_lowercase();
+	allowed_hosts.iter().any(|allowed| {
+		host == *allowed
+			|| host
+				.strip_suffix(allowed.as_str())
+				.is_some_and(|x| x.ends_with('.'))
+	})
+}
+
+/// Read a single line of a request, which can't be too long
+async fn read_line(
+	reader: &mut (impl AsyncBufRead + Unpin),
+	line: &mut String,
+) -> anyhow::Result<usize> {
+	line.clear();
+	let len = (&mut *reader)
+		.take(MAX_LINE_LENGTH)
+		.read_line(line)
+		.await
+		.context("Failed to read request")?;
+	ensure!(
+		len == 0 || line.ends_with('\n'),
+		"Request line was too long"
+	);
+	Ok(len)
+}
+
+/// Write a reply to a request
+async fn write_reply(
+	write: &mut (impl AsyncWrite + Unpin),
+	reply: Reply,
+	head: bool,
+	keep_alive: bool,
+) -> anyhow::Result<()> {
+	let connection = if keep_alive { "keep-alive" } else { "close" };
+	match reply {
+		Reply::File(path) => {
+			let mut file = tokio::fs::File::open(&path)
+				.await
+				.context("Failed to open stored file")?;
+			let len = file
+				.metadata()
+				.await
+				.context("Failed to get stored file length")?
+				.len();
+			let header = format!(
+				"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: {len}\r\nConnection: {connection}\r\n\r\n"
+			);
+			write.write_all(header.as_bytes()).await?;
+			if !head {
+				tokio::io::copy(&mut file, write)
+					.await
+					.context("Failed to send stored file")?;
+			}
+		}
+		Reply::Status(code, reason) => {
+			let response = format!(
+				"HTTP/1.1 {code} {reason}\r\nContent-Type: text/plain\r\nContent-Length: {}\r\nConnection: {connection}\r\n\r\n",
+				reason.len()
+			);
+			write.write_all(response.as_bytes()).await?;
+			if !head {
+				write.write_all(reason.as_bytes()).await?;
+			}
+		}
+	}
+	write.flush().await.context("Failed to send reply")?;
+
+	Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_content_key() {
+		let sha1 = "A94A8FE5CCB19BA61C4C0873D391E987982FBBD3";
+		let hashes = ExpectedHashes::sha1(Some(sha1.into()));
+		let key = ContentKey::from_hashes(&hashes).expect("Key should be created");
+		assert_eq!(key.algorithm, "sha1");
+		assert_eq!(key.hash, sha1.to_ascii_lowercase());
+		assert_eq!(
+			key.get_store_path(Path::new("store")),
+			Path::new("store/sha1/a9").join(&key.hash)
+		);
+
+		let base = Mirror::new(Url::parse("http://cache.lan:8000/mcvm").unwrap()).base;
+		let origin = Url::parse("https://example.com/file.jar?a=b").unwrap();
+		let url = key.get_url(&base, &origin).unwrap();
+		assert_eq!(url.path(), format!("/mcvm/cas/sha1/{}", key.hash));
+		let (_, value) = url.query_pairs().next().unwrap();
+		assert_eq!(value, origin.as_str());
+
+		assert!(ContentKey::parse("sha1", "../../etc/passwd").is_none());
+		assert!(ContentKey::parse("md5", "a94a8fe5ccb19ba61c4c0873d391e987").is_none());
+		assert!(ContentKey::from_hashes(&ExpectedHashes::default()).is_none());
+	}
+
+	#[test]
+	fn test_allowed_hosts() {
+		let allowed: Vec<_> = DEFAULT_ALLOWED_HOSTS
+			.iter()
+			.map(|x| x.to_string())
+			.collect();
+		let check = |url: &str| is_host_allowed(&Url::parse(url).unwrap(), &allowed);
+		assert!(check(
+			"https://piston-data.mojang.com/v1/objects/abc/client.jar"
+		));
+		assert!(check("https://cdn.modrinth.com/data/foo.jar"));
+		assert!(check("https://MODRINTH.com/"));
+		assert!(!check("https://notmodrinth.com/"));
+		assert!(!check("https://modrinth.com.evil.example/"));
+		assert!(!check("http://127.0.0.1/"));
+		assert!(!check("http://[::1]/"));
+		assert!(!check("http://localhost:8080/"));
+	}
+}
@@ -45,6 +45,9 @@ pub struct Project {
 	pub license: License,
 	/// The gallery items of the project
 	pub gallery: Option<Vec<GalleryEntry>>,
+	/// When the project or any of its versions were last changed
+	#[serde(default)]
+	pub updated: Option<String>,
 }
 
 /// The type of a Modrinth project
@@ -0,0 +1,387 @@
+use std::cmp::Ordering;
+use std::collections::{BinaryHeap, HashMap};
+use std::sync::{Arc, Mutex, MutexGuard, OnceLock};
+use std::time::{Duration, Instant};
+
+use mcvm_shared::timing;
+use tokio::sync::oneshot;
+
+use crate::download::get_transfer_limit;
+
+/// The number of concurrent transfers a host starts out with
+const INITIAL_HOST_LIMIT: usize = 16;
+/// The longest amount of time that a host will be paused for after rate limiting us
+const MAX_PAUSE: Duration = Duration::from_secs(60);
+/// How long a host is paused for after rate limiting us if it doesn't say
+const DEFAULT_PAUSE: Duration = Duration::from_secs(1);
+
+/// Priority of a download. Downloads with higher priority are always started
+/// before waiting downloads with lower priority
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Default)]
+pub enum DownloadPriority {
+	/// Files that are not needed soon, like sounds or prefetched files
+	Low,
+	/// Most files
+	#[default]
+	Normal,
+	/// Files that are needed before anything else can happen, like the game JAR and libraries
+	High,
+}
+
+/// Shared scheduler for downloads that bounds the total number of concurrent transfers,
+/// gives each host its own concurrency limit that adapts to its throughput and rate limiting,
+/// and starts downloads in order of priority
+#[derive(Clone)]
+pub struct DownloadScheduler {
+	state: Arc<Mutex<SchedulerState>>,
+}
+
+impl DownloadScheduler {
+	/// Create a new scheduler with a limit for the total number of concurrent transfers
+	pub fn new(total_limit: usize) -> Self {
+		Self {
+			state: Arc::new(Mutex::new(SchedulerState {
+				total_limit: total_limit.max(1),
+				total_active: 0,
+				hosts: HashMap::new(),
+				next_seq: 0,
+			})),
+		}
+	}
+
+	/// Get the scheduler that is shared by the whole process
+	pub fn global() -> &'static Self {
+		static GLOBAL: OnceLock<DownloadScheduler> = OnceLock::new();
+		GLOBAL.get_or_init(|| Self::new(get_transfer_limit()))
+	}
+
+	/// Wait for a turn to download from a host. The transfer must be finished before the
+	/// returned permit is dropped
+	pub async fn acquire(&self, host: &str, priority: DownloadPriority) -> DownloadPermit {
+		let (sender, receiver) = oneshot::channel();
+		let host: Arc<str> = host.into();
+		{
+			let mut state = lock(&self.state);
+			let total_limit = state.total_limit;
+			let seq = state.next_seq;
+			state.next_seq += 1;
+			state
+				.hosts
+				.entry(host.clone())
+				.or_insert_with(|| HostState::new(total_limit))
+				.queue
+				.push(Waiter {
+					priority,
+					seq,
+					sender,
+				});
+			state.dispatch();
+		}
+
+		let mut pending = PendingPermit {
+			state: self.state.clone(),
+			host: host.clone(),
+			receiver,
+			granted: false,
+		};
+		// The sender is only dropped without sending if the scheduler is gone, which can't
+		// happen since we hold a reference to it
+		let _ = (&mut pending.receiver).await;
+		pending.granted = true;
+
+		DownloadPermit {
+			state: self.state.clone(),
+			host,
+			start: Instant::now(),
+		}
+	}
+
+	/// Change the limit for the total number of concurrent transfers. Transfers that are
+	/// already running are not stopped when the limit is lowered
+	pub fn set_total_limit(&self, total_limit: usize) {
+		let mut state = lock(&self.state);
+		state.total_limit = total_limit.max(1);
+		state.dispatch();
+	}
+
+	/// Get the current concurrency limit for a host
+	pub fn get_host_limit(&self, host: &str) -> Option<usize> {
+		lock(&self.state).hosts.get(host).map(|x| x.limit)
+	}
+}
+
+/// A turn to download from a host. The turn is given back to the scheduler when this is dropped
+pub struct DownloadPermit {
+	state: Arc<Mutex<SchedulerState>>,
+	host: Arc<str>,
+	start: Instant,
+}
+
+impl DownloadPermit {
+	/// Report that the transfer finished successfully so that the host limit can adapt
+	pub fn report_success(&self, bytes: usize) {
+		timing::record_download(&self.host, bytes, self.start);
+		let elapsed = self.start.elapsed().as_secs_f64().max(0.001);
+		let mut state = lock(&self.state);
+		if let Some(host) = state.hosts.get_mut(&self.host) {
+			host.on_success(bytes as f64 / elapsed);
+		}
+	}
+
+	/// Report that the host rate limited us so that it can back off
+	pub fn report_rate_limited(&self, retry_after: Option<Duration>) {
+		let pause = retry_after.unwrap_or(DEFAULT_PAUSE).min(MAX_PAUSE);
+		let mut state = lock(&self.state);
+		if let Some(host) = state.hosts.get_mut(&self.host) {
+			host.on_rate_limited(pause);
+		}
+
+		// Wake up any waiters for the host once the pause is over
+		let scheduler_state = self.state.clone();
+		tokio::spawn(async move {
+			tokio::time::sleep(pause).await;
+			lock(&scheduler_state).dispatch();
+		});
+	}
+}
+
+impl Drop for DownloadPermit {
+	fn drop(&mut self) {
+		let mut state = lock(&self.state);
+		state.release(&self.host);
+		state.dispatch();
+	}
+}
+
+/// Permit that is waiting to be granted. Gives the turn back if the waiting future
+/// is cancelled after the permit was already granted
+struct PendingPermit {
+	state: Arc<Mutex<SchedulerState>>,
+	host: Arc<str>,
+	receiver: oneshot::Receiver<()>,
+	granted: bool,
+}
+
+impl Drop for PendingPermit {
+	fn drop(&mut self) {
+		if self.granted {
+			return;
+		}
+		self.receiver.close();
+		if self.receiver.try_recv().is_ok() {
+			let mut state = lock(&self.state);
+			state.release(&self.host);
+			state.dispatch();
+		}
+	}
+}
+
+struct SchedulerState {
+	total_limit: usize,
+	total_active: usize,
+	hosts: HashMap<Arc<str>, HostState>,
+	next_seq: u64,
+}
+
+impl SchedulerState {
+	/// Start as many waiting downloads as the limits allow, highest priority first
+	fn dispatch(&mut self) {
+		let now = Instant::now();
+		while self.total_active < self.total_limit {
+			let best = self
+				.hosts
+				.iter()
+				.filter(|(_, host)| host.is_available(now))
+				.filter_map(|(name, host)| Some((name, host.queue.peek()?)))
+				.max_by(|(_, a), (_, b)| a.cmp(b))
+				.map(|(name, _)| name.clone());
+			let Some(best) = best else {
+				break;
+			};
+
+			let host = self.hosts.get_mut(&best).expect("Host should exist");
+			let waiter = host.queue.pop().expect("Queue should not be empty");
+			// The waiter may have been cancelled, in which case we just move on
+			if waiter.sender.send(()).is_ok() {
+				host.active += 1;
+				self.total_active += 1;
+			}
+		}
+	}
+
+	fn release(&mut self, host: &str) {
+		if let Some(host) = self.hosts.get_mut(host) {
+			host.active = host.active.saturating_sub(1);
+		}
+		self.total_active = self.total_active.saturating_sub(1);
+	}
+}
+
+struct HostState {
+	/// Current concurrency limit
+	limit: usize,
+	/// The limit can never go higher than this
+	max_limit: usize,
+	/// Number of transfers in progress
+	active: usize,
+	/// Whether the limit is still growing exponentially
+	slow_start: bool,
+	/// Successful transfers since the limit was last changed
+	successes: usize,
+	/// Moving average of per-transfer throughput in bytes per second
+	throughput: f64,
+	/// The best throughput average that has been seen
+	peak_throughput: f64,
+	/// Time until which no new transfers will be started because of rate limiting
+	paused_until: Option<Instant>,
+	queue: BinaryHeap<Waiter>,
+}
+
+impl HostState {
+	fn new(max_limit: usize) -> Self {
+		Self {
+			limit: INITIAL_HOST_LIMIT.min(max_limit),
+			max_limit,
+			active: 0,
+			slow_start: true,
+			successes: 0,
+			throughput: 0.0,
+			peak_throughput: 0.0,
+			paused_until: None,
+			queue: BinaryHeap::new(),
+		}
+	}
+
+	fn is_available(&self, now: Instant) -> bool {
+		self.active < self.limit && self.paused_until.map_or(true, |x| now >= x)
+	}
+
+	fn on_success(&mut self, throughput: f64) {
+		self.throughput = if self.throughput == 0.0 {
+			throughput
+		} else {
+			self.throughput * 0.8 + throughput * 0.2
+		};
+		// Once we have a full round of successes at this limit, consider raising it
+		self.successes += 1;
+		if self.successes < self.limit {
+			return;
+		}
+		self.successes = 0;
+
+		// If transfers got much slower as we added more of them then we have saturated the host
+		let saturated = self.throughput < self.peak_throughput * 0.5;
+		self.peak_throughput = self.peak_throughput.max(self.throughput);
+		if saturated {
+			self.slow_start = false;
+			return;
+		}
+		self.limit = if self.slow_start {
+			self.limit * 2
+		} else {
+			self.limit + 1
+		}
+		.min(self.max_limit);
+	}
+
+	fn on_rate_limited(&mut self, pause: Duration) {
+		self.limit = (self.limit / 2).max(1);
+		self.slow_start = false;
+		self.successes = 0;
+		self.paused_until = Some(Instant::now() + pause);
+	}
+}
+
+struct Waiter {
+	priority: DownloadPriority,
+	seq: u64,
+	sender: oneshot::Sender<()>,
+}
+
+impl PartialEq for Waiter {
+	fn eq(&self, other: &Self) -> bool {
+		self.cmp(other) == Ordering::Equal
+	}
+}
+
+impl Eq for Waiter {}
+
+impl PartialOrd for Waiter {
+	fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+		Some(self.cmp(other))
+	}
+}
+
+impl Ord for Waiter {
+	fn cmp(&self, other: &Self) -> Ordering {
+		// Earlier waiters go first within the same priority
+		self.priority
+			.cmp(&other.priority)
+			.then_with(|| other.seq.cmp(&self.seq))
+	}
+}
+
+fn lock(state: &Mutex<SchedulerState>) -> MutexGuard<SchedulerState> {
+	state.lock().unwrap_or_else(|x| x.into_inner())
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_waiter_order() {
+		let mut queue = BinaryHeap::new();
+		for (priority, seq) in [
+			(DownloadPriority::Low, 0),
+			(DownloadPriority::High, 1),
+			(DownloadPriority::Normal, 2),
+			(DownloadPriority::High, 3),
+		] {
+			let (sender, _) = oneshot::channel();
+			queue.push(Waiter {
+				priority,
+				seq,
+				sender,
+			});
+		}
+		let order: Vec<_> = std::iter::from_fn(|| queue.pop().map(|x| x.seq)).collect();
+		assert_eq!(order, vec![1, 3, 2, 0]);
+	}
+
+	#[test]
+	fn test_host_limit_adapts() {
+		let mut host = HostState::new(64);
+		assert_eq!(host.limit, INITIAL_HOST_LIMIT);
+		for _ in 0..INITIAL_HOST_LIMIT {
+			host.on_success(1000.0);
+		}
+		assert_eq!(host.limit, INITIAL_HOST_LIMIT * 2);
+
+		host.on_rate_limited(Duration::ZERO);
+		assert_eq!(host.limit, INITIAL_HOST_LIMIT);
+		for _ in 0..INITIAL_HOST_LIMIT {
+			host.on_success(1000.0);
+		}
+		assert_eq!(host.limit, INITIAL_HOST_LIMIT + 1);
+	}
+
+	#[tokio::test]
+	async fn test_scheduler_limits() {
+		let scheduler = DownloadScheduler::new(2);
+		let first = scheduler.acquire("a", DownloadPriority::Normal).await;
+		let _second = scheduler.acquire("b", DownloadPriority::Normal).await;
+
+		let waiting = {
+			let scheduler = scheduler.clone();
+			tokio::spawn(async move {
+				let _permit = scheduler.acquire("a", DownloadPriority::Low).await;
+			})
+		};
+		tokio::task::yield_now().await;
+		assert!(!waiting.is_finished());
+
+		drop(first);
+		waiting.await.unwrap();
+	}
+}
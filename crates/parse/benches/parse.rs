@@ -0,0 +1,82 @@
+use std::path::PathBuf;
+
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use mcvm_parse::lex::lex;
+use mcvm_parse::parse::{lex_and_parse, parse};
+
+/// Load the package scripts from the core repository to use as fixtures
+fn load_scripts() -> Vec<(String, String)> {
+	let dir = PathBuf::from(env!("CARGO_MANIFEST_DIR")).join("../../src/pkg/core");
+	let mut out: Vec<_> = std::fs::read_dir(&dir)
+		.expect("Failed to read core package directory")
+		.map(|x| x.expect("Failed to read core package entry").path())
+		.filter(|x| x.to_string_lossy().ends_with(".pkg.txt"))
+		.map(|x| {
+			let name = x
+				.file_name()
+				.unwrap_or_default()
+				.to_string_lossy()
+				.to_string();
+			let contents = std::fs::read_to_string(&x).expect("Failed to read package script");
+			(name, contents)
+		})
+		.collect();
+	out.sort();
+	assert!(!out.is_empty(), "No package scripts found in {dir:?}");
+
+	out
+}
+
+fn bench_parse(c: &mut Criterion) {
+	let scripts = load_scripts();
+	let total_len: usize = scripts.iter().map(|(_, x)| x.len()).sum();
+
+	let mut group = c.benchmark_group("core_scripts");
+	group.throughput(Throughput::Bytes(total_len as u64));
+	group.bench_function("lex", |b| {
+		b.iter(|| {
+			for (_, script) in &scripts {
+				black_box(lex(black_box(script)).expect("Failed to lex"));
+			}
+		})
+	});
+	group.bench_function("parse", |b| {
+		b.iter_batched(
+			|| {
+				scripts
+					.iter()
+					.map(|(_, x)| lex(x).expect("Failed to lex"))
+					.collect::<Vec<_>>()
+			},
+			|tokens| {
+				for tokens in &tokens {
+					black_box(parse(tokens.iter()).expect("Failed to parse"));
+				}
+			},
+			BatchSize::SmallInput,
+		)
+	});
+	group.bench_function("lex_and_parse", |b| {
+		b.iter(|| {
+			for (_, script) in &scripts {
+				black_box(lex_and_parse(black_box(script)).expect("Failed to parse"));
+			}
+		})
+	});
+	group.finish();
+
+	// The largest script on its own, to see how the lexer and parser scale with length
+	let (name, largest) = scripts
+		.iter()
+		.max_by_key(|(_, x)| x.len())
+		.expect("There should be at least one script");
+	let mut group = c.benchmark_group("largest_script");
+	group.throughput(Throughput::Bytes(largest.len() as u64));
+	group.bench_function(name.as_str(), |b| {
+		b.iter(|| black_box(lex_and_parse(black_box(largest)).expect("Failed to parse")))
+	});
+	group.finish();
+}
+
+criterion_group!(benches, bench_parse);
+criterion_main!(benches);
@@ -15,7 +15,7 @@ use super::lex::{TextPos, Token};
 use super::vars::Value;
 
 /// A condition that checks some property to create a boolean answer
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct Condition {
 	/// What kind of condition this is
 	pub kind: ConditionKind,
@@ -35,7 +35,7 @@ impl Condition {
 }
 
 /// Different types of conditions
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
 pub enum ConditionKind {
 	/// An inverting not
 	Not(Later<Box<ConditionKind>>),
@@ -179,7 +179,7 @@ impl ConditionKind {
 			Token::Ident(name) => {
 				if self.is_finished_parsing() {
 					let current = Box::new(self.clone());
-					match name.as_str() {
+					match *name {
 						"and" => *self = ConditionKind::And(current, Later::Empty),
 						"or" => *self = ConditionKind::Or(current, Later::Empty),
 						_ => bail!("Unknown condition combinator '{name}'"),
@@ -214,7 +214,7 @@ impl ConditionKind {
 				*val = parse_arg(tok, pos)?;
 			}
 			Self::Defined(var) => match tok {
-				Token::Ident(name) => var.fill(name.clone()),
+				Token::Ident(name) => var.fill(name.to_string()),
 				_ => unexpected_token!(tok, pos),
 			},
 			Self::Side(side) => match tok {
@@ -279,7 +279,7 @@ impl ConditionKind {
 			},
 			Self::Const(val) => match tok {
 				Token::Ident(name) => val.fill(check_enum_condition_argument(
-					match name.as_str() {
+					match *name {
 						"true" => Some(true),
 						"false" => Some(false),
 						_ => None,
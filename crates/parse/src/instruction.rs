@@ -7,6 +7,7 @@ use mcvm_shared::pkg::PackageAddonHashes;
 use mcvm_shared::util::yes_no;
 use mcvm_shared::versions::VersionPattern;
 use mcvm_shared::Side;
+use serde::{Deserialize, Serialize};
 
 use super::conditions::Condition;
 use super::lex::{TextPos, Token};
@@ -18,7 +19,7 @@ use crate::unexpected_token;
 use mcvm_shared::addon::AddonKind;
 
 /// A command / statement run in a package script
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct Instruction {
 	/// What type of instruction this is
 	pub kind: InstrKind,
@@ -27,7 +28,7 @@ pub struct Instruction {
 }
 
 /// Type of an instruction
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub enum InstrKind {
 	/// Check conditions
 	If {
@@ -146,7 +147,7 @@ pub enum InstrKind {
 }
 
 /// A non-nested else / else if block connected to an if
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct ElseBlock {
 	/// The block to run if this else succeeds
 	pub block: BlockId,
@@ -439,7 +440,7 @@ impl Instruction {
 						}
 					} else {
 						match tok {
-							Token::Ident(name) => var.fill(name.clone()),
+							Token::Ident(name) => var.fill(name.to_string()),
 							_ => unexpected_token!(tok, pos),
 						}
 					}
@@ -465,7 +466,7 @@ impl Instruction {
 							if crate::routine::is_reserved(name) {
 								bail!("Cannot use reserved routine name '{name}' in call instruction {}", pos.clone());
 							}
-							routine.fill(name.clone())
+							routine.fill(name.to_string())
 						}
 						_ => unexpected_token!(tok, pos),
 					}
@@ -488,7 +489,7 @@ impl Display for Instruction {
 pub fn parse_arg(tok: &Token, pos: &TextPos) -> anyhow::Result<Value> {
 	match tok {
 		Token::Variable(name) => Ok(Value::Var(name.to_string())),
-		Token::Str(text) => Ok(Value::Literal(text.clone())),
+		Token::Str(text) => Ok(Value::Literal(text.to_string())),
 		Token::Num(num) => Ok(Value::Literal(num.to_string())),
 		_ => unexpected_token!(tok, pos),
 	}
@@ -497,7 +498,7 @@ pub fn parse_arg(tok: &Token, pos: &TextPos) -> anyhow::Result<Value> {
 /// Parses a constant string argument
 pub fn parse_string(tok: &Token, pos: &TextPos) -> anyhow::Result<String> {
 	match tok {
-		Token::Str(text) => Ok(text.clone()),
+		Token::Str(text) => Ok(text.to_string()),
 		_ => unexpected_token!(tok, pos),
 	}
 }
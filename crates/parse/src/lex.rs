@@ -1,197 +1,295 @@
+use std::borrow::Cow;
 use std::fmt::{Debug, Display};
+use std::str::CharIndices;
 
 use crate::unexpected_token;
-use anyhow::bail;
+use anyhow::{bail, Context};
+use serde::{Deserialize, Serialize};
 
 /// Create a list of tokens from package text contents that we will
 /// then use for parsing
-pub fn lex(text: &str) -> anyhow::Result<Vec<(Token, TextPos)>> {
-	let mut tokens: Vec<(Token, TextPos)> = Vec::new();
+pub fn lex(text: &str) -> anyhow::Result<Vec<TokenAndPos>> {
+	Lexer::new(text).collect()
+}
+
+/// Lexes package text contents into tokens one at a time. The tokens borrow
+/// their text from the input, so nothing is allocated unless a string literal
+/// contains escapes
+pub struct Lexer<'src> {
+	text: &'src str,
+	chars: CharIndices<'src>,
+	state: LexState,
+	/// Whether to leave out whitespace and comments, which the parser doesn't need
+	skip_ignored: bool,
+	finished: bool,
 
 	// Positional
-	let mut line_n: usize = 1;
-	let mut last_line_i: usize = 0;
-	let mut tok_start_pos = TextPos(line_n, 0, 0);
+	line_n: usize,
+	last_line_i: usize,
+	char_i: usize,
+	tok_start_pos: TextPos,
+
+	/// Tokens that are ready to be yielded. A character can finish at most two tokens:
+	/// the one before it and a single-character one
+	ready: [Option<TokenAndPos<'src>>; 2],
+}
+
+/// The token that the lexer is in the middle of, with the byte index where its text starts
+enum LexState {
+	None,
+	Whitespace,
+	Str {
+		start: usize,
+		escape: bool,
+		/// The unescaped contents, once the string has had an escape in it
+		owned: Option<String>,
+	},
+	Comment {
+		start: usize,
+	},
+	Variable {
+		start: usize,
+	},
+	Ident {
+		start: usize,
+	},
+	Num {
+		start: usize,
+	},
+}
 
-	// Current token
-	let mut tok: Token = Token::None;
-	let mut tok_finished = false;
+impl<'src> Lexer<'src> {
+	/// Create a new lexer over text
+	pub fn new(text: &'src str) -> Self {
+		Self {
+			text,
+			chars: text.char_indices(),
+			state: LexState::None,
+			skip_ignored: false,
+			finished: false,
+			line_n: 1,
+			last_line_i: 0,
+			char_i: 0,
+			tok_start_pos: TextPos(1, 0, 0),
+			ready: [None, None],
+		}
+	}
 
-	// Specific token-related vars
-	let mut escape = false;
-	let mut num_str = String::new();
+	/// Leave out whitespace and comment tokens, for when the tokens are only going to be parsed
+	pub fn skip_ignored(mut self) -> Self {
+		self.skip_ignored = true;
+		self
+	}
 
-	for (i, c) in text.chars().enumerate() {
-		let pos = TextPos(line_n, i - last_line_i, i);
+	/// Lex the next character of the input
+	fn lex_char(&mut self, byte_i: usize, c: char) -> anyhow::Result<()> {
+		let text = self.text;
+		let pos = TextPos(self.line_n, self.char_i - self.last_line_i, self.char_i);
 		if c == '\n' {
-			line_n += 1;
+			self.line_n += 1;
 			// We add one since otherwise the next line starts at column 1 instead of 0
-			last_line_i = i + 1;
+			self.last_line_i = self.char_i + 1;
 		}
+		self.char_i += 1;
 
 		// Using this loop as a goto
 		loop {
-			let mut repeat = false;
-			match &mut tok {
-				Token::None => match c {
-					';' => {
-						tok = Token::Semicolon;
-						tok_finished = true;
-					}
-					':' => {
-						tok = Token::Colon;
-						tok_finished = true;
-					}
-					',' => {
-						tok = Token::Comma;
-						tok_finished = true;
-					}
-					'|' => {
-						tok = Token::Pipe;
-						tok_finished = true;
-					}
-					'{' => {
-						tok = Token::Curly(Side::Left);
-						tok_finished = true;
-					}
-					'}' => {
-						tok = Token::Curly(Side::Right);
-						tok_finished = true;
-					}
-					'[' => {
-						tok = Token::Square(Side::Left);
-						tok_finished = true;
-					}
-					']' => {
-						tok = Token::Square(Side::Right);
-						tok_finished = true;
-					}
-					'(' => {
-						tok = Token::Paren(Side::Left);
-						tok_finished = true;
-					}
-					')' => {
-						tok = Token::Paren(Side::Right);
-						tok_finished = true;
-					}
-					'<' => {
-						tok = Token::Angle(Side::Left);
-						tok_finished = true;
-					}
-					'>' => {
-						tok = Token::Angle(Side::Right);
-						tok_finished = true;
-					}
-					'@' => {
-						tok = Token::At;
-						tok_finished = true;
-					}
-					'!' => {
-						tok = Token::Bang;
-						tok_finished = true;
-					}
-					'"' => tok = Token::Str(String::new()),
-					'#' => tok = Token::Comment(String::new()),
-					'$' => tok = Token::Variable(String::new()),
-					c if is_whitespace(c) => tok = Token::Whitespace,
-					c if is_num(c, true) => {
-						tok = Token::Num(0);
-						num_str = c.to_string();
+			match std::mem::replace(&mut self.state, LexState::None) {
+				LexState::None => match c {
+					';' => self.finish_token(Token::Semicolon, &pos),
+					':' => self.finish_token(Token::Colon, &pos),
+					',' => self.finish_token(Token::Comma, &pos),
+					'|' => self.finish_token(Token::Pipe, &pos),
+					'{' => self.finish_token(Token::Curly(Side::Left), &pos),
+					'}' => self.finish_token(Token::Curly(Side::Right), &pos),
+					'[' => self.finish_token(Token::Square(Side::Left), &pos),
+					']' => self.finish_token(Token::Square(Side::Right), &pos),
+					'(' => self.finish_token(Token::Paren(Side::Left), &pos),
+					')' => self.finish_token(Token::Paren(Side::Right), &pos),
+					'<' => self.finish_token(Token::Angle(Side::Left), &pos),
+					'>' => self.finish_token(Token::Angle(Side::Right), &pos),
+					'@' => self.finish_token(Token::At, &pos),
+					'!' => self.finish_token(Token::Bang, &pos),
+					'"' => {
+						self.state = LexState::Str {
+							start: byte_i + 1,
+							escape: false,
+							owned: None,
+						}
 					}
-					c if is_ident(c, true) => tok = Token::Ident(c.into()),
-					_ => unexpected_token!(tok, pos),
+					'#' => self.state = LexState::Comment { start: byte_i + 1 },
+					'$' => self.state = LexState::Variable { start: byte_i + 1 },
+					c if is_whitespace(c) => self.state = LexState::Whitespace,
+					c if is_num(c, true) => self.state = LexState::Num { start: byte_i },
+					c if is_ident(c, true) => self.state = LexState::Ident { start: byte_i },
+					_ => unexpected_token!(Token::None, pos),
 				},
-				Token::Str(string) => match lex_string_char(c, escape) {
+				LexState::Str {
+					start,
+					escape,
+					mut owned,
+				} => match lex_string_char(c, escape) {
 					StrLexResult::Append => {
-						string.push(c);
-						escape = false;
+						if let Some(owned) = &mut owned {
+							owned.push(c);
+						}
+						self.state = LexState::Str {
+							start,
+							escape: false,
+							owned,
+						};
+					}
+					StrLexResult::Escape => {
+						// The string can't be borrowed from the text anymore once it skips a character
+						let owned = owned.unwrap_or_else(|| text[start..byte_i].to_string());
+						self.state = LexState::Str {
+							start,
+							escape: true,
+							owned: Some(owned),
+						};
 					}
-					StrLexResult::Escape => escape = true,
 					StrLexResult::End => {
-						escape = false;
-						tok_finished = true;
+						let string = match owned {
+							Some(owned) => Cow::Owned(owned),
+							None => Cow::Borrowed(&text[start..byte_i]),
+						};
+						self.finish_token(Token::Str(string), &pos);
 					}
 				},
-				Token::Comment(string) => {
+				LexState::Comment { start } => {
 					if c == '\n' {
-						tok_finished = true;
+						self.finish_token(Token::Comment(&text[start..byte_i]), &pos);
 					} else {
-						string.push(c);
+						self.state = LexState::Comment { start };
 					}
 				}
-				Token::Variable(name) => {
-					let allowed = is_ident(c, name.is_empty());
-
-					if allowed {
-						name.push(c);
+				LexState::Variable { start } => {
+					if is_ident(c, byte_i == start) {
+						self.state = LexState::Variable { start };
 					} else {
-						repeat = true;
-						tokens.push((tok, tok_start_pos.clone()));
-						tok = Token::None;
+						self.end_token(Token::Variable(&text[start..byte_i]), &pos);
+						continue;
 					}
 				}
-				Token::Whitespace => {
-					if !is_whitespace(c) {
-						repeat = true;
-						tokens.push((tok, tok_start_pos.clone()));
-						tok_start_pos = pos.clone();
-						tok = Token::None;
+				LexState::Whitespace => {
+					if is_whitespace(c) {
+						self.state = LexState::Whitespace;
+					} else {
+						self.end_token(Token::Whitespace, &pos);
+						continue;
 					}
 				}
-				Token::Ident(name) => {
+				LexState::Ident { start } => {
 					if is_ident(c, false) {
-						name.push(c);
+						self.state = LexState::Ident { start };
 					} else {
-						repeat = true;
-						tokens.push((tok, tok_start_pos.clone()));
-						tok_start_pos = pos.clone();
-						tok = Token::None;
+						self.end_token(Token::Ident(&text[start..byte_i]), &pos);
+						continue;
 					}
 				}
-				Token::Num(num) => {
+				LexState::Num { start } => {
 					if is_num(c, false) {
-						num_str.push(c);
+						self.state = LexState::Num { start };
 					} else {
-						repeat = true;
-						if num_str == "-" {
-							bail!("Invalid number '{num_str}', {pos}");
-						}
-						*num = num_str.parse().expect("Number contains invalid characters");
-						tokens.push((tok, tok_start_pos.clone()));
-						tok_start_pos = pos.clone();
-						tok = Token::None;
+						let num = parse_num(&text[start..byte_i], &pos)?;
+						self.end_token(num, &pos);
+						continue;
 					}
 				}
-				_ => {}
-			}
-			if !repeat {
-				break;
 			}
+
+			break;
 		}
-		if tok_finished {
-			tok_finished = false;
-			tokens.push((tok, tok_start_pos));
-			tok_start_pos = pos.clone();
-			// Since these are not greedy we need to increase the col by 1
-			tok_start_pos.increase_col(1);
-			tok = Token::None;
+
+		Ok(())
+	}
+
+	/// Finish the token that is in progress once the end of the text is reached
+	fn lex_end(&mut self) -> anyhow::Result<()> {
+		let text = self.text;
+		let tok = match std::mem::replace(&mut self.state, LexState::None) {
+			LexState::None => return Ok(()),
+			LexState::Whitespace => Token::Whitespace,
+			LexState::Str { start, owned, .. } => Token::Str(match owned {
+				Some(owned) => Cow::Owned(owned),
+				None => Cow::Borrowed(&text[start..]),
+			}),
+			LexState::Comment { start } => Token::Comment(&text[start..]),
+			LexState::Variable { start } => Token::Variable(&text[start..]),
+			LexState::Ident { start } => Token::Ident(&text[start..]),
+			LexState::Num { start } => parse_num(&text[start..], &self.tok_start_pos)?,
+		};
+		self.push(tok, self.tok_start_pos.clone());
+
+		Ok(())
+	}
+
+	/// Finish a token that ends with the current character
+	fn finish_token(&mut self, tok: Token<'src>, pos: &TextPos) {
+		let start_pos = std::mem::replace(&mut self.tok_start_pos, pos.clone());
+		self.push(tok, start_pos);
+		// Since these are not greedy we need to increase the col by 1
+		self.tok_start_pos.increase_col(1);
+	}
+
+	/// Finish a token that ended before the current character
+	fn end_token(&mut self, tok: Token<'src>, pos: &TextPos) {
+		let start_pos = std::mem::replace(&mut self.tok_start_pos, pos.clone());
+		self.push(tok, start_pos);
+	}
+
+	fn push(&mut self, tok: Token<'src>, pos: TextPos) {
+		if self.skip_ignored && tok.is_ignored() {
+			return;
 		}
+		let slot = if self.ready[0].is_none() { 0 } else { 1 };
+		self.ready[slot] = Some((tok, pos));
 	}
+}
+
+impl<'src> Iterator for Lexer<'src> {
+	type Item = anyhow::Result<TokenAndPos<'src>>;
 
-	match &mut tok {
-		Token::Num(num) => {
-			*num = num_str.parse().expect("Number contains invalid characters");
-			tokens.push((tok, tok_start_pos.clone()));
+	fn next(&mut self) -> Option<Self::Item> {
+		loop {
+			if let Some(tok) = self.ready[0].take() {
+				self.ready.swap(0, 1);
+				return Some(Ok(tok));
+			}
+			if self.finished {
+				return None;
+			}
+
+			let result = match self.chars.next() {
+				Some((byte_i, c)) => self.lex_char(byte_i, c),
+				None => {
+					self.finished = true;
+					self.lex_end()
+				}
+			};
+			if let Err(e) = result {
+				self.finished = true;
+				self.ready = [None, None];
+				return Some(Err(e));
+			}
 		}
-		Token::None => {}
-		_ => tokens.push((tok, tok_start_pos.clone())),
 	}
-	Ok(tokens)
+}
+
+/// Parse the text of a number token
+fn parse_num<'src>(text: &str, pos: &TextPos) -> anyhow::Result<Token<'src>> {
+	if text == "-" {
+		bail!("Invalid number '{text}', {pos}");
+	}
+	let num = text
+		.parse()
+		.with_context(|| format!("Invalid number '{text}', {pos}"))?;
+	Ok(Token::Num(num))
 }
 
 /// A token that we derive from text
 #[derive(Debug, PartialEq, Clone)]
-pub enum Token {
+pub enum Token<'src> {
 	/// An empty token with no meaning. These technically shouldn't appear in the output,
 	/// but just skip over them.
 	None,
@@ -210,7 +308,7 @@ pub enum Token {
 	/// An exclamation point (!)
 	Bang,
 	/// A variable ($var_name)
-	Variable(String),
+	Variable(&'src str),
 	/// A curly brace ({ / })
 	Curly(Side),
 	/// A square bracket ([ / ])
@@ -220,41 +318,19 @@ pub enum Token {
 	/// An angle bracket (< / >)
 	Angle(Side),
 	/// A comment
-	Comment(String),
+	Comment(&'src str),
 	/// An identifier (foo)
-	Ident(String),
+	Ident(&'src str),
 	/// An integer number (-12, 6, 128, etc.)
 	Num(i64),
-	/// A string literal ("'hello' there")
-	Str(String),
+	/// A string literal ("'hello' there"). This is only owned if it had escapes in it
+	Str(Cow<'src, str>),
 }
 
-impl Token {
+impl<'src> Token<'src> {
 	/// Print this token as a string
 	pub fn as_string(&self) -> String {
-		match self {
-			Token::None => "none".into(),
-			Token::Whitespace => " ".into(),
-			Token::Semicolon => ";".into(),
-			Token::Colon => ":".into(),
-			Token::Comma => ",".into(),
-			Token::Pipe => "|".into(),
-			Token::At => "@".into(),
-			Token::Bang => "!".into(),
-			Token::Variable(name) => "$".to_string() + name,
-			Token::Curly(Side::Left) => "{".into(),
-			Token::Curly(Side::Right) => "}".into(),
-			Token::Square(Side::Left) => "[".into(),
-			Token::Square(Side::Right) => "]".into(),
-			Token::Paren(Side::Left) => "(".into(),
-			Token::Paren(Side::Right) => ")".into(),
-			Token::Angle(Side::Left) => "<".into(),
-			Token::Angle(Side::Right) => ">".into(),
-			Token::Comment(text) => "# ".to_string() + text,
-			Token::Ident(name) => name.clone(),
-			Token::Num(num) => num.to_string(),
-			Token::Str(string) => format!("\"{string}\""),
-		}
+		self.to_string()
 	}
 
 	/// Checks if this token is a useless character with no meaning
@@ -263,6 +339,34 @@ impl Token {
 	}
 }
 
+impl<'src> Display for Token<'src> {
+	fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+		match self {
+			Token::None => write!(f, "none"),
+			Token::Whitespace => write!(f, " "),
+			Token::Semicolon => write!(f, ";"),
+			Token::Colon => write!(f, ":"),
+			Token::Comma => write!(f, ","),
+			Token::Pipe => write!(f, "|"),
+			Token::At => write!(f, "@"),
+			Token::Bang => write!(f, "!"),
+			Token::Variable(name) => write!(f, "${name}"),
+			Token::Curly(Side::Left) => write!(f, "{{"),
+			Token::Curly(Side::Right) => write!(f, "}}"),
+			Token::Square(Side::Left) => write!(f, "["),
+			Token::Square(Side::Right) => write!(f, "]"),
+			Token::Paren(Side::Left) => write!(f, "("),
+			Token::Paren(Side::Right) => write!(f, ")"),
+			Token::Angle(Side::Left) => write!(f, "<"),
+			Token::Angle(Side::Right) => write!(f, ">"),
+			Token::Comment(text) => write!(f, "# {text}"),
+			Token::Ident(name) => write!(f, "{name}"),
+			Token::Num(num) => write!(f, "{num}"),
+			Token::Str(string) => write!(f, "\"{string}\""),
+		}
+	}
+}
+
 /// Generic side for something like a bracket
 #[derive(Debug, PartialEq, Copy, Clone)]
 pub enum Side {
@@ -273,7 +377,7 @@ pub enum Side {
 }
 
 /// Text positional information with row, column, and absolute index
-#[derive(Clone, PartialEq, Eq)]
+#[derive(Clone, PartialEq, Eq, Serialize, Deserialize)]
 pub struct TextPos(usize, usize, usize);
 
 impl Debug for TextPos {
@@ -317,7 +421,7 @@ impl TextPos {
 }
 
 /// Token and TextPos
-pub type TokenAndPos = (Token, TextPos);
+pub type TokenAndPos<'src> = (Token<'src>, TextPos);
 
 /// What action to perform after lexing a string character
 #[derive(Debug, PartialEq)]
@@ -362,9 +466,9 @@ fn is_num(c: char, first: bool) -> bool {
 }
 
 /// Removes whitespace characters and comments from an iterator of tokens
-pub fn reduce_tokens<'a, T: Iterator<Item = &'a TokenAndPos>>(
+pub fn reduce_tokens<'a, 'src: 'a, T: Iterator<Item = &'a TokenAndPos<'src>>>(
 	tokens: T,
-) -> impl Iterator<Item = &'a TokenAndPos> {
+) -> impl Iterator<Item = &'a TokenAndPos<'src>> {
 	tokens.filter(|(tok, ..)| !tok.is_ignored())
 }
 
@@ -440,6 +544,29 @@ mod tests {
 		assert_tokens!("\"Hello\"", vec![Token::Str("Hello".into())]);
 	}
 
+	#[test]
+	fn test_string_borrowed() {
+		let lexed = lex("\"Hello\" \"Hel\\\"lo\"").unwrap();
+		assert!(matches!(&lexed[0].0, Token::Str(Cow::Borrowed("Hello"))));
+		assert!(matches!(&lexed[2].0, Token::Str(Cow::Owned(string)) if string == "Hel\"lo"));
+	}
+
+	#[test]
+	fn test_skip_ignored() {
+		let lexed: Vec<_> = Lexer::new("foo # Comment\n $bar;")
+			.skip_ignored()
+			.collect::<anyhow::Result<_>>()
+			.unwrap();
+		assert_eq!(
+			lexed.iter().map(|(tok, _)| tok.clone()).collect::<Vec<_>>(),
+			vec![
+				Token::Ident("foo"),
+				Token::Variable("bar"),
+				Token::Semicolon
+			]
+		);
+	}
+
 	#[test]
 	fn test_combo() {
 		assert_tokens!(
@@ -454,7 +581,7 @@ mod tests {
 				Token::Str("Tres".into()),
 				Token::Semicolon,
 				Token::Whitespace,
-				Token::Ident("Identifier".into())
+				Token::Ident("Identifier")
 			]
 		);
 	}
@@ -467,21 +594,21 @@ mod tests {
 				Token::Str("Hello".into()),
 				Token::Semicolon,
 				Token::Whitespace,
-				Token::Ident("ident".into()),
+				Token::Ident("ident"),
 				Token::Curly(Side::Left),
 				Token::Curly(Side::Right),
 				Token::At,
-				Token::Ident("routine".into()),
+				Token::Ident("routine"),
 				Token::Square(Side::Left),
 				Token::Square(Side::Right),
-				Token::Variable("var".into()),
+				Token::Variable("var"),
 				Token::Paren(Side::Left),
 				Token::Paren(Side::Right),
 				Token::Colon,
 				Token::Num(-1000),
 				Token::Comma,
 				Token::Pipe,
-				Token::Comment(" comment".into())
+				Token::Comment(" comment")
 			]
 		);
 	}
@@ -493,7 +620,7 @@ mod tests {
 			vec![
 				Token::Str("Foo".into()),
 				Token::Whitespace,
-				Token::Comment(" Comment".into()),
+				Token::Comment(" Comment"),
 				Token::Whitespace,
 				Token::Str("Bar".into())
 			]
@@ -560,4 +687,9 @@ mod tests {
 			]
 		);
 	}
+
+	#[test]
+	fn test_token_pos_variable() {
+		assert_token_positions!("$var();", [(1, 0), (1, 4), (1, 5), (1, 6)]);
+	}
 }
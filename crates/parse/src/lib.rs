@@ -21,8 +21,10 @@ pub mod vars;
 
 use std::fmt::Display;
 
+use serde::{Deserialize, Serialize};
+
 /// Reason why the package reported a failure
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub enum FailReason {
 	/// No fail reason is provided
 	None,
@@ -9,14 +9,20 @@ use crate::routine::RESERVED_ROUTINES;
 use super::conditions::Condition;
 use super::conditions::ConditionKind;
 use super::instruction::{parse_arg, InstrKind, Instruction};
-use super::lex::{lex, reduce_tokens, Side, Token, TokenAndPos};
+use super::lex::{Lexer, Side, Token, TokenAndPos};
 use super::vars::Value;
 use mcvm_shared::addon::AddonKind;
+use serde::{Deserialize, Serialize};
 
+use std::borrow::Borrow;
 use std::collections::{HashMap, VecDeque};
 
 const DEFAULT_ROUTINE: &str = "__default__";
 
+/// Version of the parsed data format. Serialized Parsed data from a different
+/// version of this library may not be compatible and should be parsed again instead
+pub const PARSED_FORMAT_VERSION: &str = env!("CARGO_PKG_VERSION");
+
 /// Throw an anyhow error about an unexpected token at a position
 #[macro_export]
 macro_rules! unexpected_token {
@@ -25,14 +31,18 @@ macro_rules! unexpected_token {
 	};
 }
 
-/// Parse a list of tokens
-pub fn parse<'a>(tokens: impl Iterator<Item = &'a TokenAndPos>) -> anyhow::Result<Parsed> {
-	let tokens = reduce_tokens(tokens);
-
+/// Parse a list of tokens. The tokens can either be borrowed from a list or streamed from the lexer
+pub fn parse<'src, T: Borrow<TokenAndPos<'src>>>(
+	tokens: impl IntoIterator<Item = T>,
+) -> anyhow::Result<Parsed> {
 	let mut prs = ParseData::new();
 	// Whether or not a block just ended
 	let mut block_just_ended = false;
-	for (tok, pos) in tokens {
+	for tok_and_pos in tokens {
+		let (tok, pos) = tok_and_pos.borrow();
+		if tok.is_ignored() {
+			continue;
+		}
 		let mut instr_to_push = None;
 		let mut mode_to_set = None;
 		let mut block_to_set = None;
@@ -54,7 +64,7 @@ pub fn parse<'a>(tokens: impl Iterator<Item = &'a TokenAndPos>) -> anyhow::Resul
 						}
 						prs.mode = ParseMode::Routine(None);
 					}
-					Token::Ident(name) => match name.as_str() {
+					Token::Ident(name) => match *name {
 						"if" => {
 							prs.mode = ParseMode::If {
 								condition: None,
@@ -194,7 +204,7 @@ pub fn parse<'a>(tokens: impl Iterator<Item = &'a TokenAndPos>) -> anyhow::Resul
 			}
 			ParseMode::CheckForElseIf => {
 				match tok {
-					Token::Ident(name) => match name.as_str() {
+					Token::Ident(name) => match *name {
 						// Start an else if
 						"if" => {
 							prs.mode = ParseMode::If {
@@ -254,7 +264,7 @@ pub fn parse<'a>(tokens: impl Iterator<Item = &'a TokenAndPos>) -> anyhow::Resul
 					},
 					addon::State::Key => match tok {
 						Token::Ident(name) => {
-							match name.as_str() {
+							match *name {
 								"kind" => *key = addon::Key::Kind,
 								"url" => *key = addon::Key::Url,
 								"path" => *key = addon::Key::Path,
@@ -483,7 +493,7 @@ pub mod require {
 	use super::*;
 
 	/// A single required package
-	#[derive(Debug, Clone)]
+	#[derive(Debug, Clone, Serialize, Deserialize)]
 	pub struct Package {
 		/// The package ID that is required
 		pub value: Value,
@@ -571,7 +581,7 @@ impl ParseData {
 }
 
 /// The final result of parsed data
-#[derive(Debug)]
+#[derive(Debug, Serialize, Deserialize)]
 pub struct Parsed {
 	/// The blocks of instructions that have been parsed
 	pub blocks: HashMap<BlockId, Block>,
@@ -622,7 +632,7 @@ impl Default for Parsed {
 pub type BlockId = u16;
 
 /// A list of instructions inside a routine or nested block (such as an if block)
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct Block {
 	/// The instructions contained in the block, in order
 	pub contents: Vec<Instruction>,
@@ -722,8 +732,21 @@ fn check_recursion(parsed: &Parsed) -> anyhow::Result<()> {
 
 /// Lex text into tokens and then parse the result
 pub fn lex_and_parse(text: &str) -> anyhow::Result<Parsed> {
-	let tokens = lex(text).context("Lexing failed")?;
-	let parsed = parse(tokens.iter()).context("Parsing failed")?;
+	// The tokens are parsed as they are lexed instead of being collected first.
+	// If lexing fails the parser just sees the end of the tokens, so the lexing error is used instead
+	let mut lex_error = None;
+	let tokens = Lexer::new(text).skip_ignored().map_while(|x| match x {
+		Ok(tok) => Some(tok),
+		Err(e) => {
+			lex_error = Some(e);
+			None
+		}
+	});
+	let parsed = parse(tokens);
+	if let Some(e) = lex_error {
+		return Err(e.context("Lexing failed"));
+	}
+	let parsed = parsed.context("Parsing failed")?;
 	Ok(parsed)
 }
 
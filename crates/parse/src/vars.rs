@@ -1,9 +1,10 @@
 use std::collections::HashMap;
 
 use anyhow::{anyhow, bail};
+use serde::{Deserialize, Serialize};
 
 /// Argument to a command that could be a literal or a variable
-#[derive(Debug, Clone, PartialEq, Eq, Default)]
+#[derive(Debug, Clone, PartialEq, Eq, Default, Serialize, Deserialize)]
 pub enum Value {
 	/// This value has not been filled and has no data
 	#[default]
@@ -0,0 +1,169 @@
+use std::collections::HashMap;
+use std::sync::Arc;
+
+use async_trait::async_trait;
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use mcvm_pkg::properties::PackageProperties;
+use mcvm_pkg::resolve::resolve;
+use mcvm_pkg::{
+	ConfiguredPackage, PackageEvalRelationsResult, PackageEvaluator, RecommendedPackage,
+	RequiredPackage,
+};
+use mcvm_shared::pkg::{ArcPkgReq, PackageID, PkgRequest, PkgRequestSource};
+
+/// The number of packages in the synthetic graph
+const PACKAGE_COUNT: usize = 500;
+/// The number of packages that are required by the user
+const ROOT_COUNT: usize = 20;
+
+/// The relationships of a single package in the synthetic graph
+#[derive(Clone, Default)]
+struct MockRelations {
+	deps: Vec<Vec<RequiredPackage>>,
+	recommendations: Vec<RecommendedPackage>,
+	compats: Vec<(PackageID, PackageID)>,
+}
+
+impl PackageEvalRelationsResult for MockRelations {
+	fn get_deps(&self) -> Vec<Vec<RequiredPackage>> {
+		self.deps.clone()
+	}
+
+	fn get_conflicts(&self) -> Vec<PackageID> {
+		Vec::new()
+	}
+
+	fn get_recommendations(&self) -> Vec<RecommendedPackage> {
+		self.recommendations.clone()
+	}
+
+	fn get_bundled(&self) -> Vec<PackageID> {
+		Vec::new()
+	}
+
+	fn get_compats(&self) -> Vec<(PackageID, PackageID)> {
+		self.compats.clone()
+	}
+
+	fn get_extensions(&self) -> Vec<PackageID> {
+		Vec::new()
+	}
+}
+
+#[derive(Clone)]
+struct MockConfig(ArcPkgReq);
+
+impl ConfiguredPackage for MockConfig {
+	type EvalInput<'a> = ();
+
+	fn get_package(&self) -> ArcPkgReq {
+		self.0.clone()
+	}
+
+	fn override_configured_package_input(
+		&self,
+		_: &PackageProperties,
+		_: &mut Self::EvalInput<'_>,
+	) -> anyhow::Result<()> {
+		Ok(())
+	}
+}
+
+/// Evaluator that answers from an in-memory graph, so that only the resolver itself is measured
+struct MockEvaluator<'g> {
+	graph: &'g HashMap<PackageID, MockRelations>,
+	properties: PackageProperties,
+}
+
+#[async_trait]
+impl<'a, 'g: 'a> PackageEvaluator<'a> for MockEvaluator<'g> {
+	type CommonInput = ();
+	type EvalInput<'b> = ();
+	type EvalRelationsResult<'b> = MockRelations;
+	type ConfiguredPackage = MockConfig;
+
+	async fn eval_package_relations(
+		&mut self,
+		pkg: &ArcPkgReq,
+		_: &Self::EvalInput<'a>,
+		_: &Self::CommonInput,
+	) -> anyhow::Result<Self::EvalRelationsResult<'a>> {
+		Ok(self.graph.get(&pkg.id).cloned().unwrap_or_default())
+	}
+
+	async fn get_package_properties<'b>(
+		&'b mut self,
+		_: &ArcPkgReq,
+		_: &Self::CommonInput,
+	) -> anyhow::Result<&'b PackageProperties> {
+		Ok(&self.properties)
+	}
+}
+
+fn package_id(i: usize) -> PackageID {
+	format!("package-{i:03}").into()
+}
+
+/// Create a deterministic dependency graph where every package depends on a few packages
+/// after it. Lots of packages share dependencies, like libraries do in real package sets
+fn create_graph() -> HashMap<PackageID, MockRelations> {
+	let mut graph = HashMap::new();
+	for i in 0..PACKAGE_COUNT {
+		let mut relations = MockRelations::default();
+		for k in 0..(i % 4 + 1) {
+			let dep = i + 1 + (i * 31 + k * 17) % 24;
+			if dep < PACKAGE_COUNT {
+				relations.deps.push(vec![RequiredPackage {
+					value: package_id(dep),
+					explicit: false,
+				}]);
+			}
+		}
+		if i % 9 == 0 {
+			relations.recommendations.push(RecommendedPackage {
+				value: package_id((i * 13) % PACKAGE_COUNT),
+				invert: false,
+			});
+		}
+		if i % 25 == 0 && i + 2 < PACKAGE_COUNT {
+			relations
+				.compats
+				.push((package_id(i + 1), package_id(i + 2)));
+		}
+		graph.insert(package_id(i), relations);
+	}
+
+	graph
+}
+
+fn bench_resolve(c: &mut Criterion) {
+	let graph = create_graph();
+	let roots: Vec<_> = (0..ROOT_COUNT)
+		.map(|i| {
+			let id = package_id(i * (PACKAGE_COUNT / ROOT_COUNT));
+			MockConfig(Arc::new(PkgRequest::parse(
+				id,
+				PkgRequestSource::UserRequire,
+			)))
+		})
+		.collect();
+	let runtime = tokio::runtime::Builder::new_current_thread()
+		.build()
+		.expect("Failed to create runtime");
+
+	c.bench_function("resolve_500_packages", |b| {
+		b.iter(|| {
+			let evaluator = MockEvaluator {
+				graph: &graph,
+				properties: PackageProperties::default(),
+			};
+			let result = runtime
+				.block_on(resolve(black_box(&roots), evaluator, (), &()))
+				.expect("Failed to resolve");
+			black_box(result)
+		})
+	});
+}
+
+criterion_group!(benches, bench_resolve);
+criterion_main!(benches);
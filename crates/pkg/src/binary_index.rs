@@ -0,0 +1,359 @@
+use std::collections::HashSet;
+
+use anyhow::{bail, ensure, Context};
+
+use crate::repo::{PackageFlag, RepoIndex, RepoMetadata, RepoPkgEntry};
+use crate::PackageContentType;
+
+/// Magic bytes at the start of every binary index
+const MAGIC: &[u8; 8] = b"MCVMIDX\0";
+/// Version of the binary index format
+const FORMAT_VERSION: u32 = 1;
+/// Length that marks a string as not being present
+const NONE_LEN: u32 = u32::MAX;
+/// Size of the header before the metadata
+const HEADER_LEN: usize = MAGIC.len() + 4 + 4;
+
+/// A repository index stored in a compact binary format. Packages are sorted by ID
+/// and found with a binary search over an offset table, so looking up a package only
+/// decodes that package instead of the whole index.
+///
+/// Layout (all integers little-endian):
+/// - Magic bytes, format version (u32), and package count (u32)
+/// - Metadata name, description, and MCVM version as optional strings
+/// - Offset table of one u32 per package, pointing to its entry, in ID order
+/// - Entries of ID, URL, and path as strings, then content type (u8) and flags (u8)
+///
+/// Strings are a u32 length followed by UTF-8 bytes, with a length of u32::MAX for None.
+#[derive(Debug)]
+pub struct BinaryRepoIndex {
+	data: Vec<u8>,
+	count: usize,
+	table_start: usize,
+	metadata: RepoMetadata,
+}
+
+impl BinaryRepoIndex {
+	/// Load a binary index from its bytes. Only the header and metadata are decoded
+	pub fn from_bytes(data: Vec<u8>) -> anyhow::Result<Self> {
+		ensure!(
+			data.len() >= HEADER_LEN && &data[..MAGIC.len()] == MAGIC,
+			"Data is not a binary repository index"
+		);
+		let version = read_u32(&data, MAGIC.len()).context("Index is truncated")?;
+		ensure!(
+			version == FORMAT_VERSION,
+			"Unsupported binary index version {version}"
+		);
+		let count = read_u32(&data, MAGIC.len() + 4).context("Index is truncated")? as usize;
+
+		let mut pos = HEADER_LEN;
+		let mut read_meta_string = || {
+			let (value, next) = read_string(&data, pos).context("Index metadata is truncated")?;
+			pos = next;
+			Ok::<_, anyhow::Error>(value.map(str::to_string))
+		};
+		let metadata = RepoMetadata {
+			name: read_meta_string()?,
+			description: read_meta_string()?,
+			mcvm_version: read_meta_string()?,
+		};
+
+		let table_start = pos;
+		ensure!(
+			count
+				.checked_mul(4)
+				.and_then(|x| x.checked_add(table_start))
+				.is_some_and(|x| x <= data.len()),
+			"Index offset table is truncated"
+		);
+
+		Ok(Self {
+			data,
+			count,
+			table_start,
+			metadata,
+		})
+	}
+
+	/// Create the bytes of a binary index from a deserialized index
+	pub fn build(index: &RepoIndex) -> anyhow::Result<Vec<u8>> {
+		let mut ids: Vec<_> = index.packages.keys().collect();
+		ids.sort();
+
+		let mut out = Vec::new();
+		out.extend_from_slice(MAGIC);
+		out.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+		out.extend_from_slice(&to_u32(ids.len())?.to_le_bytes());
+		write_string(&mut out, index.metadata.name.as_deref())?;
+		write_string(&mut out, index.metadata.description.as_deref())?;
+		write_string(&mut out, index.metadata.mcvm_version.as_deref())?;
+
+		let table_start = out.len();
+		out.resize(table_start + ids.len() * 4, 0);
+		for (i, id) in ids.into_iter().enumerate() {
+			let offset = to_u32(out.len())?;
+			out[table_start + i * 4..table_start + i * 4 + 4]
+				.copy_from_slice(&offset.to_le_bytes());
+
+			let entry = &index.packages[id];
+			write_string(&mut out, Some(id))?;
+			write_string(&mut out, entry.url.as_deref())?;
+			write_string(&mut out, entry.path.as_deref())?;
+			out.push(content_type_to_byte(entry.content_type));
+			out.push(flags_to_byte(&entry.flags));
+		}
+
+		Ok(out)
+	}
+
+	/// Get the metadata of the repository
+	pub fn metadata(&self) -> &RepoMetadata {
+		&self.metadata
+	}
+
+	/// Get the number of packages in the index
+	pub fn len(&self) -> usize {
+		self.count
+	}
+
+	/// Check whether the index has no packages
+	pub fn is_empty(&self) -> bool {
+		self.count == 0
+	}
+
+	/// Look up the entry of a package
+	pub fn get(&self, id: &str) -> anyhow::Result<Option<RepoPkgEntry>> {
+		let index = self.lower_bound(id)?;
+		if index < self.count && self.get_id(index)? == id {
+			self.get_entry(index).map(Some)
+		} else {
+			Ok(None)
+		}
+	}
+
+	/// Check whether a package is in the index
+	pub fn contains(&self, id: &str) -> anyhow::Result<bool> {
+		let index = self.lower_bound(id)?;
+		Ok(index < self.count && self.get_id(index)? == id)
+	}
+
+	/// Iterate over the IDs of all of the packages, in order
+	pub fn ids(&self) -> impl Iterator<Item = anyhow::Result<&str>> {
+		(0..self.count).map(|i| self.get_id(i))
+	}
+
+	/// Iterate over all of the packages and their entries, in order of ID
+	pub fn entries(&self) -> impl Iterator<Item = anyhow::Result<(&str, RepoPkgEntry)>> {
+		(0..self.count).map(|i| Ok((self.get_id(i)?, self.get_entry(i)?)))
+	}
+
+	/// Get the IDs of all of the packages that start with a prefix, in order
+	pub fn search_prefix(&self, prefix: &str) -> anyhow::Result<Vec<&str>> {
+		let mut out = Vec::new();
+		for i in self.lower_bound(prefix)?..self.count {
+			let id = self.get_id(i)?;
+			if !id.starts_with(prefix) {
+				break;
+			}
+			out.push(id);
+		}
+
+		Ok(out)
+	}
+
+	/// Find the index of the first package whose ID is not less than the key
+	fn lower_bound(&self, key: &str) -> anyhow::Result<usize> {
+		let (mut low, mut high) = (0, self.count);
+		while low < high {
+			let mid = low + (high - low) / 2;
+			if self.get_id(mid)? < key {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+
+		Ok(low)
+	}
+
+	/// Get the offset of an entry from the offset table
+	fn get_offset(&self, index: usize) -> anyhow::Result<usize> {
+		read_u32(&self.data, self.table_start + index * 4)
+			.map(|x| x as usize)
+			.context("Index offset table is corrupted")
+	}
+
+	/// Get the ID of an entry without decoding the rest of it
+	fn get_id(&self, index: usize) -> anyhow::Result<&str> {
+		let offset = self.get_offset(index)?;
+		match read_string(&self.data, offset) {
+			Some((Some(id), _)) => Ok(id),
+			_ => bail!("Index entry {index} is corrupted"),
+		}
+	}
+
+	/// Decode an entry
+	fn get_entry(&self, index: usize) -> anyhow::Result<RepoPkgEntry> {
+		let decode = || {
+			let pos = self.get_offset(index).ok()?;
+			let (_, pos) = read_string(&self.data, pos)?;
+			let (url, pos) = read_string(&self.data, pos)?;
+			let (path, pos) = read_string(&self.data, pos)?;
+			let content_type = *self.data.get(pos)?;
+			let flags = *self.data.get(pos + 1)?;
+
+			Some(RepoPkgEntry {
+				url: url.map(str::to_string),
+				path: path.map(str::to_string),
+				content_type: byte_to_content_type(content_type),
+				flags: byte_to_flags(flags),
+			})
+		};
+
+		decode().with_context(|| format!("Index entry {index} is corrupted"))
+	}
+}
+
+fn to_u32(value: usize) -> anyhow::Result<u32> {
+	let value = u32::try_from(value).context("Index is too large")?;
+	ensure!(value != NONE_LEN, "Index is too large");
+	Ok(value)
+}
+
+fn read_u32(data: &[u8], pos: usize) -> Option<u32> {
+	let bytes = data.get(pos..pos.checked_add(4)?)?;
+	Some(u32::from_le_bytes(bytes.try_into().ok()?))
+}
+
+/// Read an optional string, returning it and the position after it
+fn read_string(data: &[u8], pos: usize) -> Option<(Option<&str>, usize)> {
+	let len = read_u32(data, pos)?;
+	let start = pos + 4;
+	if len == NONE_LEN {
+		return Some((None, start));
+	}
+	let end = start.checked_add(len as usize)?;
+	let string = std::str::from_utf8(data.get(start..end)?).ok()?;
+	Some((Some(string), end))
+}
+
+fn write_string(out: &mut Vec<u8>, string: Option<&str>) -> anyhow::Result<()> {
+	if let Some(string) = string {
+		out.extend_from_slice(&to_u32(string.len())?.to_le_bytes());
+		out.extend_from_slice(string.as_bytes());
+	} else {
+		out.extend_from_slice(&NONE_LEN.to_le_bytes());
+	}
+
+	Ok(())
+}
+
+fn content_type_to_byte(content_type: Option<PackageContentType>) -> u8 {
+	match content_type {
+		None => 0,
+		Some(PackageContentType::Script) => 1,
+		Some(PackageContentType::Declarative) => 2,
+	}
+}
+
+fn byte_to_content_type(byte: u8) -> Option<PackageContentType> {
+	match byte {
+		1 => Some(PackageContentType::Script),
+		2 => Some(PackageContentType::Declarative),
+		_ => None,
+	}
+}
+
+/// Flags in the order of their bits
+const FLAG_BITS: [PackageFlag; 4] = [
+	PackageFlag::OutOfDate,
+	PackageFlag::Deprecated,
+	PackageFlag::Insecure,
+	PackageFlag::Malicious,
+];
+
+fn flags_to_byte(flags: &HashSet<PackageFlag>) -> u8 {
+	FLAG_BITS
+		.iter()
+		.enumerate()
+		.filter(|(_, flag)| flags.contains(flag))
+		.fold(0, |acc, (i, _)| acc | (1 << i))
+}
+
+fn byte_to_flags(byte: u8) -> HashSet<PackageFlag> {
+	FLAG_BITS
+		.iter()
+		.enumerate()
+		.filter(|(i, _)| byte & (1 << i) != 0)
+		.map(|(_, flag)| flag.clone())
+		.collect()
+}
+
+#[cfg(test)]
+mod tests {
+	use std::collections::HashMap;
+
+	use super::*;
+
+	fn entry(url: &str) -> RepoPkgEntry {
+		RepoPkgEntry {
+			url: Some(url.into()),
+			path: None,
+			content_type: Some(PackageContentType::Declarative),
+			flags: HashSet::from([PackageFlag::Deprecated]),
+		}
+	}
+
+	#[test]
+	fn test_binary_index() {
+		let index = RepoIndex {
+			metadata: RepoMetadata {
+				name: Some("Test".into()),
+				description: None,
+				mcvm_version: Some("0.1.0".into()),
+			},
+			packages: HashMap::from([
+				("sodium".to_string(), entry("a")),
+				("fabric-api".to_string(), entry("b")),
+				("sodium-extra".to_string(), entry("c")),
+			]),
+		};
+		let index = BinaryRepoIndex::from_bytes(BinaryRepoIndex::build(&index).unwrap()).unwrap();
+
+		assert_eq!(index.len(), 3);
+		assert_eq!(index.metadata().name.as_deref(), Some("Test"));
+		assert_eq!(index.metadata().description, None);
+
+		let sodium = index.get("sodium").unwrap().unwrap();
+		assert_eq!(sodium.url.as_deref(), Some("a"));
+		assert_eq!(sodium.path, None);
+		assert!(matches!(
+			sodium.content_type,
+			Some(PackageContentType::Declarative)
+		));
+		assert!(sodium.flags.contains(&PackageFlag::Deprecated));
+		assert!(index.get("iris").unwrap().is_none());
+		assert!(index.get("zzz").unwrap().is_none());
+
+		assert_eq!(
+			index.search_prefix("sod").unwrap(),
+			vec!["sodium", "sodium-extra"]
+		);
+		let ids: Vec<_> = index.ids().collect::<anyhow::Result<_>>().unwrap();
+		assert_eq!(ids, vec!["fabric-api", "sodium", "sodium-extra"]);
+	}
+
+	#[test]
+	fn test_binary_index_invalid() {
+		assert!(BinaryRepoIndex::from_bytes(b"{}".to_vec()).is_err());
+		let mut data = BinaryRepoIndex::build(&RepoIndex {
+			metadata: RepoMetadata::default(),
+			packages: HashMap::from([("sodium".to_string(), entry("a"))]),
+		})
+		.unwrap();
+		data.truncate(data.len() - 4);
+		let index = BinaryRepoIndex::from_bytes(data).unwrap();
+		assert!(index.get("sodium").is_err());
+	}
+}
@@ -6,6 +6,8 @@
 //!
 //! - `schema`: Enable generation of JSON schemas using the `schemars` crate
 
+/// Compact binary format for repository indexes
+pub mod binary_index;
 /// Standard declarative package format
 pub mod declarative;
 /// Package metadata
@@ -113,6 +115,18 @@ pub trait PackageEvaluator<'a> {
 		pkg: &ArcPkgReq,
 		common_input: &Self::CommonInput,
 	) -> anyhow::Result<&'b PackageProperties>;
+
+	/// Load several packages at the same time before they are evaluated, so that
+	/// evaluating them one by one doesn't have to wait on each of them separately.
+	/// Does nothing by default
+	async fn preload_packages(
+		&mut self,
+		pkgs: &[ArcPkgReq],
+		common_input: &Self::CommonInput,
+	) -> anyhow::Result<()> {
+		let _ = (pkgs, common_input);
+		Ok(())
+	}
 }
 
 /// Trait for a user-configured package
@@ -1,4 +1,4 @@
-use std::collections::VecDeque;
+use std::collections::{HashMap, VecDeque};
 use std::sync::Arc;
 
 use anyhow::{bail, Context};
@@ -10,6 +10,9 @@ use crate::{ConfiguredPackage, PackageEvalRelationsResult, PackageEvaluator};
 
 use crate::{PkgRequest, PkgRequestSource};
 
+/// The maximum number of queued packages that are loaded at the same time during resolution
+const RESOLUTION_BATCH_SIZE: usize = 32;
+
 /// Find all package dependencies from a set of required packages
 pub async fn resolve<'a, E: PackageEvaluator<'a>>(
 	packages: &[E::ConfiguredPackage],
@@ -19,7 +22,7 @@ pub async fn resolve<'a, E: PackageEvaluator<'a>>(
 ) -> anyhow::Result<ResolutionResult> {
 	let mut resolver = Resolver {
 		tasks: VecDeque::new(),
-		constraints: Vec::new(),
+		constraints: Constraints::default(),
 		constant_input: constant_eval_input,
 	};
 
@@ -27,62 +30,73 @@ pub async fn resolve<'a, E: PackageEvaluator<'a>>(
 	for config in packages.iter().sorted_by_key(|x| x.get_package()) {
 		let req = config.get_package();
 
-		resolver.constraints.push(Constraint {
-			kind: ConstraintKind::UserRequire(req.clone()),
-		});
+		resolver
+			.constraints
+			.require(req.clone(), RequireKind::UserRequire);
 		resolver.tasks.push_back(Task::EvalPackage {
 			dest: req.clone(),
 			config: Some(config.clone()),
 		});
 	}
 
-	while let Some(task) = resolver.tasks.pop_front() {
-		resolve_task(task, common_input, &mut evaluator, &mut resolver).await?;
-		resolver.check_compats();
+	// Tasks are taken off of the queue in batches so that the packages in the batch can be
+	// loaded together. They are still resolved in order so that the result is deterministic
+	while !resolver.tasks.is_empty() {
+		let batch_size = resolver.tasks.len().min(RESOLUTION_BATCH_SIZE);
+		let batch: Vec<_> = resolver.tasks.drain(..batch_size).collect();
+		let to_preload: Vec<_> = batch
+			.iter()
+			.map(|Task::EvalPackage { dest, .. }| dest.clone())
+			.collect();
+		evaluator
+			.preload_packages(&to_preload, common_input)
+			.await
+			.context("Failed to load packages")?;
+
+		for task in batch {
+			resolve_task(task, common_input, &mut evaluator, &mut resolver).await?;
+			resolver.check_compats();
+		}
 	}
 
 	let mut unfulfilled_recommendations = Vec::new();
 
-	for constraint in resolver.constraints.iter() {
-		match &constraint.kind {
-			ConstraintKind::Recommend(package, invert) => {
-				if *invert {
-					if resolver.is_required(package) {
-						unfulfilled_recommendations.push(RecommendedPackage {
-							req: package.clone(),
-							invert: true,
-						});
-					}
-				} else if !resolver.is_required(package) {
-					unfulfilled_recommendations.push(RecommendedPackage {
-						req: package.clone(),
-						invert: false,
-					});
-				}
+	for (package, invert) in resolver.constraints.recommendations.iter() {
+		if *invert {
+			if resolver.constraints.is_required(package) {
+				unfulfilled_recommendations.push(RecommendedPackage {
+					req: package.clone(),
+					invert: true,
+				});
 			}
-			ConstraintKind::Extend(package) => {
-				if !resolver.is_required(package) {
-					let source = package.source.get_source();
-					if let Some(source) = source {
-						bail!(
-							"The package '{}' extends the functionality of the package '{}', which is not installed.",
-							source.debug_sources(),
-							package
-						);
-					} else {
-						bail!(
-							"A package extends the functionality of the package '{}', which is not installed.",
-							package
-						);
-					}
-				}
+		} else if !resolver.constraints.is_required(package) {
+			unfulfilled_recommendations.push(RecommendedPackage {
+				req: package.clone(),
+				invert: false,
+			});
+		}
+	}
+
+	for package in resolver.constraints.extensions.iter() {
+		if !resolver.constraints.is_required(package) {
+			let source = package.source.get_source();
+			if let Some(source) = source {
+				bail!(
+					"The package '{}' extends the functionality of the package '{}', which is not installed.",
+					source.debug_sources(),
+					package
+				);
+			} else {
+				bail!(
+					"A package extends the functionality of the package '{}', which is not installed.",
+					package
+				);
 			}
-			_ => {}
 		}
 	}
 
 	let out = ResolutionResult {
-		packages: resolver.collect_packages(),
+		packages: resolver.constraints.collect_packages(),
 		unfulfilled_recommendations,
 	};
 
@@ -139,6 +153,7 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 ) -> anyhow::Result<()> {
 	// Make sure that this package fits the constraints as well
 	resolver
+		.constraints
 		.check_constraints(&package)
 		.context("Package did not fit existing constraints")?;
 
@@ -159,15 +174,13 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			conflict,
 			PkgRequestSource::Refused(package.clone()),
 		));
-		if resolver.is_required(&req) {
+		if resolver.constraints.is_required(&req) {
 			bail!(
 				"Package '{}' is incompatible with this package.",
 				req.debug_sources()
 			);
 		}
-		resolver.constraints.push(Constraint {
-			kind: ConstraintKind::Refuse(req),
-		});
+		resolver.constraints.refuse(req);
 	}
 
 	for dep in result.get_deps().iter().flatten().sorted() {
@@ -175,14 +188,14 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			&dep.value,
 			PkgRequestSource::Dependency(package.clone()),
 		));
-		if dep.explicit && !resolver.is_user_required(&req) {
+		if dep.explicit && !resolver.constraints.is_user_required(&req) {
 			bail!("Package '{req}' has been explicitly required by this package. This means it must be required by the user in their config.");
 		}
-		resolver.check_constraints(&req)?;
-		if !resolver.is_required(&req) {
-			resolver.constraints.push(Constraint {
-				kind: ConstraintKind::Require(req.clone()),
-			});
+		resolver.constraints.check_constraints(&req)?;
+		if !resolver.constraints.is_required(&req) {
+			resolver
+				.constraints
+				.require(req.clone(), RequireKind::Require);
 			resolver.tasks.push_back(Task::EvalPackage {
 				dest: req,
 				config: None,
@@ -195,11 +208,11 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			bundled,
 			PkgRequestSource::Bundled(package.clone()),
 		));
-		resolver.check_constraints(&req)?;
-		resolver.remove_require_constraint(&req);
-		resolver.constraints.push(Constraint {
-			kind: ConstraintKind::Bundle(req.clone()),
-		});
+		resolver.constraints.check_constraints(&req)?;
+		// Bundling replaces any existing requirement of the package
+		resolver
+			.constraints
+			.require(req.clone(), RequireKind::Bundle);
 		resolver.tasks.push_back(Task::EvalPackage {
 			dest: req,
 			config: None,
@@ -215,11 +228,7 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			compat_package,
 			PkgRequestSource::Dependency(package.clone()),
 		));
-		if !resolver.compat_exists(check_package.clone(), compat_package.clone()) {
-			resolver.constraints.push(Constraint {
-				kind: ConstraintKind::Compat(check_package, compat_package),
-			});
-		}
+		resolver.constraints.compat(check_package, compat_package);
 	}
 
 	for extension in result.get_extensions().iter().sorted() {
@@ -227,9 +236,7 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			extension,
 			PkgRequestSource::Dependency(package.clone()),
 		));
-		resolver.constraints.push(Constraint {
-			kind: ConstraintKind::Extend(req),
-		});
+		resolver.constraints.extensions.push(req);
 	}
 
 	for recommendation in result.get_recommendations().iter().sorted() {
@@ -237,9 +244,10 @@ async fn resolve_eval_package<'a, E: PackageEvaluator<'a>>(
 			&recommendation.value,
 			PkgRequestSource::Dependency(package.clone()),
 		));
-		resolver.constraints.push(Constraint {
-			kind: ConstraintKind::Recommend(req, recommendation.invert),
-		});
+		resolver
+			.constraints
+			.recommendations
+			.push((req, recommendation.invert));
 	}
 
 	Ok(())
@@ -265,7 +273,7 @@ fn override_eval_input<'a, E: PackageEvaluator<'a>>(
 /// State for resolution
 struct Resolver<'a, E: PackageEvaluator<'a>> {
 	tasks: VecDeque<Task<'a, E>>,
-	constraints: Vec<Constraint>,
+	constraints: Constraints,
 	constant_input: E::EvalInput<'a>,
 }
 
@@ -273,86 +281,109 @@ impl<'a, E> Resolver<'a, E>
 where
 	E: PackageEvaluator<'a>,
 {
-	fn is_required_fn(constraint: &Constraint, req: &ArcPkgReq) -> bool {
-		matches!(
-			&constraint.kind,
-			ConstraintKind::Require(dest)
-			| ConstraintKind::UserRequire(dest)
-			| ConstraintKind::Bundle(dest) if dest == req
-		)
+	/// Adds requirements and tasks for the compat packages of packages that were
+	/// newly required or got new compats since the last check
+	pub fn check_compats(&mut self) {
+		for package in self.constraints.take_compats_to_check() {
+			self.tasks.push_back(Task::EvalPackage {
+				dest: package,
+				config: None,
+			});
+		}
 	}
+}
+
+/// The requirements for the installation of the packages, indexed by package ID
+#[derive(Default, Debug)]
+struct Constraints {
+	/// Packages that are required
+	required: HashMap<PackageID, Requirement>,
+	/// The order that packages were first required in
+	require_order: Vec<PackageID>,
+	/// Requests that refuse each package
+	refused: HashMap<PackageID, Vec<ArcPkgReq>>,
+	/// Packages that should be required when the key package is required
+	compats: HashMap<PackageID, Vec<ArcPkgReq>>,
+	/// Packages that need to have their compats checked again
+	compats_to_check: Vec<PackageID>,
+	/// Recommended packages and whether the recommendation is inverted
+	recommendations: Vec<(ArcPkgReq, bool)>,
+	/// Packages that must be installed because another package extends them
+	extensions: Vec<ArcPkgReq>,
+}
+
+/// A package that has been required
+#[derive(Debug)]
+struct Requirement {
+	req: ArcPkgReq,
+	kind: RequireKind,
+}
 
+/// How a package was required
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum RequireKind {
+	Require,
+	UserRequire,
+	Bundle,
+}
+
+impl Constraints {
 	/// Whether a package has been required by an existing constraint
 	pub fn is_required(&self, req: &ArcPkgReq) -> bool {
-		self.constraints
-			.iter()
-			.any(|x| Self::is_required_fn(x, req))
+		self.required.contains_key(&req.id)
 	}
 
 	/// Whether a package has been required by the user
 	pub fn is_user_required(&self, req: &ArcPkgReq) -> bool {
-		self.constraints.iter().any(|x| {
-			matches!(&x.kind, ConstraintKind::UserRequire(dest) if dest == req)
-				|| matches!(&x.kind, ConstraintKind::Bundle(dest) if dest == req && dest.source.is_user_bundled())
+		self.required.get(&req.id).is_some_and(|x| match x.kind {
+			RequireKind::UserRequire => true,
+			RequireKind::Bundle => x.req.source.is_user_bundled(),
+			RequireKind::Require => false,
 		})
 	}
 
-	/// Remove the require constraint of a package if it exists
-	pub fn remove_require_constraint(&mut self, req: &ArcPkgReq) {
-		let index = self
-			.constraints
-			.iter()
-			.position(|x| Self::is_required_fn(x, req));
-		if let Some(index) = index {
-			self.constraints.swap_remove(index);
+	/// Require a package, replacing any existing requirement for it
+	pub fn require(&mut self, req: ArcPkgReq, kind: RequireKind) {
+		let id = req.id.clone();
+		let existing = self.required.insert(id.clone(), Requirement { req, kind });
+		if existing.is_none() {
+			self.require_order.push(id.clone());
+			self.compats_to_check.push(id);
 		}
 	}
 
-	fn is_refused_fn(constraint: &Constraint, req: ArcPkgReq) -> bool {
-		matches!(
-			&constraint.kind,
-			ConstraintKind::Refuse(dest) if *dest == req
-		)
+	/// Refuse a package
+	pub fn refuse(&mut self, req: ArcPkgReq) {
+		self.refused.entry(req.id.clone()).or_default().push(req);
 	}
 
 	/// Whether a package has been refused by an existing constraint
 	pub fn is_refused(&self, req: &ArcPkgReq) -> bool {
-		self.constraints
-			.iter()
-			.any(|x| Self::is_refused_fn(x, req.clone()))
+		self.refused.contains_key(&req.id)
 	}
 
 	/// Get all refusers of this package
 	pub fn get_refusers(&self, req: &ArcPkgReq) -> Vec<PackageID> {
-		self.constraints
-			.iter()
-			.filter_map(|x| {
-				if let ConstraintKind::Refuse(dest) = &x.kind {
-					if dest == req {
-						Some(
-							dest.source
-								.get_source()
-								.map(|source| source.id.clone())
-								.unwrap_or("User-refused".into()),
-						)
-					} else {
-						None
-					}
-				} else {
-					None
-				}
+		self.refused
+			.get(&req.id)
+			.into_iter()
+			.flatten()
+			.map(|dest| {
+				dest.source
+					.get_source()
+					.map(|source| source.id.clone())
+					.unwrap_or("User-refused".into())
 			})
 			.collect()
 	}
 
-	/// Whether a compat constraint exists
-	pub fn compat_exists(&self, package: ArcPkgReq, compat_package: ArcPkgReq) -> bool {
-		self.constraints.iter().any(|x| {
-			matches!(
-				&x.kind,
-				ConstraintKind::Compat(src, dest) if *src == package && *dest == compat_package
-			)
-		})
+	/// Add a compat constraint if it does not exist already
+	pub fn compat(&mut self, package: ArcPkgReq, compat_package: ArcPkgReq) {
+		let compats = self.compats.entry(package.id.clone()).or_default();
+		if !compats.contains(&compat_package) {
+			compats.push(compat_package);
+			self.compats_to_check.push(package.id.clone());
+		}
 	}
 
 	/// Creates an error if this package is disallowed in the constraints
@@ -368,56 +399,45 @@ where
 		Ok(())
 	}
 
-	/// Checks compat constraints to see if new constraints are needed
-	pub fn check_compats(&mut self) {
-		let mut constraints_to_add = Vec::new();
-		for constraint in &self.constraints {
-			if let ConstraintKind::Compat(package, compat_package) = &constraint.kind {
-				if self.is_required(package) && !self.is_required(compat_package) {
-					constraints_to_add.push(Constraint {
-						kind: ConstraintKind::Require(compat_package.clone()),
-					});
-					self.tasks.push_back(Task::EvalPackage {
-						dest: compat_package.clone(),
-						config: None,
-					});
+	/// Checks the compats of packages that changed since the last check, and requires
+	/// the compat packages that are newly needed. Returns the packages that were required
+	pub fn take_compats_to_check(&mut self) -> Vec<ArcPkgReq> {
+		let mut out = Vec::new();
+		// Requiring a compat package can make its own compats needed, so this keeps going
+		// until nothing changes
+		while !self.compats_to_check.is_empty() {
+			for package in std::mem::take(&mut self.compats_to_check) {
+				if !self.required.contains_key(&package) {
+					continue;
+				}
+				let Some(compats) = self.compats.get(&package) else {
+					continue;
+				};
+				let needed: Vec<_> = compats
+					.iter()
+					.filter(|x| !self.is_required(x))
+					.cloned()
+					.collect();
+				for compat_package in needed {
+					self.require(compat_package.clone(), RequireKind::Require);
+					out.push(compat_package);
 				}
 			}
 		}
-		self.constraints.extend(constraints_to_add);
+
+		out
 	}
 
 	/// Collect all needed packages for final output
 	pub fn collect_packages(self) -> Vec<ArcPkgReq> {
-		self.constraints
+		let mut required = self.required;
+		self.require_order
 			.iter()
-			.filter_map(|x| match &x.kind {
-				ConstraintKind::Require(dest)
-				| ConstraintKind::UserRequire(dest)
-				| ConstraintKind::Bundle(dest) => Some(dest.clone()),
-				_ => None,
-			})
+			.filter_map(|x| required.remove(x).map(|x| x.req))
 			.collect()
 	}
 }
 
-/// A requirement for the installation of the packages
-#[derive(Debug)]
-struct Constraint {
-	kind: ConstraintKind,
-}
-
-#[derive(Debug)]
-enum ConstraintKind {
-	Require(ArcPkgReq),
-	UserRequire(ArcPkgReq),
-	Refuse(ArcPkgReq),
-	Recommend(ArcPkgReq, bool),
-	Bundle(ArcPkgReq),
-	Compat(ArcPkgReq, ArcPkgReq),
-	Extend(ArcPkgReq),
-}
-
 /// A task that needs to be completed for resolution
 enum Task<'a, E: PackageEvaluator<'a>> {
 	/// Evaluate a package and its relationships
@@ -432,3 +452,49 @@ enum Task<'a, E: PackageEvaluator<'a>> {
 fn package_context_error_message(package: &PkgRequest) -> String {
 	format!("In package '{}'", package.debug_sources())
 }
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	fn req(id: &str) -> ArcPkgReq {
+		Arc::new(PkgRequest::parse(id, PkgRequestSource::UserRequire))
+	}
+
+	#[test]
+	fn test_constraint_indexes() {
+		let mut constraints = Constraints::default();
+		constraints.require(req("a"), RequireKind::UserRequire);
+		constraints.require(req("b"), RequireKind::Require);
+		assert!(constraints.is_required(&req("a")));
+		assert!(constraints.is_user_required(&req("a")));
+		assert!(!constraints.is_user_required(&req("b")));
+		assert!(!constraints.is_required(&req("c")));
+
+		constraints.refuse(req("c"));
+		assert!(constraints.check_constraints(&req("c")).is_err());
+		assert!(constraints.check_constraints(&req("a")).is_ok());
+
+		constraints.require(req("a"), RequireKind::Bundle);
+		let packages = constraints.collect_packages();
+		let ids: Vec<_> = packages.iter().map(|x| x.id.to_string()).collect();
+		assert_eq!(ids, vec!["a", "b"]);
+	}
+
+	#[test]
+	fn test_incremental_compats() {
+		let mut constraints = Constraints::default();
+		constraints.compat(req("a"), req("b"));
+		constraints.compat(req("b"), req("c"));
+		assert!(constraints.take_compats_to_check().is_empty());
+
+		constraints.require(req("a"), RequireKind::UserRequire);
+		let added: Vec<_> = constraints
+			.take_compats_to_check()
+			.iter()
+			.map(|x| x.id.to_string())
+			.collect();
+		assert_eq!(added, vec!["b", "c"]);
+		assert!(constraints.take_compats_to_check().is_empty());
+	}
+}
@@ -1,7 +1,7 @@
 /// Output back to the main MCVM process
 pub mod output;
 
-use std::env::Args;
+use std::io::BufRead;
 use std::marker::PhantomData;
 use std::path::PathBuf;
 
@@ -11,6 +11,7 @@ use serde::Serialize;
 
 use crate::hooks::{Hook, CONFIG_DIR_ENV, CUSTOM_CONFIG_ENV, DATA_DIR_ENV, PLUGIN_STATE_ENV};
 use crate::output::OutputAction;
+use crate::worker::{WorkerRequest, WORKER_HOOK};
 
 use self::output::PluginOutput;
 pub use mcvm_shared::output::*;
@@ -19,7 +20,7 @@ pub use mcvm_shared::output::*;
 pub struct CustomPlugin {
 	name: String,
 	settings: PluginSettings,
-	args: Args,
+	args: std::vec::IntoIter<String>,
 	hook: String,
 	ctx: StoredHookContext,
 }
@@ -52,13 +53,13 @@ impl CustomPlugin {
 
 	/// Create a new plugin definition with more advanced settings
 	pub fn with_settings(name: &str, settings: PluginSettings) -> anyhow::Result<Self> {
-		let mut args = std::env::args();
-		args.next();
+		let mut args = std::env::args().skip(1).collect::<Vec<_>>().into_iter();
 		let hook = args.next().context("Missing hook to run")?;
 		let custom_config = std::env::var(CUSTOM_CONFIG_ENV).ok();
 		let ctx = StoredHookContext {
 			custom_config,
 			output: PluginOutput::new(settings.use_base64),
+			state: None,
 		};
 		Ok(Self {
 			name: name.into(),
@@ -74,6 +75,39 @@ impl CustomPlugin {
 		&self.name
 	}
 
+	/// Run the plugin with a function that binds all of its hook handlers. If the plugin was
+	/// started as a persistent worker, the function is run again for every hook call that the
+	/// worker gets, and the persistent state is kept in memory between calls.
+	/// Otherwise, the function is just run once for the hook the plugin was started with
+	pub fn run(mut self, f: impl Fn(&mut Self) -> anyhow::Result<()>) -> anyhow::Result<()> {
+		if self.hook != WORKER_HOOK {
+			return f(&mut self);
+		}
+
+		// The worker exits once its stdin is closed
+		for line in std::io::stdin().lock().lines() {
+			let line = line.context("Failed to read worker request")?;
+			let request: WorkerRequest =
+				serde_json::from_str(&line).context("Failed to deserialize worker request")?;
+			if let Some(state) = request.state {
+				self.ctx.state = Some(state);
+			}
+			self.hook = request.hook;
+			self.args = vec![request.arg].into_iter();
+
+			let result = f(&mut self);
+			let action = OutputAction::EndHook(result.err().map(|x| format!("{x:?}")));
+			println!(
+				"{}",
+				action
+					.serialize(self.settings.use_base64)
+					.context("Failed to serialize hook end")?
+			);
+		}
+
+		Ok(())
+	}
+
 	hook_interface!(on_load, "on_load", OnLoad, |_| Ok(()));
 	hook_interface!(subcommand, "subcommand", Subcommand);
 	hook_interface!(
@@ -132,6 +166,7 @@ impl CustomPlugin {
 
 				// Output state
 				if let Some(state) = state {
+					self.ctx.state = Some(state.clone());
 					let action = OutputAction::SetState(state);
 					println!(
 						"{}",
@@ -158,6 +193,8 @@ impl CustomPlugin {
 struct StoredHookContext {
 	custom_config: Option<String>,
 	output: PluginOutput,
+	/// The persistent state, once it is known. Workers keep this between hook calls
+	state: Option<serde_json::Value>,
 }
 
 /// Argument passed to every hook
@@ -197,7 +234,9 @@ impl<'ctx, H: Hook> HookContext<'ctx, H> {
 		match &mut self.state {
 			Some(val) => Ok(val),
 			self_state @ None => {
-				if let Ok(state) = std::env::var(PLUGIN_STATE_ENV) {
+				if let Some(state) = &self.ctx.state {
+					**self_state = Some(state.clone());
+				} else if let Ok(state) = std::env::var(PLUGIN_STATE_ENV) {
 					**self_state = Some(serde_json::from_str(&state)?);
 				} else {
 					**self_state = Some(serde_json::to_value(default)?);
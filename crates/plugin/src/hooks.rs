@@ -1,8 +1,7 @@
 use std::io::{BufRead, BufReader};
-use std::ops::Deref;
 use std::path::Path;
 use std::process::{Child, ChildStdout, Command};
-use std::sync::{Arc, Mutex};
+use std::sync::{mpsc, Arc, Mutex};
 
 use anyhow::{anyhow, bail, Context};
 use mcvm_core::net::minecraft::MinecraftUserProfile;
@@ -10,11 +9,14 @@ use mcvm_core::{net::game_files::version_manifest::VersionEntry, Paths};
 use mcvm_pkg::script_eval::AddonInstructionData;
 use mcvm_pkg::{RecommendedPackage, RequiredPackage};
 use mcvm_shared::lang::translate::LanguageMap;
+use mcvm_shared::output::{MCVMOutput, Message, MessageLevel};
 use mcvm_shared::pkg::PackageID;
-use mcvm_shared::{output::MCVMOutput, versions::VersionInfo, Side};
+use mcvm_shared::timing::Span;
+use mcvm_shared::{versions::VersionInfo, Side};
 use serde::{de::DeserializeOwned, Deserialize, Serialize};
 
 use crate::output::OutputAction;
+use crate::worker::{PluginWorker, WorkerPool};
 
 /// The environment variable for custom config passed to a hook
 pub static CUSTOM_CONFIG_ENV: &str = "MCVM_CUSTOM_CONFIG";
@@ -72,27 +74,16 @@ pub trait Hook {
 		cmd.args(additional_args);
 		cmd.arg(self.get_name());
 		cmd.arg(arg);
-
-		// Set up environment
-		if let Some(custom_config) = custom_config {
-			cmd.env(CUSTOM_CONFIG_ENV, custom_config);
-		}
-		cmd.env(DATA_DIR_ENV, &paths.data);
-		cmd.env(CONFIG_DIR_ENV, paths.project.config_dir());
-		if let Some(mcvm_version) = mcvm_version {
-			cmd.env(MCVM_VERSION_ENV, mcvm_version);
-		}
-		if let Some(working_dir) = working_dir {
-			cmd.current_dir(working_dir);
-		}
 		{
 			let lock = state.lock().map_err(|x| anyhow!("{x}"))?;
-			// Don't send null state to improve performance
-			if !lock.is_null() {
-				let state = serde_json::to_string(lock.deref())
-					.context("Failed to serialize plugin state")?;
-				cmd.env(PLUGIN_STATE_ENV, state);
-			}
+			set_hook_env(
+				&mut cmd,
+				working_dir,
+				custom_config.as_deref(),
+				&lock,
+				paths,
+				mcvm_version,
+			)?;
 		}
 
 		if Self::get_takes_over() {
@@ -120,6 +111,7 @@ pub trait Hook {
 				plugin_state: Some(state),
 				use_base64,
 				plugin_id: plugin_id.to_string(),
+				span: None,
 			};
 
 			Ok(handle)
@@ -127,6 +119,35 @@ pub trait Hook {
 	}
 }
 
+/// Set up the environment of a plugin hook process
+pub(crate) fn set_hook_env(
+	cmd: &mut Command,
+	working_dir: Option<&Path>,
+	custom_config: Option<&str>,
+	state: &serde_json::Value,
+	paths: &Paths,
+	mcvm_version: Option<&str>,
+) -> anyhow::Result<()> {
+	if let Some(custom_config) = custom_config {
+		cmd.env(CUSTOM_CONFIG_ENV, custom_config);
+	}
+	cmd.env(DATA_DIR_ENV, &paths.data);
+	cmd.env(CONFIG_DIR_ENV, paths.project.config_dir());
+	if let Some(mcvm_version) = mcvm_version {
+		cmd.env(MCVM_VERSION_ENV, mcvm_version);
+	}
+	if let Some(working_dir) = working_dir {
+		cmd.current_dir(working_dir);
+	}
+	// Don't send null state to improve performance
+	if !state.is_null() {
+		let state = serde_json::to_string(state).context("Failed to serialize plugin state")?;
+		cmd.env(PLUGIN_STATE_ENV, state);
+	}
+
+	Ok(())
+}
+
 /// Handle returned by running a hook. Make sure to await it if you need to.
 #[must_use]
 pub struct HookHandle<H: Hook> {
@@ -134,6 +155,8 @@ pub struct HookHandle<H: Hook> {
 	plugin_state: Option<Arc<Mutex<serde_json::Value>>>,
 	use_base64: bool,
 	plugin_id: String,
+	/// The timing span of the hook call, which is recorded when the handle is finished
+	span: Option<Span>,
 }
 
 impl<H: Hook> HookHandle<H> {
@@ -144,9 +167,40 @@ impl<H: Hook> HookHandle<H> {
 			plugin_state: None,
 			use_base64: true,
 			plugin_id,
+			span: None,
+		}
+	}
+
+	/// Create a new handle for a hook that was sent to a persistent worker
+	pub(crate) fn worker(
+		worker: PluginWorker,
+		pool: WorkerPool,
+		plugin_state: Arc<Mutex<serde_json::Value>>,
+		use_base64: bool,
+		plugin_id: String,
+	) -> Self {
+		Self {
+			inner: HookHandleInner::Worker {
+				worker: Some(worker),
+				pool,
+				line_buf: String::new(),
+				result: None,
+				error: None,
+			},
+			plugin_state: Some(plugin_state),
+			use_base64,
+			plugin_id,
+			span: None,
 		}
 	}
 
+	/// Attach a timing span to this handle, which ends when the handle is finished,
+	/// killed, or dropped
+	pub(crate) fn with_span(mut self, span: Span) -> Self {
+		self.span = Some(span);
+		self
+	}
+
 	/// Get the ID of the plugin that returned this handle
 	pub fn get_id(&self) -> &String {
 		&self.plugin_id
@@ -154,67 +208,87 @@ impl<H: Hook> HookHandle<H> {
 
 	/// Poll the handle, returning true if the handle is ready
 	pub fn poll(&mut self, o: &mut impl MCVMOutput) -> anyhow::Result<bool> {
-		match &mut self.inner {
+		let (stdout, line_buf) = match &mut self.inner {
 			HookHandleInner::Process {
+				line_buf, stdout, ..
+			} => (stdout as &mut dyn BufRead, line_buf),
+			HookHandleInner::Worker {
+				worker: Some(worker),
 				line_buf,
-				stdout,
-				result,
 				..
-			} => {
-				line_buf.clear();
-				let result_len = stdout.read_line(line_buf)?;
-				// EoF
-				if result_len == 0 {
-					return Ok(true);
+			} => (&mut worker.stdout as &mut dyn BufRead, line_buf),
+			HookHandleInner::Worker { worker: None, .. } | HookHandleInner::Constant(..) => {
+				return Ok(true)
+			}
+		};
+		line_buf.clear();
+		let result_len = stdout.read_line(line_buf)?;
+		// EoF
+		if result_len == 0 {
+			if let HookHandleInner::Worker { worker, .. } = &mut self.inner {
+				*worker = None;
+				bail!("Plugin worker exited before finishing the hook");
+			}
+			return Ok(true);
+		}
+		let line = line_buf.trim_end_matches("\r\n").trim_end_matches('\n');
+
+		let action = OutputAction::deserialize(line, self.use_base64)
+			.context("Failed to deserialize plugin action")?;
+		match action {
+			OutputAction::SetResult(new_result) => {
+				if let HookHandleInner::Process { result, .. }
+				| HookHandleInner::Worker { result, .. } = &mut self.inner
+				{
+					*result = Some(
+						serde_json::from_str(&new_result)
+							.context("Failed to deserialize hook result")?,
+					);
 				}
-				let line = line_buf.trim_end_matches("\r\n").trim_end_matches('\n');
-
-				let action = OutputAction::deserialize(line, self.use_base64)
-					.context("Failed to deserialize plugin action")?;
-				match action {
-					OutputAction::SetResult(new_result) => {
-						*result = Some(
-							serde_json::from_str(&new_result)
-								.context("Failed to deserialize hook result")?,
-						);
-					}
-					OutputAction::SetState(new_state) => {
-						let state = self
-							.plugin_state
-							.as_mut()
-							.context("Hook handle does not have a reference to persistent state")?;
-						let mut lock = state.lock().map_err(|x| anyhow!("{x}"))?;
-						*lock = new_state;
-					}
-					OutputAction::Text(text, level) => {
-						o.display_text(text, level);
-					}
-					OutputAction::Message(message) => {
-						o.display_message(message);
-					}
-					OutputAction::StartProcess => {
-						o.start_process();
-					}
-					OutputAction::EndProcess => {
-						o.end_process();
-					}
-					OutputAction::StartSection => {
-						o.start_section();
-					}
-					OutputAction::EndSection => {
-						o.end_section();
+			}
+			OutputAction::SetState(new_state) => {
+				let state = self
+					.plugin_state
+					.as_mut()
+					.context("Hook handle does not have a reference to persistent state")?;
+				let mut lock = state.lock().map_err(|x| anyhow!("{x}"))?;
+				// The worker already has this state, so it doesn't need to be sent back to it
+				if let HookHandleInner::Worker {
+					worker: Some(worker),
+					..
+				} = &mut self.inner
+				{
+					worker.set_known_state(new_state.clone());
+				}
+				*lock = new_state;
+			}
+			OutputAction::EndHook(new_error) => {
+				if let HookHandleInner::Worker {
+					worker,
+					pool,
+					error,
+					..
+				} = &mut self.inner
+				{
+					if let Some(mut worker) = worker.take() {
+						worker.finish_hook();
+						pool.put(worker);
 					}
+					*error = new_error;
+					return Ok(true);
 				}
-
-				Ok(false)
 			}
-			HookHandleInner::Constant(..) => Ok(true),
+			other => {
+				other.display(o);
+			}
 		}
+
+		Ok(false)
 	}
 
 	/// Get the result of the hook by waiting for it
 	pub fn result(mut self, o: &mut impl MCVMOutput) -> anyhow::Result<H::Result> {
-		if let HookHandleInner::Process { .. } = &self.inner {
+		if let HookHandleInner::Process { .. } | HookHandleInner::Worker { .. } = &self.inner {
 			loop {
 				let result = self.poll(o)?;
 				if result {
@@ -242,6 +316,13 @@ impl<H: Hook> HookHandle<H> {
 
 				Ok(result)
 			}
+			HookHandleInner::Worker { result, error, .. } => {
+				if let Some(error) = error {
+					bail!("Hook failed: {error}");
+				}
+
+				result.context("Plugin hook did not return a result")
+			}
 		}
 	}
 
@@ -257,7 +338,84 @@ impl<H: Hook> HookHandle<H> {
 
 				Ok(result)
 			}
+			HookHandleInner::Worker { worker, result, .. } => {
+				// A worker that is still running the hook can't be reused
+				if let Some(mut worker) = worker {
+					worker.kill()?;
+				}
+
+				Ok(result)
+			}
+		}
+	}
+}
+
+/// Wait for the results of multiple hook handles at the same time, returning them in the same
+/// order as the handles. Output from the handles is displayed as it comes in
+pub fn wait_all<H: Hook>(
+	handles: Vec<HookHandle<H>>,
+	o: &mut impl MCVMOutput,
+) -> anyhow::Result<Vec<H::Result>>
+where
+	H::Result: Send,
+{
+	// Constant handles are already finished, so there is nothing to wait for at the same time
+	let running = handles
+		.iter()
+		.filter(|x| !matches!(x.inner, HookHandleInner::Constant(..)))
+		.count();
+	if running <= 1 {
+		return handles.into_iter().map(|x| x.result(o)).collect();
+	}
+
+	let (sender, receiver) = mpsc::channel();
+	std::thread::scope(|scope| {
+		let threads: Vec<_> = handles
+			.into_iter()
+			.map(|handle| {
+				let mut output = ChannelOutput(sender.clone());
+				scope.spawn(move || handle.result(&mut output))
+			})
+			.collect();
+		// The channel closes once every handle is finished and has dropped its sender
+		drop(sender);
+		for action in receiver {
+			action.display(o);
 		}
+
+		threads
+			.into_iter()
+			.map(|x| x.join().map_err(|_| anyhow!("Hook thread panicked"))?)
+			.collect()
+	})
+}
+
+/// Output that sends everything to another thread to be displayed there
+struct ChannelOutput(mpsc::Sender<OutputAction>);
+
+impl MCVMOutput for ChannelOutput {
+	fn display_text(&mut self, text: String, level: MessageLevel) {
+		let _ = self.0.send(OutputAction::Text(text, level));
+	}
+
+	fn display_message(&mut self, message: Message) {
+		let _ = self.0.send(OutputAction::Message(message));
+	}
+
+	fn start_process(&mut self) {
+		let _ = self.0.send(OutputAction::StartProcess);
+	}
+
+	fn end_process(&mut self) {
+		let _ = self.0.send(OutputAction::EndProcess);
+	}
+
+	fn start_section(&mut self) {
+		let _ = self.0.send(OutputAction::StartSection);
+	}
+
+	fn end_section(&mut self) {
+		let _ = self.0.send(OutputAction::EndSection);
 	}
 }
 
@@ -270,6 +428,15 @@ enum HookHandleInner<H: Hook> {
 		stdout: BufReader<ChildStdout>,
 		result: Option<H::Result>,
 	},
+	/// Result is coming from a persistent worker
+	Worker {
+		/// The worker, which is given back to the pool once it finishes the hook
+		worker: Option<PluginWorker>,
+		pool: WorkerPool,
+		line_buf: String,
+		result: Option<H::Result>,
+		error: Option<String>,
+	},
 	/// Result is a constant, either from a constant hook or a takeover hook
 	Constant(H::Result),
 }
@@ -3,8 +3,10 @@
 //! This library is used by both MCVM to load plugins, and as a framework for defining
 //! Rust plugins for MCVM to use
 
+use std::sync::Arc;
+
 use anyhow::{bail, Context};
-use hooks::{Hook, HookHandle, OnLoad};
+use hooks::{wait_all, Hook, HookHandle, OnLoad};
 use mcvm_core::Paths;
 use mcvm_shared::output::MCVMOutput;
 use plugin::Plugin;
@@ -18,11 +20,14 @@ pub mod hooks;
 pub mod output;
 /// Plugins
 pub mod plugin;
+/// Persistent plugin worker processes
+pub mod worker;
 
-/// A manager for plugins that is used to call their hooks
-#[derive(Debug)]
+/// A manager for plugins that is used to call their hooks. Cloning it is cheap,
+/// and the clone shares the same plugins
+#[derive(Debug, Clone)]
 pub struct PluginManager {
-	plugins: Vec<Plugin>,
+	plugins: Vec<Arc<Plugin>>,
 	mcvm_version: Option<&'static str>,
 }
 
@@ -61,7 +66,7 @@ impl PluginManager {
 			result.result(o)?;
 		}
 
-		self.plugins.push(plugin);
+		self.plugins.push(Arc::new(plugin));
 
 		Ok(())
 	}
@@ -85,6 +90,23 @@ impl PluginManager {
 		Ok(out)
 	}
 
+	/// Call a plugin hook on the manager and wait for all of the results, which are returned
+	/// in plugin order. The hook handles are all waited on at the same time instead of
+	/// one after another
+	pub fn call_hook_and_wait<H: Hook>(
+		&self,
+		hook: H,
+		arg: &H::Arg,
+		paths: &Paths,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<Vec<H::Result>>
+	where
+		H::Result: Send,
+	{
+		let handles = self.call_hook(hook, arg, paths, o)?;
+		wait_all(handles, o)
+	}
+
 	/// Call a plugin hook on the manager on a specific plugin
 	pub fn call_hook_on_plugin<H: Hook>(
 		&self,
@@ -108,6 +130,6 @@ impl PluginManager {
 
 	/// Iterate over the plugins
 	pub fn iter_plugins(&self) -> impl Iterator<Item = &Plugin> {
-		self.plugins.iter()
+		self.plugins.iter().map(AsRef::as_ref)
 	}
 }
@@ -1,6 +1,6 @@
 use anyhow::Context;
 use base64::prelude::*;
-use mcvm_shared::output::{Message, MessageLevel};
+use mcvm_shared::output::{MCVMOutput, Message, MessageLevel};
 use serde::{Deserialize, Serialize};
 
 /// An action to be sent between the plugin and plugin runner
@@ -23,9 +23,27 @@ pub enum OutputAction {
 	SetResult(String),
 	/// Set the persistent state of the plugin
 	SetState(serde_json::Value),
+	/// Finish a hook that was run by a persistent worker, with an error message if it failed
+	EndHook(Option<String>),
 }
 
 impl OutputAction {
+	/// Display this action if it is one that only displays output. Returns the action back
+	/// if it is not
+	pub fn display(self, o: &mut impl MCVMOutput) -> Option<Self> {
+		match self {
+			Self::Text(text, level) => o.display_text(text, level),
+			Self::Message(message) => o.display_message(message),
+			Self::StartProcess => o.start_process(),
+			Self::EndProcess => o.end_process(),
+			Self::StartSection => o.start_section(),
+			Self::EndSection => o.end_section(),
+			other => return Some(other),
+		}
+
+		None
+	}
+
 	/// Serialize the action to be sent to the plugin runner
 	pub fn serialize(&self, use_base64: bool) -> anyhow::Result<String> {
 		let json = serde_json::to_string(&self).context("Failed to serialize output action")?;
@@ -7,9 +7,11 @@ use std::sync::Mutex;
 use anyhow::Context;
 use mcvm_core::Paths;
 use mcvm_shared::output::MCVMOutput;
+use mcvm_shared::timing::{self, SpanCategory};
 use serde::{Deserialize, Deserializer};
 
 use crate::hooks::{Hook, HookHandle};
+use crate::worker::{self, WorkerPool};
 
 /// A plugin
 #[derive(Debug)]
@@ -24,6 +26,8 @@ pub struct Plugin {
 	working_dir: Option<PathBuf>,
 	/// The persistent state of the plugin
 	state: Arc<Mutex<serde_json::Value>>,
+	/// Persistent workers of the plugin that are ready to run hooks
+	workers: WorkerPool,
 }
 
 impl Plugin {
@@ -35,6 +39,7 @@ impl Plugin {
 			custom_config: None,
 			working_dir: None,
 			state: Arc::new(Mutex::new(serde_json::Value::Null)),
+			workers: WorkerPool::default(),
 		}
 	}
 
@@ -60,7 +65,31 @@ impl Plugin {
 		let Some(handler) = self.manifest.hooks.get(hook.get_name()) else {
 			return Ok(None);
 		};
-		match handler {
+		let span = timing::span(
+			SpanCategory::Hook,
+			format!("{}:{}", self.id, hook.get_name()),
+		);
+		let handle = match handler {
+			// Takeover hooks need the terminal, so they always get their own process
+			HookHandler::Execute { executable, args }
+				if self.manifest.persistent && !H::get_takes_over() =>
+			{
+				worker::call_hook(
+					hook,
+					&self.workers,
+					executable,
+					args,
+					arg,
+					self.working_dir.as_deref(),
+					!self.manifest.raw_transfer,
+					self.custom_config.as_deref(),
+					self.state.clone(),
+					paths,
+					mcvm_version,
+					&self.id,
+				)
+				.map(Some)
+			}
 			HookHandler::Execute { executable, args } => hook
 				.call(
 					executable,
@@ -88,7 +117,10 @@ impl Plugin {
 					.context("Failed to deserialize native hook result")?;
 				Ok(Some(HookHandle::constant(result, self.id.clone())))
 			}
-		}
+		}?;
+
+		// The hook may still be running, so the span only ends once the handle is finished
+		Ok(handle.map(|x| x.with_span(span)))
 	}
 
 	/// Set the custom config of the plugin
@@ -123,6 +155,9 @@ pub struct PluginManifest {
 	pub protocol_version: Option<u16>,
 	/// Whether to disable base64 encoding in the protocol
 	pub raw_transfer: bool,
+	/// Whether the plugin's executables can run as persistent workers that handle
+	/// many hook calls, instead of starting a new process for every call
+	pub persistent: bool,
 }
 
 impl PluginManifest {
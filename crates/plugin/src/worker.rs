@@ -0,0 +1,206 @@
+use std::collections::HashMap;
+use std::io::{BufReader, Write};
+use std::path::Path;
+use std::process::{Child, ChildStdin, ChildStdout, Command, Stdio};
+use std::sync::{Arc, Mutex};
+
+use anyhow::{anyhow, Context};
+use mcvm_core::Paths;
+use serde::{Deserialize, Serialize};
+
+use crate::hooks::{set_hook_env, Hook, HookHandle};
+
+/// The hook name that a plugin executable is run with to start it as a persistent worker
+pub static WORKER_HOOK: &str = "mcvm_worker";
+
+/// A request for a persistent worker to run a hook, sent as a single line of JSON
+/// to the worker's stdin. The worker responds with the same output actions as a normal
+/// hook process, followed by an EndHook action once it is finished
+#[derive(Serialize, Deserialize, Debug)]
+pub struct WorkerRequest {
+	/// The name of the hook to run
+	pub hook: String,
+	/// The hook argument, serialized as JSON
+	pub arg: String,
+	/// The new persistent state of the plugin. This is only sent when the state has changed
+	/// since the worker last knew it, and the worker should keep using its own state otherwise
+	#[serde(default)]
+	#[serde(skip_serializing_if = "Option::is_none")]
+	pub state: Option<serde_json::Value>,
+}
+
+/// Idle persistent workers of a plugin, one for each executable
+#[derive(Debug, Clone, Default)]
+pub(crate) struct WorkerPool {
+	idle: Arc<Mutex<HashMap<WorkerKey, PluginWorker>>>,
+}
+
+/// The executable and arguments that a worker was started with
+type WorkerKey = (String, Vec<String>);
+
+impl WorkerPool {
+	/// Take the idle worker for an executable out of the pool
+	fn take(&self, key: &WorkerKey) -> Option<PluginWorker> {
+		self.idle.lock().ok()?.remove(key)
+	}
+
+	/// Give a worker that has finished its hook back to the pool
+	pub(crate) fn put(&self, worker: PluginWorker) {
+		if let Ok(mut idle) = self.idle.lock() {
+			// If another worker was started while this one was busy, only one needs to be kept
+			idle.entry(worker.key.clone()).or_insert(worker);
+		}
+	}
+}
+
+/// A running persistent worker process for a plugin
+#[derive(Debug)]
+pub(crate) struct PluginWorker {
+	key: WorkerKey,
+	child: Child,
+	stdin: Option<ChildStdin>,
+	pub(crate) stdout: BufReader<ChildStdout>,
+	/// The persistent state that the worker currently has
+	known_state: serde_json::Value,
+	/// Whether the worker is in the middle of running a hook
+	busy: bool,
+}
+
+impl PluginWorker {
+	/// Start a new worker process
+	fn start(
+		key: WorkerKey,
+		working_dir: Option<&Path>,
+		custom_config: Option<&str>,
+		state: &serde_json::Value,
+		paths: &Paths,
+		mcvm_version: Option<&str>,
+	) -> anyhow::Result<Self> {
+		let mut cmd = Command::new(&key.0);
+		cmd.args(&key.1);
+		cmd.arg(WORKER_HOOK);
+		set_hook_env(
+			&mut cmd,
+			working_dir,
+			custom_config,
+			state,
+			paths,
+			mcvm_version,
+		)?;
+		cmd.stdin(Stdio::piped());
+		cmd.stdout(Stdio::piped());
+
+		let mut child = cmd.spawn().context("Failed to spawn worker process")?;
+		let stdin = child.stdin.take();
+		let stdout = BufReader::new(child.stdout.take().expect("Stdout should be piped"));
+
+		Ok(Self {
+			key,
+			child,
+			stdin,
+			stdout,
+			known_state: state.clone(),
+			busy: false,
+		})
+	}
+
+	/// Send a hook call to the worker
+	fn send(&mut self, hook: &str, arg: String, state: &serde_json::Value) -> anyhow::Result<()> {
+		let state = if *state == self.known_state {
+			None
+		} else {
+			self.known_state = state.clone();
+			Some(state.clone())
+		};
+		let request = WorkerRequest {
+			hook: hook.to_string(),
+			arg,
+			state,
+		};
+		// JSON never contains raw newlines, so it is safe to use them as separators
+		let mut request =
+			serde_json::to_string(&request).context("Failed to serialize worker request")?;
+		request.push('\n');
+
+		let stdin = self.stdin.as_mut().context("Worker stdin is closed")?;
+		stdin
+			.write_all(request.as_bytes())
+			.and_then(|_| stdin.flush())
+			.context("Failed to send request to worker")?;
+		self.busy = true;
+
+		Ok(())
+	}
+
+	/// Update the state that the worker has after it changed it itself
+	pub(crate) fn set_known_state(&mut self, state: serde_json::Value) {
+		self.known_state = state;
+	}
+
+	/// Mark that the worker has finished running its hook
+	pub(crate) fn finish_hook(&mut self) {
+		self.busy = false;
+	}
+
+	/// Kill the worker process
+	pub(crate) fn kill(&mut self) -> std::io::Result<()> {
+		self.busy = false;
+		self.child.kill()
+	}
+}
+
+impl Drop for PluginWorker {
+	fn drop(&mut self) {
+		if self.busy {
+			let _ = self.child.kill();
+		}
+		// Closing stdin tells an idle worker to exit
+		self.stdin.take();
+		let _ = self.child.wait();
+	}
+}
+
+/// Call a hook on a persistent worker, starting the worker if there isn't an idle one.
+/// Takeover hooks can't be run on a worker
+#[allow(clippy::too_many_arguments)]
+pub(crate) fn call_hook<H: Hook>(
+	hook: &H,
+	pool: &WorkerPool,
+	executable: &str,
+	additional_args: &[String],
+	arg: &H::Arg,
+	working_dir: Option<&Path>,
+	use_base64: bool,
+	custom_config: Option<&str>,
+	state: Arc<Mutex<serde_json::Value>>,
+	paths: &Paths,
+	mcvm_version: Option<&str>,
+	plugin_id: &str,
+) -> anyhow::Result<HookHandle<H>> {
+	let arg = serde_json::to_string(arg).context("Failed to serialize hook argument")?;
+	let key = (executable.to_string(), additional_args.to_vec());
+	let lock = state.lock().map_err(|x| anyhow!("{x}"))?;
+	let make_handle = |worker| {
+		HookHandle::<H>::worker(
+			worker,
+			pool.clone(),
+			state.clone(),
+			use_base64,
+			plugin_id.to_string(),
+		)
+	};
+
+	if let Some(mut worker) = pool.take(&key) {
+		// The worker may have exited since it was last used, in which case we start a new one
+		if worker.send(hook.get_name(), arg.clone(), &lock).is_ok() {
+			return Ok(make_handle(worker));
+		}
+	}
+
+	let mut worker =
+		PluginWorker::start(key, working_dir, custom_config, &lock, paths, mcvm_version)
+			.context("Failed to start plugin worker")?;
+	worker.send(hook.get_name(), arg, &lock)?;
+
+	Ok(make_handle(worker))
+}
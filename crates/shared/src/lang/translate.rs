@@ -53,8 +53,15 @@ define_translations! {
 	StartRunningCommands, "When starting to run package commands", "Running commands";
 	FinishRunningCommands, "When finishing running package commands", "Finished running commands";
 	StartUpdatingInstance, "When starting to update an instance", "Updating instance %inst";
+	StartPrefetchingInstance, "When starting to prefetch the files of an instance", "Prefetching files for instance %inst";
+	StartPrefetchingAddons, "When starting to prefetch addons", "Prefetching addons";
+	FinishPrefetchingAddons, "When finishing prefetching addons", "Addons prefetched";
 	PreparingLaunch, "When preparing to launch the game", "Preparing to launch";
+	UsingSavedLaunchPlan, "When an instance is launched with its saved launch plan", "Using saved launch plan";
 	Launch, "When launching the game", "Launching!";
+	CreatingCdsArchive, "When the class data sharing archive will be created after the game exits", "Creating class data sharing archive when the game exits";
+	CdsSetupFailed, "When setting up class data sharing fails", "Failed to set up class data sharing: %error";
+	CdsUnsupported, "When class data sharing is enabled on a Java version that does not support it", "Class data sharing is only supported on Java 13 and newer";
 	CoreRepoName, "Name of the core repo", "Core";
 	CoreRepoDescription, "Description of the core repo", "The built-in set of packages";
 	RepoVersionWarning, "Warning when a remote repo version is too high", "Minimum MCVM version for repository %repo is higher than current installation";
@@ -81,14 +88,13 @@ define_translations! {
 	StartCheckingForJavaUpdates, "When starting to check for Java updates", "Checking for Java updates";
 	FinishCheckingForJavaUpdates, "When finishing checking for Java updates", "Java updated";
 	FinishJavaInstallation, "When finishing installing Java", "Java installation finished";
-	StartExtractingJava, "When starting to extract the JRE", "Extracting JRE";
-	StartRemovingJavaArchive, "When starting to remove the Java archive", "Removing archive";
 	DownloadingGraalVM, "When starting to download GraalVM", "Downloading GraalVM";
 	DownloadingZulu, "When starting to download Zulu", "Downloading Azul Zulu JRE version %version";
 	DownloadingAdoptium, "When starting to download Adoptium", "Downloading Adoptium Temurin JRE version %version";
 	StartUpdatingClient, "When starting to update a client", "Updating client '%id'";
 	StartUpdatingServer, "When starting to update a server", "Updating server '%id'";
 	PasskeyAccepted, "When finishing decrypting with a passkey", "Passkey accepted";
+	UsingExistingSession, "When a user is authenticated with the session from earlier in the process", "Using existing session";
 	TransferFeatureUnsupportedByFormat, "When an instance transfer feature is unsupported by the format", "Transferring %feat is not supported by the format";
 	TransferFeatureUnsupportedByPlugin, "When an instance transfer feature is unsupported by the plugin", "Transferring %feat is not supported by the plugin yet";
 	TransferModloaderFeature, "Instance transfer modloader feature", "the modloader";
@@ -16,6 +16,8 @@ pub mod modifications;
 pub mod output;
 /// Common package constructs
 pub mod pkg;
+/// Recording of how long operations and downloads take
+pub mod timing;
 /// Other utilities
 pub mod util;
 /// Tools for dealing with version patterns
@@ -32,7 +34,7 @@ use serde::{Deserialize, Serialize};
 pub mod later {
 	/// An enum very similar to `Option<T>` that lets us access it with an easier assertion.
 	/// It is meant for data that we know should already be full at some point.
-	#[derive(Clone, Debug, Default, PartialEq, Eq, Hash)]
+	#[derive(Clone, Debug, Default, PartialEq, Eq, Hash, serde::Serialize, serde::Deserialize)]
 	pub enum Later<T> {
 		/// The Later does not contain a value
 		#[default]
@@ -162,7 +162,9 @@ impl Display for PkgRequest {
 pub type ArcPkgReq = Arc<PkgRequest>;
 
 /// Stability setting for a package
-#[derive(Deserialize, Serialize, Default, Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord)]
+#[derive(
+	Deserialize, Serialize, Default, Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord, Hash,
+)]
 #[cfg_attr(feature = "schema", derive(JsonSchema))]
 #[serde(rename_all = "snake_case")]
 pub enum PackageStability {
@@ -0,0 +1,299 @@
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Mutex, MutexGuard, OnceLock};
+use std::time::{Duration, Instant};
+
+use serde::Serialize;
+
+/// Upper bounds of the buckets of the request latency histograms, in milliseconds.
+/// Latencies above the last bound go into one more bucket at the end
+pub const LATENCY_BUCKETS_MS: [u64; 10] = [10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000];
+
+/// Whether timings are being recorded. Nothing is recorded unless this is turned on,
+/// so the instrumentation costs next to nothing normally
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// Start recording timings for the rest of the process
+pub fn enable() {
+	// Make sure that the start time is set before anything is recorded
+	recorder();
+	ENABLED.store(true, Ordering::Relaxed);
+}
+
+/// Check whether timings are being recorded
+#[inline(always)]
+pub fn is_enabled() -> bool {
+	ENABLED.load(Ordering::Relaxed)
+}
+
+/// What kind of work a span measures
+#[derive(Serialize, Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+#[serde(rename_all = "snake_case")]
+pub enum SpanCategory {
+	/// A phase of an operation, like package resolution
+	Phase,
+	/// A call of a plugin hook
+	Hook,
+	/// A single download, from the start of the request until the body is read
+	Download,
+}
+
+/// Start timing a span that ends when the returned guard is dropped
+pub fn span(category: SpanCategory, name: impl Into<Cow<'static, str>>) -> Span {
+	if !is_enabled() {
+		return Span { inner: None };
+	}
+
+	Span {
+		inner: Some((category, name.into(), Instant::now())),
+	}
+}
+
+/// A running span. It is recorded when it is dropped
+#[must_use = "The span ends as soon as it is dropped"]
+pub struct Span {
+	inner: Option<(SpanCategory, Cow<'static, str>, Instant)>,
+}
+
+impl Drop for Span {
+	fn drop(&mut self) {
+		if let Some((category, name, start)) = self.inner.take() {
+			record_span(category, name, start, start.elapsed());
+		}
+	}
+}
+
+/// Record a span that was timed somewhere else
+pub fn record_span(
+	category: SpanCategory,
+	name: impl Into<Cow<'static, str>>,
+	start: Instant,
+	duration: Duration,
+) {
+	if !is_enabled() {
+		return;
+	}
+
+	let mut recorder = lock();
+	let start_us = start.saturating_duration_since(recorder.start).as_micros() as u64;
+	recorder.spans.push(SpanRecord {
+		category,
+		name: name.into().into_owned(),
+		start_us,
+		duration_us: duration.as_micros() as u64,
+	});
+}
+
+/// Record a request to a host and the time it took for the response to arrive
+pub fn record_request(host: &str, latency: Duration) {
+	if !is_enabled() {
+		return;
+	}
+
+	let mut recorder = lock();
+	let stats = recorder.get_host(host);
+	stats.requests += 1;
+	stats.total_latency_us += latency.as_micros() as u64;
+	let latency_ms = latency.as_millis() as u64;
+	let bucket = LATENCY_BUCKETS_MS
+		.iter()
+		.position(|x| latency_ms <= *x)
+		.unwrap_or(LATENCY_BUCKETS_MS.len());
+	stats.latency_histogram[bucket] += 1;
+}
+
+/// Record a finished download from a host. This also records a span for it
+pub fn record_download(host: &str, bytes: usize, start: Instant) {
+	if !is_enabled() {
+		return;
+	}
+
+	lock().get_host(host).bytes += bytes as u64;
+	record_span(
+		SpanCategory::Download,
+		host.to_string(),
+		start,
+		start.elapsed(),
+	);
+}
+
+/// Get a report of everything that has been recorded so far
+pub fn report() -> TimingReport {
+	let recorder = lock();
+
+	let mut summaries: HashMap<(SpanCategory, &str), SpanSummary> = HashMap::new();
+	for span in &recorder.spans {
+		let summary = summaries
+			.entry((span.category, &span.name))
+			.or_insert_with(|| SpanSummary {
+				category: span.category,
+				name: span.name.clone(),
+				count: 0,
+				total_us: 0,
+				max_us: 0,
+			});
+		summary.count += 1;
+		summary.total_us += span.duration_us;
+		summary.max_us = summary.max_us.max(span.duration_us);
+	}
+	let mut summaries: Vec<_> = summaries.into_values().collect();
+	summaries.sort_by(|a, b| {
+		a.category
+			.cmp(&b.category)
+			.then(b.total_us.cmp(&a.total_us))
+	});
+
+	let mut hosts: Vec<_> = recorder
+		.hosts
+		.iter()
+		.map(|(host, stats)| HostSummary {
+			host: host.clone(),
+			..stats.clone()
+		})
+		.collect();
+	hosts.sort_by(|a, b| b.requests.cmp(&a.requests).then(a.host.cmp(&b.host)));
+
+	TimingReport {
+		elapsed_us: recorder.start.elapsed().as_micros() as u64,
+		total_requests: hosts.iter().map(|x| x.requests).sum(),
+		total_bytes: hosts.iter().map(|x| x.bytes).sum(),
+		spans: recorder.spans.clone(),
+		summaries,
+		hosts,
+		latency_buckets_ms: LATENCY_BUCKETS_MS.to_vec(),
+	}
+}
+
+/// All of the timings recorded in the process
+#[derive(Serialize, Debug, Clone)]
+pub struct TimingReport {
+	/// Time since recording started, in microseconds
+	pub elapsed_us: u64,
+	/// The number of requests sent to all hosts
+	pub total_requests: u64,
+	/// The number of bytes downloaded from all hosts
+	pub total_bytes: u64,
+	/// Every recorded span, in the order that they ended
+	pub spans: Vec<SpanRecord>,
+	/// Spans with the same category and name added together, with the longest first
+	pub summaries: Vec<SpanSummary>,
+	/// Statistics for every host, with the most requested first
+	pub hosts: Vec<HostSummary>,
+	/// The upper bounds of the latency histogram buckets, in milliseconds
+	pub latency_buckets_ms: Vec<u64>,
+}
+
+/// A single recorded span
+#[derive(Serialize, Debug, Clone)]
+pub struct SpanRecord {
+	/// The kind of work the span measured
+	pub category: SpanCategory,
+	/// The name of the span
+	pub name: String,
+	/// When the span started, in microseconds since recording started
+	pub start_us: u64,
+	/// How long the span took, in microseconds
+	pub duration_us: u64,
+}
+
+/// All of the spans with the same category and name
+#[derive(Serialize, Debug, Clone)]
+pub struct SpanSummary {
+	/// The kind of work the spans measured
+	pub category: SpanCategory,
+	/// The name of the spans
+	pub name: String,
+	/// How many times the span was recorded
+	pub count: u64,
+	/// The total duration of the spans, in microseconds
+	pub total_us: u64,
+	/// The duration of the longest span, in microseconds
+	pub max_us: u64,
+}
+
+/// Request statistics for a single host
+#[derive(Serialize, Debug, Clone, Default)]
+pub struct HostSummary {
+	/// The host name
+	pub host: String,
+	/// The number of requests sent to the host, including retries
+	pub requests: u64,
+	/// The number of bytes downloaded from the host
+	pub bytes: u64,
+	/// The total time spent waiting for responses, in microseconds
+	pub total_latency_us: u64,
+	/// The number of requests in each latency bucket
+	pub latency_histogram: Vec<u64>,
+}
+
+struct Recorder {
+	start: Instant,
+	spans: Vec<SpanRecord>,
+	hosts: HashMap<String, HostSummary>,
+}
+
+impl Recorder {
+	fn get_host(&mut self, host: &str) -> &mut HostSummary {
+		if !self.hosts.contains_key(host) {
+			self.hosts.insert(
+				host.to_string(),
+				HostSummary {
+					latency_histogram: vec![0; LATENCY_BUCKETS_MS.len() + 1],
+					..Default::default()
+				},
+			);
+		}
+		self.hosts.get_mut(host).expect("Host was just inserted")
+	}
+}
+
+fn recorder() -> &'static Mutex<Recorder> {
+	static RECORDER: OnceLock<Mutex<Recorder>> = OnceLock::new();
+	RECORDER.get_or_init(|| {
+		Mutex::new(Recorder {
+			start: Instant::now(),
+			spans: Vec::new(),
+			hosts: HashMap::new(),
+		})
+	})
+}
+
+fn lock() -> MutexGuard<'static, Recorder> {
+	// The recorded data is still fine to use if a thread panicked while holding the lock
+	recorder().lock().unwrap_or_else(|x| x.into_inner())
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_timings() {
+		enable();
+		{
+			let _span = span(SpanCategory::Phase, "test_phase");
+		}
+		record_request("timing.test", Duration::from_millis(30));
+		record_request("timing.test", Duration::from_secs(60));
+		record_download("timing.test", 100, Instant::now());
+
+		let report = report();
+		let summary = report
+			.summaries
+			.iter()
+			.find(|x| x.name == "test_phase")
+			.expect("Phase should be recorded");
+		assert_eq!(summary.count, 1);
+
+		let host = report
+			.hosts
+			.iter()
+			.find(|x| x.host == "timing.test")
+			.expect("Host should be recorded");
+		assert_eq!(host.requests, 2);
+		assert_eq!(host.bytes, 100);
+		assert_eq!(host.latency_histogram[2], 1);
+		assert_eq!(host.latency_histogram[LATENCY_BUCKETS_MS.len()], 1);
+	}
+}
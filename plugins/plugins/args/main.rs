@@ -5,36 +5,36 @@ use mcvm_plugin::api::{CustomPlugin, MCVMOutput, MessageContents, MessageLevel};
 use mcvm_plugin::hooks::ModifyInstanceConfigResult;
 
 fn main() -> anyhow::Result<()> {
-	let mut plugin = CustomPlugin::new("args")?;
-	plugin.modify_instance_config(|mut ctx, config| {
-		let args = if let Some(preset) = config.get("args_preset") {
-			if let Some(preset) = preset.as_str() {
-				if let Ok(preset) = ArgsPreset::from_str(preset) {
-					preset.generate_args()
+	let plugin = CustomPlugin::new("args")?;
+	plugin.run(|plugin| {
+		plugin.modify_instance_config(|mut ctx, config| {
+			let args = if let Some(preset) = config.get("args_preset") {
+				if let Some(preset) = preset.as_str() {
+					if let Ok(preset) = ArgsPreset::from_str(preset) {
+						preset.generate_args()
+					} else {
+						ctx.get_output().display(
+							MessageContents::Error("Invalid args preset".into()),
+							MessageLevel::Important,
+						);
+						Vec::new()
+					}
 				} else {
 					ctx.get_output().display(
-						MessageContents::Error("Invalid args preset".into()),
+						MessageContents::Error("Args preset must be a string".into()),
 						MessageLevel::Important,
 					);
 					Vec::new()
 				}
 			} else {
-				ctx.get_output().display(
-					MessageContents::Error("Args preset must be a string".into()),
-					MessageLevel::Important,
-				);
 				Vec::new()
-			}
-		} else {
-			Vec::new()
-		};
+			};
 
-		Ok(ModifyInstanceConfigResult {
-			additional_jvm_args: args,
+			Ok(ModifyInstanceConfigResult {
+				additional_jvm_args: args,
+			})
 		})
-	})?;
-
-	Ok(())
+	})
 }
 
 /// Preset for generating game arguments (Usually for optimization)
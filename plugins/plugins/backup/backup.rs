@@ -12,6 +12,8 @@ use schemars::JsonSchema;
 use serde::{Deserialize, Serialize};
 use zip::{ZipArchive, ZipWriter};
 
+use crate::incremental;
+
 /// Name of the backup index file
 pub const INDEX_NAME: &str = "index.json";
 /// ID of the default group
@@ -166,18 +168,37 @@ impl Index {
 		let backup_path =
 			self.get_backup_path(group_id, &backup_id, group_config.common.storage_type);
 
-		let mut readers = Vec::new();
+		let mut files = Vec::new();
 		for path in &group_config.common.paths {
 			let paths = get_instance_file_paths(path, instance_dir)
 				.context("Failed to get recursive file paths")?;
-			for path in paths {
+			files.extend(paths);
+		}
+		if let StorageType::Incremental = group_config.common.storage_type {
+			// Unchanged files are found using the latest incremental backup in the group
+			let previous = self
+				.get_latest_incremental_backup_path(group_id)
+				.map(|x| incremental::Manifest::open(&x))
+				.transpose()
+				.context("Failed to open previous backup")?;
+			incremental::write_backup(
+				&self.get_chunks_dir(group_id),
+				&backup_path,
+				instance_dir,
+				files,
+				previous.as_ref(),
+			)
+			.context("Failed to write incremental backup")?;
+		} else {
+			let mut readers = Vec::new();
+			for path in files {
 				let file = File::open(instance_dir.join(&path))
 					.with_context(|| format!("Failed to open backed up file with path {path}"))?;
 				let file = BufReader::new(file);
-				readers.push((path.clone(), file));
+				readers.push((path, file));
 			}
+			write_backup_files(&backup_path, &group_config, readers)?;
 		}
-		write_backup_files(&backup_path, &group_config, readers)?;
 
 		let now = utc_timestamp()?;
 		// Add the backup entry to the group
@@ -210,14 +231,46 @@ impl Index {
 		let backup_path = self.get_backup_path(group_id, backup_id, storage_type);
 		if backup_path.exists() {
 			match storage_type {
-				StorageType::Archive => fs::remove_file(backup_path)?,
+				StorageType::Archive | StorageType::Incremental => fs::remove_file(backup_path)?,
 				StorageType::Folder => fs::remove_dir_all(backup_path)?,
 			}
 		}
 
+		// Chunks that were only used by this backup can be removed now
+		if let StorageType::Incremental = storage_type {
+			let manifests: Vec<_> = self
+				.get_incremental_backups(group_id)
+				.map(|x| self.get_backup_path(group_id, &x.id, x.storage_type))
+				.collect();
+			incremental::remove_unused_chunks(&self.get_chunks_dir(group_id), &manifests)
+				.context("Failed to remove unused backup chunks")?;
+		}
+
 		Ok(())
 	}
 
+	/// Iterate over the incremental backups in a group, from oldest to newest
+	fn get_incremental_backups<'a>(&'a self, group_id: &str) -> impl Iterator<Item = &'a Entry> {
+		self.contents
+			.groups
+			.get(group_id)
+			.into_iter()
+			.flat_map(|x| &x.backups)
+			.filter(|x| matches!(x.storage_type, StorageType::Incremental))
+	}
+
+	/// Get the manifest path of the latest incremental backup in a group
+	fn get_latest_incremental_backup_path(&self, group_id: &str) -> Option<PathBuf> {
+		let backup = self.get_incremental_backups(group_id).last()?;
+		let path = self.get_backup_path(group_id, &backup.id, backup.storage_type);
+		path.exists().then_some(path)
+	}
+
+	/// Gets the directory where the chunks of incremental backups in a group are stored
+	fn get_chunks_dir(&self, group_id: &str) -> PathBuf {
+		self.get_group_dir(group_id).join("chunks")
+	}
+
 	/// Remove old backups that are over the limit
 	pub fn remove_old_backups(
 		&mut self,
@@ -263,7 +316,12 @@ impl Index {
 			.ok_or(anyhow!("Backup with ID was not found"))?;
 
 		let backup_path = self.get_backup_path(group_id, backup_id, backup.storage_type);
-		restore_backup_files(&backup_path, backup.storage_type, instance_dir)?;
+		if let StorageType::Incremental = backup.storage_type {
+			incremental::restore_backup(&self.get_chunks_dir(group_id), &backup_path, instance_dir)
+				.context("Failed to restore incremental backup")?;
+		} else {
+			restore_backup_files(&backup_path, backup.storage_type, instance_dir)?;
+		}
 
 		Ok(())
 	}
@@ -284,6 +342,7 @@ impl Index {
 		let filename = match storage_type {
 			StorageType::Archive => format!("{backup_id}.zip"),
 			StorageType::Folder => backup_id.to_owned(),
+			StorageType::Incremental => format!("{backup_id}.json"),
 		};
 
 		path.join(filename)
@@ -332,6 +391,9 @@ pub enum StorageType {
 	/// Packed into an archive format to save space
 	#[default]
 	Archive,
+	/// Split into compressed chunks that are shared with the other incremental backups
+	/// in the group, so that only changed files are stored again
+	Incremental,
 }
 
 /// Get the backup directory for an instance
@@ -417,6 +479,7 @@ fn write_backup_files<R: Read>(
 
 			arc.finish()?;
 		}
+		StorageType::Incremental => bail!("Incremental backups are not written from readers"),
 		StorageType::Folder => {
 			for (path, mut reader) in readers {
 				let dest = backup_path.join(path);
@@ -451,6 +514,9 @@ fn restore_backup_files(
 			mcvm_core::io::files::copy_dir_contents(backup_path, instance_dir)
 				.context("Failed to copy directory")?;
 		}
+		StorageType::Incremental => {
+			bail!("Incremental backups are not restored from a single file")
+		}
 	}
 
 	Ok(())
@@ -0,0 +1,339 @@
+use std::collections::{HashMap, HashSet};
+use std::fs::{self, File};
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::time::UNIX_EPOCH;
+
+use anyhow::Context;
+use mcvm_core::io::{json_from_file, json_to_file};
+use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
+
+/// Size of the chunks that files are split into. Files that only change in some places,
+/// like region files, only need the changed chunks to be stored again
+const CHUNK_SIZE: usize = 1024 * 1024;
+/// The zstd compression level for chunks
+const COMPRESSION_LEVEL: i32 = 3;
+/// Counter that makes the names of temporary chunk files unique in this process
+static TEMP_COUNTER: AtomicUsize = AtomicUsize::new(0);
+
+/// Manifest for a single incremental backup, which lists the chunks that make up every file.
+/// The chunks themselves are shared between all of the backups in a group
+#[derive(Serialize, Deserialize, Default)]
+#[serde(default)]
+pub struct Manifest {
+	/// The files in the backup, by their path relative to the instance
+	pub files: HashMap<String, FileEntry>,
+}
+
+/// A single file in an incremental backup
+#[derive(Serialize, Deserialize, Clone)]
+pub struct FileEntry {
+	/// The size of the file in bytes
+	pub size: u64,
+	/// The modification time of the file, in nanoseconds since the Unix epoch
+	pub mtime: u64,
+	/// The hashes of the chunks of the file, in order
+	pub chunks: Vec<String>,
+}
+
+impl Manifest {
+	/// Open the manifest of a backup
+	pub fn open(path: &Path) -> anyhow::Result<Self> {
+		json_from_file(path).context("Failed to read backup manifest")
+	}
+}
+
+/// Write an incremental backup of files in the instance. Files that have the same size and
+/// modification time as in the previous backup are not read at all, and only chunks that
+/// aren't stored yet are compressed and written
+pub fn write_backup(
+	chunks_dir: &Path,
+	manifest_path: &Path,
+	instance_dir: &Path,
+	files: Vec<String>,
+	previous: Option<&Manifest>,
+) -> anyhow::Result<()> {
+	fs::create_dir_all(chunks_dir).context("Failed to create chunks directory")?;
+
+	let entries = run_parallel(files, |path| {
+		let full_path = instance_dir.join(&path);
+		let meta = full_path
+			.metadata()
+			.with_context(|| format!("Failed to get metadata of backed up file {path}"))?;
+		let size = meta.len();
+		let mtime = get_mtime(&meta);
+
+		if let Some(entry) = previous.and_then(|x| x.files.get(&path)) {
+			if entry.size == size && entry.mtime == mtime {
+				return Ok((path, entry.clone()));
+			}
+		}
+
+		let chunks = store_file(&full_path, chunks_dir)
+			.with_context(|| format!("Failed to store backed up file {path}"))?;
+		Ok((
+			path,
+			FileEntry {
+				size,
+				mtime,
+				chunks,
+			},
+		))
+	})?;
+
+	let manifest = Manifest {
+		files: entries.into_iter().collect(),
+	};
+	mcvm_core::io::files::create_leading_dirs(manifest_path)?;
+	json_to_file(manifest_path, &manifest).context("Failed to write backup manifest")?;
+
+	Ok(())
+}
+
+/// Restore the files of an incremental backup to the instance
+pub fn restore_backup(
+	chunks_dir: &Path,
+	manifest_path: &Path,
+	instance_dir: &Path,
+) -> anyhow::Result<()> {
+	let manifest = Manifest::open(manifest_path)?;
+	run_parallel(manifest.files.into_iter().collect(), |(path, entry)| {
+		let dest = instance_dir.join(&path);
+		mcvm_core::io::files::create_leading_dirs(&dest)?;
+		let mut file = BufWriter::new(
+			File::create(&dest)
+				.with_context(|| format!("Failed to create restored file {path}"))?,
+		);
+		for chunk in &entry.chunks {
+			let chunk_file = File::open(get_chunk_path(chunks_dir, chunk))
+				.with_context(|| format!("Backup chunk {chunk} is missing"))?;
+			zstd::stream::copy_decode(BufReader::new(chunk_file), &mut file)
+				.with_context(|| format!("Failed to decompress backup chunk {chunk}"))?;
+		}
+		file.flush().context("Failed to write restored file")?;
+
+		Ok(())
+	})?;
+
+	Ok(())
+}
+
+/// Remove all of the chunks that aren't used by any of the given backup manifests.
+/// Returns the number of chunks that were removed
+pub fn remove_unused_chunks(chunks_dir: &Path, manifests: &[PathBuf]) -> anyhow::Result<usize> {
+	if !chunks_dir.exists() {
+		return Ok(0);
+	}
+
+	let mut used = HashSet::new();
+	for path in manifests {
+		let manifest = Manifest::open(path)?;
+		used.extend(manifest.files.into_values().flat_map(|x| x.chunks));
+	}
+
+	let mut count = 0;
+	for dir in chunks_dir
+		.read_dir()
+		.context("Failed to read chunks directory")?
+	{
+		let dir = dir?.path();
+		if !dir.is_dir() {
+			continue;
+		}
+		for chunk in dir.read_dir()? {
+			let chunk = chunk?.path();
+			let is_used = chunk
+				.file_stem()
+				.is_some_and(|x| used.contains(x.to_string_lossy().as_ref()));
+			if !is_used {
+				fs::remove_file(&chunk).context("Failed to remove unused chunk")?;
+				count += 1;
+			}
+		}
+	}
+
+	Ok(count)
+}
+
+/// Split a file into chunks and store the ones that aren't stored yet.
+/// Returns the hashes of the chunks
+fn store_file(path: &Path, chunks_dir: &Path) -> anyhow::Result<Vec<String>> {
+	let mut file = BufReader::new(File::open(path).context("Failed to open file")?);
+	let mut buf = vec![0; CHUNK_SIZE];
+	let mut chunks = Vec::new();
+	loop {
+		let len = read_chunk(&mut file, &mut buf).context("Failed to read file")?;
+		if len == 0 {
+			break;
+		}
+		let data = &buf[..len];
+		let hash = hex::encode(Sha256::digest(data));
+
+		let chunk_path = get_chunk_path(chunks_dir, &hash);
+		if !chunk_path.exists() {
+			write_chunk(&chunk_path, data)
+				.with_context(|| format!("Failed to write chunk {hash}"))?;
+		}
+		chunks.push(hash);
+
+		if len < CHUNK_SIZE {
+			break;
+		}
+	}
+
+	Ok(chunks)
+}
+
+/// Compress and write a chunk. It is written to a temporary file first so that a chunk
+/// file that exists is always complete
+fn write_chunk(path: &Path, data: &[u8]) -> anyhow::Result<()> {
+	mcvm_core::io::files::create_leading_dirs(path)?;
+	let compressed = zstd::bulk::compress(data, COMPRESSION_LEVEL)?;
+	// Workers can write the same chunk at the same time, so each write gets its own file
+	let count = TEMP_COUNTER.fetch_add(1, Ordering::Relaxed);
+	let temp_path = path.with_extension(format!("tmp{}-{count}", std::process::id()));
+	fs::write(&temp_path, compressed)?;
+	if let Err(e) = fs::rename(&temp_path, path) {
+		let _ = fs::remove_file(&temp_path);
+		// Another thread may have written the same chunk first
+		if !path.exists() {
+			return Err(e.into());
+		}
+	}
+
+	Ok(())
+}
+
+/// Read as much of a chunk as possible into the buffer, returning the length that was read
+fn read_chunk(reader: &mut impl Read, buf: &mut [u8]) -> std::io::Result<usize> {
+	let mut len = 0;
+	while len < buf.len() {
+		let read = reader.read(&mut buf[len..])?;
+		if read == 0 {
+			break;
+		}
+		len += read;
+	}
+
+	Ok(len)
+}
+
+/// Get the path to a chunk. Chunks are split into directories by the start of their hash
+/// to keep directories from getting too large
+fn get_chunk_path(chunks_dir: &Path, hash: &str) -> PathBuf {
+	chunks_dir
+		.join(&hash[..2.min(hash.len())])
+		.join(format!("{hash}.zst"))
+}
+
+fn get_mtime(meta: &fs::Metadata) -> u64 {
+	meta.modified()
+		.ok()
+		.and_then(|x| x.duration_since(UNIX_EPOCH).ok())
+		.map(|x| x.as_nanos() as u64)
+		.unwrap_or_default()
+}
+
+/// Run a function over items on all of the available threads, returning the results in order
+fn run_parallel<T: Send, R: Send>(
+	items: Vec<T>,
+	f: impl Fn(T) -> anyhow::Result<R> + Sync,
+) -> anyhow::Result<Vec<R>> {
+	let thread_count = std::thread::available_parallelism()
+		.map(|x| x.get())
+		.unwrap_or(1)
+		.min(items.len().max(1));
+	let count = items.len();
+	let items: Vec<_> = items.into_iter().map(|x| Mutex::new(Some(x))).collect();
+	let results: Vec<_> = (0..count).map(|_| Mutex::new(None)).collect();
+	let next = AtomicUsize::new(0);
+
+	std::thread::scope(|scope| {
+		let threads: Vec<_> = (0..thread_count)
+			.map(|_| {
+				scope.spawn(|| loop {
+					let i = next.fetch_add(1, Ordering::Relaxed);
+					if i >= count {
+						return Ok::<_, anyhow::Error>(());
+					}
+					let item = items[i]
+						.lock()
+						.expect("Item lock should not be poisoned")
+						.take()
+						.expect("Item should only be taken once");
+					let result = f(item)?;
+					*results[i]
+						.lock()
+						.expect("Result lock should not be poisoned") = Some(result);
+				})
+			})
+			.collect();
+
+		for thread in threads {
+			thread
+				.join()
+				.map_err(|_| anyhow::anyhow!("Backup thread panicked"))??;
+		}
+
+		Ok::<_, anyhow::Error>(())
+	})?;
+
+	Ok(results
+		.into_iter()
+		.map(|x| {
+			x.into_inner()
+				.expect("Result lock should not be poisoned")
+				.expect("Every item should have a result")
+		})
+		.collect())
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_incremental_backup() {
+		let dir = std::env::temp_dir().join("mcvm_test_incremental_backup");
+		let _ = fs::remove_dir_all(&dir);
+		let instance_dir = dir.join("instance");
+		let chunks_dir = dir.join("chunks");
+		fs::create_dir_all(instance_dir.join("world")).unwrap();
+		fs::write(instance_dir.join("world/level.dat"), "level").unwrap();
+		fs::write(instance_dir.join("world/big"), vec![7; CHUNK_SIZE + 10]).unwrap();
+		let files = vec!["world/level.dat".to_string(), "world/big".to_string()];
+
+		let first = dir.join("first.json");
+		write_backup(&chunks_dir, &first, &instance_dir, files.clone(), None).unwrap();
+		let first_manifest = Manifest::open(&first).unwrap();
+		assert_eq!(first_manifest.files["world/big"].chunks.len(), 2);
+
+		fs::write(instance_dir.join("world/level.dat"), "changed level").unwrap();
+		let second = dir.join("second.json");
+		write_backup(
+			&chunks_dir,
+			&second,
+			&instance_dir,
+			files,
+			Some(&first_manifest),
+		)
+		.unwrap();
+
+		let restored = dir.join("restored");
+		restore_backup(&chunks_dir, &first, &restored).unwrap();
+		assert_eq!(
+			fs::read_to_string(restored.join("world/level.dat")).unwrap(),
+			"level"
+		);
+		assert_eq!(
+			fs::read(restored.join("world/big")).unwrap().len(),
+			CHUNK_SIZE + 10
+		);
+
+		// Only the chunk of the old level.dat is unused once the first backup is gone
+		assert_eq!(remove_unused_chunks(&chunks_dir, &[second]).unwrap(), 1);
+	}
+}
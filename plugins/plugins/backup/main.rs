@@ -1,4 +1,5 @@
 mod backup;
+mod incremental;
 
 use std::collections::HashMap;
 use std::path::{Path, PathBuf};
@@ -1,8 +1,8 @@
+use std::cmp::Reverse;
 use std::fs::File;
 use std::io::BufWriter;
 use std::path::PathBuf;
 use std::sync::Arc;
-use std::{cmp::Reverse, collections::HashMap};
 
 use iso8601_timestamp::Timestamp;
 use mcvm_core::net::download::Client;
@@ -14,6 +14,7 @@ use tokio::task::JoinSet;
 
 use mcvm_net::smithed as smithed_api;
 
+use super::fetch::fetch_modrinth;
 use super::{PackageGenerationConfig, PackageSource};
 
 /// Configuration for a lot of package generation
@@ -30,6 +31,10 @@ pub struct BatchedConfig {
 	/// Global package config to apply to all packages
 	#[serde(default)]
 	pub global_config: Option<PackageGenerationConfig>,
+	/// A directory to keep downloaded data in between runs.
+	/// Defaults to a `.cache` directory in the output directory
+	#[serde(default)]
+	pub cache_dir: Option<String>,
 }
 
 /// Configuration for a single batched package generation
@@ -93,44 +98,10 @@ pub async fn batched_gen(mut config: BatchedConfig, filter: Vec<String>) {
 		})
 		.map(|x| x.id.clone())
 		.collect();
-	let modrinth_projects = mcvm_net::modrinth::get_multiple_projects(&modrinth_ids, &client)
-		.await
-		.expect("Failed to get Modrinth projects");
-
-	// Collect Modrinth project versions. We have to batch these into multiple requests because there becomes
-	// just too many parameters for the URL to handle
-	let batch_limit = 215;
-	let modrinth_version_ids: Vec<_> = modrinth_projects
-		.iter()
-		.flat_map(|x| x.versions.iter().cloned())
-		.collect();
-	if !modrinth_version_ids.is_empty() {
-		println!(
-			"Downloading {} Modrinth versions...",
-			modrinth_version_ids.len()
-		);
-	}
-
-	let chunks = modrinth_version_ids.chunks(batch_limit);
-
-	let modrinth_versions = Arc::new(Mutex::new(Vec::new()));
-	let mut tasks = JoinSet::new();
-	for chunk in chunks {
-		let chunk = chunk.to_vec();
-		let client = client.clone();
-		let modrinth_versions = modrinth_versions.clone();
-		let task = async move {
-			let versions = mcvm_net::modrinth::get_multiple_versions(&chunk, &client)
-				.await
-				.expect("Failed to get Modrinth versions");
-			let mut lock = modrinth_versions.lock().await;
-			lock.extend(versions);
-		};
-		tasks.spawn(task);
-	}
 
 	// Download Smithed packs at the same time
 	let smithed_packs = Arc::new(Mutex::new(Vec::new()));
+	let mut tasks = JoinSet::new();
 	for pkg in &config.packages {
 		if let PackageSource::Smithed = pkg.source {
 			let client = client.clone();
@@ -147,44 +118,29 @@ pub async fn batched_gen(mut config: BatchedConfig, filter: Vec<String>) {
 		}
 	}
 
-	// Download Modrinth teams at the same time
-	let mut modrinth_team_ids = Vec::new();
-	for project in &modrinth_projects {
-		modrinth_team_ids.push(project.team.clone());
-	}
-	let modrinth_teams = Arc::new(Mutex::new(Vec::new()));
-	{
-		let client = client.clone();
-		let modrinth_teams = modrinth_teams.clone();
-		let task = async move {
-			let teams = mcvm_net::modrinth::get_multiple_teams(&modrinth_team_ids, &client)
-				.await
-				.expect("Failed to get Modrinth teams");
-			let mut lock = modrinth_teams.lock().await;
-			*lock = teams;
-		};
-		tasks.spawn(task);
-	}
+	// Fetch all of the Modrinth data in bulk
+	let cache_dir = config
+		.cache_dir
+		.map(PathBuf::from)
+		.unwrap_or_else(|| PathBuf::from(&config.output_dir).join(".cache"));
+	let modrinth = fetch_modrinth(
+		&modrinth_ids,
+		Some(cache_dir.join("modrinth_versions")),
+		&client,
+	)
+	.await
+	.expect("Failed to get Modrinth data");
 
 	// Run the tasks
 	while let Some(result) = tasks.join_next().await {
 		result.expect("Task failed");
 	}
-	let mut modrinth_versions = modrinth_versions.lock().await;
 	let smithed_packs = smithed_packs.lock().await;
-	let modrinth_teams = modrinth_teams.lock().await;
 
 	// Sort the Modrinth versions
-	modrinth_versions.sort_by_key(SortVersions::new);
-
-	// Put the Modrinth versions into a HashMap for better performance
-	let mut modrinth_version_map: HashMap<_, Vec<_>> = HashMap::new();
-	for version in modrinth_versions.iter() {
-		let entry = modrinth_version_map
-			.entry(version.project_id.clone())
-			.or_default();
-
-		entry.push(version.clone());
+	let mut modrinth_version_map = modrinth.versions;
+	for versions in modrinth_version_map.values_mut() {
+		versions.sort_by_key(SortVersions::new);
 	}
 
 	// Iterate through the packages to generate
@@ -217,9 +173,9 @@ pub async fn batched_gen(mut config: BatchedConfig, filter: Vec<String>) {
 			}
 			PackageSource::Modrinth => {
 				// Get the project
-				let project = modrinth_projects
-					.iter()
-					.find(|x| x.id == pkg.id)
+				let project = modrinth
+					.projects
+					.get(&pkg.id)
 					.expect("Project should have been fetched");
 
 				// Get the versions for the project
@@ -229,10 +185,7 @@ pub async fn batched_gen(mut config: BatchedConfig, filter: Vec<String>) {
 
 				// Get the team associated with this project. Teams can have no members, which we handle by just using an empty team
 				let empty_vec = Vec::new();
-				let team = modrinth_teams
-					.iter()
-					.find(|team| team.iter().any(|member| member.team_id == project.team))
-					.unwrap_or(&empty_vec);
+				let team = modrinth.teams.get(&project.team).unwrap_or(&empty_vec);
 
 				super::modrinth::gen_raw(
 					project.clone(),
@@ -0,0 +1,340 @@
+use std::collections::{HashMap, HashSet};
+use std::path::PathBuf;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+use anyhow::Context;
+use mcvm_core::net::download::{self, Client, DownloadPriority};
+use mcvm_net::modrinth::{Member, Project, Version};
+use serde::de::DeserializeOwned;
+use serde::{Deserialize, Serialize};
+use tokio::sync::Semaphore;
+use tokio::task::JoinSet;
+
+/// The longest that the encoded ID list of a bulk request can be. Lots of servers and
+/// proxies reject URLs that are much longer than this
+const MAX_PARAM_LEN: usize = 6000;
+/// Extra length that every ID takes up in the encoded list, from the quotes and the comma
+const ID_OVERHEAD: usize = 7;
+/// How many bulk requests are sent at the same time
+const MAX_CONCURRENT_REQUESTS: usize = 4;
+/// Requests are paused once there are only this many left before the rate limit resets
+const RATE_LIMIT_RESERVE: u64 = 5;
+/// How long the cached versions of a project are used before they are all fetched again,
+/// in case an edit to them didn't show up in the project's update time
+const VERSION_CACHE_TTL: Duration = Duration::from_secs(60 * 60 * 24);
+
+/// All of the data from Modrinth that is needed to generate a set of packages
+pub struct ModrinthData {
+	/// Projects by their ID
+	pub projects: HashMap<String, Project>,
+	/// The versions of each project, by project ID
+	pub versions: HashMap<String, Vec<Version>>,
+	/// Team members, by team ID. Teams with no members are not included
+	pub teams: HashMap<String, Vec<Member>>,
+}
+
+/// Fetches all of the data for a list of Modrinth projects using the bulk endpoints.
+/// Versions are stored in the cache directory, and only the ones that aren't there yet
+/// are requested. Authors can edit their versions, so all of the cached versions of a
+/// project are thrown out when the project has been updated since, or when they get too old
+pub async fn fetch_modrinth(
+	project_ids: &[String],
+	cache_dir: Option<PathBuf>,
+	client: &Client,
+) -> anyhow::Result<ModrinthData> {
+	let fetcher = Arc::new(BulkFetcher::new(client.clone()));
+
+	let project_ids: Vec<_> = project_ids
+		.iter()
+		.cloned()
+		.collect::<HashSet<_>>()
+		.into_iter()
+		.collect();
+	let projects: Vec<Project> = fetcher
+		.get_all("projects", project_ids)
+		.await
+		.context("Failed to get Modrinth projects")?;
+
+	// Teams only depend on the projects, so they can be fetched alongside the versions
+	let team_ids: Vec<_> = projects
+		.iter()
+		.map(|x| x.team.clone())
+		.collect::<HashSet<_>>()
+		.into_iter()
+		.collect();
+	let teams_task = {
+		let fetcher = fetcher.clone();
+		tokio::spawn(async move { fetcher.get_all::<Vec<Member>>("teams", team_ids).await })
+	};
+
+	let cache = cache_dir.map(VersionCache::new);
+	let mut versions = HashMap::new();
+	let mut missing_version_ids = Vec::new();
+	for project in &projects {
+		let cached = cache.as_ref().map(|x| x.load(project)).unwrap_or_default();
+		let cached_ids: HashSet<_> = cached.iter().map(|x| x.id.clone()).collect();
+		missing_version_ids.extend(
+			project
+				.versions
+				.iter()
+				.filter(|x| !cached_ids.contains(*x))
+				.cloned(),
+		);
+		versions.insert(project.id.clone(), cached);
+	}
+
+	if !missing_version_ids.is_empty() {
+		println!(
+			"Downloading {} Modrinth versions...",
+			missing_version_ids.len()
+		);
+	}
+	let new_versions: Vec<Version> = fetcher
+		.get_all("versions", missing_version_ids)
+		.await
+		.context("Failed to get Modrinth versions")?;
+	let mut changed_projects = HashSet::new();
+	for version in new_versions {
+		changed_projects.insert(version.project_id.clone());
+		versions
+			.entry(version.project_id.clone())
+			.or_default()
+			.push(version);
+	}
+	if let Some(cache) = &cache {
+		for project in projects.iter().filter(|x| changed_projects.contains(&x.id)) {
+			cache
+				.store(project, &versions[&project.id])
+				.context("Failed to cache Modrinth versions")?;
+		}
+	}
+
+	let teams = teams_task
+		.await
+		.context("Team task failed")?
+		.context("Failed to get Modrinth teams")?;
+	let teams = teams
+		.into_iter()
+		.filter_map(|team| Some((team.first()?.team_id.clone(), team)))
+		.collect();
+
+	Ok(ModrinthData {
+		projects: projects.into_iter().map(|x| (x.id.clone(), x)).collect(),
+		versions,
+		teams,
+	})
+}
+
+/// Sends bulk requests to the Modrinth API while staying under the rate limit
+struct BulkFetcher {
+	client: Client,
+	requests: Semaphore,
+	/// Time until which no requests will be sent because we are almost out of our rate limit
+	paused_until: Mutex<Option<Instant>>,
+}
+
+impl BulkFetcher {
+	fn new(client: Client) -> Self {
+		Self {
+			client,
+			requests: Semaphore::new(MAX_CONCURRENT_REQUESTS),
+			paused_until: Mutex::new(None),
+		}
+	}
+
+	/// Get all of the items with the given IDs from a bulk endpoint, like `projects`.
+	/// The IDs are split up into as many requests as their length needs
+	async fn get_all<T: DeserializeOwned + Send + 'static>(
+		self: &Arc<Self>,
+		endpoint: &'static str,
+		ids: Vec<String>,
+	) -> anyhow::Result<Vec<T>> {
+		let mut tasks = JoinSet::new();
+		for chunk in plan_chunks(ids, MAX_PARAM_LEN) {
+			let fetcher = self.clone();
+			tasks.spawn(async move { fetcher.get_chunk::<T>(endpoint, &chunk).await });
+		}
+
+		let mut out = Vec::new();
+		while let Some(result) = tasks.join_next().await {
+			out.extend(result.context("Request task failed")??);
+		}
+
+		Ok(out)
+	}
+
+	/// Send a single bulk request
+	async fn get_chunk<T: DeserializeOwned>(
+		&self,
+		endpoint: &str,
+		ids: &[String],
+	) -> anyhow::Result<Vec<T>> {
+		let _permit = self
+			.requests
+			.acquire()
+			.await
+			.context("Request limit closed")?;
+		self.wait_for_rate_limit().await;
+
+		let param = serde_json::to_string(ids).context("Failed to convert IDs to API parameter")?;
+		let url = format!("https://api.modrinth.com/v2/{endpoint}?ids={param}");
+		let (response, permit) =
+			download::download_scheduled(url, &self.client, DownloadPriority::Normal)
+				.await
+				.with_context(|| format!("Failed to request Modrinth {endpoint}"))?;
+		self.update_rate_limit(&response);
+
+		let bytes = response.bytes().await.context("Failed to read response")?;
+		permit.report_success(bytes.len());
+
+		serde_json::from_slice(&bytes)
+			.with_context(|| format!("Failed to parse Modrinth {endpoint}"))
+	}
+
+	/// Wait until we are allowed to send requests again
+	async fn wait_for_rate_limit(&self) {
+		let paused_until = *self.paused_until.lock().unwrap_or_else(|x| x.into_inner());
+		if let Some(paused_until) = paused_until {
+			tokio::time::sleep_until(paused_until.into()).await;
+		}
+	}
+
+	/// Pause requests if the rate limit headers of a response say we are running out
+	fn update_rate_limit(&self, response: &reqwest::Response) {
+		let get = |name| -> Option<u64> {
+			response
+				.headers()
+				.get(name)?
+				.to_str()
+				.ok()?
+				.trim()
+				.parse()
+				.ok()
+		};
+		let (Some(remaining), Some(reset)) =
+			(get("x-ratelimit-remaining"), get("x-ratelimit-reset"))
+		else {
+			return;
+		};
+		if remaining <= RATE_LIMIT_RESERVE {
+			let until = Instant::now() + Duration::from_secs(reset);
+			let mut paused_until = self.paused_until.lock().unwrap_or_else(|x| x.into_inner());
+			if paused_until.map_or(true, |x| x < until) {
+				*paused_until = Some(until);
+			}
+		}
+	}
+}
+
+/// Split IDs into chunks whose encoded lists are no longer than the limit
+fn plan_chunks(ids: Vec<String>, max_len: usize) -> Vec<Vec<String>> {
+	let mut out = Vec::new();
+	let mut chunk = Vec::new();
+	let mut len = 0;
+	for id in ids {
+		let id_len = id.len() + ID_OVERHEAD;
+		if !chunk.is_empty() && len + id_len > max_len {
+			out.push(std::mem::take(&mut chunk));
+			len = 0;
+		}
+		len += id_len;
+		chunk.push(id);
+	}
+	if !chunk.is_empty() {
+		out.push(chunk);
+	}
+
+	out
+}
+
+/// On-disk cache of the versions of projects
+struct VersionCache {
+	dir: PathBuf,
+}
+
+impl VersionCache {
+	fn new(dir: PathBuf) -> Self {
+		Self { dir }
+	}
+
+	/// Load the cached versions of a project that are still listed on it. Nothing is
+	/// loaded if the cache is out of date
+	fn load(&self, project: &Project) -> Vec<Version> {
+		let Ok(contents) = std::fs::read(self.get_path(&project.id)) else {
+			return Vec::new();
+		};
+		let Ok(cached) = serde_json::from_slice::<CachedVersions>(&contents) else {
+			return Vec::new();
+		};
+		if !cached.is_valid(project, get_current_time()) {
+			return Vec::new();
+		}
+		let listed: HashSet<_> = project.versions.iter().collect();
+		cached
+			.versions
+			.into_iter()
+			.filter(|x| listed.contains(&x.id))
+			.collect()
+	}
+
+	/// Store the versions of a project
+	fn store(&self, project: &Project, versions: &[Version]) -> anyhow::Result<()> {
+		std::fs::create_dir_all(&self.dir).context("Failed to create cache directory")?;
+		let cached = CachedVersions {
+			project_updated: project.updated.clone(),
+			fetched: get_current_time(),
+			versions: versions.to_vec(),
+		};
+		let contents = serde_json::to_vec(&cached).context("Failed to serialize versions")?;
+		std::fs::write(self.get_path(&project.id), contents).context("Failed to write versions")
+	}
+
+	fn get_path(&self, project_id: &str) -> PathBuf {
+		self.dir.join(format!("{project_id}.json"))
+	}
+}
+
+/// The cached versions of a project, along with what is needed to tell if they are out of date
+#[derive(Serialize, Deserialize)]
+struct CachedVersions {
+	/// The update time of the project when the versions were fetched
+	project_updated: Option<String>,
+	/// When the versions were fetched, in seconds since the Unix epoch
+	fetched: u64,
+	versions: Vec<Version>,
+}
+
+impl CachedVersions {
+	fn is_valid(&self, project: &Project, now: u64) -> bool {
+		// Projects without an update time can't be checked, so they only have the TTL
+		let same_update = project.updated.is_none() || self.project_updated == project.updated;
+		same_update && now.saturating_sub(self.fetched) < VERSION_CACHE_TTL.as_secs()
+	}
+}
+
+fn get_current_time() -> u64 {
+	SystemTime::now()
+		.duration_since(UNIX_EPOCH)
+		.unwrap_or_default()
+		.as_secs()
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_plan_chunks() {
+		let ids: Vec<_> = (0..10).map(|x| format!("id{x:06}")).collect();
+		let chunks = plan_chunks(ids.clone(), (8 + ID_OVERHEAD) * 4);
+		assert_eq!(chunks.len(), 3);
+		assert_eq!(chunks[0].len(), 4);
+		assert_eq!(chunks[2].len(), 2);
+		assert_eq!(chunks.concat(), ids);
+
+		assert!(plan_chunks(Vec::new(), MAX_PARAM_LEN).is_empty());
+		// IDs that are too long on their own still get their own chunk
+		assert_eq!(plan_chunks(ids, 1).len(), 10);
+	}
+}
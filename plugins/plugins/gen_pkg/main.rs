@@ -10,6 +10,8 @@ use serde_json::Serializer;
 
 /// Generation of many packages
 pub mod batched;
+/// Bulk fetching of data from package sources
+pub mod fetch;
 /// Modrinth package generation
 pub mod modrinth;
 /// Smithed package generation
@@ -8,30 +8,30 @@ use mcvm_shared::Side;
 use serde::Deserialize;
 
 fn main() -> anyhow::Result<()> {
-	let mut plugin = CustomPlugin::new("server_restart")?;
-	plugin.on_instance_setup(|_, arg| {
-		if !arg.side.is_some_and(|x| x == Side::Server) {
-			return Ok(());
-		}
-
-		let config = if let Some(config) = arg.custom_config.get("restart") {
-			serde_json::from_value(config.clone()).context("Failed to deserialize config")?
-		} else {
-			Config::default()
-		};
+	let plugin = CustomPlugin::new("server_restart")?;
+	plugin.run(|plugin| {
+		plugin.on_instance_setup(|_, arg| {
+			if !arg.side.is_some_and(|x| x == Side::Server) {
+				return Ok(());
+			}
 
-		#[cfg(target_os = "windows")]
-		let filename = "start.bat";
-		#[cfg(not(target_os = "windows"))]
-		let filename = "start.sh";
-		let path = PathBuf::from(&arg.game_dir).join(filename);
-		create_script(&path, &arg.id, config)
-			.context("Failed to create startup script for instance")?;
+			let config = if let Some(config) = arg.custom_config.get("restart") {
+				serde_json::from_value(config.clone()).context("Failed to deserialize config")?
+			} else {
+				Config::default()
+			};
 
-		Ok(())
-	})?;
+			#[cfg(target_os = "windows")]
+			let filename = "start.bat";
+			#[cfg(not(target_os = "windows"))]
+			let filename = "start.sh";
+			let path = PathBuf::from(&arg.game_dir).join(filename);
+			create_script(&path, &arg.id, config)
+				.context("Failed to create startup script for instance")?;
 
-	Ok(())
+			Ok(())
+		})
+	})
 }
 
 /// Config for restart behavior on an instance
@@ -3,14 +3,16 @@ use mcvm_shared::addon::{Addon, AddonKind};
 use mcvm_shared::pkg::PackageAddonOptionalHashes;
 use reqwest::Client;
 
+use crate::io::lock::Lockfile;
 use crate::io::paths::Paths;
 use crate::util::hash::{get_best_hash, hash_file_with_best_hash};
 use mcvm_core::io::files::{create_leading_dirs, update_hardlink};
-use mcvm_core::net::download;
+use mcvm_core::net::download::{self, DownloadPriority, ExpectedHashes};
 use mcvm_shared::modifications::{Modloader, ServerType};
 
 use std::future::Future;
 use std::path::{Path, PathBuf};
+use std::time::{Duration, SystemTime};
 
 /// Extension methods for addons that this crate uses
 pub trait AddonExt {
@@ -82,6 +84,61 @@ pub fn is_stored_addon_path(path: &Path, paths: &Paths) -> bool {
 	path.starts_with(&paths.addons)
 }
 
+/// Get the directory of the content-addressed addon store. Every addon file with a known
+/// SHA-512 hash is kept here once, and the stored addon paths are hardlinks to it, so that
+/// addons with identical content from different packages or instances share storage
+pub fn get_addon_store_dir(paths: &Paths) -> PathBuf {
+	paths.addons.join("store")
+}
+
+/// Get the path to an addon file in the addon store, if it has a usable hash
+fn get_addon_store_path(paths: &Paths, hashes: &PackageAddonOptionalHashes) -> Option<PathBuf> {
+	let hash = hashes.sha512.as_ref()?.to_ascii_lowercase();
+	// The hash is used as a filename, so it can't be anything but a hash
+	if hash.is_empty() || !hash.chars().all(|x| x.is_ascii_hexdigit()) {
+		return None;
+	}
+	Some(get_addon_store_dir(paths).join(hash))
+}
+
+/// How long a file in the addon store is kept after it was added, even if no addon in the
+/// lockfile uses it. Addons that were prefetched, or that another update is still
+/// acquiring, aren't in the lockfile yet
+pub const ADDON_STORE_GRACE_PERIOD: Duration = Duration::from_secs(7 * 24 * 60 * 60);
+
+/// Remove all of the files in the addon store that aren't used by any addon in the lockfile
+/// and are older than the grace period. Returns the number of files that were removed
+pub fn remove_unused_stored_addons(paths: &Paths, lock: &Lockfile) -> anyhow::Result<usize> {
+	let dir = get_addon_store_dir(paths);
+	if !dir.exists() {
+		return Ok(0);
+	}
+
+	let used = lock
+		.get_addon_hashes()
+		.context("Failed to get addon hashes from lockfile")?;
+	let mut count = 0;
+	for entry in dir.read_dir().context("Failed to read addon store")? {
+		let entry = entry.context("Failed to read addon store entry")?;
+		if used.contains(entry.file_name().to_string_lossy().as_ref()) {
+			continue;
+		}
+		let age = entry
+			.metadata()
+			.and_then(|x| x.modified())
+			.ok()
+			.and_then(|x| SystemTime::now().duration_since(x).ok());
+		// Files with an unknown age are kept, since they could be new
+		if !age.is_some_and(|x| x > ADDON_STORE_GRACE_PERIOD) {
+			continue;
+		}
+		std::fs::remove_file(entry.path()).context("Failed to remove unused stored addon")?;
+		count += 1;
+	}
+
+	Ok(count)
+}
+
 /// The location of an addon
 #[derive(Debug, Clone)]
 pub enum AddonLocation {
@@ -134,29 +191,69 @@ impl AddonRequest {
 	) -> anyhow::Result<impl Future<Output = anyhow::Result<()>> + Send + 'static> {
 		let path = self.addon.get_path(paths, instance_id);
 		create_leading_dirs(&path)?;
+		let store_path = get_addon_store_path(paths, &self.addon.hashes);
+		if let Some(store_path) = &store_path {
+			create_leading_dirs(store_path)?;
+		}
 
 		let location = self.location.clone();
 		let client = client.clone();
 		let hashes = self.addon.hashes.clone();
 		let task = async move {
+			// Files that are already in the store don't need to be acquired again
+			if let Some(store_path) = &store_path {
+				if store_path.exists() {
+					if path.exists() {
+						std::fs::remove_file(&path)
+							.context("Failed to remove stored addon file")?;
+					}
+					update_hardlink(store_path, &path)
+						.context("Failed to link addon from addon store")?;
+					return Ok(());
+				}
+			}
+
 			match location {
 				AddonLocation::Remote(url) => {
-					download::file(url, &path, &client)
-						.await
-						.context("Failed to download addon")?;
+					// Hashes are checked while the addon is downloaded, and the file is
+					// not stored at all if they don't match
+					let hashes = ExpectedHashes {
+						sha256: hashes.sha256,
+						sha512: hashes.sha512,
+						..Default::default()
+					};
+					download::file_verified(
+						&url,
+						&path,
+						&client,
+						DownloadPriority::Normal,
+						&hashes,
+					)
+					.await
+					.context("Failed to download addon")?;
 				}
 				AddonLocation::Local(actual_path) => {
 					update_hardlink(&actual_path, &path)
 						.context("Failed to hardlink local addon")?;
+
+					let result = Self::check_hashes_impl(hashes, &path);
+					// Remove the addon file if it fails the checksum
+					if result.is_err() {
+						std::fs::remove_file(path).context("Failed to remove stored addon file")?;
+					}
+					result?;
 				}
 			}
 
-			let result = Self::check_hashes_impl(hashes, &path);
-			// Remove the addon file if it fails the checksum
-			if result.is_err() {
-				std::fs::remove_file(path).context("Failed to remove stored addon file")?;
+			// The file has been checked against the hash by now, so it is safe to store
+			if let Some(store_path) = &store_path {
+				match std::fs::hard_link(&path, store_path) {
+					Ok(..) => {}
+					// Another task may have stored the same file first
+					Err(e) if e.kind() == std::io::ErrorKind::AlreadyExists => {}
+					Err(e) => return Err(e).context("Failed to add addon to addon store"),
+				}
 			}
-			result?;
 
 			Ok(())
 		};
@@ -164,6 +261,42 @@ impl AddonRequest {
 		Ok(task)
 	}
 
+	/// Get the task to download the addon into the addon store ahead of time, without
+	/// storing it for any instance. Returns None if the addon can't be stored or is already
+	/// there. The next update will link the addon from the store instead of downloading it
+	pub fn get_prefetch_task(
+		&self,
+		paths: &Paths,
+		client: &Client,
+	) -> anyhow::Result<Option<impl Future<Output = anyhow::Result<()>> + Send + 'static>> {
+		let AddonLocation::Remote(url) = &self.location else {
+			return Ok(None);
+		};
+		let Some(store_path) = get_addon_store_path(paths, &self.addon.hashes) else {
+			return Ok(None);
+		};
+		if store_path.exists() {
+			return Ok(None);
+		}
+		create_leading_dirs(&store_path)?;
+
+		let url = url.clone();
+		let client = client.clone();
+		// Having a store path means that there is a SHA-512 hash to check the download with
+		let hashes = ExpectedHashes {
+			sha256: self.addon.hashes.sha256.clone(),
+			sha512: self.addon.hashes.sha512.clone(),
+			..Default::default()
+		};
+		let task = async move {
+			download::file_verified(&url, &store_path, &client, DownloadPriority::Low, &hashes)
+				.await
+				.context("Failed to download addon")
+		};
+
+		Ok(Some(task))
+	}
+
 	/// Check the addon's hashes. The stored addon file must exist at this time
 	pub fn check_hashes(&self, path: &Path) -> anyhow::Result<()> {
 		Self::check_hashes_impl(self.addon.hashes.clone(), path)
@@ -227,4 +360,18 @@ mod tests {
 		};
 		assert_eq!(addon.split_filename(), ("FooBar", ".baz.jar"));
 	}
+
+	#[test]
+	fn test_addon_store_path() {
+		let paths = Paths::new_no_create().unwrap();
+		let mut hashes = PackageAddonOptionalHashes::default();
+		assert!(get_addon_store_path(&paths, &hashes).is_none());
+		hashes.sha512 = Some("../../foo".into());
+		assert!(get_addon_store_path(&paths, &hashes).is_none());
+		hashes.sha512 = Some("ABCdef0123".into());
+		assert_eq!(
+			get_addon_store_path(&paths, &hashes),
+			Some(get_addon_store_dir(&paths).join("abcdef0123"))
+		);
+	}
 }
@@ -14,6 +14,7 @@ use mcvm_shared::Side;
 #[cfg(feature = "schema")]
 use schemars::JsonSchema;
 use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
 
 use crate::instance::launch::{LaunchOptions, WrapperCommand};
 use crate::instance::{InstKind, Instance, InstanceStoredConfig};
@@ -238,6 +239,10 @@ pub struct LaunchConfig {
 	#[serde(default)]
 	#[serde(skip_serializing_if = "DefaultExt::is_default")]
 	pub use_log4j_config: bool,
+	/// Whether to use class data sharing archives to make the JVM start faster
+	#[serde(default)]
+	#[serde(skip_serializing_if = "DefaultExt::is_default")]
+	pub use_cds: bool,
 }
 
 impl LaunchConfig {
@@ -271,6 +276,7 @@ impl LaunchConfig {
 			wrapper: self.wrapper,
 			quick_play: self.quick_play,
 			use_log4j_config: self.use_log4j_config,
+			use_cds: self.use_cds,
 		})
 	}
 
@@ -311,6 +317,7 @@ impl Default for LaunchConfig {
 			wrapper: None,
 			quick_play: QuickPlay::default(),
 			use_log4j_config: false,
+			use_cds: false,
 		}
 	}
 }
@@ -395,7 +402,7 @@ pub fn read_instance_config(
 	let packages = consolidate_package_configs(profile, &config, side);
 
 	let kind = match side {
-		Side::Client => InstKind::client(config.window),
+		Side::Client => InstKind::client(config.window.clone()),
 		Side::Server => InstKind::server(),
 	};
 
@@ -414,10 +421,9 @@ pub fn read_instance_config(
 
 	// Apply plugins
 	let results = plugins
-		.call_hook(ModifyInstanceConfig, &config.common.plugin_config, paths, o)
+		.call_hook_and_wait(ModifyInstanceConfig, &config.common.plugin_config, paths, o)
 		.context("Failed to apply plugin instance modifications")?;
 	for result in results {
-		let result = result.result(o)?;
 		config
 			.common
 			.launch
@@ -426,6 +432,11 @@ pub fn read_instance_config(
 			.merge(Args::List(result.additional_jvm_args));
 	}
 
+	// Converting to a value first sorts the keys of any maps so that the hash is stable
+	let config_value =
+		serde_json::to_value(&config).context("Failed to serialize instance config")?;
+	let config_hash = hex::encode(Sha256::digest(config_value.to_string()));
+
 	let stored_config = InstanceStoredConfig {
 		name: config.name,
 		version,
@@ -435,6 +446,7 @@ pub fn read_instance_config(
 		packages,
 		package_stability: config.common.package_stability.unwrap_or_default(),
 		plugin_config: config.common.plugin_config,
+		config_hash,
 	};
 
 	let instance = Instance::new(kind, id, stored_config);
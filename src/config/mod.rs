@@ -24,6 +24,7 @@ use self::user::UserConfig;
 use anyhow::{bail, Context};
 use mcvm_core::auth_crate::mc::ClientId;
 use mcvm_core::io::{json_from_file, json_to_file_pretty};
+use mcvm_core::net::mirror;
 use mcvm_core::user::UserManager;
 use mcvm_shared::id::{InstanceID, ProfileID};
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
@@ -117,6 +118,9 @@ impl Config {
 		// Preferences
 		let (prefs, repositories) =
 			ConfigPreferences::read(&config.preferences).context("Failed to read preferences")?;
+		if !prefs.mirrors.is_empty() {
+			mirror::set_mirrors(prefs.mirrors.clone());
+		}
 
 		let packages = PkgRegistry::new(repositories, prefs.package_caching_strategy.clone());
 
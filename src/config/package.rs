@@ -80,7 +80,7 @@ impl PackageConfig {
 }
 
 /// Where a package was configured from
-#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
 pub enum PackageConfigSource {
 	/// Configured for one profile
 	Profile,
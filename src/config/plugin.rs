@@ -190,8 +190,23 @@ impl PluginManager {
 		paths: &Paths,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<Vec<HookHandle<H>>> {
-		let inner = self.inner.lock().map_err(|x| anyhow!("{x}"))?;
-		inner.manager.call_hook(hook, arg, &paths.core, o)
+		self.get_manager()?.call_hook(hook, arg, &paths.core, o)
+	}
+
+	/// Call a plugin hook on the manager and wait for all of the results at the same time.
+	/// The results are returned in plugin order
+	pub fn call_hook_and_wait<H: Hook>(
+		&self,
+		hook: H,
+		arg: &H::Arg,
+		paths: &Paths,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<Vec<H::Result>>
+	where
+		H::Result: Send,
+	{
+		self.get_manager()?
+			.call_hook_and_wait(hook, arg, &paths.core, o)
 	}
 
 	/// Call a plugin hook on a specific plugin
@@ -203,12 +218,17 @@ impl PluginManager {
 		paths: &Paths,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<Option<HookHandle<H>>> {
-		let inner = self.inner.lock().map_err(|x| anyhow!("{x}"))?;
-		inner
-			.manager
+		self.get_manager()?
 			.call_hook_on_plugin(hook, plugin_id, arg, &paths.core, o)
 	}
 
+	/// Get a copy of the loaded plugin manager so that hooks can be run without
+	/// keeping the lock while the plugins run
+	fn get_manager(&self) -> anyhow::Result<LoadedPluginManager> {
+		let inner = self.inner.lock().map_err(|x| anyhow!("{x}"))?;
+		Ok(inner.manager.clone())
+	}
+
 	/// Get a lock for the inner mutex
 	pub fn get_lock(&self) -> anyhow::Result<MutexGuard<PluginManagerInner>> {
 		let inner = self.inner.lock().map_err(|x| anyhow!("{x}"))?;
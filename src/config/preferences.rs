@@ -1,5 +1,6 @@
 use std::collections::HashSet;
 use std::path::PathBuf;
+use std::time::Duration;
 
 use crate::pkg::reg::CachingStrategy;
 use crate::pkg::repo::{PkgRepo, PkgRepoLocation};
@@ -7,6 +8,7 @@ use mcvm_core::net::download::validate_url;
 
 use anyhow::{bail, Context};
 use mcvm_shared::lang::Language;
+use reqwest::Url;
 #[cfg(feature = "schema")]
 use schemars::JsonSchema;
 use serde::{Deserialize, Serialize};
@@ -18,6 +20,8 @@ pub struct ConfigPreferences {
 	pub package_caching_strategy: CachingStrategy,
 	/// The global language
 	pub language: Language,
+	/// Mirrors to download files from before their origin
+	pub mirrors: Vec<Url>,
 }
 
 /// Deserialization struct for user preferences
@@ -31,6 +35,9 @@ pub struct PrefDeser {
 	pub package_caching_strategy: CachingStrategy,
 	/// The user's configured language
 	pub language: Language,
+	/// The base URLs of mirror servers to download files from before their origin
+	#[serde(skip_serializing_if = "Vec::is_empty")]
+	pub mirrors: Vec<String>,
 }
 
 /// Deserialization struct for a package repo
@@ -65,6 +72,10 @@ pub struct RepositoriesDeser {
 	pub enable_core: bool,
 	/// Whether to enable the std repository
 	pub enable_std: bool,
+	/// How many hours old the cached repository indexes can be before they are refreshed
+	/// in the background
+	#[serde(skip_serializing_if = "Option::is_none")]
+	pub refresh_interval: Option<u64>,
 }
 
 impl Default for RepositoriesDeser {
@@ -74,6 +85,7 @@ impl Default for RepositoriesDeser {
 			backup: Vec::new(),
 			enable_core: true,
 			enable_std: true,
+			refresh_interval: None,
 		}
 	}
 }
@@ -98,6 +110,21 @@ impl ConfigPreferences {
 			}
 		}
 
+		let refresh_interval = prefs
+			.repositories
+			.refresh_interval
+			.map(|x| {
+				x.checked_mul(60 * 60)
+					.map(Duration::from_secs)
+					.with_context(|| {
+						format!("Repository refresh interval of {x} hours is too large")
+					})
+			})
+			.transpose()?;
+		for repo in &mut repositories {
+			repo.set_refresh_interval(refresh_interval);
+		}
+
 		// Check for duplicate IDs
 		let mut existing = HashSet::new();
 		for repo in &repositories {
@@ -107,10 +134,17 @@ impl ConfigPreferences {
 			existing.insert(&repo.id);
 		}
 
+		let mirrors = prefs
+			.mirrors
+			.iter()
+			.map(|x| Url::parse(x).with_context(|| format!("Invalid mirror URL '{x}'")))
+			.collect::<anyhow::Result<_>>()?;
+
 		Ok((
 			Self {
 				package_caching_strategy: prefs.package_caching_strategy.clone(),
 				language: prefs.language,
+				mirrors,
 			},
 			repositories,
 		))
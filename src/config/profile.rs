@@ -182,7 +182,7 @@ pub fn consolidate_profile_configs(
 }
 
 /// Game modifications
-#[derive(Clone, Debug)]
+#[derive(Clone, Debug, PartialEq, Eq, Hash)]
 pub struct GameModifications {
 	modloader: Modloader,
 	/// Type of the client
@@ -103,7 +103,7 @@ impl Instance {
 		})
 	}
 
-	/// Hardlinks the addon from the path in addon storage to the correct in the instance,
+	/// Links the addon from the path in addon storage to the correct in the instance,
 	/// under the specified directory
 	fn link_addon(
 		dir: &Path,
@@ -120,8 +120,7 @@ impl Instance {
 		if link.exists() {
 			std::fs::remove_file(&link).context("Failed to remove instance addon file")?;
 		}
-		mcvm_core::io::files::update_hardlink(&addon_path, &link)
-			.context("Failed to create hard link")?;
+		mcvm_core::io::files::update_link(&addon_path, &link).context("Failed to create link")?;
 		Ok(())
 	}
 
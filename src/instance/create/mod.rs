@@ -113,12 +113,9 @@ impl Instance {
 			version_info: manager.version_info.get_clone(),
 			custom_config: self.config.plugin_config.clone(),
 		};
-		let results = plugins
-			.call_hook(OnInstanceSetup, &arg, paths, o)
+		plugins
+			.call_hook_and_wait(OnInstanceSetup, &arg, paths, o)
 			.context("Failed to call instance setup hook")?;
-		for result in results {
-			result.result(o)?;
-		}
 
 		// Make the core instance
 		let mut version = manager
@@ -189,6 +186,7 @@ impl Instance {
 			wrappers: Vec::from_iter(wrapper),
 			quick_play,
 			use_log4j_config: self.config.launch.use_log4j_config,
+			use_cds: self.config.launch.use_cds,
 		};
 		let config = mcvm_core::InstanceConfiguration {
 			side,
@@ -83,10 +83,11 @@ impl Instance {
 			MessageLevel::Important,
 		);
 
-		let build_num = paper::get_newest_build(mode, version, client)
-			.await
-			.context("Failed to get the newest {mode} version")?;
-		let file_name = paper::get_jar_file_name(mode, version, build_num, client)
+		let build_num =
+			paper::get_newest_build(mode, version, manager.meta_ttl(), &paths.core, client)
+				.await
+				.context("Failed to get the newest {mode} version")?;
+		let file_name = paper::get_jar_file_name(mode, version, build_num, &paths.core, client)
 			.await
 			.context("Failed to get the {mode} file name")?;
 		let paper_jar_path = paper::get_local_jar_path(mode, version, &paths.core);
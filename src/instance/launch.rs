@@ -1,23 +1,30 @@
 use std::collections::HashMap;
+use std::path::PathBuf;
 
 use anyhow::Context;
 use mcvm_core::auth_crate::mc::ClientId;
 use mcvm_core::io::java::args::MemoryNum;
 use mcvm_core::io::java::install::JavaInstallationKind;
+use mcvm_core::io::{json_from_file, json_to_file};
+use mcvm_core::launch::LaunchPlan;
+use mcvm_core::net::download;
 use mcvm_core::user::UserManager;
+use mcvm_core::util::versions::MinecraftVersion;
 use mcvm_plugin::hooks::{
 	HookHandle, InstanceLaunchArg, OnInstanceLaunch, OnInstanceStop, WhileInstanceLaunch,
 };
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
 use mcvm_shared::translate;
-use reqwest::Client;
+use mcvm_shared::versions::VersionInfo;
 #[cfg(feature = "schema")]
 use schemars::JsonSchema;
 use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
 
-use super::update::manager::UpdateManager;
+use super::update::manager::{setup_core_users, UpdateManager};
 use crate::config::instance::QuickPlay;
 use crate::config::plugin::PluginManager;
+use crate::io::lock::Lockfile;
 use crate::io::paths::Paths;
 
 use super::Instance;
@@ -32,50 +39,109 @@ impl Instance {
 		settings: LaunchSettings,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<InstanceHandle> {
-		o.display(
-			MessageContents::StartProcess(translate!(o, StartUpdatingInstance, "inst" = &self.id)),
-			MessageLevel::Important,
+		let client = download::new_client()?;
+
+		let mut core_users = UserManager::new(settings.ms_client_id.clone());
+		setup_core_users(
+			&mut core_users,
+			users,
+			settings.offline_auth,
+			plugins,
+			paths,
 		);
+		// Refresh the user while the instance is updated so that launching doesn't wait for it
+		core_users.prefetch_auth(&paths.core, &client);
 
-		let mut manager = UpdateManager::new(false, true);
-		let client = Client::new();
-		manager.set_version(&self.config.version);
-		manager.add_requirements(self.get_requirements());
-		manager.set_client_id(settings.ms_client_id);
-		if settings.offline_auth {
-			manager.offline_auth();
-		}
-		manager
-			.fulfill_requirements(users, plugins, paths, &client, o)
-			.await
-			.context("Update failed")?;
+		// Use the saved launch plan if nothing that went into it has changed,
+		// which lets us skip updating the instance entirely
+		self.ensure_dirs(paths)?;
+		let fingerprint = self
+			.get_launch_fingerprint(paths)
+			.context("Failed to get launch plan fingerprint")?;
+		let plan_path = self.get_launch_plan_path(paths);
+		let cached = fingerprint
+			.as_ref()
+			.and_then(|fingerprint| {
+				let cached: CachedLaunchPlan = json_from_file(&plan_path).ok()?;
+				(&cached.fingerprint == fingerprint).then_some(cached)
+			})
+			.filter(|x| x.plan.is_usable(&core_users));
 
-		let result = self
-			.create(&mut manager, plugins, paths, users, &client, o)
-			.await
-			.context("Failed to update instance")?;
-		manager.add_result(result);
+		let (plan, version_info) = if let Some(cached) = cached {
+			o.display(
+				MessageContents::Simple(translate!(o, UsingSavedLaunchPlan)),
+				MessageLevel::Debug,
+			);
+			(cached.plan, cached.version_info)
+		} else {
+			o.display(
+				MessageContents::StartProcess(translate!(
+					o,
+					StartUpdatingInstance,
+					"inst" = &self.id
+				)),
+				MessageLevel::Important,
+			);
+
+			let mut manager = UpdateManager::new(false, true);
+			manager.set_version(&self.config.version);
+			manager.add_requirements(self.get_requirements());
+			manager.set_client_id(settings.ms_client_id);
+			if settings.offline_auth {
+				manager.offline_auth();
+			}
+			manager
+				.fulfill_requirements(users, plugins, paths, &client, o)
+				.await
+				.context("Update failed")?;
+
+			let result = self
+				.create(&mut manager, plugins, paths, users, &client, o)
+				.await
+				.context("Failed to update instance")?;
+			manager.add_result(result);
+
+			let version_info = manager.version_info.get_clone();
+
+			let mut installed_version = manager
+				.get_core_version(o)
+				.await
+				.context("Failed to get core version")?;
+
+			let instance = self
+				.create_core_instance(&mut installed_version, paths, o)
+				.await
+				.context("Failed to create core instance")?;
+
+			let plan = instance
+				.get_launch_plan(o)
+				.context("Failed to create launch plan")?;
+
+			if let Some(fingerprint) = fingerprint {
+				let cached = CachedLaunchPlan {
+					fingerprint,
+					version_info,
+					plan,
+				};
+				// Failing to save the plan just means that the next launch will be slower
+				let _ = mcvm_core::io::files::create_leading_dirs(&plan_path);
+				let _ = json_to_file(&plan_path, &cached);
+				(cached.plan, cached.version_info)
+			} else {
+				(plan, version_info)
+			}
+		};
 
 		let hook_arg = InstanceLaunchArg {
 			id: self.id.to_string(),
 			side: Some(self.get_side()),
 			dir: self.dirs.get().inst_dir.to_string_lossy().into(),
 			game_dir: self.dirs.get().game_dir.to_string_lossy().into(),
-			version_info: manager.version_info.get_clone(),
+			version_info,
 			custom_config: self.config.plugin_config.clone(),
 			pid: None,
 		};
 
-		let mut installed_version = manager
-			.get_core_version(o)
-			.await
-			.context("Failed to get core version")?;
-
-		let mut instance = self
-			.create_core_instance(&mut installed_version, paths, o)
-			.await
-			.context("Failed to create core instance")?;
-
 		// Make sure that any fluff from the update gets ended
 		o.end_process();
 
@@ -85,16 +151,13 @@ impl Instance {
 		);
 
 		// Run pre-launch hooks
-		let results = plugins
-			.call_hook(OnInstanceLaunch, &hook_arg, paths, o)
+		plugins
+			.call_hook_and_wait(OnInstanceLaunch, &hook_arg, paths, o)
 			.context("Failed to call on launch hook")?;
-		for result in results {
-			result.result(o)?;
-		}
 
 		// Launch the instance using core
-		let handle = instance
-			.launch_with_handle(o)
+		let handle = plan
+			.launch(&mut core_users, &paths.core, &client, o)
 			.await
 			.context("Failed to launch core instance")?;
 
@@ -112,6 +175,72 @@ impl Instance {
 	}
 }
 
+impl Instance {
+	/// Get the fingerprint of everything that goes into the launch plan of the instance.
+	/// Returns None if the plan can't be saved, like when the version of the instance
+	/// can change without anything on our side changing
+	fn get_launch_fingerprint(&self, paths: &Paths) -> anyhow::Result<Option<String>> {
+		let MinecraftVersion::Version(version) = &self.config.version else {
+			return Ok(None);
+		};
+
+		let mut hasher = Sha256::new();
+		hasher.update(crate::VERSION);
+		hasher.update(&self.config.config_hash);
+		// The lockfile changes whenever the packages or modloader of an instance are updated
+		for path in [
+			Lockfile::get_instance_path(paths, &self.id),
+			PluginManager::get_path(paths),
+			paths
+				.core
+				.internal
+				.join("versions")
+				.join(version.to_string())
+				.join(format!("{version}.json")),
+		] {
+			// Hash the name of the file too so that a file that is missing can't be
+			// confused with one of the others
+			hasher.update(path.to_string_lossy().as_bytes());
+			if let Ok(contents) = std::fs::read(&path) {
+				hasher.update(contents);
+			}
+		}
+
+		Ok(Some(hex::encode(hasher.finalize())))
+	}
+
+	/// Get the path to the saved launch plan of the instance
+	fn get_launch_plan_path(&self, paths: &Paths) -> PathBuf {
+		paths
+			.internal
+			.join("launch_plans")
+			.join(format!("{}.json", self.id))
+	}
+
+	/// Remove the saved launch plan of the instance so that it is created again
+	/// the next time the instance is launched
+	pub fn remove_launch_plan(&self, paths: &Paths) -> anyhow::Result<()> {
+		let path = self.get_launch_plan_path(paths);
+		if path.exists() {
+			std::fs::remove_file(path).context("Failed to remove saved launch plan")?;
+		}
+
+		Ok(())
+	}
+}
+
+/// A launch plan for an instance that is saved so that the instance can be launched
+/// again without updating it, as long as its fingerprint has not changed
+#[derive(Serialize, Deserialize)]
+struct CachedLaunchPlan {
+	/// The fingerprint of the inputs to the plan
+	fingerprint: String,
+	/// The version info for the instance to give to plugins
+	version_info: VersionInfo,
+	/// The plan itself
+	plan: LaunchPlan,
+}
+
 /// Settings for launch provided to the instance launch function
 pub struct LaunchSettings {
 	/// The Microsoft client ID to use
@@ -141,6 +270,8 @@ pub struct LaunchOptions {
 	pub quick_play: QuickPlay,
 	/// Whether or not to use the Log4J configuration
 	pub use_log4j_config: bool,
+	/// Whether to use class data sharing archives
+	pub use_cds: bool,
 }
 
 /// A wrapper command
@@ -218,12 +349,9 @@ impl InstanceHandle {
 		paths: &Paths,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<()> {
-		let results = plugins
-			.call_hook(OnInstanceStop, arg, paths, o)
+		plugins
+			.call_hook_and_wait(OnInstanceStop, arg, paths, o)
 			.context("Failed to call on stop hook")?;
-		for result in results {
-			result.result(o)?;
-		}
 		Ok(())
 	}
 }
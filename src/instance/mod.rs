@@ -93,6 +93,9 @@ pub struct InstanceStoredConfig {
 	pub package_stability: PackageStability,
 	/// Custom plugin config
 	pub plugin_config: serde_json::Map<String, serde_json::Value>,
+	/// Hash of the full configuration of the instance, used to tell when
+	/// things that were cached for the instance are out of date
+	pub config_hash: String,
 }
 
 impl Instance {
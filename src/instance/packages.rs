@@ -81,7 +81,10 @@ impl Instance {
 				let task = addon
 					.get_acquire_task(paths, &self.id, client)
 					.context("Failed to get task for acquiring addon")?;
-				tasks.insert(addon.get_unique_id(&self.id), task);
+				// Versioned addons are stored in the same place for every instance, so keying
+				// by the stored path makes sure that they are only acquired once
+				let path = addon.addon.get_path(paths, &self.id);
+				tasks.insert(path.to_string_lossy().into_owned(), task);
 			}
 		}
 
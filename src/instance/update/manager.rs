@@ -1,10 +1,12 @@
 use std::collections::HashSet;
 use std::path::{Path, PathBuf};
 use std::sync::Arc;
+use std::time::Duration;
 
 use anyhow::Context;
 use mcvm_core::auth_crate::mc::ClientId;
 use mcvm_core::config::BrandingProperties;
+use mcvm_core::net::cache::META_TTL;
 use mcvm_core::user::UserManager;
 use mcvm_core::util::versions::MinecraftVersion;
 use mcvm_core::version::InstalledVersion;
@@ -13,6 +15,7 @@ use mcvm_plugin::hooks::{AddVersions, HandleAuth, HandleAuthArg};
 use mcvm_shared::later::Later;
 use mcvm_shared::output::MCVMOutput;
 use mcvm_shared::output::NoOp;
+use mcvm_shared::timing::{self, SpanCategory};
 use mcvm_shared::versions::VersionInfo;
 use mcvm_shared::Side;
 use reqwest::Client;
@@ -39,6 +42,8 @@ pub struct UpdateSettings {
 	pub allow_offline: bool,
 	/// Whether to do offline authentication
 	pub offline_auth: bool,
+	/// Whether to verify the contents of installed files that have changed
+	pub verify: bool,
 }
 
 /// Manager for when we are updating profile files.
@@ -69,6 +74,7 @@ impl UpdateManager {
 			force,
 			allow_offline,
 			offline_auth: false,
+			verify: false,
 		};
 
 		Self {
@@ -83,11 +89,26 @@ impl UpdateManager {
 		}
 	}
 
+	/// Gets how long cached metadata can be used without checking whether it has changed.
+	/// Forced updates always check
+	pub fn meta_ttl(&self) -> Duration {
+		if self.settings.force {
+			Duration::ZERO
+		} else {
+			META_TTL
+		}
+	}
+
 	/// Set offline authentication
 	pub fn offline_auth(&mut self) {
 		self.settings.offline_auth = true;
 	}
 
+	/// Set whether to verify the contents of installed files that have changed
+	pub fn set_verify(&mut self, verify: bool) {
+		self.settings.verify = verify;
+	}
+
 	/// Set the MS client ID
 	pub fn set_client_id(&mut self, id: ClientId) {
 		self.ms_client_id = Some(id);
@@ -103,6 +124,11 @@ impl UpdateManager {
 		self.requirements.extend(reqs);
 	}
 
+	/// Replace the requirements, such as when moving on to updating another instance
+	pub fn set_requirements(&mut self, reqs: HashSet<UpdateRequirement>) {
+		self.requirements = reqs;
+	}
+
 	/// Check if a requirement is held
 	pub fn has_requirement(&self, req: UpdateRequirement) -> bool {
 		self.requirements.contains(&req)
@@ -145,6 +171,8 @@ impl UpdateManager {
 		client: &Client,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<()> {
+		let _span = timing::span(SpanCategory::Phase, "fulfill_requirements");
+
 		// Setup the core
 		self.setup_core(client, users, plugins, paths, o)
 			.await
@@ -187,6 +215,7 @@ impl UpdateManager {
 		let mut core_config = mcvm_core::ConfigBuilder::new()
 			.allow_offline(self.settings.allow_offline)
 			.force_reinstall(self.settings.force)
+			.verify_files(self.settings.verify)
 			.branding(BrandingProperties::new(
 				"mcvm".into(),
 				crate::VERSION.into(),
@@ -197,44 +226,31 @@ impl UpdateManager {
 		let core_config = core_config.build();
 		let mut core = MCVMCore::with_config(core_config).context("Failed to initialize core")?;
 
-		// Set up user manager along with custom auth function that handles using plugins
-		core.get_users().steal_users(users);
-		core.get_users().set_offline(self.settings.offline_auth);
-		{
-			let plugins = plugins.clone();
-			let paths = paths.clone();
-
-			core.get_users()
-				.set_custom_auth_function(Arc::new(move |user_id, user_type| {
-					let arg = HandleAuthArg {
-						user_id: user_id.to_string(),
-						user_type: user_type.to_string(),
-					};
-					let results = plugins
-						.call_hook(HandleAuth, &arg, &paths, &mut NoOp)
-						.context("Failed to call handle auth hook")?;
-					for result in results {
-						let result = result.result(&mut NoOp)?;
-						if result.handled {
-							return Ok(result.profile);
-						}
-					}
-
-					Ok(None)
-				}));
-		}
+		setup_core_users(
+			core.get_users(),
+			users,
+			self.settings.offline_auth,
+			plugins,
+			paths,
+		);
 
 		core.set_client(client.clone());
 
+		// Check the version manifest for changes while the plugins add their versions
+		let manifest_prefetch = core.prefetch_version_manifest();
+
 		// Add extra versions to manifest from plugins
 		let results = plugins
-			.call_hook(AddVersions, &(), paths, o)
+			.call_hook_and_wait(AddVersions, &(), paths, o)
 			.context("Failed to call add_versions hook")?;
 		for result in results {
-			let result = result.result(o)?;
 			core.add_additional_versions(result);
 		}
 
+		if let Some(manifest_prefetch) = manifest_prefetch {
+			let _ = manifest_prefetch.await;
+		}
+
 		self.core.fill(core);
 
 		Ok(())
@@ -321,6 +337,39 @@ impl UpdateManager {
 	}
 }
 
+/// Set up a user manager from the core with the configured users, along with a custom
+/// auth function that handles using plugins
+pub fn setup_core_users(
+	core_users: &mut UserManager,
+	users: &UserManager,
+	offline_auth: bool,
+	plugins: &PluginManager,
+	paths: &Paths,
+) {
+	core_users.steal_users(users);
+	core_users.set_offline(offline_auth);
+
+	let plugins = plugins.clone();
+	let paths = paths.clone();
+	core_users.set_custom_auth_function(Arc::new(move |user_id, user_type| {
+		let arg = HandleAuthArg {
+			user_id: user_id.to_string(),
+			user_type: user_type.to_string(),
+		};
+		let results = plugins
+			.call_hook(HandleAuth, &arg, &paths, &mut NoOp)
+			.context("Failed to call handle auth hook")?;
+		for result in results {
+			let result = result.result(&mut NoOp)?;
+			if result.handled {
+				return Ok(result.profile);
+			}
+		}
+
+		Ok(None)
+	}));
+}
+
 /// Struct returned by updating functions, with data like changed files
 #[derive(Default)]
 pub struct UpdateMethodResult {
@@ -2,30 +2,36 @@
 pub mod manager;
 /// Updating packages on a profile
 pub mod packages;
+/// Downloading files for later updates ahead of time
+pub mod prefetch;
 
 use crate::config::plugin::PluginManager;
 use crate::config::preferences::ConfigPreferences;
 #[cfg(not(feature = "disable_profile_update_packages"))]
 use crate::pkg::eval::EvalConstants;
 use mcvm_core::user::UserManager;
+use mcvm_core::util::versions::MinecraftVersion;
 use mcvm_shared::translate;
 #[cfg(not(feature = "disable_profile_update_packages"))]
 use packages::print_package_support_messages;
 use packages::update_instance_packages;
-#[cfg(not(feature = "disable_profile_update_packages"))]
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
+use std::future::Future;
+use std::time::Duration;
 
-use anyhow::Context;
+use anyhow::{anyhow, Context};
 use mcvm_mods::paper;
 use mcvm_shared::modifications::ServerType;
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::timing::{self, SpanCategory};
 use reqwest::Client;
+use tokio::task::JoinSet;
 
 use crate::io::lock::Lockfile;
 use crate::io::paths::Paths;
 use crate::pkg::reg::PkgRegistry;
 
-use manager::UpdateManager;
+use manager::{UpdateManager, UpdateRequirement};
 
 use super::Instance;
 
@@ -50,18 +56,27 @@ pub struct InstanceUpdateContext<'a, O: MCVMOutput> {
 }
 
 impl Instance {
-	/// Update this instance
+	/// Update this instance. If verify is set, installed files that have changed
+	/// since they were last checked will have their contents verified
 	pub async fn update<'a, O: MCVMOutput>(
 		&mut self,
 		update_packages: bool,
 		force: bool,
+		verify: bool,
 		ctx: &mut InstanceUpdateContext<'a, O>,
 	) -> anyhow::Result<()> {
-		#[cfg(feature = "disable_profile_update_packages")]
-		let _update_packages = update_packages;
-
-		let mut manager = UpdateManager::new(force, false);
+		update_instances(&mut [self], update_packages, force, verify, ctx).await
+	}
 
+	/// Update the game files of this instance, without its packages. The manager must
+	/// already be fulfilled for the version and requirements of this instance, and the
+	/// instance must already be cleaned up
+	async fn update_game_files<'a, O: MCVMOutput>(
+		&mut self,
+		manager: &mut UpdateManager,
+		ctx: &mut InstanceUpdateContext<'a, O>,
+	) -> anyhow::Result<()> {
+		let _span = timing::span(SpanCategory::Phase, "update_game_files");
 		ctx.output.display(
 			MessageContents::Header(translate!(
 				ctx.output,
@@ -71,32 +86,8 @@ impl Instance {
 			MessageLevel::Important,
 		);
 
-		manager.set_version(&self.config.version);
-		manager.add_requirements(self.get_requirements());
-		manager
-			.fulfill_requirements(ctx.users, ctx.plugins, ctx.paths, ctx.client, ctx.output)
-			.await
-			.context("Failed to fulfill update manager")?;
-		let mc_version = manager.version_info.get().version.clone();
-
-		let paper_properties = get_paper_properties(self, &mc_version, ctx)
-			.await
-			.context("Failed to get Paper build number and filename")?;
-
-		check_instance_version_change(self, &mc_version, paper_properties.clone(), ctx)
-			.await
-			.context("Failed to check for a profile version update")?;
-
-		check_instance_paper_update(self, paper_properties, ctx)
-			.await
-			.context("Failed to check for Paper updates")?;
-
-		ctx.lock
-			.finish(ctx.paths)
-			.context("Failed to finish using lockfile")?;
-
 		self.create(
-			&mut manager,
+			manager,
 			ctx.plugins,
 			ctx.paths,
 			ctx.users,
@@ -106,115 +97,295 @@ impl Instance {
 		.await
 		.context("Failed to create instance")?;
 
-		if update_packages {
-			#[cfg(not(feature = "disable_profile_update_packages"))]
-			{
-				let mut all_packages = HashSet::new();
-
-				ctx.output.display(
-					MessageContents::Header(translate!(ctx.output, StartUpdatingPackages)),
-					MessageLevel::Important,
-				);
-
-				let constants = EvalConstants {
-					version: mc_version.to_string(),
-					modifications: self.config.modifications.clone(),
-					version_list: manager.version_info.get().versions.clone(),
-					language: ctx.prefs.language,
-					profile_stability: self.config.package_stability,
-				};
-
-				let packages =
-					update_instance_packages(&mut [self], &constants, ctx, force).await?;
-
-				ctx.output.display(
-					MessageContents::Success(translate!(ctx.output, FinishUpdatingPackages)),
-					MessageLevel::Important,
-				);
-
-				all_packages.extend(packages);
-
-				ctx.lock
-					.finish(ctx.paths)
-					.context("Failed to finish using lockfile")?;
-
-				let all_packages = Vec::from_iter(all_packages);
-				print_package_support_messages(&all_packages, ctx)
-					.await
-					.context("Failed to print support messages")?;
-			}
-		}
-
 		Ok(())
 	}
 }
 
-/// Update an instance when the Minecraft version has changed
-async fn check_instance_version_change<'a, O: MCVMOutput>(
-	instance: &mut Instance,
-	mc_version: &str,
-	paper_properties: Option<(u16, String)>,
+/// Update multiple instances together. The game files of each instance are updated first,
+/// sharing one update manager so that the version manifest, game files, and libraries that
+/// instances have in common are only checked once. Instances with the same version and
+/// requirements are updated as a group, with the manager only fulfilled once for all of
+/// them, and their lookups and removal of old files running at the same time. Then the
+/// packages of all of the instances are resolved and installed in one batch, so that every
+/// addon is only acquired once and all of the downloads run at the same time
+pub async fn update_instances<'a, O: MCVMOutput>(
+	instances: &mut [&mut Instance],
+	update_packages: bool,
+	force: bool,
+	verify: bool,
 	ctx: &mut InstanceUpdateContext<'a, O>,
 ) -> anyhow::Result<()> {
-	if ctx.lock.update_instance_version(&instance.id, mc_version) {
-		ctx.output.start_process();
-		ctx.output.display(
-			MessageContents::StartProcess(translate!(ctx.output, StartUpdatingProfileVersion)),
-			MessageLevel::Important,
-		);
+	#[cfg(feature = "disable_profile_update_packages")]
+	let _update_packages = update_packages;
 
-		instance
-			.teardown(ctx.paths, paper_properties.clone())
-			.context("Failed to remove old files when updating Minecraft version")?;
+	let mut manager = UpdateManager::new(force, false);
+	manager.set_verify(verify);
 
-		ctx.output.display(
-			MessageContents::Success(translate!(ctx.output, FinishUpdatingProfileVersion)),
-			MessageLevel::Important,
-		);
-		ctx.output.end_process();
+	let mut version_infos = HashMap::new();
+	for group in group_by_requirements(instances) {
+		let first = &instances[group[0]];
+		manager.set_version(&first.config.version);
+		manager.set_requirements(first.get_requirements());
+		manager
+			.fulfill_requirements(ctx.users, ctx.plugins, ctx.paths, ctx.client, ctx.output)
+			.await
+			.context("Failed to fulfill update manager")
+			.with_context(|| format!("Failed to update instance '{}'", first.id))?;
+		let version_info = manager.version_info.get_clone();
+		let ttl = manager.meta_ttl();
+
+		let mut lookups = JoinSet::new();
+		for &i in &group {
+			let instance = &instances[i];
+			if let Some(task) = get_paper_properties_task(
+				instance,
+				&version_info.version,
+				ttl,
+				ctx.paths,
+				ctx.client,
+			) {
+				lookups.spawn(async move { (i, task.await) });
+			}
+		}
+		let mut paper_properties = HashMap::new();
+		while let Some(result) = lookups.join_next().await {
+			let (i, result) = result.context("Failed to run Paper lookup task")?;
+			let properties = result
+				.context("Failed to get Paper build number and filename")
+				.with_context(|| format!("Failed to update instance '{}'", instances[i].id))?;
+			paper_properties.insert(i, properties);
+		}
+
+		// Checking what changed uses the lockfile, so it happens one instance at a time
+		let mut cleanups = HashMap::new();
+		for &i in &group {
+			let instance = &instances[i];
+			let cleanup = get_instance_cleanup(
+				instance,
+				&version_info.version,
+				paper_properties.remove(&i),
+				ctx.lock,
+			)
+			.with_context(|| format!("Failed to update instance '{}'", instance.id))?;
+			cleanups.insert(i, cleanup);
+		}
+		ctx.lock
+			.finish()
+			.context("Failed to finish using lockfile")?;
+
+		let version_changed = cleanups.values().any(|x| x.version_changed);
+		if version_changed {
+			ctx.output.start_process();
+			ctx.output.display(
+				MessageContents::StartProcess(translate!(ctx.output, StartUpdatingProfileVersion)),
+				MessageLevel::Important,
+			);
+		}
+		clean_up_instances(instances, &cleanups, ctx.paths)?;
+		if version_changed {
+			ctx.output.display(
+				MessageContents::Success(translate!(ctx.output, FinishUpdatingProfileVersion)),
+				MessageLevel::Important,
+			);
+			ctx.output.end_process();
+		}
+
+		// Creating the instances goes through the core, which can only be used by one at a time
+		for &i in &group {
+			let instance = &mut instances[i];
+			instance
+				.update_game_files(&mut manager, ctx)
+				.await
+				.with_context(|| format!("Failed to update instance '{}'", instance.id))?;
+			version_infos.insert(instance.id.clone(), version_info.clone());
+		}
 	}
+
+	if update_packages {
+		#[cfg(not(feature = "disable_profile_update_packages"))]
+		{
+			ctx.output.display(
+				MessageContents::Header(translate!(ctx.output, StartUpdatingPackages)),
+				MessageLevel::Important,
+			);
+
+			let constants: HashMap<_, _> = instances
+				.iter()
+				.map(|instance| {
+					let version_info = version_infos
+						.remove(&instance.id)
+						.expect("Every instance should have been updated");
+					let constants = EvalConstants {
+						version: version_info.version,
+						modifications: instance.config.modifications.clone(),
+						version_list: version_info.versions,
+						language: ctx.prefs.language,
+						profile_stability: instance.config.package_stability,
+					};
+					(instance.id.clone(), constants)
+				})
+				.collect();
+
+			let packages = update_instance_packages(instances, &constants, ctx, force).await?;
+
+			ctx.output.display(
+				MessageContents::Success(translate!(ctx.output, FinishUpdatingPackages)),
+				MessageLevel::Important,
+			);
+
+			ctx.lock
+				.finish()
+				.context("Failed to finish using lockfile")?;
+
+			let all_packages = Vec::from_iter(packages);
+			print_package_support_messages(&all_packages, ctx)
+				.await
+				.context("Failed to print support messages")?;
+		}
+	}
+
 	Ok(())
 }
 
-/// Get the updated Paper file name and build number for an instance that uses it
-async fn get_paper_properties<'a, O: MCVMOutput>(
+/// The old files of an instance that have to be removed before its game files are updated
+struct InstanceCleanup {
+	/// Whether the Minecraft version changed, so the old game files have to be torn down
+	version_changed: bool,
+	/// Whether the Paper build changed, so the old Paper jar has to be removed
+	paper_changed: bool,
+	/// The newest Paper build number and file name, if the instance uses Paper
+	paper_properties: Option<(u16, String)>,
+}
+
+/// Check what changed for an instance since it was last updated, recording the new version
+/// and Paper build in the lockfile
+fn get_instance_cleanup(
 	instance: &Instance,
 	mc_version: &str,
-	ctx: &mut InstanceUpdateContext<'a, O>,
-) -> anyhow::Result<Option<(u16, String)>> {
-	let out = if let ServerType::Paper = instance.config.modifications.server_type {
-		let build_num = paper::get_newest_build(paper::Mode::Paper, mc_version, ctx.client)
-			.await
-			.context("Failed to get the newest Paper build number")?;
-		let paper_file_name =
-			paper::get_jar_file_name(paper::Mode::Paper, mc_version, build_num, ctx.client)
-				.await
-				.context("Failed to get the name of the Paper Jar file")?;
-		Some((build_num, paper_file_name))
+	paper_properties: Option<(u16, String)>,
+	lock: &mut Lockfile,
+) -> anyhow::Result<InstanceCleanup> {
+	let version_changed = lock
+		.update_instance_version(&instance.id, mc_version)
+		.context("Failed to update instance version in lockfile")?;
+
+	// TODO: Make this work with Folia
+	let paper_changed = if let Some((build_num, ..)) = &paper_properties {
+		lock.update_instance_paper_build(&instance.id, *build_num)
+			.context("Failed to update Paper build in lockfile")?
 	} else {
-		None
+		false
 	};
 
-	Ok(out)
+	Ok(InstanceCleanup {
+		version_changed,
+		paper_changed,
+		paper_properties,
+	})
 }
 
-// TODO: Make this work with Folia
-/// Remove the old Paper files for an instance if they have updated
-async fn check_instance_paper_update<'a, O: MCVMOutput>(
+/// Remove the old files of an instance before updating it
+fn clean_up_instance(
 	instance: &mut Instance,
-	paper_properties: Option<(u16, String)>,
-	ctx: &mut InstanceUpdateContext<'a, O>,
+	cleanup: &InstanceCleanup,
+	paths: &Paths,
 ) -> anyhow::Result<()> {
-	if let Some((build_num, file_name)) = paper_properties {
-		if ctx
-			.lock
-			.update_instance_paper_build(&instance.id, build_num)
-		{
-			instance
-				.remove_paper(ctx.paths, file_name.clone())
-				.context("Failed to remove Paper")?;
-		}
+	// Anything that goes into the launch plan may change while updating
+	instance.remove_launch_plan(paths)?;
+	instance.ensure_dirs(paths)?;
+
+	if cleanup.version_changed {
+		instance
+			.teardown(paths, cleanup.paper_properties.clone())
+			.context("Failed to remove old files when updating Minecraft version")?;
+	}
+
+	if let (true, Some((_, file_name))) = (cleanup.paper_changed, &cleanup.paper_properties) {
+		instance
+			.remove_paper(paths, file_name.clone())
+			.context("Failed to remove Paper")?;
 	}
 
 	Ok(())
 }
+
+/// Clean up the instances with the given indices. Every instance only touches its own
+/// files, so they are cleaned up at the same time on separate threads
+fn clean_up_instances(
+	instances: &mut [&mut Instance],
+	cleanups: &HashMap<usize, InstanceCleanup>,
+	paths: &Paths,
+) -> anyhow::Result<()> {
+	std::thread::scope(|scope| {
+		let threads: Vec<_> = instances
+			.iter_mut()
+			.enumerate()
+			.filter_map(|(i, instance)| {
+				let cleanup = cleanups.get(&i)?;
+				Some(scope.spawn(move || {
+					clean_up_instance(instance, cleanup, paths)
+						.with_context(|| format!("Failed to update instance '{}'", instance.id))
+				}))
+			})
+			.collect();
+
+		for thread in threads {
+			thread
+				.join()
+				.map_err(|_| anyhow!("Instance cleanup thread panicked"))??;
+		}
+
+		Ok(())
+	})
+}
+
+/// Split instances into groups that have the same version and update requirements, so that
+/// the update manager only has to be fulfilled once for each group. Returns the indices of
+/// the instances in each group, in the order that they first appear
+fn group_by_requirements(instances: &[&mut Instance]) -> Vec<Vec<usize>> {
+	let mut groups: Vec<(&MinecraftVersion, HashSet<UpdateRequirement>, Vec<usize>)> = Vec::new();
+	for (i, instance) in instances.iter().enumerate() {
+		let requirements = instance.get_requirements();
+		let group = groups.iter_mut().find(|(version, reqs, _)| {
+			**version == instance.config.version && *reqs == requirements
+		});
+		if let Some((.., group)) = group {
+			group.push(i);
+		} else {
+			groups.push((&instance.config.version, requirements, vec![i]));
+		}
+	}
+
+	groups.into_iter().map(|(.., group)| group).collect()
+}
+
+/// Get the task to look up the newest Paper build number and file name for an instance that
+/// uses it, for use in concurrent operations
+fn get_paper_properties_task(
+	instance: &Instance,
+	mc_version: &str,
+	ttl: Duration,
+	paths: &Paths,
+	client: &Client,
+) -> Option<impl Future<Output = anyhow::Result<(u16, String)>> + Send + 'static> {
+	let ServerType::Paper = instance.config.modifications.server_type else {
+		return None;
+	};
+
+	let mc_version = mc_version.to_string();
+	let paths = paths.core.clone();
+	let client = client.clone();
+	let task = async move {
+		let build_num =
+			paper::get_newest_build(paper::Mode::Paper, &mc_version, ttl, &paths, &client)
+				.await
+				.context("Failed to get the newest Paper build number")?;
+		let paper_file_name =
+			paper::get_jar_file_name(paper::Mode::Paper, &mc_version, build_num, &paths, &client)
+				.await
+				.context("Failed to get the name of the Paper Jar file")?;
+		Ok((build_num, paper_file_name))
+	};
+
+	Some(task)
+}
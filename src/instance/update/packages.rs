@@ -1,18 +1,17 @@
 use std::collections::{HashMap, HashSet};
 use std::future::Future;
-use std::sync::Arc;
 
 use itertools::Itertools;
-use mcvm_core::net::download::get_transfer_limit;
 use mcvm_pkg::repo::PackageFlag;
 use mcvm_pkg::PkgRequest;
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
 use mcvm_shared::pkg::{ArcPkgReq, PackageID};
+use mcvm_shared::timing::{self, SpanCategory};
 use mcvm_shared::translate;
 use mcvm_shared::versions::VersionInfo;
-use tokio::sync::Semaphore;
 use tokio::task::JoinSet;
 
+use crate::addon;
 use crate::instance::Instance;
 use crate::pkg::eval::{resolve, EvalConstants, EvalInput, EvalParameters};
 use crate::util::select_random_n_items_from_list;
@@ -25,7 +24,7 @@ use anyhow::Context;
 /// Install packages on multiple instances. Returns a set of all unique packages
 pub async fn update_instance_packages<'a, O: MCVMOutput>(
 	instances: &mut [&mut Instance],
-	constants: &EvalConstants,
+	constants: &HashMap<InstanceID, EvalConstants>,
 	ctx: &mut InstanceUpdateContext<'a, O>,
 	force: bool,
 ) -> anyhow::Result<HashSet<ArcPkgReq>> {
@@ -49,6 +48,7 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 		MessageContents::StartProcess(translate!(ctx.output, StartAcquiringAddons)),
 		MessageLevel::Important,
 	);
+	let eval_span = timing::span(SpanCategory::Phase, "eval_packages");
 	let mut tasks = HashMap::new();
 	let mut evals = HashMap::new();
 	for (package, package_instances) in resolved_packages
@@ -72,7 +72,10 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 			let mut params = EvalParameters::new(instance.kind.to_side());
 			params.stability = instance.config.package_stability;
 
-			let input = EvalInput { constants, params };
+			let input = EvalInput {
+				constants: get_constants(constants, instance_id),
+				params,
+			};
 			let (eval, new_tasks) = instance
 				.get_package_addon_tasks(
 					package,
@@ -114,6 +117,8 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 		}
 	}
 
+	drop(eval_span);
+
 	// Run the acquire tasks
 	run_addon_tasks(tasks, ctx.output)
 		.await
@@ -142,6 +147,7 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 				.find(|x| &x.id == instance_id)
 				.expect("Instance should exist");
 
+			let constants = get_constants(constants, instance_id);
 			let version_info = VersionInfo {
 				version: constants.version.clone(),
 				versions: constants.version_list.clone(),
@@ -203,6 +209,10 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 		}
 	}
 
+	// Clean up stored addon files that no instance uses anymore
+	addon::remove_unused_stored_addons(ctx.paths, ctx.lock)
+		.context("Failed to remove unused addons from addon store")?;
+
 	// Get the set of unique packages
 	let mut out = HashSet::new();
 	out.extend(resolved_packages.package_to_instances.keys().cloned());
@@ -211,21 +221,16 @@ pub async fn update_instance_packages<'a, O: MCVMOutput>(
 }
 
 /// Evaluates addon acquire tasks efficiently with a progress display to the user
-async fn run_addon_tasks(
+pub(super) async fn run_addon_tasks(
 	tasks: HashMap<String, impl Future<Output = anyhow::Result<()>> + Send + 'static>,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<()> {
+	let _span = timing::span(SpanCategory::Phase, "run_addon_tasks");
 	let total_count = tasks.len();
 	let mut task_set = JoinSet::new();
 
-	let sem = Arc::new(Semaphore::new(get_transfer_limit()));
+	// Concurrency is limited by the download scheduler that the tasks use
 	for task in tasks.into_values() {
-		let permit = sem.clone().acquire_owned().await;
-		let task = async move {
-			let _permit = permit?;
-
-			task.await
-		};
 		task_set.spawn(task);
 	}
 
@@ -254,9 +259,10 @@ async fn run_addon_tasks(
 /// It also returns a map of instances to packages so that unused packages can be removed
 async fn resolve_and_batch<'a, O: MCVMOutput>(
 	instances: &[&mut Instance],
-	constants: &EvalConstants,
+	constants: &HashMap<InstanceID, EvalConstants>,
 	ctx: &mut InstanceUpdateContext<'a, O>,
 ) -> anyhow::Result<ResolvedPackages> {
+	let _span = timing::span(SpanCategory::Phase, "resolve_and_batch");
 	let mut batched: HashMap<ArcPkgReq, Vec<InstanceID>> = HashMap::new();
 	let mut resolved = HashMap::new();
 
@@ -267,7 +273,7 @@ async fn resolve_and_batch<'a, O: MCVMOutput>(
 		let instance_pkgs = instance.get_configured_packages();
 		let instance_resolved = resolve(
 			instance_pkgs,
-			constants,
+			get_constants(constants, &instance.id),
 			params,
 			ctx.paths,
 			ctx.packages,
@@ -298,6 +304,16 @@ async fn resolve_and_batch<'a, O: MCVMOutput>(
 	})
 }
 
+/// Get the evaluation constants of an instance that is being updated
+fn get_constants<'c>(
+	constants: &'c HashMap<InstanceID, EvalConstants>,
+	instance_id: &InstanceID,
+) -> &'c EvalConstants {
+	constants
+		.get(instance_id)
+		.expect("Constants should exist for every instance")
+}
+
 struct ResolvedPackages {
 	/// A mapping of package IDs to all of the instances they are installed on
 	pub package_to_instances: HashMap<ArcPkgReq, Vec<InstanceID>>,
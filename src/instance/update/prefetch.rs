@@ -0,0 +1,253 @@
+use std::collections::HashMap;
+use std::time::Duration;
+
+use anyhow::Context;
+use mcvm_mods::{paper, sponge};
+use mcvm_shared::modifications::ServerType;
+use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
+use mcvm_shared::timing::{self, SpanCategory};
+use mcvm_shared::translate;
+use mcvm_shared::versions::VersionInfo;
+use mcvm_shared::Side;
+
+use crate::instance::Instance;
+#[cfg(not(feature = "disable_profile_update_packages"))]
+use crate::pkg::eval::{resolve, EvalConstants, EvalInput, EvalParameters, Routine};
+
+use super::manager::UpdateManager;
+#[cfg(not(feature = "disable_profile_update_packages"))]
+use super::packages::run_addon_tasks;
+use super::InstanceUpdateContext;
+
+/// Download the files that instances will need for their next update ahead of time, so
+/// that the update itself has little left to do. The game files, Java, and modloader files
+/// go into the same shared directories that updating uses, and addons are put in the addon
+/// store. Nothing in the instances or the lockfile is changed, so this is safe to run while
+/// the instances are being played. Addons without a SHA-512 hash can't be put in the store
+/// and are left for the update
+pub async fn prefetch_instances<'a, O: MCVMOutput>(
+	instances: &mut [&mut Instance],
+	prefetch_packages: bool,
+	ctx: &mut InstanceUpdateContext<'a, O>,
+) -> anyhow::Result<()> {
+	#[cfg(feature = "disable_profile_update_packages")]
+	let _prefetch_packages = prefetch_packages;
+
+	let mut manager = UpdateManager::new(false, false);
+
+	let mut version_infos = HashMap::new();
+	for instance in instances.iter_mut() {
+		let version_info = prefetch_game_files(instance, &mut manager, ctx)
+			.await
+			.with_context(|| format!("Failed to prefetch files for instance '{}'", instance.id))?;
+		version_infos.insert(instance.id.clone(), version_info);
+	}
+
+	if prefetch_packages {
+		#[cfg(not(feature = "disable_profile_update_packages"))]
+		{
+			ctx.output.display(
+				MessageContents::StartProcess(translate!(ctx.output, StartPrefetchingAddons)),
+				MessageLevel::Important,
+			);
+
+			let mut tasks = HashMap::new();
+			for instance in instances.iter() {
+				let version_info = version_infos
+					.remove(&instance.id)
+					.expect("Every instance should have been prefetched");
+				let new_tasks = get_instance_addon_tasks(instance, version_info, ctx)
+					.await
+					.with_context(|| {
+						format!("Failed to prefetch packages for instance '{}'", instance.id)
+					})?;
+				tasks.extend(new_tasks);
+			}
+
+			run_addon_tasks(tasks, ctx.output)
+				.await
+				.context("Failed to prefetch addons")?;
+
+			ctx.output.display(
+				MessageContents::Success(translate!(ctx.output, FinishPrefetchingAddons)),
+				MessageLevel::Important,
+			);
+		}
+	}
+
+	Ok(())
+}
+
+/// Prefetch the game files of an instance. Returns the version info of the instance
+async fn prefetch_game_files<'a, O: MCVMOutput>(
+	instance: &Instance,
+	manager: &mut UpdateManager,
+	ctx: &mut InstanceUpdateContext<'a, O>,
+) -> anyhow::Result<VersionInfo> {
+	let _span = timing::span(SpanCategory::Phase, "prefetch_game_files");
+	ctx.output.display(
+		MessageContents::Header(translate!(
+			ctx.output,
+			StartPrefetchingInstance,
+			"inst" = &instance.id
+		)),
+		MessageLevel::Important,
+	);
+
+	// This checks the version manifest and gets the Fabric or Quilt files
+	manager.set_version(&instance.config.version);
+	manager.set_requirements(instance.get_requirements());
+	manager
+		.fulfill_requirements(ctx.users, ctx.plugins, ctx.paths, ctx.client, ctx.output)
+		.await
+		.context("Failed to fulfill update manager")?;
+	let version_info = manager.version_info.get_clone();
+
+	let side = instance.kind.to_side();
+	let server_type = &instance.config.modifications.server_type;
+	// These servers replace the game JAR with their own
+	let download_jar = !matches!(
+		(side, server_type),
+		(
+			Side::Server,
+			ServerType::Paper | ServerType::Folia | ServerType::Sponge
+		)
+	);
+
+	let mut version = manager
+		.get_core_version(ctx.output)
+		.await
+		.context("Failed to get version")?;
+	version
+		.prefetch_files(
+			side,
+			download_jar,
+			instance.config.launch.java.clone(),
+			ctx.output,
+		)
+		.await
+		.context("Failed to prefetch game files")?;
+
+	if let Side::Server = side {
+		prefetch_server_jar(server_type, &version_info.version, manager.meta_ttl(), ctx)
+			.await
+			.context("Failed to prefetch server JAR")?;
+	}
+
+	Ok(version_info)
+}
+
+/// Download the JAR of a server that replaces the game JAR if it isn't there already.
+/// A JAR that is there but has a newer build is left for the update, which replaces it
+/// in place
+async fn prefetch_server_jar<'a, O: MCVMOutput>(
+	server_type: &ServerType,
+	version: &str,
+	ttl: Duration,
+	ctx: &mut InstanceUpdateContext<'a, O>,
+) -> anyhow::Result<()> {
+	let paths = &ctx.paths.core;
+	match server_type {
+		ServerType::Paper | ServerType::Folia => {
+			let mode = if let ServerType::Paper = server_type {
+				paper::Mode::Paper
+			} else {
+				paper::Mode::Folia
+			};
+			if paper::get_local_jar_path(mode, version, paths).exists() {
+				return Ok(());
+			}
+			let build_num = paper::get_newest_build(mode, version, ttl, paths, ctx.client)
+				.await
+				.with_context(|| format!("Failed to get the newest {mode} build"))?;
+			let file_name = paper::get_jar_file_name(mode, version, build_num, paths, ctx.client)
+				.await
+				.with_context(|| format!("Failed to get the {mode} file name"))?;
+			paper::download_server_jar(mode, version, build_num, &file_name, paths, ctx.client)
+				.await
+				.with_context(|| format!("Failed to download {mode} server JAR"))?;
+		}
+		ServerType::Sponge => {
+			let mode = sponge::Mode::Vanilla;
+			if sponge::get_local_jar_path(mode, version, paths).exists() {
+				return Ok(());
+			}
+			let sponge_version = sponge::get_newest_version(mode, version, ctx.client)
+				.await
+				.context("Failed to get newest Sponge version")?;
+			sponge::download_server_jar(mode, version, &sponge_version, paths, ctx.client)
+				.await
+				.context("Failed to download Sponge server JAR")?;
+		}
+		_ => {}
+	}
+
+	Ok(())
+}
+
+/// Resolve the packages of an instance and get the tasks to put their addons in the addon store
+#[cfg(not(feature = "disable_profile_update_packages"))]
+async fn get_instance_addon_tasks<'a, O: MCVMOutput>(
+	instance: &Instance,
+	version_info: VersionInfo,
+	ctx: &mut InstanceUpdateContext<'a, O>,
+) -> anyhow::Result<
+	HashMap<String, impl std::future::Future<Output = anyhow::Result<()>> + Send + 'static>,
+> {
+	let _span = timing::span(SpanCategory::Phase, "prefetch_packages");
+	let constants = EvalConstants {
+		version: version_info.version,
+		modifications: instance.config.modifications.clone(),
+		version_list: version_info.versions,
+		language: ctx.prefs.language,
+		profile_stability: instance.config.package_stability,
+	};
+	let mut params = EvalParameters::new(instance.kind.to_side());
+	params.stability = instance.config.package_stability;
+
+	let resolved = resolve(
+		instance.get_configured_packages(),
+		&constants,
+		params.clone(),
+		ctx.paths,
+		ctx.packages,
+		ctx.client,
+		ctx.plugins,
+		ctx.output,
+	)
+	.await
+	.context("Failed to resolve package dependencies")?;
+
+	let mut tasks = HashMap::new();
+	for package in &resolved.packages {
+		let input = EvalInput {
+			constants: &constants,
+			params: params.clone(),
+		};
+		let eval = ctx
+			.packages
+			.eval(
+				package,
+				ctx.paths,
+				Routine::Install,
+				input,
+				ctx.client,
+				ctx.plugins,
+				ctx.output,
+			)
+			.await
+			.with_context(|| format!("Failed to evaluate package '{package}'"))?;
+
+		for addon in &eval.addon_reqs {
+			let task = addon
+				.get_prefetch_task(ctx.paths, ctx.client)
+				.context("Failed to get task for prefetching addon")?;
+			// Addons are stored by hash, so the same file is only downloaded once
+			if let (Some(task), Some(hash)) = (task, &addon.addon.hashes.sha512) {
+				tasks.insert(hash.to_ascii_lowercase(), task);
+			}
+		}
+	}
+
+	Ok(tasks)
+}
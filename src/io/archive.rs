@@ -0,0 +1,584 @@
+use std::borrow::Cow;
+use std::collections::{HashMap, HashSet};
+use std::fs::{self, File};
+use std::io::{BufReader, BufWriter, Cursor, Read, Seek, Write};
+use std::path::{Component, Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{mpsc, Condvar, Mutex};
+
+use anyhow::{anyhow, bail, Context};
+use mcvm_core::io::files::{create_leading_dirs, update_hardlink};
+use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha512};
+use zip::write::FileOptions;
+use zip::{CompressionMethod, ZipArchive, ZipWriter};
+
+/// The entry in an archive that lists the addons that are referenced by their hash
+/// instead of being included
+pub const ADDON_REFERENCES_ENTRY: &str = "mcvm_addons.json";
+/// Files larger than this are compressed by the thread writing the archive instead of
+/// in parallel, so that they never have to be kept in memory
+const MAX_PARALLEL_FILE_SIZE: u64 = 16 * 1024 * 1024;
+/// Extensions of files that are already compressed, which are stored as they are since
+/// compressing them again takes a long time for next to no gain
+const COMPRESSED_EXTENSIONS: [&str; 11] = [
+	"jar", "zip", "png", "jpg", "jpeg", "ogg", "mp3", "gz", "xz", "zst", "7z",
+];
+
+/// Options for writing an archive of a directory
+#[derive(Debug, Default)]
+pub struct ArchiveOptions<'a> {
+	/// The addon store. Files with the same contents as a stored addon are referenced by
+	/// their hash instead of being included in the archive
+	pub addon_store: Option<&'a Path>,
+}
+
+/// What was written to an archive
+#[derive(Debug, Default)]
+pub struct ArchiveSummary {
+	/// The number of files that were included
+	pub files: usize,
+	/// The number of addon files that were referenced by their hash
+	pub referenced_addons: usize,
+}
+
+/// What was extracted from an archive
+#[derive(Debug, Default)]
+pub struct ExtractSummary {
+	/// The number of files that were extracted
+	pub files: usize,
+	/// The number of referenced addons that were linked from the addon store
+	pub linked_addons: usize,
+	/// The paths of the referenced addons that are not in the addon store. These are
+	/// usually installed again by packages once the instance is updated
+	pub missing_addons: Vec<String>,
+}
+
+/// The addons that are referenced in an archive, by their path in the archive
+#[derive(Serialize, Deserialize, Default)]
+#[serde(default)]
+struct AddonReferences {
+	files: HashMap<String, String>,
+}
+
+/// Write a zip archive of everything in a directory. The directory is read and the files
+/// are compressed on all of the available threads, while they are written to the archive
+/// as soon as they are ready
+pub fn write_archive<W: Write + Seek>(
+	dir: &Path,
+	writer: W,
+	options: &ArchiveOptions,
+) -> anyhow::Result<ArchiveSummary> {
+	let store = options
+		.addon_store
+		.map(AddonStoreIndex::read)
+		.transpose()
+		.context("Failed to read addon store")?;
+
+	let thread_count = get_thread_count();
+	let queue = WorkQueue::new(PathBuf::new());
+	let (sender, receiver) = mpsc::sync_channel(thread_count * 2);
+	let mut zip = ZipWriter::new(writer);
+	let mut references = AddonReferences::default();
+	let mut summary = ArchiveSummary::default();
+
+	let result = std::thread::scope(|scope| {
+		for _ in 0..thread_count {
+			let sender = sender.clone();
+			let queue = &queue;
+			let store = store.as_ref();
+			scope.spawn(move || {
+				while let Some(path) = queue.pop() {
+					let result = read_entry(dir, &path, store, queue);
+					let failed = result.is_err();
+					let sent = match result {
+						Ok(Some(entry)) => sender.send(Ok(entry)).is_ok(),
+						Ok(None) => true,
+						Err(e) => sender.send(Err(e)).is_ok(),
+					};
+					if failed || !sent {
+						queue.abort();
+					}
+					queue.finish_one();
+				}
+			});
+		}
+		// The receiver stops once all of the threads are done with their senders
+		drop(sender);
+
+		let result = (|| {
+			for entry in receiver.iter() {
+				match entry? {
+					Entry::Compressed(data) => {
+						let mut archive = ZipArchive::new(Cursor::new(data))
+							.context("Failed to read compressed file")?;
+						let file = archive
+							.by_index_raw(0)
+							.context("Failed to read compressed file")?;
+						zip.raw_copy_file(file)
+							.context("Failed to write file to archive")?;
+						summary.files += 1;
+					}
+					Entry::Large { name, path, size } => {
+						let options = FileOptions::<()>::default()
+							.compression_method(get_compression_method(&name))
+							.large_file(size >= u32::MAX as u64);
+						zip.start_file(name, options)
+							.context("Failed to start file in archive")?;
+						let mut file = BufReader::new(
+							File::open(&path).context("Failed to open archived file")?,
+						);
+						std::io::copy(&mut file, &mut zip).with_context(|| {
+							format!("Failed to archive file {}", path.display())
+						})?;
+						summary.files += 1;
+					}
+					Entry::Dir(name) => {
+						zip.add_directory(name, FileOptions::<()>::default())
+							.context("Failed to add directory to archive")?;
+					}
+					Entry::Addon { name, hash } => {
+						references.files.insert(name, hash);
+						summary.referenced_addons += 1;
+					}
+				}
+			}
+			Ok::<_, anyhow::Error>(())
+		})();
+		if result.is_err() {
+			queue.abort();
+		}
+		// Threads that are still sending stop once nobody is receiving
+		drop(receiver);
+
+		result
+	});
+	result?;
+
+	if !references.files.is_empty() {
+		zip.start_file(ADDON_REFERENCES_ENTRY, FileOptions::<()>::default())
+			.context("Failed to start addon references in archive")?;
+		serde_json::to_writer(&mut zip, &references).context("Failed to write addon references")?;
+	}
+	zip.finish().context("Failed to finish archive")?;
+
+	Ok(summary)
+}
+
+/// Extract an archive created by `write_archive` into a directory. Files are extracted
+/// on all of the available threads, and referenced addons are hardlinked from the addon
+/// store when it has them
+pub fn extract_archive(
+	archive_path: &Path,
+	dir: &Path,
+	addon_store: Option<&Path>,
+) -> anyhow::Result<ExtractSummary> {
+	let open = || -> anyhow::Result<ZipArchive<BufReader<File>>> {
+		let file = File::open(archive_path).context("Failed to open archive file")?;
+		ZipArchive::new(BufReader::new(file)).context("Failed to read archive")
+	};
+
+	let mut archive = open()?;
+	let references: AddonReferences = match archive.by_name(ADDON_REFERENCES_ENTRY) {
+		Ok(entry) => serde_json::from_reader(entry).context("Failed to read addon references")?,
+		Err(zip::result::ZipError::FileNotFound) => AddonReferences::default(),
+		Err(e) => return Err(e).context("Failed to read addon references"),
+	};
+
+	// Create the directories first so that the threads don't have to worry about them
+	let mut file_indices = Vec::new();
+	for i in 0..archive.len() {
+		let entry = archive
+			.by_index_raw(i)
+			.context("Failed to read archive entry")?;
+		if entry.name() == ADDON_REFERENCES_ENTRY {
+			continue;
+		}
+		let Some(path) = entry.enclosed_name() else {
+			bail!("Archive entry '{}' has an unsafe path", entry.name());
+		};
+		let path = dir.join(path);
+		if entry.is_dir() {
+			fs::create_dir_all(&path).context("Failed to create extracted directory")?;
+		} else {
+			create_leading_dirs(&path).context("Failed to create extracted directory")?;
+			file_indices.push((i, path));
+		}
+	}
+
+	let next = AtomicUsize::new(0);
+	let thread_count = get_thread_count().min(file_indices.len().max(1));
+	std::thread::scope(|scope| {
+		let threads: Vec<_> = (0..thread_count)
+			.map(|_| {
+				let (file_indices, next) = (&file_indices, &next);
+				scope.spawn(move || {
+					let mut archive = open()?;
+					while let Some((i, path)) =
+						file_indices.get(next.fetch_add(1, Ordering::Relaxed))
+					{
+						extract_entry(&mut archive, *i, path)?;
+					}
+					Ok::<_, anyhow::Error>(())
+				})
+			})
+			.collect();
+
+		for thread in threads {
+			thread
+				.join()
+				.map_err(|_| anyhow!("Extraction thread panicked"))??;
+		}
+
+		Ok::<_, anyhow::Error>(())
+	})?;
+
+	let mut summary = ExtractSummary {
+		files: file_indices.len(),
+		..Default::default()
+	};
+	for (name, hash) in references.files {
+		let path = Path::new(&name);
+		if !path
+			.components()
+			.all(|x| matches!(x, Component::Normal(..)))
+		{
+			bail!("Referenced addon '{name}' has an unsafe path");
+		}
+		let stored = addon_store
+			.filter(|_| is_hash(&hash))
+			.map(|x| x.join(hash.to_ascii_lowercase()))
+			.filter(|x| x.exists());
+		let Some(stored) = stored else {
+			summary.missing_addons.push(name);
+			continue;
+		};
+		let dest = dir.join(path);
+		create_leading_dirs(&dest).context("Failed to create addon directory")?;
+		update_hardlink(&stored, &dest)
+			.with_context(|| format!("Failed to link addon {name} from the addon store"))?;
+		summary.linked_addons += 1;
+	}
+
+	Ok(summary)
+}
+
+/// Something to put in the archive
+enum Entry {
+	/// A file that was compressed into an archive with only that file in it, which
+	/// can be copied into the real archive without compressing it again
+	Compressed(Vec<u8>),
+	/// A file that is too large to keep in memory
+	Large {
+		name: String,
+		path: PathBuf,
+		size: u64,
+	},
+	/// A directory, which is included so that empty directories are kept
+	Dir(String),
+	/// A file that is in the addon store
+	Addon { name: String, hash: String },
+}
+
+/// Read a path in the directory that is being archived. The entries of directories are
+/// added to the queue
+fn read_entry(
+	dir: &Path,
+	path: &Path,
+	store: Option<&AddonStoreIndex>,
+	queue: &WorkQueue<PathBuf>,
+) -> anyhow::Result<Option<Entry>> {
+	let full_path = dir.join(path);
+	let name = get_entry_name(path);
+	let meta = full_path
+		.symlink_metadata()
+		.and_then(|x| {
+			if x.file_type().is_symlink() {
+				full_path.metadata()
+			} else {
+				Ok(x)
+			}
+		})
+		.with_context(|| format!("Failed to get metadata of {}", full_path.display()))?;
+	// Following links to directories could walk in a circle forever
+	if meta.is_dir() && full_path.is_symlink() {
+		return Ok(None);
+	}
+
+	if meta.is_dir() {
+		let entries = full_path
+			.read_dir()
+			.with_context(|| format!("Failed to read directory {}", full_path.display()))?;
+		for entry in entries {
+			let entry = entry.context("Failed to read directory entry")?;
+			queue.push(path.join(entry.file_name()));
+		}
+		// The root doesn't need an entry of its own
+		return Ok((!name.is_empty()).then_some(Entry::Dir(name)));
+	}
+
+	let size = meta.len();
+	let is_candidate = store.is_some_and(|x| x.sizes.contains(&size));
+	if size > MAX_PARALLEL_FILE_SIZE {
+		if let Some(store) = store.filter(|_| is_candidate) {
+			let hash = hash_file(&full_path).context("Failed to hash file")?;
+			if store.hashes.contains(&hash) {
+				return Ok(Some(Entry::Addon { name, hash }));
+			}
+		}
+		return Ok(Some(Entry::Large {
+			name,
+			path: full_path,
+			size,
+		}));
+	}
+
+	let contents = fs::read(&full_path)
+		.with_context(|| format!("Failed to read file {}", full_path.display()))?;
+	if let Some(store) = store.filter(|_| is_candidate) {
+		let hash = hex::encode(Sha512::digest(&contents));
+		if store.hashes.contains(&hash) {
+			return Ok(Some(Entry::Addon { name, hash }));
+		}
+	}
+
+	let mut zip = ZipWriter::new(Cursor::new(Vec::with_capacity(contents.len() / 2)));
+	let options = FileOptions::<()>::default().compression_method(get_compression_method(&name));
+	zip.start_file(name.as_str(), options)
+		.context("Failed to start compressed file")?;
+	zip.write_all(&contents)
+		.with_context(|| format!("Failed to compress file {name}"))?;
+	let data = zip
+		.finish()
+		.context("Failed to finish compressed file")?
+		.into_inner();
+
+	Ok(Some(Entry::Compressed(data)))
+}
+
+/// Extract a single file from an archive
+fn extract_entry(
+	archive: &mut ZipArchive<BufReader<File>>,
+	index: usize,
+	path: &Path,
+) -> anyhow::Result<()> {
+	let mut entry = archive
+		.by_index(index)
+		.context("Failed to read archive entry")?;
+	let mut file = BufWriter::new(
+		File::create(path)
+			.with_context(|| format!("Failed to create extracted file {}", path.display()))?,
+	);
+	std::io::copy(&mut entry, &mut file)
+		.with_context(|| format!("Failed to extract file {}", path.display()))?;
+	file.flush()
+		.with_context(|| format!("Failed to write extracted file {}", path.display()))?;
+
+	Ok(())
+}
+
+/// Get the hex SHA-512 hash of a file without reading all of it into memory
+fn hash_file(path: &Path) -> std::io::Result<String> {
+	let mut file = BufReader::new(File::open(path)?);
+	let mut hasher = Sha512::new();
+	let mut buf = [0u8; 64 * 1024];
+	loop {
+		let len = file.read(&mut buf)?;
+		if len == 0 {
+			break;
+		}
+		hasher.update(&buf[..len]);
+	}
+
+	Ok(hex::encode(hasher.finalize()))
+}
+
+/// The contents of the addon store, which are checked against the files being archived
+struct AddonStoreIndex {
+	/// The sizes of the stored files. Only files with one of these sizes have to be hashed
+	sizes: HashSet<u64>,
+	/// The SHA-512 hashes of the stored files
+	hashes: HashSet<String>,
+}
+
+impl AddonStoreIndex {
+	fn read(dir: &Path) -> anyhow::Result<Self> {
+		let mut out = Self {
+			sizes: HashSet::new(),
+			hashes: HashSet::new(),
+		};
+		if !dir.exists() {
+			return Ok(out);
+		}
+
+		for entry in dir.read_dir()? {
+			let entry = entry?;
+			let hash = entry.file_name().to_string_lossy().to_ascii_lowercase();
+			if !is_hash(&hash) {
+				continue;
+			}
+			out.sizes.insert(entry.metadata()?.len());
+			out.hashes.insert(hash);
+		}
+
+		Ok(out)
+	}
+}
+
+/// A queue of work shared between threads, where doing work can add more work to the queue.
+/// Threads wait for more work until everything that was ever added to the queue is finished
+struct WorkQueue<T> {
+	state: Mutex<WorkQueueState<T>>,
+	ready: Condvar,
+}
+
+struct WorkQueueState<T> {
+	items: Vec<T>,
+	/// The number of items that have been added and not finished yet
+	unfinished: usize,
+	aborted: bool,
+}
+
+impl<T> WorkQueue<T> {
+	fn new(first: T) -> Self {
+		Self {
+			state: Mutex::new(WorkQueueState {
+				items: vec![first],
+				unfinished: 1,
+				aborted: false,
+			}),
+			ready: Condvar::new(),
+		}
+	}
+
+	fn push(&self, item: T) {
+		let mut state = self.lock();
+		state.items.push(item);
+		state.unfinished += 1;
+		self.ready.notify_one();
+	}
+
+	/// Take the next item, or None once all of the work is done
+	fn pop(&self) -> Option<T> {
+		let mut state = self.lock();
+		loop {
+			if state.aborted {
+				return None;
+			}
+			if let Some(item) = state.items.pop() {
+				return Some(item);
+			}
+			if state.unfinished == 0 {
+				return None;
+			}
+			state = self.ready.wait(state).unwrap_or_else(|x| x.into_inner());
+		}
+	}
+
+	/// Mark an item that was taken from the queue as finished
+	fn finish_one(&self) {
+		let mut state = self.lock();
+		state.unfinished -= 1;
+		if state.unfinished == 0 {
+			self.ready.notify_all();
+		}
+	}
+
+	/// Stop handing out work
+	fn abort(&self) {
+		self.lock().aborted = true;
+		self.ready.notify_all();
+	}
+
+	fn lock(&self) -> std::sync::MutexGuard<'_, WorkQueueState<T>> {
+		self.state.lock().unwrap_or_else(|x| x.into_inner())
+	}
+}
+
+/// Get the name of a path in an archive, which always uses forward slashes
+fn get_entry_name(path: &Path) -> String {
+	let components: Vec<Cow<str>> = path
+		.components()
+		.map(|x| x.as_os_str().to_string_lossy())
+		.collect();
+	components.join("/")
+}
+
+/// Get the compression method for a file in an archive
+fn get_compression_method(name: &str) -> CompressionMethod {
+	let extension = name.rsplit_once('.').map(|x| x.1.to_ascii_lowercase());
+	if extension.is_some_and(|x| COMPRESSED_EXTENSIONS.contains(&x.as_str())) {
+		CompressionMethod::Stored
+	} else {
+		CompressionMethod::Deflated
+	}
+}
+
+/// Check if a string is a hex SHA-512 hash
+fn is_hash(hash: &str) -> bool {
+	hash.len() == 128 && hash.chars().all(|x| x.is_ascii_hexdigit())
+}
+
+fn get_thread_count() -> usize {
+	std::thread::available_parallelism()
+		.map(|x| x.get())
+		.unwrap_or(1)
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_archive_round_trip() {
+		let dir = std::env::temp_dir().join(format!("mcvm_test_archive_{}", std::process::id()));
+		let _ = fs::remove_dir_all(&dir);
+		let instance_dir = dir.join("instance");
+		let store_dir = dir.join("store");
+		fs::create_dir_all(instance_dir.join("world/region")).unwrap();
+		fs::create_dir_all(instance_dir.join("empty")).unwrap();
+		fs::create_dir_all(instance_dir.join("mods")).unwrap();
+		fs::create_dir_all(&store_dir).unwrap();
+		fs::write(instance_dir.join("server.properties"), "motd=test").unwrap();
+		fs::write(instance_dir.join("world/region/r.0.0.mca"), vec![3; 5000]).unwrap();
+		fs::write(instance_dir.join("mods/mod.jar"), "mod contents").unwrap();
+		let hash = hex::encode(Sha512::digest("mod contents"));
+		fs::write(store_dir.join(&hash), "mod contents").unwrap();
+
+		let archive_path = dir.join("export.zip");
+		let options = ArchiveOptions {
+			addon_store: Some(&store_dir),
+		};
+		let file = BufWriter::new(File::create(&archive_path).unwrap());
+		let summary = write_archive(&instance_dir, file, &options).unwrap();
+		assert_eq!(summary.files, 2);
+		assert_eq!(summary.referenced_addons, 1);
+
+		let restored = dir.join("restored");
+		let summary = extract_archive(&archive_path, &restored, Some(&store_dir)).unwrap();
+		assert_eq!(summary.files, 2);
+		assert_eq!(summary.linked_addons, 1);
+		assert!(summary.missing_addons.is_empty());
+		assert_eq!(
+			fs::read_to_string(restored.join("server.properties")).unwrap(),
+			"motd=test"
+		);
+		assert_eq!(
+			fs::read(restored.join("world/region/r.0.0.mca"))
+				.unwrap()
+				.len(),
+			5000
+		);
+		assert_eq!(
+			fs::read_to_string(restored.join("mods/mod.jar")).unwrap(),
+			"mod contents"
+		);
+		assert!(restored.join("empty").is_dir());
+
+		let without_store = dir.join("without_store");
+		let summary = extract_archive(&archive_path, &without_store, None).unwrap();
+		assert_eq!(summary.missing_addons, vec!["mods/mod.jar".to_string()]);
+
+		let _ = fs::remove_dir_all(dir);
+	}
+}
@@ -1,8 +1,9 @@
 use std::collections::{HashMap, HashSet};
-use std::fs;
-use std::path::PathBuf;
+use std::fs::{self, File};
+use std::path::{Path, PathBuf};
 
 use anyhow::{anyhow, bail, Context};
+use mcvm_core::io::files::lock_file_exclusive;
 use mcvm_core::io::{json_from_file, json_to_file_pretty};
 use mcvm_shared::output::{MCVMOutput, MessageContents};
 use mcvm_shared::translate;
@@ -13,26 +14,51 @@ use mcvm_shared::pkg::{PackageAddonOptionalHashes, PackageID};
 
 use super::paths::Paths;
 
-/// A file that remembers important info like what files and packages are currently installed
+/// A file that remembers important info like what files and packages are currently installed.
+/// Every instance has its own file, which is only read once the instance is used and only
+/// written if it has changed. An instance stays locked while it is in use, so other processes
+/// that use the same instance wait for this one to be dropped, but different instances can
+/// be updated at the same time
 #[derive(Debug)]
 pub struct Lockfile {
-	contents: LockfileContents,
+	dir: PathBuf,
+	instances: HashMap<String, LoadedInstance>,
 }
 
-#[derive(Serialize, Deserialize, Default, Debug)]
+/// The lockfile of an instance that has been read
+#[derive(Debug)]
+struct LoadedInstance {
+	contents: LockfileInstance,
+	dirty: bool,
+	/// Kept open for as long as the instance is in use, since closing it releases the lock
+	_lock_file: File,
+}
+
+#[derive(Serialize, Deserialize, Debug, Default)]
 #[serde(default)]
-struct LockfileContents {
+struct LockfileInstance {
+	#[serde(skip_serializing_if = "Option::is_none")]
+	version: Option<String>,
+	#[serde(skip_serializing_if = "Option::is_none")]
+	paper_build: Option<u16>,
+	/// Whether the instance has done its first update
+	created: bool,
+	packages: HashMap<String, LockfilePackage>,
+}
+
+/// The format of the single lockfile from older versions, which had every instance in it
+#[derive(Deserialize, Default)]
+#[serde(default)]
+struct LegacyLockfileContents {
 	packages: HashMap<String, HashMap<String, LockfilePackage>>,
-	instances: HashMap<String, LockfileInstance>,
-	/// Instances that have done their first update
+	instances: HashMap<String, LegacyLockfileInstance>,
 	created_instances: HashSet<String>,
 }
 
-#[derive(Serialize, Deserialize, Debug, Default)]
+#[derive(Deserialize, Default)]
 #[serde(default)]
-struct LockfileInstance {
+struct LegacyLockfileInstance {
 	version: String,
-	#[serde(skip_serializing_if = "Option::is_none")]
 	paper_build: Option<u16>,
 }
 
@@ -108,15 +134,13 @@ impl LockfileAddon {
 	}
 }
 
-impl LockfileContents {
+impl LockfileInstance {
 	/// Fix changes in lockfile format
-	pub fn fix(&mut self) {
-		for (.., instance) in &mut self.packages {
-			for (.., package) in instance {
-				for addon in &mut package.addons {
-					if addon.file_name.is_none() {
-						addon.file_name = Some(addon.id.clone())
-					}
+	fn fix(&mut self) {
+		for package in self.packages.values_mut() {
+			for addon in &mut package.addons {
+				if addon.file_name.is_none() {
+					addon.file_name = Some(addon.id.clone())
 				}
 			}
 		}
@@ -124,31 +148,127 @@ impl LockfileContents {
 }
 
 impl Lockfile {
-	/// Open the lockfile
+	/// Open the lockfile. Instances are not read until they are used
 	pub fn open(paths: &Paths) -> anyhow::Result<Self> {
-		let path = Self::get_path(paths);
-		let mut contents = if path.exists() {
-			json_from_file(path).context("Failed to open lockfile")?
-		} else {
-			LockfileContents::default()
+		let dir = Self::get_dir(paths);
+		fs::create_dir_all(&dir).context("Failed to create lockfile directory")?;
+		migrate_legacy_lockfile(paths, &dir).context("Failed to split legacy lockfile")?;
+
+		Ok(Self {
+			dir,
+			instances: HashMap::new(),
+		})
+	}
+
+	/// Get the directory with the lockfiles of every instance
+	pub fn get_dir(paths: &Paths) -> PathBuf {
+		paths.internal.join("lock")
+	}
+
+	/// Get the path to the lockfile of an instance
+	pub fn get_instance_path(paths: &Paths, instance: &str) -> PathBuf {
+		Self::get_dir(paths).join(format!("{instance}.json"))
+	}
+
+	/// Get the SHA-512 hashes of every addon installed on any instance, in lowercase.
+	/// Instances that are not in use are read from the disk without locking them
+	pub fn get_addon_hashes(&self) -> anyhow::Result<HashSet<String>> {
+		let mut out = HashSet::new();
+		let mut add_instance = |instance: &LockfileInstance| {
+			let hashes = instance
+				.packages
+				.values()
+				.flat_map(|x| &x.addons)
+				.filter_map(|x| x.hashes.sha512.as_ref())
+				.map(|x| x.to_ascii_lowercase());
+			out.extend(hashes);
 		};
-		contents.fix();
-		Ok(Self { contents })
+
+		for instance in self.instances.values() {
+			add_instance(&instance.contents);
+		}
+		for entry in self
+			.dir
+			.read_dir()
+			.context("Failed to read lockfile directory")?
+		{
+			let path = entry?.path();
+			let Some(id) = path.file_stem().and_then(|x| x.to_str()) else {
+				continue;
+			};
+			if path.extension().is_some_and(|x| x == "json") && !self.instances.contains_key(id) {
+				let instance: LockfileInstance = json_from_file(&path)
+					.with_context(|| format!("Failed to open lockfile for instance {id}"))?;
+				add_instance(&instance);
+			}
+		}
+
+		Ok(out)
 	}
 
-	/// Get the path to the lockfile
-	pub fn get_path(paths: &Paths) -> PathBuf {
-		paths.internal.join("lock.json")
+	/// Write the instances that have changed to the disk. The instances stay locked
+	/// until the lockfile is dropped
+	pub fn finish(&mut self) -> anyhow::Result<()> {
+		for (id, instance) in &mut self.instances {
+			if !instance.dirty {
+				continue;
+			}
+			write_instance(&self.dir.join(format!("{id}.json")), &instance.contents)
+				.with_context(|| format!("Failed to write lockfile for instance {id}"))?;
+			instance.dirty = false;
+		}
+
+		Ok(())
 	}
 
-	/// Finish using the lockfile and write to the disk
-	pub fn finish(&mut self, paths: &Paths) -> anyhow::Result<()> {
-		json_to_file_pretty(Self::get_path(paths), &self.contents)
-			.context("Failed to write to lockfile")?;
+	/// Write an instance if it has changed and stop using it, letting other processes use it
+	pub fn release_instance(&mut self, id: &str) -> anyhow::Result<()> {
+		if let Some(instance) = self.instances.remove(id) {
+			if instance.dirty {
+				write_instance(&self.dir.join(format!("{id}.json")), &instance.contents)
+					.with_context(|| format!("Failed to write lockfile for instance {id}"))?;
+			}
+		}
 
 		Ok(())
 	}
 
+	/// Get an instance, reading and locking it if it isn't in use yet
+	fn get_instance(&mut self, id: &str) -> anyhow::Result<&mut LoadedInstance> {
+		if !self.instances.contains_key(id) {
+			let lock_file = File::options()
+				.create(true)
+				.truncate(false)
+				.write(true)
+				.open(self.dir.join(format!("{id}.lock")))
+				.context("Failed to open instance lock")?;
+			lock_file_exclusive(&lock_file).context("Failed to lock instance")?;
+
+			let path = self.dir.join(format!("{id}.json"));
+			let mut contents: LockfileInstance = if path.exists() {
+				json_from_file(path)
+					.with_context(|| format!("Failed to open lockfile for instance {id}"))?
+			} else {
+				LockfileInstance::default()
+			};
+			contents.fix();
+
+			self.instances.insert(
+				id.to_string(),
+				LoadedInstance {
+					contents,
+					dirty: false,
+					_lock_file: lock_file,
+				},
+			);
+		}
+
+		Ok(self
+			.instances
+			.get_mut(id)
+			.expect("Instance should have been loaded"))
+	}
+
 	/// Updates a package with a new version.
 	/// Returns a list of addon files to be removed
 	pub fn update_package(
@@ -160,56 +280,46 @@ impl Lockfile {
 	) -> anyhow::Result<Vec<PathBuf>> {
 		let mut files_to_remove = Vec::new();
 		let mut new_files = Vec::new();
-		if let Some(instance) = self.contents.packages.get_mut(instance) {
-			if let Some(pkg) = instance.get_mut(id) {
-				let mut indices = Vec::new();
-				// Check for addons that need to be removed
-				for (i, current) in pkg.addons.iter().enumerate() {
-					if !addons.iter().any(|x| x.id == current.id) {
-						indices.push(i);
-						files_to_remove.extend(current.files.iter().map(PathBuf::from));
-					}
-				}
-				for i in indices {
-					pkg.addons.remove(i);
-				}
-				// Check for addons that need to be updated
-				for requested in addons {
-					if let Some(current) = pkg.addons.iter().find(|x| x.id == requested.id) {
-						files_to_remove.extend(
-							current
-								.files
-								.iter()
-								.filter(|x| !requested.files.contains(x))
-								.map(PathBuf::from),
-						);
-						new_files.extend(
-							requested
-								.files
-								.iter()
-								.filter(|x| !current.files.contains(x))
-								.cloned(),
-						);
-					} else {
-						new_files.extend(requested.files.clone());
-					};
+		let instance = self.get_instance(instance)?;
+		instance.dirty = true;
+		if let Some(pkg) = instance.contents.packages.get_mut(id) {
+			// Check for addons that need to be removed
+			for current in &pkg.addons {
+				if !addons.iter().any(|x| x.id == current.id) {
+					files_to_remove.extend(current.files.iter().map(PathBuf::from));
 				}
-
-				pkg.addons = addons.to_vec();
-			} else {
-				instance.insert(
-					id.to_owned(),
-					LockfilePackage {
-						addons: addons.to_vec(),
-					},
-				);
-				new_files.extend(addons.iter().flat_map(|x| x.files.clone()));
 			}
+			// Check for addons that need to be updated
+			for requested in addons {
+				if let Some(current) = pkg.addons.iter().find(|x| x.id == requested.id) {
+					files_to_remove.extend(
+						current
+							.files
+							.iter()
+							.filter(|x| !requested.files.contains(x))
+							.map(PathBuf::from),
+					);
+					new_files.extend(
+						requested
+							.files
+							.iter()
+							.filter(|x| !current.files.contains(x))
+							.cloned(),
+					);
+				} else {
+					new_files.extend(requested.files.clone());
+				};
+			}
+
+			pkg.addons = addons.to_vec();
 		} else {
-			self.contents
-				.packages
-				.insert(instance.to_owned(), HashMap::new());
-			self.update_package(id, instance, addons, o)?;
+			instance.contents.packages.insert(
+				id.to_owned(),
+				LockfilePackage {
+					addons: addons.to_vec(),
+				},
+			);
+			new_files.extend(addons.iter().flat_map(|x| x.files.clone()));
 		}
 
 		for file in &new_files {
@@ -241,77 +351,130 @@ impl Lockfile {
 		instance: &str,
 		used_packages: &[PackageID],
 	) -> anyhow::Result<Vec<PathBuf>> {
-		if let Some(inst) = self.contents.packages.get_mut(instance) {
-			let mut pkgs_to_remove = Vec::new();
-			for (pkg, ..) in inst.iter() {
-				if !used_packages.contains(&PackageID::from(pkg.clone())) {
-					pkgs_to_remove.push(pkg.clone());
-				}
-			}
+		let instance = self.get_instance(instance)?;
+		let pkgs_to_remove: Vec<_> = instance
+			.contents
+			.packages
+			.keys()
+			.filter(|x| !used_packages.contains(&PackageID::from((*x).clone())))
+			.cloned()
+			.collect();
 
-			let mut files_to_remove = Vec::new();
-			for pkg_id in pkgs_to_remove {
-				if let Some(pkg) = inst.remove(&pkg_id) {
-					for addon in pkg.addons {
-						files_to_remove.extend(addon.files.iter().map(PathBuf::from));
-					}
+		let mut files_to_remove = Vec::new();
+		for pkg_id in pkgs_to_remove {
+			if let Some(pkg) = instance.contents.packages.remove(&pkg_id) {
+				instance.dirty = true;
+				for addon in pkg.addons {
+					files_to_remove.extend(addon.files.iter().map(PathBuf::from));
 				}
 			}
-
-			Ok(files_to_remove)
-		} else {
-			Ok(vec![])
 		}
+
+		Ok(files_to_remove)
 	}
 
 	/// Updates an instance in the lockfile. Returns true if the version has changed.
-	pub fn update_instance_version(&mut self, instance: &str, version: &str) -> bool {
-		if let Some(instance) = self.contents.instances.get_mut(instance) {
-			if instance.version == version {
-				false
-			} else {
-				instance.version = version.to_owned();
-				true
-			}
-		} else {
-			self.contents.instances.insert(
-				instance.to_owned(),
-				LockfileInstance {
-					version: version.to_owned(),
-					paper_build: None,
-				},
-			);
+	pub fn update_instance_version(
+		&mut self,
+		instance: &str,
+		version: &str,
+	) -> anyhow::Result<bool> {
+		let instance = self.get_instance(instance)?;
+		let changed = match &instance.contents.version {
+			Some(current) if current == version => return Ok(false),
+			Some(..) => true,
+			None => false,
+		};
+		instance.contents.version = Some(version.to_owned());
+		instance.dirty = true;
 
-			false
-		}
+		Ok(changed)
 	}
 
 	/// Updates an instance with a new Paper build. Returns true if the version has changed.
-	pub fn update_instance_paper_build(&mut self, instance: &str, build_num: u16) -> bool {
-		if let Some(instance) = self.contents.instances.get_mut(instance) {
-			if let Some(paper_build) = instance.paper_build.as_mut() {
-				if *paper_build == build_num {
-					false
-				} else {
-					*paper_build = build_num;
-					true
-				}
-			} else {
-				instance.paper_build = Some(build_num);
-				false
-			}
-		} else {
-			false
+	pub fn update_instance_paper_build(
+		&mut self,
+		instance: &str,
+		build_num: u16,
+	) -> anyhow::Result<bool> {
+		let instance = self.get_instance(instance)?;
+		if instance.contents.version.is_none() {
+			return Ok(false);
 		}
+		let changed = match instance.contents.paper_build {
+			Some(current) if current == build_num => return Ok(false),
+			Some(..) => true,
+			None => false,
+		};
+		instance.contents.paper_build = Some(build_num);
+		instance.dirty = true;
+
+		Ok(changed)
 	}
 
 	/// Check whether an instance has done its first update successfully
-	pub fn has_instance_done_first_update(&mut self, instance: &str) -> bool {
-		self.contents.created_instances.contains(instance)
+	pub fn has_instance_done_first_update(&mut self, instance: &str) -> anyhow::Result<bool> {
+		Ok(self.get_instance(instance)?.contents.created)
 	}
 
 	/// Update whether an instance has done its first update
-	pub fn update_instance_has_done_first_update(&mut self, instance: &str) {
-		self.contents.created_instances.insert(instance.to_string());
+	pub fn update_instance_has_done_first_update(&mut self, instance: &str) -> anyhow::Result<()> {
+		let instance = self.get_instance(instance)?;
+		if !instance.contents.created {
+			instance.contents.created = true;
+			instance.dirty = true;
+		}
+
+		Ok(())
 	}
 }
+
+/// Write the lockfile of an instance. It is written to a temporary file first so that
+/// the lockfile on the disk is always complete, even if we are interrupted
+fn write_instance(path: &Path, contents: &LockfileInstance) -> anyhow::Result<()> {
+	let temp_path = path.with_extension("json.tmp");
+	json_to_file_pretty(&temp_path, contents)?;
+	fs::rename(&temp_path, path).context("Failed to move lockfile into place")?;
+
+	Ok(())
+}
+
+/// Split the single lockfile from older versions into the lockfiles for each instance
+fn migrate_legacy_lockfile(paths: &Paths, dir: &Path) -> anyhow::Result<()> {
+	let legacy_path = paths.internal.join("lock.json");
+	if !legacy_path.exists() {
+		return Ok(());
+	}
+	let legacy: LegacyLockfileContents =
+		json_from_file(&legacy_path).context("Failed to open legacy lockfile")?;
+
+	let mut instances: HashMap<String, LockfileInstance> = HashMap::new();
+	for (id, packages) in legacy.packages {
+		instances.entry(id).or_default().packages = packages;
+	}
+	for (id, legacy_instance) in legacy.instances {
+		let instance = instances.entry(id).or_default();
+		instance.version = Some(legacy_instance.version);
+		instance.paper_build = legacy_instance.paper_build;
+	}
+	for id in legacy.created_instances {
+		instances.entry(id).or_default().created = true;
+	}
+
+	for (id, instance) in instances {
+		let path = dir.join(format!("{id}.json"));
+		// Another process may have migrated this instance and started using it already
+		if !path.exists() {
+			write_instance(&path, &instance)?;
+		}
+	}
+
+	// Keep the old lockfile around just in case
+	if let Err(e) = fs::rename(&legacy_path, legacy_path.with_extension("json.old")) {
+		if legacy_path.exists() {
+			return Err(e).context("Failed to move legacy lockfile");
+		}
+	}
+
+	Ok(())
+}
@@ -1,3 +1,5 @@
+/// Streaming archives of instance directories for transfer formats
+pub mod archive;
 /// Use of the lockfile for persistent data
 pub mod lock;
 /// Standard paths for MCVM
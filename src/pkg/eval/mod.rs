@@ -55,6 +55,8 @@ use crate::util::hash::{
 use mcvm_shared::pkg::PackageStability;
 use mcvm_shared::Side;
 
+use std::collections::hash_map::DefaultHasher;
+use std::hash::{Hash, Hasher};
 use std::path::PathBuf;
 
 /// Max notice instructions per package
@@ -63,7 +65,7 @@ const MAX_NOTICE_INSTRUCTIONS: usize = 10;
 const MAX_NOTICE_CHARACTERS: usize = 128;
 
 /// Permissions level for an evaluation
-#[derive(Deserialize, Serialize, Debug, Copy, Clone, Default)]
+#[derive(Deserialize, Serialize, Debug, Copy, Clone, Default, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "schema", derive(JsonSchema))]
 #[serde(rename_all = "snake_case")]
 pub enum EvalPermissions {
@@ -77,6 +79,7 @@ pub enum EvalPermissions {
 }
 
 /// Context / purpose for when we are evaluating
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub enum Routine {
 	/// Install the package
 	Install,
@@ -128,7 +131,7 @@ pub struct EvalConstants {
 }
 
 /// Constants for the evaluation that may be different for each package
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 pub struct EvalParameters {
 	/// The side (client/server) we are installing the package on
 	pub side: Side,
@@ -225,8 +228,99 @@ impl<'a> EvalData<'a> {
 	}
 }
 
+/// Key for memoized evaluations of a package. The result of evaluating a package
+/// only depends on its contents and these inputs, so evaluations of the same package
+/// with equal keys, like for instances with the same version and modloader, are the same
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct EvalCacheKey {
+	routine: Routine,
+	version: String,
+	modifications: GameModifications,
+	/// Hash of the version list, since it is long and almost always the same
+	version_list_hash: u64,
+	language: Language,
+	profile_stability: PackageStability,
+	params: EvalParameters,
+}
+
+impl EvalCacheKey {
+	/// Create the key for an evaluation
+	pub fn new(routine: Routine, input: &EvalInput) -> Self {
+		let mut hasher = DefaultHasher::new();
+		input.constants.version_list.hash(&mut hasher);
+
+		Self {
+			routine,
+			version: input.constants.version.clone(),
+			modifications: input.constants.modifications.clone(),
+			version_list_hash: hasher.finish(),
+			language: input.constants.language,
+			profile_stability: input.constants.profile_stability,
+			params: input.params.clone(),
+		}
+	}
+}
+
+/// The results of an evaluation, without the input that they came from
+#[derive(Debug, Clone)]
+pub struct EvalOutput {
+	properties: PackageProperties,
+	vars: HashMapVariableStore,
+	addon_reqs: Vec<AddonRequest>,
+	deps: Vec<Vec<RequiredPackage>>,
+	conflicts: Vec<PackageID>,
+	recommendations: Vec<RecommendedPackage>,
+	bundled: Vec<PackageID>,
+	compats: Vec<(PackageID, PackageID)>,
+	extensions: Vec<PackageID>,
+	notices: Vec<String>,
+	commands: Vec<Vec<String>>,
+}
+
+impl EvalOutput {
+	/// Take the output from an evaluation
+	fn from_eval_data(data: &EvalData) -> Self {
+		Self {
+			properties: data.properties.clone(),
+			vars: data.vars.clone(),
+			addon_reqs: data.addon_reqs.clone(),
+			deps: data.deps.clone(),
+			conflicts: data.conflicts.clone(),
+			recommendations: data.recommendations.clone(),
+			bundled: data.bundled.clone(),
+			compats: data.compats.clone(),
+			extensions: data.extensions.clone(),
+			notices: data.notices.clone(),
+			commands: data.commands.clone(),
+		}
+	}
+
+	/// Recreate the evaluation with a new input
+	fn into_eval_data<'a>(
+		self,
+		input: EvalInput<'a>,
+		id: PackageID,
+		routine: &Routine,
+		plugins: &PluginManager,
+	) -> EvalData<'a> {
+		let mut data = EvalData::new(input, id, self.properties, routine, plugins);
+		data.vars = self.vars;
+		data.addon_reqs = self.addon_reqs;
+		data.deps = self.deps;
+		data.conflicts = self.conflicts;
+		data.recommendations = self.recommendations;
+		data.bundled = self.bundled;
+		data.compats = self.compats;
+		data.extensions = self.extensions;
+		data.notices = self.notices;
+		data.commands = self.commands;
+		data
+	}
+}
+
 impl Package {
-	/// Evaluate a routine on a package
+	/// Evaluate a routine on a package. Results are memoized, so evaluating the
+	/// package again with the same input will not run it again
 	pub async fn eval<'a>(
 		&mut self,
 		paths: &'a Paths,
@@ -234,6 +328,35 @@ impl Package {
 		input: EvalInput<'a>,
 		client: &Client,
 		plugins: &'a PluginManager,
+	) -> anyhow::Result<EvalData<'a>> {
+		let key = EvalCacheKey::new(routine, &input);
+		if let Some(output) = self.eval_cache.get(&key) {
+			return Ok(output
+				.clone()
+				.into_eval_data(input, self.id.clone(), &routine, plugins));
+		}
+
+		let eval = self
+			.eval_uncached(paths, routine, input, client, plugins)
+			.await?;
+		// Custom instructions are handled by plugins, which we can't assume
+		// will give the same result each time
+		if !eval.uses_custom_instructions {
+			self.eval_cache
+				.insert(key, EvalOutput::from_eval_data(&eval));
+		}
+
+		Ok(eval)
+	}
+
+	/// Evaluate a routine on a package without memoization
+	async fn eval_uncached<'a>(
+		&mut self,
+		paths: &'a Paths,
+		routine: Routine,
+		input: EvalInput<'a>,
+		client: &Client,
+		plugins: &'a PluginManager,
 	) -> anyhow::Result<EvalData<'a>> {
 		self.parse(paths, client).await?;
 
@@ -555,6 +678,22 @@ impl<'a> PackageEvaluatorTrait<'a> for PackageEvaluator<'a> {
 			.await?;
 		Ok(properties)
 	}
+
+	async fn preload_packages(
+		&mut self,
+		pkgs: &[ArcPkgReq],
+		common_input: &Self::CommonInput,
+	) -> anyhow::Result<()> {
+		self.reg
+			.preload(
+				pkgs,
+				common_input.paths,
+				common_input.client,
+				&mut output::NoOp,
+			)
+			.await;
+		Ok(())
+	}
 }
 
 /// Resolve package dependencies
@@ -2,6 +2,8 @@
 mod core;
 /// Package evaluation functions
 pub mod eval;
+/// Caching of parsed package scripts
+mod parse_cache;
 /// Registry used to store packages
 pub mod reg;
 /// Interacting with package repositories
@@ -14,17 +16,19 @@ use mcvm_pkg::repo::PackageFlag;
 use mcvm_pkg::PackageContentType;
 use mcvm_shared::later::Later;
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::fs;
 use std::future::Future;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 
 use self::core::get_core_package;
+use self::eval::{EvalCacheKey, EvalOutput};
 use anyhow::{anyhow, bail, Context};
-use mcvm_parse::parse::{lex_and_parse, Parsed};
+use mcvm_parse::parse::Parsed;
 use mcvm_pkg::metadata::{eval_metadata, PackageMetadata};
 use mcvm_pkg::properties::{eval_properties, PackageProperties};
 use mcvm_shared::pkg::PackageID;
+use parse_cache::parse_cached;
 use reqwest::Client;
 
 /// An installable package that loads content into your game
@@ -40,6 +44,8 @@ pub struct Package {
 	pub flags: HashSet<PackageFlag>,
 	/// The data of the package
 	pub data: Later<PkgData>,
+	/// Memoized evaluation results
+	eval_cache: HashMap<EvalCacheKey, EvalOutput>,
 }
 
 /// Location of a package
@@ -94,6 +100,25 @@ pub enum PkgContents {
 }
 
 impl PkgContents {
+	/// Parse the text of a package. Parsed scripts are cached at the given path
+	pub fn parse(
+		text: &str,
+		content_type: PackageContentType,
+		parse_cache_path: &Path,
+	) -> anyhow::Result<Self> {
+		match content_type {
+			PackageContentType::Script => {
+				let parsed = parse_cached(text, parse_cache_path)?;
+				Ok(Self::Script(parsed))
+			}
+			PackageContentType::Declarative => {
+				let contents = deserialize_declarative_package(text)
+					.context("Failed to deserialize declarative package")?;
+				Ok(Self::Declarative(Box::new(contents)))
+			}
+		}
+	}
+
 	/// Get the contents with an assertion that it is a script package
 	pub fn get_script_contents(&self) -> &Parsed {
 		if let Self::Script(parsed) = &self {
@@ -127,6 +152,7 @@ impl Package {
 			data: Later::new(),
 			content_type,
 			flags,
+			eval_cache: HashMap::new(),
 		}
 	}
 
@@ -145,12 +171,22 @@ impl Package {
 		cache_dir.join(self.filename())
 	}
 
-	/// Remove the cached package file
+	/// Get the path where the parsed contents of the package are cached
+	pub fn parse_cache_path(&self, paths: &Paths) -> PathBuf {
+		let cache_dir = paths.project.cache_dir().join("pkg");
+		cache_dir.join(format!("{}.parsed.json", self.id))
+	}
+
+	/// Remove the cached package file, along with its cached parse
 	pub fn remove_cached(&self, paths: &Paths) -> anyhow::Result<()> {
 		let path = self.cached_path(paths);
 		if path.exists() {
 			fs::remove_file(path)?;
 		}
+		let path = self.parse_cache_path(paths);
+		if path.exists() {
+			fs::remove_file(path)?;
+		}
 		Ok(())
 	}
 
@@ -162,36 +198,52 @@ impl Package {
 		client: &Client,
 	) -> anyhow::Result<()> {
 		if self.data.is_empty() {
-			match &self.location {
-				PkgLocation::Local(path) => {
-					if !path.exists() {
-						bail!("Local package path does not exist");
-					}
-					self.data
-						.fill(PkgData::new(&tokio::fs::read_to_string(path).await?));
-				}
-				PkgLocation::Remote { url, .. } => {
-					let path = self.cached_path(paths);
-					if !force && path.exists() {
-						self.data
-							.fill(PkgData::new(&tokio::fs::read_to_string(path).await?));
-					} else {
-						let url = url.as_ref().expect("URL for remote package missing");
-						let text = download::text(url, client).await?;
-						tokio::fs::write(&path, &text).await?;
-						self.data.fill(PkgData::new(&text));
-					}
-				}
-				PkgLocation::Core => {
-					let contents = get_core_package(&self.id)
-						.ok_or(anyhow!("Package is not a core package"))?;
-					self.data.fill(PkgData::new(contents));
-				}
-			};
+			let text = load_text(
+				&self.location,
+				&self.id,
+				&self.cached_path(paths),
+				force,
+				client,
+			)
+			.await?;
+			self.data.fill(PkgData::new(&text));
 		}
 		Ok(())
 	}
 
+	/// Returns a task that loads and parses the package contents if they aren't loaded
+	/// already. The resulting data can be used to fill the package data
+	pub fn get_preload_task(
+		&self,
+		paths: &Paths,
+		force: bool,
+		client: &Client,
+	) -> Option<impl Future<Output = anyhow::Result<PkgData>> + Send + 'static> {
+		if self.data.is_full() {
+			return None;
+		}
+
+		let location = self.location.clone();
+		let id = self.id.clone();
+		let path = self.cached_path(paths);
+		let content_type = self.content_type;
+		let parse_cache_path = self.parse_cache_path(paths);
+		let client = client.clone();
+		Some(async move {
+			let text = load_text(&location, &id, &path, force, &client).await?;
+			// Parsing is CPU-bound, so it shouldn't block the other tasks
+			let data = tokio::task::spawn_blocking(move || {
+				let mut data = PkgData::new(&text);
+				if let Ok(contents) = PkgContents::parse(&text, content_type, &parse_cache_path) {
+					data.contents.fill(contents);
+				}
+				data
+			})
+			.await?;
+			Ok(data)
+		})
+	}
+
 	/// Returns a task that download's the package file if necessary. This will not
 	/// update the contents and is only useful when doing repo resyncs
 	pub fn get_download_task(
@@ -223,18 +275,9 @@ impl Package {
 			return Ok(());
 		}
 
-		match self.content_type {
-			PackageContentType::Script => {
-				let parsed = lex_and_parse(&data.get_text())?;
-				data.contents.fill(PkgContents::Script(parsed));
-			}
-			PackageContentType::Declarative => {
-				let contents = deserialize_declarative_package(&data.get_text())
-					.context("Failed to deserialize declarative package")?;
-				data.contents
-					.fill(PkgContents::Declarative(Box::new(contents)));
-			}
-		}
+		let contents =
+			PkgContents::parse(&data.text, self.content_type, &self.parse_cache_path(paths))?;
+		data.contents.fill(contents);
 
 		Ok(())
 	}
@@ -289,6 +332,38 @@ impl Package {
 	}
 }
 
+/// Load the raw text of a package from its location
+async fn load_text(
+	location: &PkgLocation,
+	id: &PackageID,
+	cached_path: &Path,
+	force: bool,
+	client: &Client,
+) -> anyhow::Result<String> {
+	match location {
+		PkgLocation::Local(path) => {
+			if !path.exists() {
+				bail!("Local package path does not exist");
+			}
+			Ok(tokio::fs::read_to_string(path).await?)
+		}
+		PkgLocation::Remote { url, .. } => {
+			if !force && cached_path.exists() {
+				Ok(tokio::fs::read_to_string(cached_path).await?)
+			} else {
+				let url = url.as_ref().expect("URL for remote package missing");
+				let text = download::text(url, client).await?;
+				tokio::fs::write(cached_path, &text).await?;
+				Ok(text)
+			}
+		}
+		PkgLocation::Core => {
+			let contents = get_core_package(id).ok_or(anyhow!("Package is not a core package"))?;
+			Ok(contents.to_string())
+		}
+	}
+}
+
 #[cfg(test)]
 mod tests {
 	use super::*;
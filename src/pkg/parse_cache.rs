@@ -0,0 +1,104 @@
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use anyhow::Context;
+use mcvm_parse::parse::{lex_and_parse, Parsed, PARSED_FORMAT_VERSION};
+use serde::{Deserialize, Serialize};
+use sha2::{Digest, Sha256};
+
+/// A parsed package script that is stored on disk along with the text it was parsed from
+#[derive(Serialize, Deserialize)]
+struct CachedParse<P> {
+	/// The version of the parsed format
+	version: String,
+	/// Hash of the text that was parsed
+	hash: String,
+	parsed: P,
+}
+
+/// Parse a package script, reusing the result that is cached at a path if it was parsed
+/// from the same text by the same version of the parser. Updates the cache if it was missing
+/// or out of date.
+pub fn parse_cached(text: &str, cache_path: &Path) -> anyhow::Result<Parsed> {
+	let hash = hex::encode(Sha256::digest(text.as_bytes()));
+	if let Some(parsed) = read_cache(cache_path, &hash) {
+		return Ok(parsed);
+	}
+
+	let parsed = lex_and_parse(text)?;
+	// Failing to write the cache only means that the script will be parsed again next time
+	let _ = write_cache(cache_path, &hash, &parsed);
+
+	Ok(parsed)
+}
+
+/// Read a cached parse, returning None if it is missing, corrupted, or stale
+fn read_cache(path: &Path, hash: &str) -> Option<Parsed> {
+	let data = std::fs::read(path).ok()?;
+	let cached: CachedParse<Parsed> = serde_json::from_slice(&data).ok()?;
+	if cached.version != PARSED_FORMAT_VERSION || cached.hash != hash {
+		return None;
+	}
+
+	Some(cached.parsed)
+}
+
+/// Write a parse to the cache. It is written to a temporary file first so that a process
+/// that reads the cache at the same time never sees a partial file
+fn write_cache(path: &Path, hash: &str, parsed: &Parsed) -> anyhow::Result<()> {
+	let cached = CachedParse {
+		version: PARSED_FORMAT_VERSION.to_string(),
+		hash: hash.to_string(),
+		parsed,
+	};
+
+	let mut file_name = path.file_name().unwrap_or_default().to_owned();
+	let count = TMP_COUNTER.fetch_add(1, Ordering::Relaxed);
+	file_name.push(format!(".{}-{count}.tmp", std::process::id()));
+	let tmp_path = path.with_file_name(file_name);
+	let result = write_cache_file(&tmp_path, &cached).and_then(|_| {
+		std::fs::rename(&tmp_path, path).context("Failed to move cache file into place")
+	});
+	if result.is_err() {
+		let _ = std::fs::remove_file(&tmp_path);
+	}
+
+	result
+}
+
+/// Keeps the temporary files of cache writes that happen at the same time apart
+static TMP_COUNTER: AtomicU64 = AtomicU64::new(0);
+
+/// Serialize a cached parse to a file
+fn write_cache_file(path: &Path, cached: &CachedParse<&Parsed>) -> anyhow::Result<()> {
+	let mut file = BufWriter::new(File::create(path).context("Failed to create cache file")?);
+	serde_json::to_writer(&mut file, cached).context("Failed to serialize parsed package")?;
+	file.flush().context("Failed to write cache file")?;
+
+	Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn test_parse_cache() {
+		let dir = std::env::temp_dir().join("mcvm_test_parse_cache");
+		std::fs::create_dir_all(&dir).unwrap();
+		let path = dir.join("test.parsed.json");
+		let _ = std::fs::remove_file(&path);
+
+		let text = "@install {} @meta {}";
+		let parsed = parse_cached(text, &path).unwrap();
+		assert!(parsed.routine_exists("install"));
+		assert!(read_cache(&path, &hex::encode(Sha256::digest(text.as_bytes()))).is_some());
+
+		// Changed text should not use the cached result
+		let parsed = parse_cached("@other {}", &path).unwrap();
+		assert!(!parsed.routine_exists("install"));
+		assert!(parsed.routine_exists("other"));
+	}
+}
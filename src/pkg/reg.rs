@@ -1,5 +1,4 @@
 use anyhow::{anyhow, Context};
-use mcvm_core::net::download;
 use mcvm_pkg::metadata::PackageMetadata;
 use mcvm_pkg::parse_and_validate;
 use mcvm_pkg::properties::PackageProperties;
@@ -13,7 +12,6 @@ use reqwest::Client;
 #[cfg(feature = "schema")]
 use schemars::JsonSchema;
 use serde::{Deserialize, Serialize};
-use tokio::sync::Semaphore;
 use tokio::task::JoinSet;
 
 use super::eval::{EvalData, EvalInput, Routine};
@@ -137,6 +135,40 @@ impl PkgRegistry {
 		Ok(())
 	}
 
+	/// Load and parse the contents of several packages at the same time. Packages that
+	/// fail to load are skipped, so that the error is reported when they are actually used
+	pub async fn preload(
+		&mut self,
+		reqs: &[ArcPkgReq],
+		paths: &Paths,
+		client: &Client,
+		o: &mut impl MCVMOutput,
+	) {
+		let force = matches!(self.caching_strategy, CachingStrategy::None);
+		// Concurrency is limited by the download scheduler that the tasks use
+		let mut tasks = JoinSet::new();
+		for req in reqs {
+			let Ok(pkg) = self.get(req, paths, client, o).await else {
+				continue;
+			};
+			if let Some(task) = pkg.get_preload_task(paths, force, client) {
+				let req = req.clone();
+				tasks.spawn(async move { (req, task.await) });
+			}
+		}
+
+		while let Some(result) = tasks.join_next().await {
+			let Ok((req, Ok(data))) = result else {
+				continue;
+			};
+			if let Some(pkg) = self.packages.get_mut(&req) {
+				if pkg.data.is_empty() {
+					pkg.data.fill(data);
+				}
+			}
+		}
+	}
+
 	/// Get the metadata of a package
 	pub async fn get_metadata<'a>(
 		&'a mut self,
@@ -283,11 +315,29 @@ impl PkgRegistry {
 		client: &Client,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<Vec<ArcPkgReq>> {
-		let out = super::repo::get_all_packages(&mut self.repos, paths, client, o)
+		let out = super::repo::get_all_package_ids(&mut self.repos, paths, client, o)
 			.await
 			.context("Failed to retrieve all packages from repos")?
 			.iter()
-			.map(|(id, ..)| Arc::new(PkgRequest::any(id.as_ref(), PkgRequestSource::Repository)))
+			.map(|id| Arc::new(PkgRequest::any(id.as_str(), PkgRequestSource::Repository)))
+			.collect();
+
+		Ok(out)
+	}
+
+	/// Get the available package requests from the repos whose IDs start with a prefix
+	pub async fn search_available_packages(
+		&mut self,
+		prefix: &str,
+		paths: &Paths,
+		client: &Client,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<Vec<ArcPkgReq>> {
+		let out = super::repo::search_prefix_all(&mut self.repos, prefix, paths, client, o)
+			.await
+			.context("Failed to search packages in repos")?
+			.iter()
+			.map(|id| Arc::new(PkgRequest::any(id.as_str(), PkgRequestSource::Repository)))
 			.collect();
 
 		Ok(out)
@@ -328,8 +378,8 @@ impl PkgRegistry {
 
 		// Redownload all the packages
 		if let CachingStrategy::All = self.caching_strategy {
+			// Concurrency is limited by the download scheduler that the tasks use
 			let mut tasks = JoinSet::new();
-			let semaphore = Arc::new(Semaphore::new(download::get_transfer_limit()));
 			for package in packages {
 				let pkg = self
 					.get(&package, paths, client, o)
@@ -337,11 +387,6 @@ impl PkgRegistry {
 					.with_context(|| format!("Failed to get package {package}"))?;
 
 				if let Some(task) = pkg.get_download_task(paths, true, client) {
-					let semaphore = semaphore.clone();
-					let task = async move {
-						let _ = semaphore.acquire_owned().await;
-						task.await
-					};
 					tasks.spawn(task);
 				}
 			}
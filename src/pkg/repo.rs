@@ -1,5 +1,6 @@
 use crate::io::paths::Paths;
 use mcvm_core::net::download;
+use mcvm_pkg::binary_index::BinaryRepoIndex;
 use mcvm_pkg::repo::{
 	get_api_url, get_index_url, PackageFlag, RepoIndex, RepoMetadata, RepoPkgEntry,
 };
@@ -10,13 +11,15 @@ use anyhow::{bail, Context};
 use mcvm_shared::output::{MCVMOutput, MessageContents, MessageLevel};
 use mcvm_shared::translate;
 use reqwest::Client;
+use tokio::task::{JoinHandle, JoinSet};
 
 use std::borrow::Cow;
 use std::collections::HashSet;
 use std::fmt::Display;
-use std::fs::File;
-use std::io::{BufReader, Cursor};
-use std::path::PathBuf;
+use std::future::Future;
+use std::path::{Path, PathBuf};
+use std::sync::{Mutex, MutexGuard};
+use std::time::{Duration, SystemTime};
 
 use super::core::{
 	get_all_core_packages, get_core_package_content_type, get_core_package_count, is_core_package,
@@ -29,11 +32,13 @@ pub struct PkgRepo {
 	/// The identifier for the repository
 	pub id: String,
 	location: PkgRepoLocation,
-	index: Later<RepoIndex>,
+	index: Later<BinaryRepoIndex>,
+	/// How old the cached index can be before it is refreshed in the background
+	refresh_interval: Option<Duration>,
 }
 
 /// Location for a PkgRepo
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum PkgRepoLocation {
 	/// A repository on a remote device
 	Remote(String),
@@ -60,9 +65,17 @@ impl PkgRepo {
 			id: id.to_owned(),
 			location,
 			index: Later::new(),
+			refresh_interval: None,
 		}
 	}
 
+	/// Set how old the cached index can be before it is refreshed. A stale index is still
+	/// used while it is refreshed in the background, and the refreshed version is used the
+	/// next time it is loaded. Without an interval, the index is only refreshed when syncing
+	pub fn set_refresh_interval(&mut self, interval: Option<Duration>) {
+		self.refresh_interval = interval;
+	}
+
 	/// Create the core repository
 	pub fn core() -> Self {
 		Self::new("core", PkgRepoLocation::Core)
@@ -91,7 +104,7 @@ impl PkgRepo {
 
 	/// The cached path of the index
 	pub fn get_path(&self, paths: &Paths) -> PathBuf {
-		paths.pkg_index_cache.join(format!("{}.json", &self.id))
+		paths.pkg_index_cache.join(format!("{}.idx", &self.id))
 	}
 
 	/// Gets the location of the repository
@@ -99,34 +112,21 @@ impl PkgRepo {
 		&self.location
 	}
 
-	/// Set the index to serialized json text
-	fn set_index(&mut self, index: &mut impl std::io::Read) -> anyhow::Result<()> {
-		let parsed = simd_json::from_reader(index)?;
-		self.index.fill(parsed);
+	/// Set the index from the bytes of a binary index
+	fn set_index(&mut self, bytes: Vec<u8>) -> anyhow::Result<()> {
+		let index = BinaryRepoIndex::from_bytes(bytes)?;
+		self.index.fill(index);
 		Ok(())
 	}
 
-	/// Update the currently cached index file
+	/// Update the currently cached index file. The JSON index is converted to the
+	/// binary format here so that later loads don't have to parse it
 	pub async fn sync(&mut self, paths: &Paths, client: &Client) -> anyhow::Result<()> {
-		match &self.location {
-			PkgRepoLocation::Local(path) => {
-				let bytes = tokio::fs::read(path).await?;
-				tokio::fs::write(self.get_path(paths), &bytes).await?;
-				let mut cursor = Cursor::new(&bytes);
-				self.set_index(&mut cursor).context("Failed to set index")?;
-			}
-			PkgRepoLocation::Remote(url) => {
-				let bytes = download::bytes(get_index_url(url), client)
-					.await
-					.context("Failed to download index")?;
-				tokio::fs::write(self.get_path(paths), &bytes)
-					.await
-					.context("Failed to write index to cached file")?;
-				let mut cursor = Cursor::new(&bytes);
-				self.set_index(&mut cursor).context("Failed to set index")?;
-			}
-			PkgRepoLocation::Core => {}
+		if let PkgRepoLocation::Core = &self.location {
+			return Ok(());
 		}
+		let bytes = fetch_index(&self.location, &self.get_path(paths), client).await?;
+		self.set_index(bytes).context("Failed to set index")?;
 
 		Ok(())
 	}
@@ -138,39 +138,37 @@ impl PkgRepo {
 		client: &Client,
 		o: &mut impl MCVMOutput,
 	) -> anyhow::Result<()> {
-		// The core repository doesn't have an index
-		if let PkgRepoLocation::Core = &self.location {
-			return Ok(());
+		if let Some(task) = self.get_index_task(paths, client) {
+			let index = task.await?;
+			self.index.fill(index);
+			self.check_index(o);
 		}
 
-		if self.index.is_empty() {
-			let path = self.get_path(paths);
-			if path.exists() {
-				let file = File::open(&path).context("Failed to open cached index")?;
-				let mut file = BufReader::new(file);
-				match self.set_index(&mut file) {
-					Ok(..) => {}
-					Err(..) => {
-						self.sync(paths, client)
-							.await
-							.context("Failed to sync index")?;
-					}
-				};
-			} else {
-				self.sync(paths, client)
-					.await
-					.context("Failed to sync index")?;
-			}
+		Ok(())
+	}
 
-			self.check_index(o);
+	/// Returns a task that loads the index if it isn't loaded yet, from the cached
+	/// index if possible and by syncing it otherwise. The result should be used to fill the index
+	fn get_index_task(
+		&self,
+		paths: &Paths,
+		client: &Client,
+	) -> Option<impl Future<Output = anyhow::Result<BinaryRepoIndex>> + Send + 'static> {
+		// The core repository doesn't have an index
+		if self.index.is_full() || matches!(self.location, PkgRepoLocation::Core) {
+			return None;
 		}
 
-		Ok(())
+		let location = self.location.clone();
+		let path = self.get_path(paths);
+		let refresh_interval = self.refresh_interval;
+		let client = client.clone();
+		Some(async move { load_index(location, path, refresh_interval, client).await })
 	}
 
 	/// Checks the index. It must be already loaded.
 	fn check_index(&self, o: &mut impl MCVMOutput) {
-		let repo_version = &self.index.get().metadata.mcvm_version;
+		let repo_version = &self.index.get().metadata().mcvm_version;
 		if let Some(repo_version) = repo_version {
 			let repo_version = version_compare::Version::from(repo_version);
 			let program_version = version_compare::Version::from(crate::VERSION);
@@ -212,13 +210,13 @@ impl PkgRepo {
 		} else {
 			self.ensure_index(paths, client, o).await?;
 			let index = self.index.get();
-			if let Some(entry) = index.packages.get(id) {
-				let location = get_package_location(entry, &self.location, &self.id)
+			if let Some(entry) = index.get(id).context("Failed to read index")? {
+				let location = get_package_location(&entry, &self.location, &self.id)
 					.context("Failed to get location of package")?;
 				return Ok(Some(RepoQueryResult {
 					location,
-					content_type: get_content_type(entry).await,
-					flags: entry.flags.clone(),
+					content_type: get_content_type(&entry).await,
+					flags: entry.flags,
 				}));
 			}
 			Ok(None)
@@ -237,12 +235,60 @@ impl PkgRepo {
 		if let PkgRepoLocation::Core = &self.location {
 			Ok(get_all_core_packages())
 		} else {
-			let index = self.index.get();
-			Ok(index
-				.packages
-				.iter()
-				.map(|(id, entry)| (id.clone(), entry.clone()))
+			self.index
+				.get()
+				.entries()
+				.map(|x| x.map(|(id, entry)| (id.to_string(), entry)))
+				.collect()
+		}
+	}
+
+	/// Get the IDs of all packages from this repo, without reading their entries
+	pub async fn get_all_package_ids(
+		&mut self,
+		paths: &Paths,
+		client: &Client,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<Vec<String>> {
+		self.ensure_index(paths, client, o).await?;
+		if let PkgRepoLocation::Core = &self.location {
+			Ok(get_all_core_packages()
+				.into_iter()
+				.map(|(id, _)| id)
 				.collect())
+		} else {
+			self.index
+				.get()
+				.ids()
+				.map(|x| x.map(str::to_string))
+				.collect()
+		}
+	}
+
+	/// Get the IDs of all packages from this repo that start with a prefix
+	pub async fn search_prefix(
+		&mut self,
+		prefix: &str,
+		paths: &Paths,
+		client: &Client,
+		o: &mut impl MCVMOutput,
+	) -> anyhow::Result<Vec<String>> {
+		self.ensure_index(paths, client, o).await?;
+		if let PkgRepoLocation::Core = &self.location {
+			let mut out: Vec<_> = get_all_core_packages()
+				.into_iter()
+				.map(|(id, _)| id)
+				.filter(|id| id.starts_with(prefix))
+				.collect();
+			out.sort();
+			Ok(out)
+		} else {
+			let ids = self
+				.index
+				.get()
+				.search_prefix(prefix)
+				.context("Failed to read index")?;
+			Ok(ids.into_iter().map(str::to_string).collect())
 		}
 	}
 
@@ -258,7 +304,7 @@ impl PkgRepo {
 		if let PkgRepoLocation::Core = &self.location {
 			Ok(get_core_package_count())
 		} else {
-			Ok(self.index.get().packages.len())
+			Ok(self.index.get().len())
 		}
 	}
 
@@ -280,12 +326,113 @@ impl PkgRepo {
 
 			Ok(Cow::Owned(meta))
 		} else {
-			Ok(Cow::Borrowed(&self.index.get().metadata))
+			Ok(Cow::Borrowed(self.index.get().metadata()))
 		}
 	}
 }
 
-/// Query a list of repos
+/// Load the cached index of a repository, syncing it if it is missing or invalid
+async fn load_index(
+	location: PkgRepoLocation,
+	path: PathBuf,
+	refresh_interval: Option<Duration>,
+	client: Client,
+) -> anyhow::Result<BinaryRepoIndex> {
+	if let Ok(bytes) = tokio::fs::read(&path).await {
+		if let Ok(index) = BinaryRepoIndex::from_bytes(bytes) {
+			if is_index_stale(&path, refresh_interval) {
+				// Serve the cached index now and refresh it for next time
+				let handle = tokio::spawn(async move {
+					let _ = fetch_index(&location, &path, &client).await;
+				});
+				let mut refreshes = lock_index_refreshes();
+				refreshes.retain(|x| !x.is_finished());
+				refreshes.push(handle);
+			}
+			return Ok(index);
+		}
+	}
+
+	let bytes = fetch_index(&location, &path, &client)
+		.await
+		.context("Failed to sync index")?;
+	BinaryRepoIndex::from_bytes(bytes).context("Failed to set index")
+}
+
+/// Background refreshes of cached indexes that may still be running
+static INDEX_REFRESHES: Mutex<Vec<JoinHandle<()>>> = Mutex::new(Vec::new());
+
+fn lock_index_refreshes() -> MutexGuard<'static, Vec<JoinHandle<()>>> {
+	INDEX_REFRESHES.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+/// Wait for the background refreshes of cached indexes to finish. The runtime cancels
+/// any tasks that are still running when it shuts down, so this should be called before
+/// exiting for the refreshed indexes to actually be written
+pub async fn wait_for_index_refreshes() {
+	let refreshes = std::mem::take(&mut *lock_index_refreshes());
+	for refresh in refreshes {
+		let _ = refresh.await;
+	}
+}
+
+/// Check whether a cached index is older than the refresh interval
+fn is_index_stale(path: &Path, refresh_interval: Option<Duration>) -> bool {
+	let Some(refresh_interval) = refresh_interval else {
+		return false;
+	};
+	let age = path
+		.metadata()
+		.and_then(|x| x.modified())
+		.ok()
+		.and_then(|x| SystemTime::now().duration_since(x).ok());
+	age.is_some_and(|x| x > refresh_interval)
+}
+
+/// Read or download an index and convert it to the binary format, then write it
+/// to the cached path. Returns the bytes of the binary index
+async fn fetch_index(
+	location: &PkgRepoLocation,
+	path: &Path,
+	client: &Client,
+) -> anyhow::Result<Vec<u8>> {
+	let mut bytes = match location {
+		PkgRepoLocation::Local(path) => tokio::fs::read(path).await?,
+		PkgRepoLocation::Remote(url) => download::bytes(get_index_url(url), client)
+			.await
+			.context("Failed to download index")?
+			.to_vec(),
+		PkgRepoLocation::Core => bail!("The core repository does not have an index"),
+	};
+
+	let index: RepoIndex = simd_json::from_slice(&mut bytes).context("Failed to parse index")?;
+	let bytes = BinaryRepoIndex::build(&index).context("Failed to create binary index")?;
+	// Write to a temporary file first so that a concurrent load never sees a partial index.
+	// The name is unique so that refreshes from different tasks or processes don't collide
+	let temp_path = path.with_extension(format!(
+		"idx.{}-{:08x}.tmp",
+		std::process::id(),
+		rand::random::<u32>()
+	));
+	let result = tokio::fs::write(&temp_path, &bytes)
+		.await
+		.context("Failed to write index to cached file");
+	let result = match result {
+		Ok(()) => tokio::fs::rename(&temp_path, path)
+			.await
+			.context("Failed to move index to cached file"),
+		Err(e) => Err(e),
+	};
+	if result.is_err() {
+		let _ = tokio::fs::remove_file(&temp_path).await;
+	}
+	result?;
+
+	Ok(bytes)
+}
+
+/// Query a list of repos. The indexes of all of the repos are loaded at the same time first,
+/// and then the first repo in the list with the package is used
 pub async fn query_all(
 	repos: &mut [PkgRepo],
 	id: &str,
@@ -293,7 +440,36 @@ pub async fn query_all(
 	client: &Client,
 	o: &mut impl MCVMOutput,
 ) -> anyhow::Result<Option<RepoQueryResult>> {
-	for repo in repos {
+	let mut tasks = JoinSet::new();
+	for (i, repo) in repos.iter().enumerate() {
+		if let Some(task) = repo.get_index_task(paths, client) {
+			tasks.spawn(async move { (i, task.await) });
+		}
+	}
+	let mut failed = HashSet::new();
+	while let Some(result) = tasks.join_next().await {
+		let (i, result) = result.context("Failed to join index task")?;
+		match result {
+			Ok(index) => {
+				let repo = &mut repos[i];
+				repo.index.fill(index);
+				repo.check_index(o);
+			}
+			Err(e) => {
+				o.display(
+					MessageContents::Error(e.to_string()),
+					MessageLevel::Important,
+				);
+				failed.insert(i);
+			}
+		}
+	}
+
+	for (i, repo) in repos.iter_mut().enumerate() {
+		// Errors for these have already been shown
+		if failed.contains(&i) {
+			continue;
+		}
 		let query = match repo.query(id, paths, client, o).await {
 			Ok(val) => val,
 			Err(e) => {
@@ -311,6 +487,49 @@ pub async fn query_all(
 	Ok(None)
 }
 
+/// Get the IDs of all packages from a list of repositories with the normal priority order
+pub async fn get_all_package_ids(
+	repos: &mut [PkgRepo],
+	paths: &Paths,
+	client: &Client,
+	o: &mut impl MCVMOutput,
+) -> anyhow::Result<Vec<String>> {
+	// Iterate in reverse to make sure that repos at the beginning take precendence
+	let mut out = Vec::new();
+	for repo in repos.iter_mut().rev() {
+		let packages = repo
+			.get_all_package_ids(paths, client, o)
+			.await
+			.with_context(|| format!("Failed to get all packages from repository '{}'", repo.id))?;
+		out.extend(packages);
+	}
+
+	Ok(out)
+}
+
+/// Get the IDs of all packages that start with a prefix from a list of repositories,
+/// sorted and without duplicates
+pub async fn search_prefix_all(
+	repos: &mut [PkgRepo],
+	prefix: &str,
+	paths: &Paths,
+	client: &Client,
+	o: &mut impl MCVMOutput,
+) -> anyhow::Result<Vec<String>> {
+	let mut out = Vec::new();
+	for repo in repos.iter_mut() {
+		let packages = repo
+			.search_prefix(prefix, paths, client, o)
+			.await
+			.with_context(|| format!("Failed to search packages in repository '{}'", repo.id))?;
+		out.extend(packages);
+	}
+	out.sort();
+	out.dedup();
+
+	Ok(out)
+}
+
 /// Get all packages from a list of repositories with the normal priority order
 pub async fn get_all_packages(
 	repos: &mut [PkgRepo],